@@ -0,0 +1,143 @@
+/*
+ * Arena Allocator Implementation File
+ * Memory is handed out by bumping a pointer through a chain of blocks.
+ * Nothing is freed individually: arena_reset() rewinds to the first block
+ * and keeps every block for the next expression.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK (64 * 1024)
+
+struct ArenaBlock {
+    ArenaBlock *next;
+    size_t capacity;
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+};
+
+static size_t align_up(size_t size) {
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static void *default_allocate(size_t size, void *context) {
+    (void)context;
+    return malloc(size);
+}
+
+static void default_release(void *ptr, void *context) {
+    (void)context;
+    free(ptr);
+}
+
+void arena_init(Arena *arena) {
+    static const ArenaAllocator system_allocator = { default_allocate, default_release, NULL };
+    arena_init_with_allocator(arena, &system_allocator);
+}
+
+void arena_init_with_allocator(Arena *arena, const ArenaAllocator *allocator) {
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->allocator = *allocator;
+}
+
+/*
+ * Allocate size bytes, 16-byte aligned
+ * Returns: NULL when the system is out of memory
+ */
+void *arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size);
+
+    // Try the current block, then any blocks left over from before a reset
+    ArenaBlock *block = arena->current;
+    while (block != NULL && block->capacity - block->used < size) {
+        block = block->next;
+        if (block != NULL) {
+            block->used = 0;
+        }
+    }
+
+    if (block == NULL) {
+        // Each new block is at least twice the previous one
+        size_t capacity = ARENA_MIN_BLOCK;
+        ArenaBlock *last = arena->first;
+        while (last != NULL && last->next != NULL) {
+            last = last->next;
+        }
+        if (last != NULL && last->capacity * 2 > capacity) {
+            capacity = last->capacity * 2;
+        }
+        if (capacity < size) {
+            capacity = size;
+        }
+
+        block = arena->allocator.allocate(sizeof(ArenaBlock) + capacity, arena->allocator.context);
+        if (block == NULL) {
+            return NULL;
+        }
+        block->next = NULL;
+        block->capacity = capacity;
+        block->used = 0;
+        if (last == NULL) {
+            arena->first = block;
+        } else {
+            last->next = block;
+        }
+    }
+
+    arena->current = block;
+    void *ptr = block->data + block->used;
+    block->used += size;
+    return ptr;
+}
+
+/*
+ * Resize an allocation, extending it in place when it is the most recent
+ * allocation and the block has room; otherwise it is copied
+ * Returns: the (possibly moved) pointer, or NULL when out of memory
+ */
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    ArenaBlock *block = arena->current;
+    size_t old_aligned = align_up(old_size);
+    size_t new_aligned = align_up(new_size);
+    if (block != NULL &&
+        (unsigned char *)ptr + old_aligned == block->data + block->used &&
+        block->used - old_aligned + new_aligned <= block->capacity) {
+        block->used = block->used - old_aligned + new_aligned;
+        return ptr;
+    }
+
+    void *moved = arena_alloc(arena, new_size);
+    if (moved != NULL) {
+        memcpy(moved, ptr, old_size < new_size ? old_size : new_size);
+    }
+    return moved;
+}
+
+/*
+ * Forget every allocation but keep the blocks for reuse
+ */
+void arena_reset(Arena *arena) {
+    arena->current = arena->first;
+    if (arena->first != NULL) {
+        arena->first->used = 0;
+    }
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->first;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        arena->allocator.release(block, arena->allocator.context);
+        block = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
@@ -0,0 +1,44 @@
+/*
+ * Arena Allocator Header File
+ * Bump allocator whose memory is reused between expressions
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ArenaBlock ArenaBlock;
+
+// Where an arena gets its blocks from; arena_init() uses malloc/free.
+// Programs embedding the calculator can hand blocks out of their own pool.
+typedef struct {
+    void *(*allocate)(size_t size, void *context);
+    void (*release)(void *ptr, void *context);
+    void *context;
+} ArenaAllocator;
+
+// Blocks are kept across arena_reset(), so once an arena has grown to
+// fit the largest expression it stops allocating altogether
+typedef struct {
+    ArenaBlock *first;
+    ArenaBlock *current;
+    ArenaAllocator allocator;
+} Arena;
+
+void arena_init(Arena *arena);
+void arena_init_with_allocator(Arena *arena, const ArenaAllocator *allocator);
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_grow(Arena *arena, void *ptr, size_t old_size, size_t new_size);
+void arena_reset(Arena *arena);
+void arena_free(Arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // ARENA_H
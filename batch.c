@@ -0,0 +1,644 @@
+/*
+ * Batch Mode Implementation File
+ * Streams expressions (one per line) through the compiler and evaluator
+ * and writes one result per line, without menus or banners
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "calc.h"
+#include "arena.h"
+#include "format.h"
+#include "cache.h"
+#include "batch.h"
+#include "reduce.h"
+#include "shape_batch.h"
+
+#define BATCH_OUTPUT_BUFFER (1 << 20)
+#define BATCH_CHUNK_BYTES (64 * 1024)
+#define BATCH_LINE_RESULT 96
+
+/*
+ * Decimal mode: compile, convert the literals and evaluate in fixed point
+ * Results are not cached, since the cache and store hold doubles.
+ * Returns: number of characters written
+ */
+static int format_decimal_line(const char *line, Arena *arena, const DecimalContext *context,
+                               char *out, size_t size) {
+    CalcError error;
+    Program program;
+    DecimalProgram decimal;
+    CalcDecimal result;
+    if (compile_expression(line, &program, arena, &error) != CALC_OK ||
+        compile_decimal(line, &program, context, &decimal, arena, &error) != CALC_OK ||
+        evaluate_decimal(&decimal, NULL, &result, &error) != CALC_OK) {
+        return snprintf(out, size, "Error: %s\n", error.message);
+    }
+    int length = format_decimal(result, context->scale, out);
+    out[length++] = '\n';
+    return length;
+}
+
+/*
+ * Compile and evaluate one line, writing its result text (with newline)
+ * into out. A failing line produces its error message instead, so output
+ * line N always belongs to input line N.
+ * The arena is reset first, so one arena serves every line of a stream.
+ * Repeated expressions are answered from cache (which may be NULL).
+ * Returns: number of characters written
+ */
+static int format_line(char *line, Arena *arena, ResultCache *cache,
+                       const BatchOptions *options, char *out, size_t size) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' ' || line[len - 1] == '\t')) {
+        line[--len] = '\0';
+    }
+
+    // A line of blanks is as empty as one with nothing on it
+    if (strspn(line, " \t") == len) {
+        return snprintf(out, size, "Error: Expression is empty.\n");
+    }
+
+    CalcError error;
+    CalcValue result;
+    arena_reset(arena);
+    if (options->decimal) {
+        return format_decimal_line(line, arena, &options->decimal_context, out, size);
+    }
+    if (cached_evaluate(cache, line, arena, &result, &error) != CALC_OK) {
+        return snprintf(out, size, "Error: %s\n", error.message);
+    }
+    int length = format_value(&result, options->precision, out);
+    out[length++] = '\n';
+    return length;
+}
+
+static void report_cache_stats(uint64_t hits, uint64_t misses, uint64_t evictions,
+                               uint64_t store_hits, int have_store) {
+    uint64_t lookups = hits + misses;
+    fprintf(stderr, "Cache: %llu hits, %llu misses (%.1f%% hit rate), %llu evictions\n",
+            (unsigned long long)hits, (unsigned long long)misses,
+            lookups > 0 ? 100.0 * (double)hits / (double)lookups : 0.0,
+            (unsigned long long)evictions);
+    if (have_store) {
+        fprintf(stderr, "Store: %llu of %llu misses answered without compiling\n",
+                (unsigned long long)store_hits, (unsigned long long)misses);
+    }
+}
+
+/*
+ * Evaluate every line of input and print its result
+ * Returns: 0 on success, 1 on a read error
+ */
+int run_batch(FILE *input, const BatchOptions *options) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+    Arena arena;
+    OutputBuffer output;
+    ResultCache cache;
+
+    // Results collect in one large buffer that is written out in bulk
+    if (!output_init(&output, stdout, BATCH_OUTPUT_BUFFER)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    if (!result_cache_init(&cache, options->cache_size)) {
+        result_cache_init(&cache, 0);   // run uncached rather than fail
+    }
+    result_cache_attach_store(&cache, options->store);
+    arena_init(&arena);
+
+    while ((len = getline(&line, &capacity, input)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        if (output.capacity - output.used < BATCH_LINE_RESULT) {
+            output_flush(&output);
+        }
+        output.used += (size_t)format_line(line, &arena, &cache, options,
+                                           output.data + output.used, BATCH_LINE_RESULT);
+    }
+
+    if (options->cache_stats) {
+        report_cache_stats(cache.hits, cache.misses, cache.evictions, cache.store_hits,
+                           options->store != NULL);
+    }
+    result_cache_free(&cache);
+    arena_free(&arena);
+    free(line);
+    output_free(&output);
+
+    if (ferror(input)) {
+        fprintf(stderr, "Error: Failed to read input\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                          Parallel batch evaluation
+ * ----------------------------------------------------------------------------
+ * The whole input is read into memory and cut into chunks of roughly
+ * BATCH_CHUNK_BYTES at line boundaries. Each worker starts with its own
+ * contiguous range of chunks and takes them from the front; a worker
+ * whose range runs dry steals from the back of another worker's range,
+ * so a few expensive chunks cannot leave the other threads idle.
+ *
+ * Every chunk writes into its own output buffer. The main thread prints
+ * the buffers strictly in chunk order as soon as each one is finished,
+ * which keeps the output in input order.
+ *
+ * Each worker keeps a private result cache, so lookups never take a lock;
+ * the counters are summed into the job when the worker exits.
+ *
+ * With --shapes every line of a chunk is compiled first, and the ones
+ * evaluate_shape_batch() accepts are evaluated together, grouped by the
+ * shape of their program. Those lines bypass the result cache; the rest
+ * (integer-only, failing or empty lines) go through format_line() as
+ * usual.
+ */
+
+typedef struct {
+    char *start;        // first byte of the chunk's first line
+    char *end;          // one past the chunk's last byte
+    char *output;       // result text for every line in the chunk
+    size_t output_len;
+    int done;
+} BatchChunk;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int head;           // next chunk for the owner
+    int tail;           // one past the last chunk; thieves take tail - 1
+} WorkQueue;
+
+typedef struct {
+    BatchChunk *chunks;
+    WorkQueue *queues;
+    int queue_count;
+    const BatchOptions *options;
+    size_t cache_size;
+    ProgramStore *store;
+    uint64_t cache_hits;        // totals from finished workers
+    uint64_t cache_misses;
+    uint64_t cache_evictions;
+    uint64_t store_hits;
+    pthread_mutex_t progress_lock;
+    pthread_cond_t chunk_done;
+} BatchJob;
+
+typedef struct {
+    BatchJob *job;
+    int index;
+} WorkerArgs;
+
+/*
+ * Read the whole stream into one buffer
+ * One spare byte is kept past the end so the last line can always be
+ * terminated in place.
+ */
+static char *read_all(FILE *input, size_t *length) {
+    size_t capacity = BATCH_OUTPUT_BUFFER;
+    size_t used = 0;
+    char *data = malloc(capacity);
+    if (data == NULL) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (capacity - used < 2) {
+            char *grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                free(data);
+                return NULL;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        size_t n = fread(data + used, 1, capacity - used - 1, input);
+        used += n;
+        if (n == 0) {
+            break;
+        }
+    }
+
+    data[used] = '\0';
+    *length = used;
+    return data;
+}
+
+static void run_chunk(BatchChunk *chunk, Arena *arena, ResultCache *cache,
+                      const BatchOptions *options) {
+    size_t capacity = (size_t)(chunk->end - chunk->start) + BATCH_LINE_RESULT;
+    chunk->output = malloc(capacity);
+    chunk->output_len = 0;
+    if (chunk->output == NULL) {
+        return;
+    }
+
+    char *line = chunk->start;
+    while (line < chunk->end) {
+        char *newline = memchr(line, '\n', (size_t)(chunk->end - line));
+        char *line_end = newline != NULL ? newline : chunk->end;
+        *line_end = '\0';
+
+        if (capacity - chunk->output_len < BATCH_LINE_RESULT) {
+            char *grown = realloc(chunk->output, capacity * 2);
+            if (grown == NULL) {
+                free(chunk->output);
+                chunk->output = NULL;
+                return;
+            }
+            chunk->output = grown;
+            capacity *= 2;
+        }
+        chunk->output_len += (size_t)format_line(line, arena, cache, options,
+                                                 chunk->output + chunk->output_len,
+                                                 BATCH_LINE_RESULT);
+        line = line_end + 1;
+    }
+}
+
+/*
+ * run_chunk() for --shapes
+ * The chunk's programs live in shapes until the chunk is written out.
+ */
+static void run_shape_chunk(BatchChunk *chunk, Arena *arena, Arena *shapes, ResultCache *cache,
+                            const BatchOptions *options) {
+    size_t capacity = (size_t)(chunk->end - chunk->start) + BATCH_LINE_RESULT;
+    chunk->output = malloc(capacity);
+    chunk->output_len = 0;
+    if (chunk->output == NULL) {
+        return;
+    }
+
+    size_t line_count = 1;
+    for (const char *p = chunk->start; p < chunk->end; p++) {
+        line_count += *p == '\n';
+    }
+    arena_reset(shapes);
+    char **lines = arena_alloc(shapes, line_count * sizeof(char *));
+    size_t *batched = arena_alloc(shapes, line_count * sizeof(size_t));   // index + 1, 0 if not
+    Program *programs = arena_alloc(shapes, line_count * sizeof(Program));
+    double *results = arena_alloc(shapes, line_count * sizeof(double));
+    unsigned char *status = arena_alloc(shapes, line_count);
+    size_t count = 0;
+    size_t program_count = 0;
+
+    // Compile every line, keeping the programs that can be batched
+    char *line = chunk->start;
+    while (line < chunk->end && lines != NULL && batched != NULL && programs != NULL) {
+        char *newline = memchr(line, '\n', (size_t)(chunk->end - line));
+        char *line_end = newline != NULL ? newline : chunk->end;
+        *line_end = '\0';
+        for (char *trim = line_end; trim > line && trim[-1] == '\r'; trim--) {
+            trim[-1] = '\0';
+        }
+        lines[count] = line;
+        batched[count] = 0;
+        if (line[0] != '\0' &&
+            compile_expression(line, &programs[program_count], shapes, NULL) == CALC_OK &&
+            shape_batchable(&programs[program_count])) {
+            batched[count] = ++program_count;
+        }
+        count++;
+        line = line_end + 1;
+    }
+    if (lines == NULL || batched == NULL || programs == NULL || results == NULL ||
+        status == NULL ||
+        evaluate_shape_batch(programs, program_count, results, status, shapes, NULL) != CALC_OK) {
+        free(chunk->output);
+        chunk->output = NULL;
+        return;
+    }
+
+    for (size_t k = 0; k < count; k++) {
+        if (capacity - chunk->output_len < BATCH_LINE_RESULT) {
+            char *grown = realloc(chunk->output, capacity * 2);
+            if (grown == NULL) {
+                free(chunk->output);
+                chunk->output = NULL;
+                return;
+            }
+            chunk->output = grown;
+            capacity *= 2;
+        }
+        char *out = chunk->output + chunk->output_len;
+        if (batched[k] == 0) {
+            chunk->output_len += (size_t)format_line(lines[k], arena, cache, options, out,
+                                                     BATCH_LINE_RESULT);
+        } else if (status[batched[k] - 1] != CALC_OK) {
+            chunk->output_len += (size_t)snprintf(out, BATCH_LINE_RESULT, "Error: %s\n",
+                                                  calc_status_string(status[batched[k] - 1]));
+        } else {
+            CalcValue value = { results[batched[k] - 1], 0, 0 };
+            int length = format_value(&value, options->precision, out);
+            out[length++] = '\n';
+            chunk->output_len += (size_t)length;
+        }
+    }
+}
+
+static int queue_pop_front(WorkQueue *queue) {
+    int chunk = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        chunk = queue->head++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return chunk;
+}
+
+static int queue_steal_back(WorkQueue *queue) {
+    int chunk = -1;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        chunk = --queue->tail;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return chunk;
+}
+
+static void *batch_worker(void *arg) {
+    WorkerArgs *args = arg;
+    BatchJob *job = args->job;
+    Arena arena;
+    Arena shapes;       // programs of the current chunk, with --shapes
+    ResultCache cache;
+
+    arena_init(&arena);
+    arena_init(&shapes);
+    if (!result_cache_init(&cache, job->cache_size)) {
+        result_cache_init(&cache, 0);
+    }
+    result_cache_attach_store(&cache, job->store);
+
+    for (;;) {
+        int chunk = queue_pop_front(&job->queues[args->index]);
+        for (int k = 1; chunk < 0 && k < job->queue_count; k++) {
+            chunk = queue_steal_back(&job->queues[(args->index + k) % job->queue_count]);
+        }
+        if (chunk < 0) {
+            break;  // every queue is empty; no new work can appear
+        }
+
+        if (job->options->shapes) {
+            run_shape_chunk(&job->chunks[chunk], &arena, &shapes, &cache, job->options);
+        } else {
+            run_chunk(&job->chunks[chunk], &arena, &cache, job->options);
+        }
+
+        pthread_mutex_lock(&job->progress_lock);
+        job->chunks[chunk].done = 1;
+        pthread_cond_broadcast(&job->chunk_done);
+        pthread_mutex_unlock(&job->progress_lock);
+    }
+
+    pthread_mutex_lock(&job->progress_lock);
+    job->cache_hits += cache.hits;
+    job->cache_misses += cache.misses;
+    job->cache_evictions += cache.evictions;
+    job->store_hits += cache.store_hits;
+    pthread_mutex_unlock(&job->progress_lock);
+
+    result_cache_free(&cache);
+    arena_free(&arena);
+    arena_free(&shapes);
+    return NULL;
+}
+
+/*
+ * Evaluate every line of input on options->threads worker threads
+ * Returns: 0 on success, 1 on a read or allocation error
+ */
+int run_batch_parallel(FILE *input, const BatchOptions *options) {
+    int thread_count = options->threads;
+    size_t length;
+    if (thread_count > 1) {
+        reduce_set_threads(1);  // the lines already keep every thread busy
+    }
+    char *data = read_all(input, &length);
+    if (data == NULL || ferror(input)) {
+        fprintf(stderr, "Error: Failed to read input\n");
+        free(data);
+        return 1;
+    }
+
+    // Cut the input into chunks that end on a line boundary
+    int chunk_count = 0;
+    // Every chunk but the last covers at least BATCH_CHUNK_BYTES
+    int chunk_capacity = (int)(length / BATCH_CHUNK_BYTES) + 1;
+    BatchChunk *chunks = calloc((size_t)chunk_capacity, sizeof(BatchChunk));
+    size_t pos = 0;
+    while (chunks != NULL && pos < length) {
+        size_t end = pos + BATCH_CHUNK_BYTES < length ? pos + BATCH_CHUNK_BYTES : length;
+        char *newline = memchr(data + end, '\n', length - end);
+        end = newline != NULL ? (size_t)(newline - data) + 1 : length;
+        chunks[chunk_count].start = data + pos;
+        chunks[chunk_count].end = data + end;
+        chunk_count++;
+        pos = end;
+    }
+
+    if (thread_count > chunk_count) {
+        thread_count = chunk_count > 0 ? chunk_count : 1;
+    }
+
+    BatchJob job;
+    job.chunks = chunks;
+    job.queue_count = thread_count;
+    job.options = options;
+    job.cache_size = options->cache_size;
+    job.store = options->store;
+    job.store_hits = 0;
+    job.cache_hits = 0;
+    job.cache_misses = 0;
+    job.cache_evictions = 0;
+    job.queues = calloc((size_t)thread_count, sizeof(WorkQueue));
+    pthread_t *threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    WorkerArgs *args = calloc((size_t)thread_count, sizeof(WorkerArgs));
+    if (chunks == NULL || job.queues == NULL || threads == NULL || args == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(chunks);
+        free(job.queues);
+        free(threads);
+        free(args);
+        free(data);
+        return 1;
+    }
+    pthread_mutex_init(&job.progress_lock, NULL);
+    pthread_cond_init(&job.chunk_done, NULL);
+
+    // Give each worker an equal contiguous share of the chunks to start with
+    for (int t = 0; t < thread_count; t++) {
+        pthread_mutex_init(&job.queues[t].lock, NULL);
+        job.queues[t].head = (int)((long)chunk_count * t / thread_count);
+        job.queues[t].tail = (int)((long)chunk_count * (t + 1) / thread_count);
+        args[t].job = &job;
+        args[t].index = t;
+    }
+
+    int started = 0;
+    for (; started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, batch_worker, &args[started]) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        batch_worker(&args[0]);  // no threads available; do the work here
+    }
+
+    // Print chunks in input order as they complete; each chunk is one write
+    int status = 0;
+    for (int c = 0; c < chunk_count; c++) {
+        pthread_mutex_lock(&job.progress_lock);
+        while (!chunks[c].done) {
+            pthread_cond_wait(&job.chunk_done, &job.progress_lock);
+        }
+        pthread_mutex_unlock(&job.progress_lock);
+
+        if (chunks[c].output == NULL) {
+            status = 1;
+        } else {
+            fwrite(chunks[c].output, 1, chunks[c].output_len, stdout);
+        }
+        free(chunks[c].output);
+    }
+    fflush(stdout);
+
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    for (int t = 0; t < thread_count; t++) {
+        pthread_mutex_destroy(&job.queues[t].lock);
+    }
+    pthread_mutex_destroy(&job.progress_lock);
+    pthread_cond_destroy(&job.chunk_done);
+
+    if (options->cache_stats) {
+        report_cache_stats(job.cache_hits, job.cache_misses, job.cache_evictions, job.store_hits,
+                           options->store != NULL);
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "Error: Out of memory\n");
+    }
+    free(args);
+    free(threads);
+    free(job.queues);
+    free(chunks);
+    free(data);
+    return status;
+}
+
+/*
+ * Entry point for: cli_calculator --batch [file] [--threads N] [--precision N]
+ *                                 [--cache-size N] [--cache-stats] [--store FILE]
+ *                                 [--decimal SCALE [--rounding MODE]] [--shapes]
+ * Without --threads (or --shapes) the input is streamed line by line on
+ * one thread.
+ * --threads 0 uses one thread per online CPU. Results are printed in
+ * their shortest round-trip form unless --precision asks for a fixed
+ * number of decimals. --cache-size sets how many results each thread
+ * remembers (0 turns the cache off). --store keeps what each expression
+ * text compiled to in FILE (its program, or its error, and the value of a
+ * constant) so that later runs can skip formulas seen before.
+ * --decimal evaluates in exact fixed-point arithmetic with SCALE digits
+ * after the point (see decimal.c), rounding with MODE (half-even unless
+ * given); results then always show SCALE decimals. --shapes evaluates
+ * expressions that differ only in their numbers together, with SIMD
+ * instructions across expressions (see shape_batch.c); it reads the
+ * whole input first, and has no effect in decimal mode.
+ */
+int batch_main(int argc, char *argv[]) {
+    const char *path = NULL;
+    BatchOptions options = { 1, FORMAT_SHORTEST, CACHE_DEFAULT_SIZE, 0, NULL, 0,
+                             { 2, DECIMAL_HALF_EVEN }, 0 };
+    const char *store_path = NULL;
+    ProgramStore store;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+            if (options.threads <= 0) {
+                long online = sysconf(_SC_NPROCESSORS_ONLN);
+                options.threads = online > 0 ? (int)online : 1;
+            }
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            options.precision = atoi(argv[++i]);
+            if (options.precision < 0 || options.precision > FORMAT_MAX_PRECISION) {
+                fprintf(stderr, "Error: Precision must be between 0 and %d\n",
+                        FORMAT_MAX_PRECISION);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc) {
+            long size = atol(argv[++i]);
+            options.cache_size = size > 0 ? (size_t)size : 0;
+        } else if (strcmp(argv[i], "--cache-stats") == 0) {
+            options.cache_stats = 1;
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store_path = argv[++i];
+        } else if (strcmp(argv[i], "--decimal") == 0 && i + 1 < argc) {
+            options.decimal = 1;
+            options.decimal_context.scale = atoi(argv[++i]);
+            if (options.decimal_context.scale < 0 ||
+                options.decimal_context.scale > DECIMAL_MAX_SCALE) {
+                fprintf(stderr, "Error: Scale must be between 0 and %d\n", DECIMAL_MAX_SCALE);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rounding") == 0 && i + 1 < argc) {
+            if (!decimal_rounding_from_name(argv[++i], &options.decimal_context.rounding)) {
+                fprintf(stderr, "Error: Rounding must be half-even, half-up, down, up, "
+                        "floor or ceiling\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--shapes") == 0) {
+            options.shapes = 1;
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "Usage: %s --batch [file] [--threads N] [--precision N] "
+                    "[--cache-size N] [--cache-stats] [--store FILE] "
+                    "[--decimal SCALE [--rounding MODE]] [--shapes]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *input = stdin;
+    if (path != NULL && strcmp(path, "-") != 0) {
+        input = fopen(path, "r");
+        if (input == NULL) {
+            fprintf(stderr, "Error: Cannot open '%s'\n", path);
+            return 1;
+        }
+    }
+
+    // Without the store everything still works, just from a cold start
+    if (store_path != NULL) {
+        if (program_store_open(&store, store_path)) {
+            options.store = &store;
+        } else {
+            fprintf(stderr, "Warning: Could not open program store '%s'\n", store_path);
+        }
+    }
+
+    if (options.decimal) {
+        options.shapes = 0;     // decimal programs are not run on doubles
+    }
+    int status = options.threads > 1 || options.shapes ? run_batch_parallel(input, &options)
+                                                       : run_batch(input, &options);
+    if (options.store != NULL) {
+        program_store_close(options.store);
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
+    return status;
+}
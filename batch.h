@@ -0,0 +1,30 @@
+/*
+ * Batch Mode Header File
+ * Non-interactive evaluation of many expressions
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include "program_store.h"
+#include "decimal.h"
+
+// Settings collected from the --batch command line
+typedef struct {
+    int threads;        // 1 streams the input on the calling thread
+    int precision;      // decimals, or FORMAT_SHORTEST for round-trip output
+    size_t cache_size;  // cached results per thread; 0 disables the cache
+    int cache_stats;    // report cache hits and misses on stderr
+    ProgramStore *store;    // compiled programs shared across runs, or NULL
+    int decimal;            // evaluate in fixed-point decimal (uncached)
+    DecimalContext decimal_context;
+    int shapes;             // evaluate same-shape expressions together (see shape_batch.h)
+} BatchOptions;
+
+int batch_main(int argc, char *argv[]);
+int run_batch(FILE *input, const BatchOptions *options);
+int run_batch_parallel(FILE *input, const BatchOptions *options);
+
+#endif  // BATCH_H
@@ -0,0 +1,762 @@
+/*
+ * Calculator Microbenchmarks
+ * Times the parser and evaluator over generated corpora:
+ *   short   - everyday arithmetic, 3 to 8 operands
+ *   nested  - deeply nested parentheses
+ *   long    - machine-generated expressions with thousands of operands
+ *   integer - counter/ID arithmetic: integer literals with + - *
+ * and two formulas over columns of variable values, evaluated row by row
+ * and with evaluate_columns(): arithmetic ("rows") and one calling sqrt,
+ * sin, exp, log, pow and cos ("math"). CALC_SIMD=scalar|sse2|avx2 picks
+ * the column kernels to compare. evaluate_decimal runs the same
+ * programs in fixed-point decimal (scale 2) to compare with
+ * evaluate_program; values in the nested and long corpora grow past
+ * 2^64 units and take its slower wide paths (or overflow). The "shapes"
+ * corpus is generated expressions of a few structures with different
+ * numbers, evaluated one program at a time and with
+ * evaluate_shape_batch(). The "workspace" benchmarks time updates to a
+ * workspace of named formulas (see workspace.h): setting one input and
+ * recomputing the cells that read it, against recomputing every cell.
+ *
+ * Usage: calc_bench [--warmup N] [--repeat N] [--size N] [--filter TEXT]
+ *
+ * Every benchmark makes --warmup untimed passes over its corpus, then
+ * --repeat timed passes. Each pass is cut into samples of a few
+ * expressions; the table reports the mean time per expression, the
+ * 50th/90th/99th percentile of the samples and the throughput.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "calc.h"
+#include "arena.h"
+#include "numparse.h"
+#include "optimizer.h"
+#include "register_vm.h"
+#include "jit.h"
+#include "vector_eval.h"
+#include "decimal.h"
+#include "workspace.h"
+#include "shape_batch.h"
+
+typedef struct {
+    const char *name;
+    char **expressions;
+    int count;
+    int sample_size;        // expressions per timed sample
+    size_t bytes;           // total text size
+} Corpus;
+
+typedef struct {
+    int warmup;
+    int repeat;
+    int size;
+    const char *filter;
+} BenchOptions;
+
+// Data shared by every benchmark function for one corpus
+typedef struct {
+    Corpus *corpus;
+    char **postfix;         // infix_to_postfix() output per expression
+    Program *programs;      // compile_expression() output per expression
+    Program *optimized;     // optimize_program() output per expression
+    RegisterProgram *registers; // compile_registers() of the unoptimized program
+    DecimalProgram *decimals;   // compile_decimal() of the unoptimized program
+    Arena scratch;          // reset after every expression
+    double sink;            // keeps results alive
+} BenchState;
+
+typedef void (*BenchFunction)(BenchState *state, int index);
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Corpus generation
+ * ----------------------------------------------------------------------------
+ */
+
+static unsigned int bench_seed = 12345;
+
+static unsigned int next_random(void) {
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return (bench_seed >> 16) & 0x7FFF;
+}
+
+static size_t append_number(char *out) {
+    if (next_random() % 3 == 0) {
+        return (size_t)sprintf(out, "%u.%02u", next_random() % 1000, next_random() % 100);
+    }
+    return (size_t)sprintf(out, "%u", 1 + next_random() % 1000);
+}
+
+static char random_operator(void) {
+    static const char operators[] = "+-*/";
+    return operators[next_random() % 4];
+}
+
+static char *generate_flat(int operands) {
+    char *text = malloc((size_t)operands * 16 + 1);
+    size_t used = append_number(text);
+    for (int i = 1; i < operands; i++) {
+        text[used++] = ' ';
+        text[used++] = random_operator();
+        text[used++] = ' ';
+        used += append_number(text + used);
+    }
+    text[used] = '\0';
+    return text;
+}
+
+static char *generate_integer(int operands) {
+    static const char operators[] = "+-*";
+    char *text = malloc((size_t)operands * 16 + 1);
+    size_t used = (size_t)sprintf(text, "%u", next_random() * 1000u + next_random() % 1000);
+    for (int i = 1; i < operands; i++) {
+        used += (size_t)sprintf(text + used, " %c %u", operators[next_random() % 3],
+                                1 + next_random() % 1000);
+    }
+    return text;
+}
+
+static char *generate_nested(int depth) {
+    char *text = malloc((size_t)depth * 20 + 16);
+    size_t used = 0;
+    for (int i = 0; i < depth; i++) {
+        text[used++] = '(';
+    }
+    used += append_number(text + used);
+    for (int i = 0; i < depth; i++) {
+        text[used++] = random_operator();
+        used += append_number(text + used);
+        text[used++] = ')';
+    }
+    text[used] = '\0';
+    return text;
+}
+
+static void corpus_init(Corpus *corpus, const char *name, int count, int sample_size) {
+    corpus->name = name;
+    corpus->count = count;
+    corpus->sample_size = sample_size;
+    corpus->expressions = malloc((size_t)count * sizeof(char *));
+    corpus->bytes = 0;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, "short") == 0) {
+            corpus->expressions[i] = generate_flat(3 + (int)(next_random() % 6));
+        } else if (strcmp(name, "integer") == 0) {
+            corpus->expressions[i] = generate_integer(3 + (int)(next_random() % 6));
+        } else if (strcmp(name, "nested") == 0) {
+            corpus->expressions[i] = generate_nested(50 + (int)(next_random() % 50));
+        } else {
+            corpus->expressions[i] = generate_flat(2000 + (int)(next_random() % 2000));
+        }
+        corpus->bytes += strlen(corpus->expressions[i]);
+    }
+}
+
+static void corpus_free(Corpus *corpus) {
+    for (int i = 0; i < corpus->count; i++) {
+        free(corpus->expressions[i]);
+    }
+    free(corpus->expressions);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Benchmarked operations
+ * ----------------------------------------------------------------------------
+ */
+
+static void bench_infix_to_postfix(BenchState *state, int index) {
+    char *postfix;
+    arena_reset(&state->scratch);
+    if (infix_to_postfix(state->corpus->expressions[index], &postfix, &state->scratch, NULL) == CALC_OK) {
+        state->sink += postfix[0];
+    }
+}
+
+static void bench_evaluate_postfix(BenchState *state, int index) {
+    double result;
+    arena_reset(&state->scratch);
+    if (evaluate_postfix(state->postfix[index], &state->scratch, &result, NULL) == CALC_OK) {
+        state->sink += result;
+    }
+}
+
+static void bench_scan_numbers(BenchState *state, int index) {
+    const char *p = state->corpus->expressions[index];
+    while (*p != '\0') {
+        double value;
+        const char *end = scan_number(p, &value);
+        if (end != NULL) {
+            state->sink += value;
+            p = end;
+        } else {
+            p++;
+        }
+    }
+}
+
+static void bench_compile(BenchState *state, int index) {
+    Program program;
+    arena_reset(&state->scratch);
+    if (compile_expression(state->corpus->expressions[index], &program, &state->scratch, NULL) == CALC_OK) {
+        state->sink += program.length;
+    }
+}
+
+static void bench_evaluate_program(BenchState *state, int index) {
+    double result;
+    if (evaluate_program(&state->programs[index], &result, NULL) == CALC_OK) {
+        state->sink += result;
+    }
+}
+
+static void bench_evaluate_value(BenchState *state, int index) {
+    CalcValue result;
+    if (evaluate_program_value(&state->programs[index], &result, NULL) == CALC_OK) {
+        state->sink += result.value;
+    }
+}
+
+static void bench_optimize(BenchState *state, int index) {
+    Program program;
+    arena_reset(&state->scratch);
+    if (optimize_program(&state->programs[index], &program, &state->scratch, 0, NULL) == CALC_OK) {
+        state->sink += program.length;
+    }
+}
+
+static void bench_evaluate_optimized(BenchState *state, int index) {
+    double result;
+    if (evaluate_program(&state->optimized[index], &result, NULL) == CALC_OK) {
+        state->sink += result;
+    }
+}
+
+static void bench_compile_registers(BenchState *state, int index) {
+    RegisterProgram program;
+    arena_reset(&state->scratch);
+    if (compile_registers(&state->programs[index], &program, &state->scratch, NULL) == CALC_OK) {
+        state->sink += program.length;
+    }
+}
+
+static void bench_evaluate_registers(BenchState *state, int index) {
+    double result;
+    if (evaluate_registers(&state->registers[index], NULL, &result, NULL) == CALC_OK) {
+        state->sink += result;
+    }
+}
+
+static void bench_evaluate_decimal(BenchState *state, int index) {
+    CalcDecimal result;
+    if (evaluate_decimal(&state->decimals[index], NULL, &result, NULL) == CALC_OK) {
+        state->sink += (double)result;
+    }
+}
+
+static void bench_end_to_end(BenchState *state, int index) {
+    Program program;
+    double result;
+    arena_reset(&state->scratch);
+    if (compile_expression(state->corpus->expressions[index], &program, &state->scratch, NULL) == CALC_OK &&
+        evaluate_program(&program, &result, NULL) == CALC_OK) {
+        state->sink += result;
+    }
+}
+
+typedef struct {
+    const char *name;
+    BenchFunction run;
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    { "infix_to_postfix", bench_infix_to_postfix },
+    { "evaluate_postfix", bench_evaluate_postfix },
+    { "scan_number", bench_scan_numbers },
+    { "compile", bench_compile },
+    { "evaluate_program", bench_evaluate_program },
+    { "evaluate_value", bench_evaluate_value },
+    { "optimize", bench_optimize },
+    { "evaluate_optimized", bench_evaluate_optimized },
+    { "compile_registers", bench_compile_registers },
+    { "evaluate_registers", bench_evaluate_registers },
+    { "evaluate_decimal", bench_evaluate_decimal },
+    { "end_to_end", bench_end_to_end },
+};
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Measurement
+ * ----------------------------------------------------------------------------
+ */
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int count, double p) {
+    int index = (int)(p * (count - 1) + 0.5);
+    return sorted[index];
+}
+
+static void run_benchmark(const Benchmark *benchmark, BenchState *state,
+                          const BenchOptions *options) {
+    Corpus *corpus = state->corpus;
+    int per_pass = (corpus->count + corpus->sample_size - 1) / corpus->sample_size;
+    int sample_count = per_pass * options->repeat;
+    double *samples = malloc((size_t)sample_count * sizeof(double));
+    double total_ns = 0;
+    int s = 0;
+
+    for (int pass = 0; pass < options->warmup; pass++) {
+        for (int i = 0; i < corpus->count; i++) {
+            benchmark->run(state, i);
+        }
+    }
+
+    for (int pass = 0; pass < options->repeat; pass++) {
+        for (int first = 0; first < corpus->count; first += corpus->sample_size) {
+            int last = first + corpus->sample_size;
+            if (last > corpus->count) {
+                last = corpus->count;
+            }
+            double start = now_ns();
+            for (int i = first; i < last; i++) {
+                benchmark->run(state, i);
+            }
+            double elapsed = now_ns() - start;
+            total_ns += elapsed;
+            samples[s++] = elapsed / (last - first);
+        }
+    }
+
+    qsort(samples, (size_t)s, sizeof(double), compare_doubles);
+    double evaluated = (double)corpus->count * options->repeat;
+    double mean = total_ns / evaluated;
+    printf("%-18s %-7s %12.1f %12.1f %12.1f %12.1f %14.0f %10.1f\n",
+           benchmark->name, corpus->name, mean,
+           percentile(samples, s, 0.50), percentile(samples, s, 0.90),
+           percentile(samples, s, 0.99),
+           evaluated / (total_ns / 1e9),
+           (double)corpus->bytes * options->repeat / (total_ns / 1e9) / 1e6);
+    free(samples);
+}
+
+/*
+ * Time formula over --size * 50 rows of generated columns:
+ * once per row with each evaluator, then evaluate_columns() and
+ * jit_evaluate_columns() over samples of COLUMN_SAMPLE_ROWS rows
+ */
+#define COLUMN_SAMPLE_ROWS 65536
+
+static void print_column_result(const char *name, const char *corpus, double *samples, int s,
+                                double total_ns, double evaluated, double bytes) {
+    qsort(samples, (size_t)s, sizeof(double), compare_doubles);
+    printf("%-18s %-7s %12.2f %12.2f %12.2f %12.2f %14.0f %10.1f\n",
+           name, corpus, total_ns / evaluated,
+           percentile(samples, s, 0.50), percentile(samples, s, 0.90),
+           percentile(samples, s, 0.99),
+           evaluated / (total_ns / 1e9), bytes / (total_ns / 1e9) / 1e6);
+}
+
+static double run_column_benchmarks(const BenchOptions *options, const char *formula,
+                                    const char *corpus) {
+    size_t rows = (size_t)options->size * 50;
+    Arena arena;
+    Program compiled, program;
+    RegisterProgram registers;
+    arena_init(&arena);
+    if (compile_expression(formula, &compiled, &arena, NULL) != CALC_OK ||
+        optimize_program(&compiled, &program, &arena, 0, NULL) != CALC_OK ||
+        compile_registers(&program, &registers, &arena, NULL) != CALC_OK) {
+        fprintf(stderr, "Error: column formula failed to compile\n");
+        exit(1);
+    }
+
+    // One column per variable, in the program's variable order
+    int variable_count = program.variable_count;
+    double **columns = malloc((size_t)variable_count * sizeof(double *));
+    double *results = malloc(rows * sizeof(double));
+    double *row = malloc((size_t)variable_count * sizeof(double));
+    for (int v = 0; v < variable_count; v++) {
+        columns[v] = malloc(rows * sizeof(double));
+        for (size_t r = 0; r < rows; r++) {
+            columns[v][r] = 1 + next_random() % 1000 + (next_random() % 100) / 100.0;
+        }
+    }
+
+    int per_pass = (int)((rows + COLUMN_SAMPLE_ROWS - 1) / COLUMN_SAMPLE_ROWS);
+    double *samples = malloc((size_t)(per_pass * options->repeat) * sizeof(double));
+    double evaluated = (double)rows * options->repeat;
+    double bytes = evaluated * variable_count * sizeof(double);
+    double sink = 0;
+    char name[32];
+
+    // Row at a time through the stack machine, the register VM, native
+    // code, and the register VM promoted to native code once it is hot
+    static const char *const row_names[] = {
+        "row_by_row", "registers_by_row", "jit_by_row", "hot_by_row"
+    };
+    JitCode *jit = jit_compile(&registers);
+    HotExpression hot;
+    hot_expression_init(&hot, &program, &arena, JIT_DEFAULT_THRESHOLD, NULL);
+    for (int vm = 0; vm < 4; vm++) {
+        const char *row_name = row_names[vm];
+        if ((options->filter != NULL && strstr(row_name, options->filter) == NULL &&
+             strstr(corpus, options->filter) == NULL) || (vm == 2 && jit == NULL)) {
+            continue;
+        }
+        double total_ns = 0;
+        int s = 0;
+        for (int pass = 0; pass < options->warmup + options->repeat; pass++) {
+            for (size_t first = 0; first < rows; first += COLUMN_SAMPLE_ROWS) {
+                size_t last = first + COLUMN_SAMPLE_ROWS < rows ? first + COLUMN_SAMPLE_ROWS : rows;
+                double start = now_ns();
+                for (size_t r = first; r < last; r++) {
+                    for (int v = 0; v < variable_count; v++) {
+                        row[v] = columns[v][r];
+                    }
+                    switch (vm) {
+                        case 0: evaluate_program_with(&program, row, &results[r], NULL); break;
+                        case 1: evaluate_registers(&registers, row, &results[r], NULL); break;
+                        case 2: jit_evaluate(jit, &registers, row, &results[r], NULL); break;
+                        default: hot_evaluate(&hot, row, &results[r], NULL); break;
+                    }
+                }
+                double elapsed = now_ns() - start;
+                if (pass >= options->warmup) {
+                    total_ns += elapsed;
+                    samples[s++] = elapsed / (double)(last - first);
+                }
+            }
+            sink += results[rows - 1];
+        }
+        print_column_result(row_name, corpus, samples, s, total_ns, evaluated, bytes);
+    }
+
+    // Whole columns through the vector evaluator, then through native code
+    for (int backend = 0; backend < 2; backend++) {
+        if (backend == 0) {
+            snprintf(name, sizeof(name), "columns_%s", vector_isa());
+        } else {
+            snprintf(name, sizeof(name), "columns_jit");
+        }
+        if ((options->filter != NULL && strstr(name, options->filter) == NULL &&
+             strstr(corpus, options->filter) == NULL) || (backend == 1 && jit == NULL)) {
+            continue;
+        }
+        double total_ns = 0;
+        int s = 0;
+        for (int pass = 0; pass < options->warmup + options->repeat; pass++) {
+            for (size_t first = 0; first < rows; first += COLUMN_SAMPLE_ROWS) {
+                size_t count = rows - first < COLUMN_SAMPLE_ROWS ? rows - first : COLUMN_SAMPLE_ROWS;
+                const double *block[8];
+                for (int v = 0; v < variable_count; v++) {
+                    block[v] = columns[v] + first;
+                }
+                double start = now_ns();
+                if (backend == 0) {
+                    evaluate_columns(&program, block, count, results + first, NULL, NULL);
+                } else {
+                    jit_evaluate_columns(jit, &registers, block, count, results + first, NULL, NULL);
+                }
+                double elapsed = now_ns() - start;
+                if (pass >= options->warmup) {
+                    total_ns += elapsed;
+                    samples[s++] = elapsed / (double)count;
+                }
+            }
+            sink += results[rows - 1];
+        }
+        print_column_result(name, corpus, samples, s, total_ns, evaluated, bytes);
+    }
+
+    jit_free(jit);
+    hot_expression_free(&hot);
+    for (int v = 0; v < variable_count; v++) {
+        free(columns[v]);
+    }
+    free(columns);
+    free(results);
+    free(row);
+    free(samples);
+    arena_free(&arena);
+    return sink;
+}
+
+/*
+ * Time --size * 10 generated expressions of four shapes, one
+ * evaluate_program() call each and then evaluate_shape_batch() over
+ * samples of COLUMN_SAMPLE_ROWS programs
+ */
+static double run_shape_benchmarks(const BenchOptions *options) {
+    static const char *const shapes[] = {
+        "%s * %s + %s / %s", "(%s - %s) * %s / %s", "sqrt(%s) + %s * %s - %s", "%s / (%s - %s) + %s"
+    };
+    size_t count = (size_t)options->size * 10;
+    Arena arena;
+    arena_init(&arena);
+    Program *programs = malloc(count * sizeof(Program));
+    double *results = malloc(count * sizeof(double));
+    unsigned char *status = malloc(count);
+    double bytes = 0;
+    for (size_t k = 0; k < count; k++) {
+        char numbers[4][16];
+        char text[96];
+        for (int n = 0; n < 4; n++) {
+            snprintf(numbers[n], sizeof(numbers[n]), "%u.%02u", 1 + next_random() % 1000,
+                     next_random() % 100);
+        }
+        bytes += snprintf(text, sizeof(text), shapes[next_random() % 4],
+                          numbers[0], numbers[1], numbers[2], numbers[3]);
+        if (compile_expression(text, &programs[k], &arena, NULL) != CALC_OK) {
+            fprintf(stderr, "Error: shape expression failed to compile\n");
+            exit(1);
+        }
+    }
+
+    int per_pass = (int)((count + COLUMN_SAMPLE_ROWS - 1) / COLUMN_SAMPLE_ROWS);
+    double *samples = malloc((size_t)(per_pass * options->repeat) * sizeof(double));
+    double evaluated = (double)count * options->repeat;
+    double sink = 0;
+    static const char *const names[] = { "one_by_one", "shape_batch" };
+    Arena scratch;
+    arena_init(&scratch);
+    for (int mode = 0; mode < 2; mode++) {
+        if (options->filter != NULL && strstr(names[mode], options->filter) == NULL &&
+            strstr("shapes", options->filter) == NULL) {
+            continue;
+        }
+        double total_ns = 0;
+        int s = 0;
+        for (int pass = 0; pass < options->warmup + options->repeat; pass++) {
+            for (size_t first = 0; first < count; first += COLUMN_SAMPLE_ROWS) {
+                size_t n = count - first < COLUMN_SAMPLE_ROWS ? count - first : COLUMN_SAMPLE_ROWS;
+                arena_reset(&scratch);
+                double start = now_ns();
+                if (mode == 0) {
+                    for (size_t k = first; k < first + n; k++) {
+                        evaluate_program(&programs[k], &results[k], NULL);
+                    }
+                } else {
+                    evaluate_shape_batch(programs + first, n, results + first, status + first,
+                                         &scratch, NULL);
+                }
+                double elapsed = now_ns() - start;
+                if (pass >= options->warmup) {
+                    total_ns += elapsed;
+                    samples[s++] = elapsed / (double)n;
+                }
+            }
+            sink += results[count - 1];
+        }
+        print_column_result(names[mode], "shapes", samples, s, total_ns, evaluated,
+                            bytes * options->repeat);
+    }
+
+    free(programs);
+    free(results);
+    free(status);
+    free(samples);
+    arena_free(&scratch);
+    arena_free(&arena);
+    return sink;
+}
+
+/*
+ * Time updates to a workspace of --size cells, chains of
+ * WORKSPACE_CHAIN_CELLS formulas that each read the previous cell and the
+ * chain's input: one changed input and the recompute of its chain, or
+ * every input changed and every cell recomputed. Each sample is one
+ * update.
+ */
+#define WORKSPACE_CHAIN_CELLS 100
+#define WORKSPACE_PASS_UPDATES 16
+
+static double run_workspace_benchmarks(const BenchOptions *options) {
+    int chains = options->size / WORKSPACE_CHAIN_CELLS;
+    if (chains < 1) {
+        chains = 1;
+    }
+    Workspace workspace;
+    char name[32];
+    char formula[96];
+    if (!workspace_init(&workspace)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    workspace_define(&workspace, "rate", 4, "0.05", NULL);
+    for (int c = 0; c < chains; c++) {
+        int length = snprintf(name, sizeof(name), "in%d", c);
+        snprintf(formula, sizeof(formula), "%d", c + 1);
+        workspace_define(&workspace, name, (size_t)length, formula, NULL);
+        for (int d = 0; d < WORKSPACE_CHAIN_CELLS; d++) {
+            length = snprintf(name, sizeof(name), "r%d_%d", c, d);
+            if (d == 0) {
+                snprintf(formula, sizeof(formula), "in%d * 1.01 + rate", c);
+            } else {
+                snprintf(formula, sizeof(formula), "r%d_%d * 0.99 + in%d", c, d - 1, c);
+            }
+            if (workspace_define(&workspace, name, (size_t)length, formula, NULL) != CALC_OK) {
+                fprintf(stderr, "Error: workspace formula failed to compile\n");
+                exit(1);
+            }
+        }
+    }
+    workspace_recompute(&workspace, NULL, NULL);
+    int last = workspace_find(&workspace, name, strlen(name));
+
+    double *samples = malloc((size_t)(WORKSPACE_PASS_UPDATES * options->repeat) * sizeof(double));
+    double evaluated = (double)WORKSPACE_PASS_UPDATES * options->repeat;
+    double sink = 0;
+    static const char *const names[] = { "recompute_one", "recompute_all" };
+    for (int mode = 0; mode < 2; mode++) {
+        if (options->filter != NULL && strstr(names[mode], options->filter) == NULL &&
+            strstr("workspace", options->filter) == NULL) {
+            continue;
+        }
+        double total_ns = 0;
+        int s = 0;
+        for (int pass = 0; pass < options->warmup + options->repeat; pass++) {
+            for (int update = 0; update < WORKSPACE_PASS_UPDATES; update++) {
+                double start = now_ns();
+                int first = mode == 0 ? (int)(next_random() % (unsigned int)chains) : 0;
+                int end = mode == 0 ? first + 1 : chains;
+                for (int c = first; c < end; c++) {
+                    int length = snprintf(name, sizeof(name), "in%d", c);
+                    snprintf(formula, sizeof(formula), "%u", 1 + next_random() % 1000);
+                    workspace_define(&workspace, name, (size_t)length, formula, NULL);
+                }
+                workspace_recompute(&workspace, NULL, NULL);
+                double elapsed = now_ns() - start;
+                if (pass >= options->warmup) {
+                    total_ns += elapsed;
+                    samples[s++] = elapsed;
+                }
+            }
+            CalcValue value;
+            workspace_value(&workspace, last, &value, NULL);
+            sink += value.value;
+        }
+        print_column_result(names[mode], "workspace", samples, s, total_ns, evaluated, 0);
+    }
+
+    free(samples);
+    workspace_free(&workspace);
+    return sink;
+}
+
+static void usage(const char *program) {
+    printf("Usage: %s [--warmup N] [--repeat N] [--size N] [--filter TEXT]\n", program);
+    printf("  --warmup N     untimed passes before measuring (default 2)\n");
+    printf("  --repeat N     timed passes (default 10)\n");
+    printf("  --size N       expressions in the short corpus (default 20000);\n");
+    printf("                 the column benchmarks use 50x as many rows,\n");
+    printf("                 the shape benchmarks 10x as many expressions;\n");
+    printf("                 the workspace has N cells\n");
+    printf("  --filter TEXT  only run benchmarks or corpora whose name contains TEXT\n");
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions options = { 2, 10, 20000, NULL };
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+            options.warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            options.repeat = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            options.size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            options.filter = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.repeat < 1 || options.size < 1 || options.warmup < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // The long corpus is ~2000x the work per expression of the short one
+    Corpus corpora[4];
+    corpus_init(&corpora[0], "short", options.size, 64);
+    corpus_init(&corpora[1], "nested", options.size / 20 > 0 ? options.size / 20 : 1, 8);
+    corpus_init(&corpora[2], "long", options.size / 200 > 0 ? options.size / 200 : 1, 1);
+    corpus_init(&corpora[3], "integer", options.size, 64);
+
+    printf("%-18s %-7s %12s %12s %12s %12s %14s %10s\n", "benchmark", "corpus",
+           "ns/expr", "p50", "p90", "p99", "expr/s", "MB/s");
+
+    double sink = 0;
+    for (int c = 0; c < 4; c++) {
+        BenchState state;
+        Corpus *corpus = &corpora[c];
+        state.corpus = corpus;
+        state.sink = 0;
+        arena_init(&state.scratch);
+
+        // Inputs for the benchmarks that start from an intermediate form
+        Arena prepared;
+        arena_init(&prepared);
+        state.postfix = malloc((size_t)corpus->count * sizeof(char *));
+        state.programs = malloc((size_t)corpus->count * sizeof(Program));
+        state.optimized = malloc((size_t)corpus->count * sizeof(Program));
+        state.registers = malloc((size_t)corpus->count * sizeof(RegisterProgram));
+        state.decimals = malloc((size_t)corpus->count * sizeof(DecimalProgram));
+        DecimalContext money = { 2, DECIMAL_HALF_EVEN };
+        for (int i = 0; i < corpus->count; i++) {
+            if (infix_to_postfix(corpus->expressions[i], &state.postfix[i], &prepared, NULL) != CALC_OK ||
+                compile_expression(corpus->expressions[i], &state.programs[i], &prepared, NULL) != CALC_OK ||
+                optimize_program(&state.programs[i], &state.optimized[i], &prepared, 0, NULL) != CALC_OK ||
+                compile_registers(&state.programs[i], &state.registers[i], &prepared, NULL) != CALC_OK ||
+                compile_decimal(corpus->expressions[i], &state.programs[i], &money,
+                                &state.decimals[i], &prepared, NULL) != CALC_OK) {
+                fprintf(stderr, "Error: generated expression failed to compile\n");
+                return 1;
+            }
+        }
+
+        for (size_t b = 0; b < sizeof(benchmarks) / sizeof(benchmarks[0]); b++) {
+            if (options.filter != NULL && strstr(benchmarks[b].name, options.filter) == NULL &&
+                strstr(corpus->name, options.filter) == NULL) {
+                continue;
+            }
+            run_benchmark(&benchmarks[b], &state, &options);
+        }
+
+        sink += state.sink;
+        free(state.postfix);
+        free(state.programs);
+        free(state.optimized);
+        free(state.registers);
+        free(state.decimals);
+        arena_free(&prepared);
+        arena_free(&state.scratch);
+        corpus_free(corpus);
+    }
+
+    sink += run_column_benchmarks(&options, "price * qty * (1 - discount) + price / qty", "rows");
+    sink += run_column_benchmarks(&options, "sqrt(x) * sin(y) + exp(y / 500) * log(x) + pow(x, 0.25) * cos(y)",
+                                  "math");
+    sink += run_shape_benchmarks(&options);
+    sink += run_workspace_benchmarks(&options);
+
+    // Printing the sink keeps the compiler from discarding the work
+    fprintf(stderr, "checksum: %g\n", sink);
+    return 0;
+}
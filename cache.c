@@ -0,0 +1,347 @@
+/*
+ * Result Cache Implementation File
+ *
+ * Batch inputs repeat the same formulas over and over. Before compiling a
+ * line, its text is normalized (whitespace that cannot change the meaning
+ * is dropped) and hashed; if the normalized text was evaluated recently
+ * the stored value is returned without compiling anything.
+ *
+ * Layout: entries live in a fixed pool of `capacity` records linked into
+ * a recency list. The lookup table is a separate power-of-two array of
+ * entry indexes with linear probing, kept at most half full. When the
+ * pool is full the least recently used entry is evicted; its slot is
+ * removed with backward-shift deletion, so no tombstones build up.
+ *
+ * Only successful results are stored. A failing expression is compiled
+ * again each time so its error position always refers to the caller's
+ * own text.
+ *
+ * A ProgramStore can be attached as a second level. It is keyed by the
+ * exact text, not the normalized one, so it can also keep compile errors
+ * with positions that match the caller's text: a miss here is looked up
+ * there before compiling, and whatever a new text compiles to is saved,
+ * so later processes start warm.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "cache.h"
+
+#define CACHE_NONE UINT32_MAX
+#define CACHE_MAX_KEY 4096          // longer expressions bypass the cache
+#define CACHE_LOCAL_KEY 256
+
+struct CacheEntry {
+    uint64_t hash;
+    char *key;
+    uint32_t key_length;
+    uint32_t key_capacity;
+    uint32_t prev;      // towards the newest entry
+    uint32_t next;      // towards the oldest entry
+    CalcValue result;
+};
+
+/*
+ * Create a cache holding at most capacity results
+ * capacity 0 gives a disabled cache that every lookup misses.
+ * Returns: 1 on success, 0 when out of memory
+ */
+int result_cache_init(ResultCache *cache, size_t capacity) {
+    memset(cache, 0, sizeof(*cache));
+    cache->newest = CACHE_NONE;
+    cache->oldest = CACHE_NONE;
+    if (capacity == 0) {
+        return 1;
+    }
+    if (capacity > CACHE_NONE / 2) {
+        capacity = CACHE_NONE / 2;
+    }
+
+    size_t slot_count = 16;
+    while (slot_count < capacity * 2) {
+        slot_count *= 2;
+    }
+    cache->entries = calloc(capacity, sizeof(CacheEntry));
+    cache->slots = calloc(slot_count, sizeof(uint32_t));
+    if (cache->entries == NULL || cache->slots == NULL) {
+        result_cache_free(cache);
+        return 0;
+    }
+    cache->capacity = capacity;
+    cache->slot_mask = slot_count - 1;
+    return 1;
+}
+
+/*
+ * Use store (which may be NULL) behind this cache
+ * The store must stay open while the cache is in use.
+ */
+void result_cache_attach_store(ResultCache *cache, ProgramStore *store) {
+    cache->store = store;
+}
+
+void result_cache_free(ResultCache *cache) {
+    for (size_t i = 0; i < cache->count; i++) {
+        free(cache->entries[i].key);
+    }
+    free(cache->entries);
+    free(cache->slots);
+    cache->entries = NULL;
+    cache->slots = NULL;
+    cache->capacity = 0;
+    cache->count = 0;
+}
+
+static int is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '.' || c == '_';
+}
+
+static int is_sign(char c) {
+    return c == '+' || c == '-';
+}
+
+/*
+ * Whether a blank between before and after must be kept: when the two
+ * could be read as one token without it. A sign next to a word character
+ * counts, since it may be an exponent sign: "1e+5" is a number, while
+ * "1e +5" and "1e+ 5" are rejected. Keeping the blank in "1 +2" only
+ * costs a cache miss against "1+2".
+ */
+static int blank_matters(char before, char after) {
+    return (is_word_char(before) && (is_word_char(after) || is_sign(after))) ||
+           (is_sign(before) && is_word_char(after));
+}
+
+/*
+ * Copy expression into out without insignificant whitespace, hashing the
+ * result (FNV-1a) on the way. A run of blanks that blank_matters() becomes
+ * a single space, since removing it could change what the expression
+ * means ("1 2", "1e +5").
+ * out needs room for strlen(expression) + 1 bytes.
+ * Returns: length of the normalized text
+ */
+size_t cache_normalize(const char *expression, char *out, uint64_t *hash) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t length = 0;
+    int pending_blank = 0;
+
+    for (const char *p = expression; *p != '\0'; p++) {
+        char c = *p;
+        if (c == ' ' || c == '\t') {
+            pending_blank = 1;
+            continue;
+        }
+        if (pending_blank && length > 0 && blank_matters(out[length - 1], c)) {
+            out[length++] = ' ';
+            h = (h ^ (unsigned char)' ') * 0x100000001b3ULL;
+        }
+        pending_blank = 0;
+        out[length++] = c;
+        h = (h ^ (unsigned char)c) * 0x100000001b3ULL;
+    }
+    out[length] = '\0';
+    *hash = h;
+    return length;
+}
+
+static size_t home_slot(const ResultCache *cache, uint64_t hash) {
+    return (size_t)(hash ^ (hash >> 32)) & cache->slot_mask;
+}
+
+static void unlink_entry(ResultCache *cache, uint32_t index) {
+    CacheEntry *entry = &cache->entries[index];
+    if (entry->prev != CACHE_NONE) {
+        cache->entries[entry->prev].next = entry->next;
+    } else {
+        cache->newest = entry->next;
+    }
+    if (entry->next != CACHE_NONE) {
+        cache->entries[entry->next].prev = entry->prev;
+    } else {
+        cache->oldest = entry->prev;
+    }
+}
+
+static void push_newest(ResultCache *cache, uint32_t index) {
+    CacheEntry *entry = &cache->entries[index];
+    entry->prev = CACHE_NONE;
+    entry->next = cache->newest;
+    if (cache->newest != CACHE_NONE) {
+        cache->entries[cache->newest].prev = index;
+    } else {
+        cache->oldest = index;
+    }
+    cache->newest = index;
+}
+
+/*
+ * Find a normalized key
+ * Returns: entry index, or CACHE_NONE
+ */
+static uint32_t find_entry(const ResultCache *cache, const char *key, size_t length, uint64_t hash) {
+    size_t slot = home_slot(cache, hash);
+    while (cache->slots[slot] != 0) {
+        uint32_t index = cache->slots[slot] - 1;
+        const CacheEntry *entry = &cache->entries[index];
+        if (entry->hash == hash && entry->key_length == length &&
+            memcmp(entry->key, key, length) == 0) {
+            return index;
+        }
+        slot = (slot + 1) & cache->slot_mask;
+    }
+    return CACHE_NONE;
+}
+
+/*
+ * Remove an entry's slot, shifting later members of its probe run back
+ * so that every remaining key stays reachable from its home slot
+ */
+static void remove_slot(ResultCache *cache, uint32_t index) {
+    size_t hole = home_slot(cache, cache->entries[index].hash);
+    while (cache->slots[hole] != index + 1) {
+        hole = (hole + 1) & cache->slot_mask;
+    }
+
+    size_t next = hole;
+    for (;;) {
+        next = (next + 1) & cache->slot_mask;
+        if (cache->slots[next] == 0) {
+            break;
+        }
+        size_t home = home_slot(cache, cache->entries[cache->slots[next] - 1].hash);
+        // Move the key back unless its home lies cyclically in (hole, next]
+        int stays = hole <= next ? (home > hole && home <= next)
+                                 : (home > hole || home <= next);
+        if (!stays) {
+            cache->slots[hole] = cache->slots[next];
+            hole = next;
+        }
+    }
+    cache->slots[hole] = 0;
+}
+
+static void insert_entry(ResultCache *cache, const char *key, size_t length, uint64_t hash,
+                         const CalcValue *result) {
+    // A free entry while the pool is filling up, then the least recently used
+    uint32_t index = cache->count < cache->capacity ? (uint32_t)cache->count : cache->oldest;
+    CacheEntry *entry = &cache->entries[index];
+
+    // Make room for the key first; if that fails the cache is left untouched
+    if (entry->key_capacity < length) {
+        char *grown = realloc(entry->key, length);
+        if (grown == NULL) {
+            return;
+        }
+        entry->key = grown;
+        entry->key_capacity = (uint32_t)length;
+    }
+
+    if (index == cache->count) {
+        cache->count++;
+    } else {
+        remove_slot(cache, index);
+        unlink_entry(cache, index);
+        cache->evictions++;
+    }
+
+    memcpy(entry->key, key, length);
+    entry->key_length = (uint32_t)length;
+    entry->hash = hash;
+    entry->result = *result;
+
+    size_t slot = home_slot(cache, hash);
+    while (cache->slots[slot] != 0) {
+        slot = (slot + 1) & cache->slot_mask;
+    }
+    cache->slots[slot] = index + 1;
+    push_newest(cache, index);
+}
+
+/*
+ * Evaluate an expression, answering from the cache when its normalized
+ * text was evaluated recently, then from the attached store, and only
+ * then by compiling it. cache may be NULL.
+ * The arena is used for compilation and for long keys; reset it between
+ * calls as with compile_expression().
+ * Returns: the same status compile_expression()/evaluate_program() would
+ */
+CalcStatus cached_evaluate(ResultCache *cache, const char *expression, Arena *arena,
+                           CalcValue *result, CalcError *error) {
+    Program program;
+    CalcStatus status;
+
+    if (cache == NULL || (cache->capacity == 0 && cache->store == NULL)) {
+        status = compile_expression(expression, &program, arena, error);
+        return status == CALC_OK ? evaluate_program_value(&program, result, error) : status;
+    }
+
+    size_t length = strlen(expression);
+    char local[CACHE_LOCAL_KEY];
+    char *key = length < sizeof(local) ? local : arena_alloc(arena, length + 1);
+    uint64_t hash = 0;
+    size_t key_length = 0;
+    uint32_t index = CACHE_NONE;
+
+    if (key != NULL) {
+        key_length = cache_normalize(expression, key, &hash);
+        if (cache->capacity > 0) {
+            index = find_entry(cache, key, key_length, hash);
+        }
+    }
+    if (index != CACHE_NONE) {
+        cache->hits++;
+        if (cache->newest != index) {
+            unlink_entry(cache, index);
+            push_newest(cache, index);
+        }
+        *result = cache->entries[index].result;
+        return CALC_OK;
+    }
+    cache->misses++;
+    int cacheable = key != NULL && key_length <= CACHE_MAX_KEY;
+
+    if (cache->store != NULL) {
+        StoredExpression stored;
+        if (program_store_lookup(cache->store, expression, length, &stored, arena)) {
+            cache->store_hits++;
+            if (stored.status != CALC_OK) {
+                if (error != NULL) {
+                    *error = stored.error;
+                }
+                return stored.status;
+            }
+            if (stored.has_result) {
+                *result = stored.result;
+                status = CALC_OK;
+            } else {
+                status = evaluate_program_value(&stored.program, result, error);
+            }
+            if (status == CALC_OK && cacheable && cache->capacity > 0) {
+                insert_entry(cache, key, key_length, hash, result);
+            }
+            return status;
+        }
+    }
+
+    StoredExpression compiled;
+    compiled.status = compile_expression(expression, &compiled.program, arena, &compiled.error);
+    status = compiled.status;
+    if (status == CALC_OK) {
+        status = evaluate_program_value(&compiled.program, result, error);
+    } else if (error != NULL) {
+        *error = compiled.error;
+    }
+    if (status == CALC_OK && cacheable && cache->capacity > 0) {
+        insert_entry(cache, key, key_length, hash, result);
+    }
+    if (cache->store != NULL && compiled.status != CALC_ERR_OUT_OF_MEMORY) {
+        // A program without variables always has the value just computed
+        compiled.has_result = status == CALC_OK && compiled.program.variable_count == 0;
+        if (compiled.has_result) {
+            compiled.result = *result;
+        }
+        program_store_insert(cache->store, expression, length, &compiled);
+    }
+    return status;
+}
@@ -0,0 +1,51 @@
+/*
+ * Result Cache Header File
+ * Remembers the values of recently evaluated expressions
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "calc.h"
+#include "arena.h"
+#include "program_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_DEFAULT_SIZE 65536
+
+typedef struct CacheEntry CacheEntry;
+
+// Bounded LRU table: an open-addressing index over a fixed pool of
+// entries. Not synchronized; give each thread its own cache.
+typedef struct {
+    CacheEntry *entries;
+    uint32_t *slots;        // entry index + 1, 0 marks an empty slot
+    size_t capacity;        // entries; 0 disables the cache
+    size_t slot_mask;
+    size_t count;
+    uint32_t newest;        // head of the recency list
+    uint32_t oldest;        // tail; evicted first
+    ProgramStore *store;    // optional second level shared across runs
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t store_hits;    // misses answered from the store
+} ResultCache;
+
+int result_cache_init(ResultCache *cache, size_t capacity);
+void result_cache_free(ResultCache *cache);
+void result_cache_attach_store(ResultCache *cache, ProgramStore *store);
+size_t cache_normalize(const char *expression, char *out, uint64_t *hash);
+CalcStatus cached_evaluate(ResultCache *cache, const char *expression, Arena *arena,
+                           CalcValue *result, CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // CACHE_H
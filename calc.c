@@ -3,7 +3,6 @@
  * Contains the actual implementation of calculation functions
  */
 
-#include <stdio.h>
 #include "calc.h"
 #include <math.h>
 
@@ -40,17 +39,6 @@ double divide(double a, double b) {
     return a / b;
 }
 
-/*
- * Swap function (pass by reference) - correct implementation using pointers
- * Swaps the values of two double variables using pointer parameters
- */
-void swap(double *a, double *b) {
-    double temp = *a;
-    *a = *b;
-    *b = temp;
-    printf("  [Inside swap] *a = %.2lf, *b = %.2lf\n", *a, *b);
-}
-
 /*
  * Power function
  * Calculates base raised to the power of exponent (base^exponent)
@@ -1,34 +1,156 @@
 /*
  * Calculator Header File
- * Function declarations for calculator operations
+ * Public interface of libcalc: arithmetic helpers and the expression
+ * compiler/evaluator. Nothing in the library reads stdin or writes to
+ * stdout; every failure comes back as a CalcStatus.
  */
 
 #ifndef CALC_H
 #define CALC_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+#include "mathfn.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Basic arithmetic operations
 double add(double a, double b);
 double subtract(double a, double b);
 double multiply(double a, double b);
 double divide(double a, double b);
 
-// Pointer demonstration functions
-void swap(double *a, double *b);
-
 // Scientific calculator functions
 double power(double base, double exponent);
 double square_root(double number);
 double modulo(double a, double b);
 
-void expression_calculator(void);
+// Result of every parse/evaluate call; CALC_OK is zero
+typedef enum {
+    CALC_OK = 0,
+    CALC_ERR_SYNTAX,            // missing operand, stray operand, empty input
+    CALC_ERR_PARENTHESES,       // unbalanced ( or )
+    CALC_ERR_UNKNOWN_CHARACTER,
+    CALC_ERR_DIVISION_BY_ZERO,
+    CALC_ERR_OUT_OF_MEMORY,
+    CALC_ERR_UNBOUND_VARIABLE,  // a variable was given no value
+    CALC_ERR_OVERFLOW,          // result does not fit (fixed-point decimal mode)
+    CALC_ERR_CYCLE              // a workspace cell would depend on itself
+} CalcStatus;
+
+// Filled in when a call fails; the caller decides whether and how to show
+// it, so the library is safe to call from several threads at once
+typedef struct {
+    CalcStatus status;
+    int position;       // byte offset into the input text, -1 if not tied to one
+    char message[64];
+} CalcError;
+
+const char *calc_status_string(CalcStatus status);
+
+// Text-based Shunting Yard pipeline (infix -> postfix string -> value)
+// Error positions from evaluate_postfix() are offsets into the postfix text
+CalcStatus infix_to_postfix(const char *infix, char **postfix, Arena *arena, CalcError *error);
+CalcStatus evaluate_postfix(const char *postfix, Arena *arena, double *result, CalcError *error);
+
+// Compiled expression program
+// compile_expression() runs the Shunting Yard pass once and produces a
+// flat instruction list with pre-parsed constants; evaluate_program() can
+// then run it any number of times without touching the text again.
+// Programs are also saved to disk (program_store.c): bump
+// CALC_BYTECODE_VERSION whenever OpCode or Instruction changes.
+#define CALC_BYTECODE_VERSION 6
+
+typedef enum {
+    OP_PUSH,    // push a constant
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,     // remainder with the sign of the dividend, like fmod()
+    OP_STORE,   // copy the top of the stack into a temporary (no pop)
+    OP_LOAD,    // push a temporary
+    OP_VAR,     // push a variable
+    OP_CALL,    // replace the top arguments with calc_functions[slot] of them
+    OP_REDUCE   // replace the bounds FROM, TO with program->reductions[slot] over them
+} OpCode;
 
-// History record structure
 typedef struct {
-    double num1;
-    double num2;
-    double result;
-    char operator[10];
-} Record;
+    OpCode op;
+    int position;       // offset of the token in the source, for error reports
+    union {
+        double value;   // constant for OP_PUSH
+        int slot;       // temporary for OP_STORE / OP_LOAD, variable for OP_VAR,
+                        // CalcFunctionId for OP_CALL, reduction for OP_REDUCE
+    };
+} Instruction;
+
+typedef struct Reduction Reduction;
+
+typedef struct {
+    Instruction *code;  // lives in the arena passed to compile_expression()
+    int length;
+    int capacity;
+    int max_depth;      // deepest stack the program needs
+    int temp_count;     // temporaries used by OP_STORE / OP_LOAD
+    char **variables;   // identifier of each OP_VAR slot, in order of first use
+    int variable_count;
+    int64_t *integers;  // exact value of each OP_PUSH when the program is
+                        // integer-only (see below), otherwise NULL
+    Reduction *reductions;  // bodies of the program's OP_REDUCE instructions
+    int reduction_count;
+} Program;
+
+// sum(i, FROM, TO, BODY) and product, min, max alike: BODY evaluated for
+// every integer i with FROM <= i <= TO, combined in a fixed order (see
+// reduce.c) so the result does not depend on the number of threads
+typedef enum {
+    REDUCE_SUM,
+    REDUCE_PRODUCT,
+    REDUCE_MIN,
+    REDUCE_MAX
+} ReductionKind;
+
+struct Reduction {
+    ReductionKind kind;
+    int position;           // offset of the name (sum, ...) in the source
+    const char *index_name;
+    Program body;           // error positions are offsets into the whole source
+    int index;              // body variable bound to i, -1 if the body does not use it
+    int *outer;             // outer[v]: variable of the enclosing program that
+                            // body variable v reads (-1 for the index)
+};
+
+// Value of an evaluation. compile_expression() marks programs made only
+// of integer literals (no decimals, exponents or variables) that fit in
+// int64; evaluate_program_value() runs those in exact int64 arithmetic
+// and only falls back to double when a step overflows or a division has
+// a remainder.
+typedef struct {
+    double value;       // always set (the integer, rounded, if is_integer)
+    int64_t integer;    // exact result when is_integer
+    int is_integer;
+} CalcValue;
+
+// A compiled Program is read-only during evaluation, so one program may
+// be evaluated by several threads at once. error may be NULL.
+// Identifiers ([A-Za-z_][A-Za-z0-9_]*) compile to variables; values are
+// supplied per call, indexed like program->variables. An identifier
+// followed by '(' calls one of calc_functions[], e.g. pow(x, 2) + sin(y),
+// or is a reduction, e.g. sum(i, 1, n, 1 / (i * i)).
+CalcStatus compile_expression(const char *infix, Program *program, Arena *arena, CalcError *error);
+CalcStatus evaluate_program(const Program *program, double *result, CalcError *error);
+CalcStatus evaluate_program_with(const Program *program, const double *variables, double *result,
+                                 CalcError *error);
+CalcStatus evaluate_program_value(const Program *program, CalcValue *result, CalcError *error);
+int program_variable_index(const Program *program, const char *name);
+void program_to_postfix(const Program *program, char *buffer, size_t size);
 
+#ifdef __cplusplus
+}
+#endif
 
 #endif  // CALC_H
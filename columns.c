@@ -0,0 +1,386 @@
+/*
+ * Column Mode Implementation File
+ *
+ *   cli_calculator --columns prices.csv "price * qty * (1 - discount)"
+ *
+ * The first line of the CSV file names the columns. Every identifier in
+ * the expression must name one of them; the other columns are skipped
+ * without being parsed. The expression is compiled and optimized once,
+ * the referenced columns are loaded into one array each, and
+ * evaluate_columns() computes all rows block by block. The output has
+ * one line per data row, like --batch.
+ *
+ * With --jit the expression is compiled to native code instead (see
+ * jit.c); where that is not possible the vector evaluator is used.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "format.h"
+#include "numparse.h"
+#include "optimizer.h"
+#include "program_store.h"
+#include "vector_eval.h"
+#include "register_vm.h"
+#include "jit.h"
+#include "columns.h"
+
+#define COLUMNS_OUTPUT_BUFFER (1 << 20)
+#define COLUMNS_INITIAL_ROWS 4096
+
+typedef struct {
+    double **values;    // values[v]: the column bound to program variable v
+    int *field_of;      // CSV field index of each variable
+    char **names;       // the program's variable names
+    int variable_count;
+    size_t rows;
+    size_t capacity;
+} ColumnData;
+
+static char *read_file(const char *path, size_t *length) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+    size_t capacity = 1 << 16;
+    size_t used = 0;
+    char *data = malloc(capacity);
+    while (data != NULL) {
+        if (capacity - used < 2) {
+            char *grown = realloc(data, capacity * 2);
+            if (grown == NULL) {
+                free(data);
+                data = NULL;
+                break;
+            }
+            data = grown;
+            capacity *= 2;
+        }
+        size_t n = fread(data + used, 1, capacity - used - 1, file);
+        used += n;
+        if (n == 0) {
+            data[used] = '\0';
+            *length = used;
+            break;
+        }
+    }
+    fclose(file);
+    return data;
+}
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+/*
+ * Find which field of the header line each program variable names
+ * Returns: 1 on success, 0 (after printing why) if a variable has no column
+ */
+static int bind_header(const char *line, const char *end, const Program *program,
+                       ColumnData *data) {
+    for (int v = 0; v < program->variable_count; v++) {
+        data->field_of[v] = -1;
+    }
+
+    int field = 0;
+    const char *p = line;
+    for (;;) {
+        while (p < end && is_blank(*p)) {
+            p++;
+        }
+        const char *name = p;
+        while (p < end && *p != ',') {
+            p++;
+        }
+        const char *name_end = p;
+        while (name_end > name && is_blank(name_end[-1])) {
+            name_end--;
+        }
+        int v = 0;
+        for (; v < program->variable_count; v++) {
+            const char *variable = program->variables[v];
+            if (strlen(variable) == (size_t)(name_end - name) &&
+                memcmp(variable, name, (size_t)(name_end - name)) == 0) {
+                break;
+            }
+        }
+        if (v < program->variable_count && data->field_of[v] < 0) {
+            data->field_of[v] = field;
+        }
+        if (p >= end) {
+            break;
+        }
+        p++;
+        field++;
+    }
+
+    for (int v = 0; v < program->variable_count; v++) {
+        if (data->field_of[v] < 0) {
+            fprintf(stderr, "Error: No column named '%s'\n", program->variables[v]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int grow_columns(ColumnData *data) {
+    size_t capacity = data->capacity == 0 ? COLUMNS_INITIAL_ROWS : data->capacity * 2;
+    for (int v = 0; v < data->variable_count; v++) {
+        double *grown = realloc(data->values[v], capacity * sizeof(double));
+        if (grown == NULL) {
+            return 0;
+        }
+        data->values[v] = grown;
+    }
+    data->capacity = capacity;
+    return 1;
+}
+
+/*
+ * Parse one signed number filling the whole field [p, end)
+ * Returns: 1 on success, 0 if the field is not a number
+ */
+static int parse_cell(const char *p, const char *end, double *value) {
+    while (p < end && is_blank(*p)) {
+        p++;
+    }
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    const char *after = p < end ? scan_number(p, value) : NULL;
+    if (after == NULL || after > end) {
+        return 0;
+    }
+    while (after < end && is_blank(*after)) {
+        after++;
+    }
+    if (after != end) {
+        return 0;
+    }
+    if (negative) {
+        *value = -*value;
+    }
+    return 1;
+}
+
+/*
+ * Load the bound fields of every data line into data->values
+ * Returns: 1 on success, 0 (after printing why) on a bad cell
+ */
+static int load_rows(const char *text, const char *text_end, ColumnData *data) {
+    int max_field = -1;
+    for (int v = 0; v < data->variable_count; v++) {
+        if (data->field_of[v] > max_field) {
+            max_field = data->field_of[v];
+        }
+    }
+
+    size_t line_number = 1;
+    const char *line = text;
+    while (line < text_end) {
+        const char *end = memchr(line, '\n', (size_t)(text_end - line));
+        if (end == NULL) {
+            end = text_end;
+        }
+        line_number++;
+
+        const char *last = end;
+        while (last > line && is_blank(last[-1])) {
+            last--;
+        }
+        if (last == line) {     // blank lines are not rows
+            line = end + 1;
+            continue;
+        }
+        if (data->rows == data->capacity && !grow_columns(data)) {
+            fprintf(stderr, "Error: Out of memory\n");
+            return 0;
+        }
+
+        // Walk the fields once, parsing only the ones that are bound
+        // A missing field (short line) parses like an empty one: an error
+        const char *field_start = line;
+        for (int field = 0; field <= max_field; field++) {
+            const char *field_end = last;
+            if (field_start < last) {
+                const char *comma = memchr(field_start, ',', (size_t)(last - field_start));
+                if (comma != NULL) {
+                    field_end = comma;
+                }
+            } else {
+                field_start = last;
+            }
+            for (int v = 0; v < data->variable_count; v++) {
+                if (data->field_of[v] == field &&
+                    !parse_cell(field_start, field_end, &data->values[v][data->rows])) {
+                    fprintf(stderr, "Error: Line %zu: Value of '%s' is not a number\n",
+                            line_number, data->names[v]);
+                    return 0;
+                }
+            }
+            field_start = field_end + 1;
+        }
+        data->rows++;
+        line = end + 1;
+    }
+    return 1;
+}
+
+static void free_columns(ColumnData *data) {
+    for (int v = 0; v < data->variable_count; v++) {
+        free(data->values[v]);
+    }
+    free(data->values);
+    free(data->field_of);
+}
+
+/*
+ * Compile expression, through the program store at store_path when one
+ * is given so that a formula compiled by an earlier run is not parsed
+ * again. A store that cannot be opened only costs the warm start.
+ * Returns: the status of compile_expression()
+ */
+static CalcStatus compile_with_store(const char *expression, const char *store_path,
+                                     Program *program, Arena *arena, CalcError *error) {
+    ProgramStore store;
+    if (store_path == NULL) {
+        return compile_expression(expression, program, arena, error);
+    }
+    if (!program_store_open(&store, store_path)) {
+        fprintf(stderr, "Warning: Could not open program store '%s'\n", store_path);
+        return compile_expression(expression, program, arena, error);
+    }
+    // The program is copied into arena, so the store can be closed at once
+    CalcStatus status = program_store_compile(&store, expression, program, arena, error, NULL);
+    program_store_close(&store);
+    return status;
+}
+
+/*
+ * Handle "cli_calculator --columns FILE EXPRESSION [--precision N] [--jit]
+ *                                  [--store FILE]"
+ * Returns: process exit status
+ */
+int columns_main(int argc, char *argv[]) {
+    const char *path = NULL;
+    const char *expression = NULL;
+    const char *store_path = NULL;
+    int precision = FORMAT_SHORTEST;
+    int use_jit = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--jit") == 0) {
+            use_jit = 1;
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store_path = argv[++i];
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            precision = atoi(argv[++i]);
+            if (precision < 0 || precision > FORMAT_MAX_PRECISION) {
+                printf("Error: Precision must be between 0 and %d\n", FORMAT_MAX_PRECISION);
+                return 1;
+            }
+        } else if (path == NULL) {
+            path = argv[i];
+        } else if (expression == NULL) {
+            expression = argv[i];
+        } else {
+            path = NULL;
+            break;
+        }
+    }
+    if (path == NULL || expression == NULL) {
+        printf("Usage: %s --columns FILE.csv EXPRESSION [--precision N] [--jit]\n"
+               "       [--store FILE]\n", argv[0]);
+        return 1;
+    }
+
+    Arena arena;
+    Program compiled, program;
+    CalcError error;
+    arena_init(&arena);
+    if (compile_with_store(expression, store_path, &compiled, &arena, &error) != CALC_OK ||
+        optimize_program(&compiled, &program, &arena, 0, &error) != CALC_OK) {
+        printf("Error: %s\n", error.message);
+        arena_free(&arena);
+        return 1;
+    }
+
+    RegisterProgram registers;
+    JitCode *jit = NULL;
+    if (use_jit && compile_registers(&program, &registers, &arena, &error) == CALC_OK) {
+        jit = jit_compile(&registers);
+    }
+
+    size_t length;
+    char *text = read_file(path, &length);
+    if (text == NULL) {
+        fprintf(stderr, "Error: Cannot read '%s'\n", path);
+        jit_free(jit);
+        arena_free(&arena);
+        return 1;
+    }
+
+    ColumnData data = { 0 };
+    data.variable_count = program.variable_count;
+    data.names = program.variables;
+    data.values = calloc((size_t)program.variable_count + 1, sizeof(double *));
+    data.field_of = calloc((size_t)program.variable_count + 1, sizeof(int));
+    int status = 1;
+    const char *text_end = text + length;
+    const char *header_end = memchr(text, '\n', length);
+    if (header_end == NULL) {
+        header_end = text_end;
+    }
+
+    double *results = NULL;
+    unsigned char *row_status = NULL;
+    OutputBuffer output = { 0 };
+    if (data.values == NULL || data.field_of == NULL) {
+        fprintf(stderr, "Error: Out of memory\n");
+    } else if (bind_header(text, header_end, &program, &data) &&
+               load_rows(header_end < text_end ? header_end + 1 : text_end, text_end, &data)) {
+        results = malloc((data.rows + 1) * sizeof(double));
+        row_status = malloc(data.rows + 1);
+        if (results == NULL || row_status == NULL ||
+            !output_init(&output, stdout, COLUMNS_OUTPUT_BUFFER)) {
+            fprintf(stderr, "Error: Out of memory\n");
+        } else if ((jit != NULL
+                        ? jit_evaluate_columns(jit, &registers, (const double *const *)data.values,
+                                               data.rows, results, row_status, &error)
+                        : evaluate_columns(&program, (const double *const *)data.values,
+                                           data.rows, results, row_status, &error)) != CALC_OK) {
+            printf("Error: %s\n", error.message);
+        } else {
+            for (size_t r = 0; r < data.rows; r++) {
+                if (row_status[r] != CALC_OK) {
+                    const char *message = calc_status_string((CalcStatus)row_status[r]);
+                    output_write(&output, "Error: ", 7);
+                    output_write(&output, message, strlen(message));
+                    output_write(&output, "\n", 1);
+                    continue;
+                }
+                output_double(&output, results[r], precision);
+                output_write(&output, "\n", 1);
+            }
+            status = 0;
+        }
+    }
+
+    if (output.data != NULL) {
+        output_free(&output);
+    }
+    free(results);
+    free(row_status);
+    free_columns(&data);
+    free(text);
+    jit_free(jit);
+    arena_free(&arena);
+    return status;
+}
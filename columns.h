@@ -0,0 +1,11 @@
+/*
+ * Column Mode Header File
+ * Evaluates one expression for every row of a CSV file
+ */
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+int columns_main(int argc, char *argv[]);
+
+#endif  // COLUMNS_H
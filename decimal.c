@@ -0,0 +1,505 @@
+/*
+ * Decimal Mode Implementation File
+ *
+ * In double, 0.1 + 0.2 is 0.30000000000000004, which is fine for
+ * science and wrong for money. In decimal mode every number is a signed
+ * 128-bit count of 10^-scale units:
+ *
+ *   scale 2:   19.99 * 3  ->  1999 * 300 / 100 = 5997    (59.97)
+ *              0.1 + 0.2  ->  10 + 20 = 30               (0.30)
+ *
+ * Addition, subtraction and remainder of two such integers are exact.
+ * A product or quotient has digits beyond the scale; it is computed
+ * exactly (products in 256 bits, quotients with their remainder) and
+ * rounded once, with the context's rounding mode, so every operator
+ * gives the correctly rounded result. Literals are converted from their
+ * text the same way, never through double. A result of more than
+ * 2^127 - 1 units is CALC_ERR_OVERFLOW; nothing wraps around.
+ *
+ * Most operands in practice are below 2^64 units, so the common case is
+ * one 64x64->128 multiply and one division, which keeps decimal mode
+ * within a few times the speed of evaluate_program() (see calc_bench).
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decimal.h"
+
+#define DECIMAL_STACK_LOCAL 64
+
+typedef unsigned __int128 Unsigned128;
+
+#define DECIMAL_MAX_MAGNITUDE (~(Unsigned128)0 >> 1)
+
+static CalcStatus decimal_error(CalcError *error, CalcStatus status, int position,
+                                const char *message) {
+    if (error != NULL) {
+        error->status = status;
+        error->position = position;
+        snprintf(error->message, sizeof(error->message), "%s", message);
+    }
+    return status;
+}
+
+static Unsigned128 magnitude(CalcDecimal value) {
+    return value < 0 ? -(Unsigned128)value : (Unsigned128)value;
+}
+
+/*
+ * Whether a truncated result must move one unit away from zero
+ * compare is the discarded part against half a unit (<0, 0, >0),
+ * inexact whether anything was discarded, odd the last kept digit's parity
+ */
+static int round_away(DecimalRounding rounding, int compare, int inexact, int odd, int negative) {
+    switch (rounding) {
+        case DECIMAL_HALF_EVEN: return compare > 0 || (compare == 0 && odd);
+        case DECIMAL_HALF_UP:   return compare >= 0;
+        case DECIMAL_DOWN:      return 0;
+        case DECIMAL_UP:        return inexact;
+        case DECIMAL_FLOOR:     return inexact && negative;
+        case DECIMAL_CEILING:   return inexact && !negative;
+    }
+    return 0;
+}
+
+/*
+ * Round quotient + remainder / divisor to an integer and apply the sign
+ * The divisor is at most 2^127, so twice the remainder cannot overflow.
+ * Returns: 1, or 0 if the result does not fit
+ */
+static int round_quotient(Unsigned128 quotient, Unsigned128 remainder, Unsigned128 divisor,
+                          int negative, DecimalRounding rounding, CalcDecimal *result) {
+    Unsigned128 twice = remainder << 1;
+    int compare = twice < divisor ? -1 : twice > divisor;
+    if (quotient > DECIMAL_MAX_MAGNITUDE) {
+        return 0;
+    }
+    quotient += (Unsigned128)round_away(rounding, compare, remainder != 0, (int)(quotient & 1),
+                                        negative);
+    if (quotient > DECIMAL_MAX_MAGNITUDE) {
+        return 0;
+    }
+    *result = negative ? -(CalcDecimal)quotient : (CalcDecimal)quotient;
+    return 1;
+}
+
+/*
+ * Divide the little-endian 64-bit limbs of a number by divisor in place
+ * Returns: the remainder
+ */
+static uint64_t divide_limbs(uint64_t *limbs, int count, uint64_t divisor) {
+    uint64_t remainder = 0;
+    for (int i = count - 1; i >= 0; i--) {
+        Unsigned128 current = ((Unsigned128)remainder << 64) | limbs[i];
+        limbs[i] = (uint64_t)(current / divisor);
+        remainder = (uint64_t)(current % divisor);
+    }
+    return remainder;
+}
+
+/*
+ * a * b / unit, rounded
+ * Returns: 1, or 0 on overflow
+ */
+static int decimal_multiply(CalcDecimal a, CalcDecimal b, uint64_t unit, DecimalRounding rounding,
+                            CalcDecimal *result) {
+    int negative = (a < 0) != (b < 0);
+    Unsigned128 x = magnitude(a);
+    Unsigned128 y = magnitude(b);
+
+    if ((x >> 64) == 0 && (y >> 64) == 0) {
+        Unsigned128 product = x * y;
+        if ((product >> 64) == 0) {
+            uint64_t small = (uint64_t)product;
+            return round_quotient(small / unit, small % unit, unit, negative, rounding, result);
+        }
+        Unsigned128 quotient = product / unit;
+        return round_quotient(quotient, product - quotient * unit, unit, negative, rounding,
+                              result);
+    }
+
+    // Full 256-bit product from four 64x64 partial products
+    uint64_t x0 = (uint64_t)x, x1 = (uint64_t)(x >> 64);
+    uint64_t y0 = (uint64_t)y, y1 = (uint64_t)(y >> 64);
+    Unsigned128 p00 = (Unsigned128)x0 * y0;
+    Unsigned128 p01 = (Unsigned128)x0 * y1;
+    Unsigned128 p10 = (Unsigned128)x1 * y0;
+    Unsigned128 p11 = (Unsigned128)x1 * y1;
+    Unsigned128 middle = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+    Unsigned128 high = (middle >> 64) + (p01 >> 64) + (p10 >> 64) + (uint64_t)p11;
+    uint64_t limbs[4];
+    limbs[0] = (uint64_t)p00;
+    limbs[1] = (uint64_t)middle;
+    limbs[2] = (uint64_t)high;
+    limbs[3] = (uint64_t)((high >> 64) + (p11 >> 64));
+
+    uint64_t remainder = divide_limbs(limbs, 4, unit);
+    if (limbs[3] != 0 || limbs[2] != 0) {
+        return 0;
+    }
+    Unsigned128 quotient = ((Unsigned128)limbs[1] << 64) | limbs[0];
+    return round_quotient(quotient, remainder, unit, negative, rounding, result);
+}
+
+/*
+ * a * unit / b, rounded; b is not zero
+ * Returns: 1, or 0 on overflow
+ */
+static int decimal_divide(CalcDecimal a, CalcDecimal b, uint64_t unit, DecimalRounding rounding,
+                          CalcDecimal *result) {
+    int negative = (a < 0) != (b < 0);
+    Unsigned128 x = magnitude(a);
+    Unsigned128 y = magnitude(b);
+
+    if ((x >> 64) == 0) {
+        Unsigned128 numerator = x * unit;
+        if ((numerator >> 64) == 0 && (y >> 64) == 0) {
+            uint64_t small = (uint64_t)numerator;
+            uint64_t divisor = (uint64_t)y;
+            return round_quotient(small / divisor, small % divisor, divisor, negative, rounding,
+                                  result);
+        }
+        Unsigned128 quotient = numerator / y;
+        return round_quotient(quotient, numerator - quotient * y, y, negative, rounding, result);
+    }
+
+    // 192-bit numerator
+    Unsigned128 low = (Unsigned128)(uint64_t)x * unit;
+    Unsigned128 high = (Unsigned128)(uint64_t)(x >> 64) * unit + (low >> 64);
+    uint64_t limbs[3] = { (uint64_t)low, (uint64_t)high, (uint64_t)(high >> 64) };
+
+    if ((y >> 64) == 0) {
+        uint64_t remainder = divide_limbs(limbs, 3, (uint64_t)y);
+        if (limbs[2] != 0) {
+            return 0;
+        }
+        Unsigned128 quotient = ((Unsigned128)limbs[1] << 64) | limbs[0];
+        return round_quotient(quotient, remainder, y, negative, rounding, result);
+    }
+
+    // Both wide: shift-subtract long division. The divisor is at least
+    // 2^64, so the quotient fits in 128 bits, and the remainder stays
+    // below the divisor (at most 2^127), so shifting it cannot overflow.
+    Unsigned128 quotient = 0;
+    Unsigned128 remainder = 0;
+    for (int bit = 191; bit >= 0; bit--) {
+        remainder = (remainder << 1) | ((limbs[bit / 64] >> (bit % 64)) & 1);
+        quotient <<= 1;
+        if (remainder >= y) {
+            remainder -= y;
+            quotient |= 1;
+        }
+    }
+    return round_quotient(quotient, remainder, y, negative, rounding, result);
+}
+
+/*
+ * Convert number text to a scaled decimal
+ * Accepts what scan_number() accepts (digits, an optional point, an
+ * optional exponent that is only used if digits follow it), with an
+ * optional leading sign. Digits past the scale are rounded with the
+ * context's rounding mode.
+ * Returns: CALC_OK, CALC_ERR_SYNTAX if text does not start with a number,
+ *          or CALC_ERR_OVERFLOW
+ */
+CalcStatus parse_decimal(const char *text, const DecimalContext *context, CalcDecimal *value,
+                         const char **end) {
+    const char *p = text;
+    int negative = 0;
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        p++;
+    }
+
+    const char *digits = p;
+    long integer_digits = 0;
+    long total_digits = 0;
+    while (isdigit((unsigned char)*p)) {
+        p++;
+        integer_digits++;
+    }
+    total_digits = integer_digits;
+    if (*p == '.' && (integer_digits > 0 || isdigit((unsigned char)p[1]))) {
+        p++;
+        while (isdigit((unsigned char)*p)) {
+            p++;
+            total_digits++;
+        }
+    }
+    if (total_digits == 0) {
+        *end = text;
+        return CALC_ERR_SYNTAX;
+    }
+    const char *digits_end = p;
+
+    long exponent = 0;
+    if (*p == 'e' || *p == 'E') {
+        const char *q = p + 1;
+        int exponent_negative = 0;
+        if (*q == '+' || *q == '-') {
+            exponent_negative = *q == '-';
+            q++;
+        }
+        if (isdigit((unsigned char)*q)) {
+            while (isdigit((unsigned char)*q)) {
+                if (exponent < 1000000) {
+                    exponent = exponent * 10 + (*q - '0');
+                }
+                q++;
+            }
+            exponent = exponent_negative ? -exponent : exponent;
+            p = q;
+        }
+    }
+    *end = p;
+
+    // Digit k (counting from the first, skipping the point) is worth
+    // 10^(integer_digits - 1 - k + exponent); in units that is one more
+    // factor 10^scale, so the first keep digits form the integer part
+    long keep = integer_digits + exponent + context->scale;
+    Unsigned128 units = 0;
+    int first_dropped = 0;
+    int sticky = 0;
+    long k = 0;
+    for (const char *c = digits; c < digits_end; c++) {
+        if (*c == '.') {
+            continue;
+        }
+        int digit = *c - '0';
+        if (k < keep) {
+            if (units > (DECIMAL_MAX_MAGNITUDE - (Unsigned128)digit) / 10) {
+                return CALC_ERR_OVERFLOW;
+            }
+            units = units * 10 + (Unsigned128)digit;
+        } else if (k == keep) {
+            first_dropped = digit;
+        } else {
+            sticky |= digit != 0;
+        }
+        k++;
+    }
+    for (; k < keep && units != 0; k++) {
+        if (units > DECIMAL_MAX_MAGNITUDE / 10) {
+            return CALC_ERR_OVERFLOW;
+        }
+        units *= 10;
+    }
+
+    int compare = first_dropped != 5 ? (first_dropped > 5 ? 1 : -1) : sticky;
+    units += (Unsigned128)round_away(context->rounding, compare, first_dropped != 0 || sticky,
+                                     (int)(units & 1), negative);
+    if (units > DECIMAL_MAX_MAGNITUDE) {
+        return CALC_ERR_OVERFLOW;
+    }
+    *value = negative ? -(CalcDecimal)units : (CalcDecimal)units;
+    return CALC_OK;
+}
+
+/*
+ * Prepare program for decimal evaluation
+ * Every constant is converted from its literal in infix. The output
+ * lives in arena and refers to program, which must outlive it.
+ * Returns: CALC_OK, CALC_ERR_OVERFLOW (a literal or the scale is too
+ *          large), CALC_ERR_SYNTAX (a function call: sqrt, sin and the
+ *          rest have no exact decimal result; or a reduction, which runs
+ *          in double) or CALC_ERR_OUT_OF_MEMORY
+ */
+CalcStatus compile_decimal(const char *infix, const Program *program,
+                           const DecimalContext *context, DecimalProgram *output, Arena *arena,
+                           CalcError *error) {
+    if (context->scale < 0 || context->scale > DECIMAL_MAX_SCALE) {
+        return decimal_error(error, CALC_ERR_OVERFLOW, -1, "Scale out of range");
+    }
+    CalcDecimal *constants = arena_alloc(arena, (size_t)(program->length + 1) * sizeof(CalcDecimal));
+    if (constants == NULL) {
+        return decimal_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    }
+
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        constants[pc] = 0;
+        if (ins->op == OP_CALL) {
+            return decimal_error(error, CALC_ERR_SYNTAX, ins->position,
+                                 "Functions are not available in decimal mode");
+        }
+        if (ins->op == OP_REDUCE) {
+            return decimal_error(error, CALC_ERR_SYNTAX, ins->position,
+                                 "Reductions are not available in decimal mode");
+        }
+        if (ins->op == OP_PUSH) {
+            const char *end;
+            CalcStatus status = parse_decimal(infix + ins->position, context, &constants[pc], &end);
+            if (status != CALC_OK) {
+                return decimal_error(error, status, ins->position,
+                                     status == CALC_ERR_OVERFLOW ? "Number out of range"
+                                                                 : "Invalid number");
+            }
+        }
+    }
+
+    uint64_t unit = 1;
+    for (int i = 0; i < context->scale; i++) {
+        unit *= 10;
+    }
+    output->program = program;
+    output->constants = constants;
+    output->context = *context;
+    output->unit = unit;
+    return CALC_OK;
+}
+
+/*
+ * Run a decimal program
+ * Same structure as the int64 loop in expression_parser.c: the top of
+ * the stack is kept in a local, so each operator reads one operand from
+ * memory.
+ * Returns: CALC_OK (result written to *result), or the reason for failure
+ */
+CalcStatus evaluate_decimal(const DecimalProgram *decimal, const CalcDecimal *variables,
+                            CalcDecimal *result, CalcError *error) {
+    const Program *program = decimal->program;
+    CalcDecimal local_stack[DECIMAL_STACK_LOCAL];
+    CalcDecimal *stack = local_stack;  // values below the top
+    CalcDecimal top_value = 0;
+    int top = -1;
+    CalcStatus status = CALC_OK;
+    int needed = program->max_depth + program->temp_count;
+
+    if (program->variable_count > 0 && variables == NULL) {
+        return decimal_error(error, CALC_ERR_UNBOUND_VARIABLE, -1, "Unbound variable");
+    }
+    if (needed > DECIMAL_STACK_LOCAL) {
+        stack = malloc((size_t)needed * sizeof(CalcDecimal));
+        if (stack == NULL) {
+            return decimal_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+    }
+    CalcDecimal *temps = stack + program->max_depth;
+    const CalcDecimal *constants = decimal->constants;
+    uint64_t unit = decimal->unit;
+    DecimalRounding rounding = decimal->context.rounding;
+
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        CalcDecimal a;
+        int fits = 1;
+        switch (ins->op) {
+            case OP_PUSH:
+                stack[++top] = top_value;
+                top_value = constants[pc];
+                break;
+            case OP_ADD:
+                fits = !__builtin_add_overflow(stack[top--], top_value, &top_value);
+                break;
+            case OP_SUB:
+                fits = !__builtin_sub_overflow(stack[top--], top_value, &top_value);
+                break;
+            case OP_MUL:
+                fits = decimal_multiply(stack[top--], top_value, unit, rounding, &top_value);
+                break;
+            case OP_DIV:
+            case OP_MOD:
+                a = stack[top--];
+                if (top_value == 0) {
+                    status = decimal_error(error, CALC_ERR_DIVISION_BY_ZERO, ins->position,
+                                           "Division by zero");
+                    pc = program->length;
+                } else if (ins->op == OP_DIV) {
+                    fits = decimal_divide(a, top_value, unit, rounding, &top_value);
+                } else {
+                    // Exact, with the sign of the dividend like fmod();
+                    // MIN % -1 would trap
+                    top_value = top_value == -1 ? 0 : a % top_value;
+                }
+                break;
+            case OP_STORE:
+                temps[ins->slot] = top_value;
+                break;
+            case OP_LOAD:
+                stack[++top] = top_value;
+                top_value = temps[ins->slot];
+                break;
+            case OP_VAR:
+                stack[++top] = top_value;
+                top_value = variables[ins->slot];
+                break;
+            case OP_CALL:
+            case OP_REDUCE:
+                break;      // rejected by compile_decimal()
+        }
+        if (!fits) {
+            status = decimal_error(error, CALC_ERR_OVERFLOW, ins->position, "Result out of range");
+            break;
+        }
+    }
+
+    if (status == CALC_OK) {
+        *result = top_value;
+    }
+    if (stack != local_stack) {
+        free(stack);
+    }
+    return status;
+}
+
+/*
+ * Write value with exactly scale digits after the point, e.g. "-12.50"
+ * out must hold DECIMAL_BUFFER_SIZE characters.
+ * Returns: length of the text
+ */
+int format_decimal(CalcDecimal value, int scale, char *out) {
+    char digits[DECIMAL_BUFFER_SIZE];
+    int count = 0;
+    Unsigned128 units = magnitude(value);
+
+    // Peel digits off in 128-bit arithmetic only while they need it
+    while ((units >> 64) != 0) {
+        digits[count++] = (char)('0' + (int)(units % 10));
+        units /= 10;
+    }
+    uint64_t low = (uint64_t)units;
+    do {
+        digits[count++] = (char)('0' + (int)(low % 10));
+        low /= 10;
+    } while (low != 0 || count <= scale);
+
+    int length = 0;
+    if (value < 0) {
+        out[length++] = '-';
+    }
+    while (count > 0) {
+        if (count == scale) {
+            out[length++] = '.';
+        }
+        out[length++] = digits[--count];
+    }
+    out[length] = '\0';
+    return length;
+}
+
+/*
+ * Look up a rounding mode by its command line name
+ * Returns: 1 if name is one of half-even, half-up, down, up, floor, ceiling
+ */
+int decimal_rounding_from_name(const char *name, DecimalRounding *rounding) {
+    static const struct {
+        const char *name;
+        DecimalRounding rounding;
+    } modes[] = {
+        { "half-even", DECIMAL_HALF_EVEN },
+        { "half-up", DECIMAL_HALF_UP },
+        { "down", DECIMAL_DOWN },
+        { "up", DECIMAL_UP },
+        { "floor", DECIMAL_FLOOR },
+        { "ceiling", DECIMAL_CEILING },
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        if (strcmp(name, modes[i].name) == 0) {
+            *rounding = modes[i].rounding;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * Decimal Mode Header File
+ * Evaluates a compiled Program in exact fixed-point decimal arithmetic
+ */
+
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#include "calc.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Digits after the decimal point; 10^scale must fit in 64 bits
+#define DECIMAL_MAX_SCALE 18
+// Longest text format_decimal() writes, with sign, point and NUL
+#define DECIMAL_BUFFER_SIZE 48
+
+// A decimal is the integer value * 10^scale, so with scale 2 the number
+// 12.34 is stored as 1234. Needs a compiler with __int128 (GCC, Clang).
+typedef __int128 CalcDecimal;
+
+// What to do with the digits past the scale, of literals and of every
+// product and quotient
+typedef enum {
+    DECIMAL_HALF_EVEN,  // to nearest, ties to the even digit (default)
+    DECIMAL_HALF_UP,    // to nearest, ties away from zero
+    DECIMAL_DOWN,       // toward zero (truncate)
+    DECIMAL_UP,         // away from zero
+    DECIMAL_FLOOR,      // toward -infinity
+    DECIMAL_CEILING     // toward +infinity
+} DecimalRounding;
+
+typedef struct {
+    int scale;                  // 0 .. DECIMAL_MAX_SCALE
+    DecimalRounding rounding;
+} DecimalContext;
+
+typedef struct {
+    const Program *program;
+    CalcDecimal *constants;     // scaled value of each OP_PUSH, indexed by pc
+    DecimalContext context;
+    uint64_t unit;              // 10^scale, the scaled value of 1
+} DecimalProgram;
+
+// Literals are read again from infix, digit by digit, so 0.1 is exactly
+// one tenth; program must come straight from compile_expression(infix)
+// (the optimizer folds constants in double).
+CalcStatus compile_decimal(const char *infix, const Program *program,
+                           const DecimalContext *context, DecimalProgram *output, Arena *arena,
+                           CalcError *error);
+// A compiled DecimalProgram is read-only during evaluation and may be
+// shared between threads. variables may be NULL if there are none.
+CalcStatus evaluate_decimal(const DecimalProgram *program, const CalcDecimal *variables,
+                            CalcDecimal *result, CalcError *error);
+
+// Number text (optional sign, digits, point, exponent) to a scaled value;
+// *end is set past the last character used
+CalcStatus parse_decimal(const char *text, const DecimalContext *context, CalcDecimal *value,
+                         const char **end);
+int format_decimal(CalcDecimal value, int scale, char *out);
+int decimal_rounding_from_name(const char *name, DecimalRounding *rounding);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // DECIMAL_H
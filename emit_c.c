@@ -0,0 +1,337 @@
+/*
+ * C Code Generation Implementation File
+ *
+ *   cli_calculator --emit-c "price * qty * (1 - discount)" --name order_total
+ *
+ * The expression goes through the usual compiler and the optimizer, and
+ * the optimized program is printed as two C functions: one that
+ * evaluates a single set of values,
+ *
+ *   static inline int order_total(double price, double qty, double discount,
+ *                                 double *result)
+ *
+ * and one that evaluates whole arrays, written as a plain loop without
+ * branches so that the C compiler can vectorize it:
+ *
+ *   static inline size_t order_total_array(const double *restrict price, ...,
+ *                                          double *restrict results,
+ *                                          unsigned char *restrict errors,
+ *                                          size_t n)
+ *
+ * Every operator becomes one statement in the program's evaluation order
+ * and every constant is printed in shortest round-trip form, so the
+ * generated code computes exactly what the calculator computes, division
+ * by zero included. (It must be compiled without floating-point
+ * contraction, which the generated file reminds its reader of.)
+ * sqrt() is correctly rounded everywhere and comes from <math.h>. The
+ * other functions become calls of libcalc's own calc_pow(), calc_exp()
+ * and so on, rather than of libm, whose last bits differ. They are
+ * declared at the top of the file, whose header comment then says that
+ * it is not standalone and must be linked with libcalc (-lcalc -lm).
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "format.h"
+#include "optimizer.h"
+#include "emit_c.h"
+
+#define EMIT_NAME_SIZE 64
+#define EMIT_OPERAND_SIZE 96
+
+// Names C code cannot use for a parameter or function (generated locals
+// use the calc_ prefix, which variables therefore may not have)
+static const char *const c_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double",
+    "else", "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long",
+    "register", "restrict", "return", "short", "signed", "sizeof", "static", "struct",
+    "switch", "typedef", "union", "unsigned", "void", "volatile", "while", "result",
+    "results", "errors", "n", "size_t", "NAN", "INFINITY"
+};
+
+static int is_keyword(const char *name) {
+    for (size_t i = 0; i < sizeof(c_keywords) / sizeof(c_keywords[0]); i++) {
+        if (strcmp(name, c_keywords[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int is_c_identifier(const char *name) {
+    if (!((name[0] >= 'a' && name[0] <= 'z') || (name[0] >= 'A' && name[0] <= 'Z') ||
+          name[0] == '_')) {
+        return 0;
+    }
+    for (const char *p = name; *p != '\0'; p++) {
+        if (!((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') ||
+              (*p >= '0' && *p <= '9') || *p == '_')) {
+            return 0;
+        }
+    }
+    return strlen(name) < EMIT_NAME_SIZE;
+}
+
+/*
+ * Write a constant as a C double literal that reads back exactly
+ */
+static void format_constant(double value, char *out, size_t size) {
+    char digits[FORMAT_BUFFER_SIZE];
+    if (isnan(value)) {
+        snprintf(out, size, "NAN");
+        return;
+    }
+    if (isinf(value)) {
+        snprintf(out, size, value < 0 ? "(-INFINITY)" : "INFINITY");
+        return;
+    }
+    format_shortest(value, digits);
+    const char *suffix = strpbrk(digits, ".e") != NULL ? "" : ".0";
+    if (value < 0 || (value == 0 && signbit(value))) {
+        snprintf(out, size, "(%s%s)", digits, suffix);
+    } else {
+        snprintf(out, size, "%s%s", digits, suffix);
+    }
+}
+
+/*
+ * Operand text for each stack entry: a constant, a variable (or, in the
+ * array version, its element), or a calc_tN local
+ */
+typedef struct {
+    char (*stack)[EMIT_OPERAND_SIZE];
+    char (*temps)[EMIT_OPERAND_SIZE];
+} OperandNames;
+
+/*
+ * Print one statement per operator of program
+ * indent is the line prefix; element is "" for scalars or "[calc_i]".
+ * Divisors equal to zero return -1 (scalar) or are collected in
+ * calc_zero (array).
+ */
+static void emit_body(const Program *program, OperandNames *names, const char *indent,
+                      int array, FILE *out) {
+    static const char op_chars[] = { 0, '+', '-', '*', '/' };
+    int top = -1;
+    int next_local = 0;
+
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        switch (ins->op) {
+            case OP_PUSH:
+                format_constant(ins->value, names->stack[++top], EMIT_OPERAND_SIZE);
+                break;
+            case OP_VAR:
+                snprintf(names->stack[++top], EMIT_OPERAND_SIZE, "%s%s",
+                         program->variables[ins->slot], array ? "[calc_i]" : "");
+                break;
+            case OP_STORE:
+                memcpy(names->temps[ins->slot], names->stack[top], EMIT_OPERAND_SIZE);
+                break;
+            case OP_LOAD:
+                memcpy(names->stack[++top], names->temps[ins->slot], EMIT_OPERAND_SIZE);
+                break;
+            case OP_CALL:
+                if (ins->slot == CALC_FN_SQRT) {
+                    fprintf(out, "%sconst double calc_t%d = sqrt(%s);\n", indent, next_local,
+                            names->stack[top]);
+                } else if (calc_functions[ins->slot].arity == 2) {
+                    top--;
+                    fprintf(out, "%sconst double calc_t%d = calc_%s(%s, %s);\n", indent,
+                            next_local, calc_functions[ins->slot].name, names->stack[top],
+                            names->stack[top + 1]);
+                } else {
+                    fprintf(out, "%sconst double calc_t%d = calc_%s(%s);\n", indent, next_local,
+                            calc_functions[ins->slot].name, names->stack[top]);
+                }
+                snprintf(names->stack[top], EMIT_OPERAND_SIZE, "calc_t%d", next_local++);
+                break;
+            default:
+                top--;
+                if ((ins->op == OP_DIV || ins->op == OP_MOD) && array) {
+                    fprintf(out, "%scalc_zero |= %s == 0;\n", indent, names->stack[top + 1]);
+                } else if (ins->op == OP_DIV || ins->op == OP_MOD) {
+                    fprintf(out, "%sif (%s == 0) {\n%s    return -1;\n%s}\n", indent,
+                            names->stack[top + 1], indent, indent);
+                }
+                if (ins->op == OP_MOD) {
+                    fprintf(out, "%sconst double calc_t%d = fmod(%s, %s);\n", indent, next_local,
+                            names->stack[top], names->stack[top + 1]);
+                } else {
+                    fprintf(out, "%sconst double calc_t%d = %s %c %s;\n", indent, next_local,
+                            names->stack[top], op_chars[ins->op], names->stack[top + 1]);
+                }
+                snprintf(names->stack[top], EMIT_OPERAND_SIZE, "calc_t%d", next_local++);
+                break;
+        }
+    }
+}
+
+/*
+ * Print program as C source
+ * name is the function name, source the expression text for the comment.
+ * Returns: 1 on success, 0 on a variable or function name C cannot use
+ *          or a reduction
+ */
+int emit_c_program(const Program *program, const char *name, const char *source, FILE *out) {
+    if (!is_c_identifier(name) || is_keyword(name)) {
+        fprintf(stderr, "Error: '%s' cannot be used as a C function name\n", name);
+        return 0;
+    }
+    for (int v = 0; v < program->variable_count; v++) {
+        const char *variable = program->variables[v];
+        if (!is_c_identifier(variable) || is_keyword(variable) ||
+            strncmp(variable, "calc_", 5) == 0 || strcmp(variable, name) == 0) {
+            fprintf(stderr, "Error: Variable '%s' cannot be used as a C parameter name\n",
+                    variable);
+            return 0;
+        }
+    }
+
+    if (program->reduction_count > 0) {
+        fprintf(stderr, "Error: Reductions cannot be emitted as C\n");
+        return 0;
+    }
+
+    OperandNames names;
+    names.stack = malloc((size_t)(program->max_depth + 1) * sizeof(*names.stack));
+    names.temps = malloc((size_t)(program->temp_count + 1) * sizeof(*names.temps));
+    if (names.stack == NULL || names.temps == NULL) {
+        free(names.stack);
+        free(names.temps);
+        fprintf(stderr, "Error: Out of memory\n");
+        return 0;
+    }
+    int needs_math = 0;
+    int calls[CALC_FN_COUNT] = { 0 };
+    for (int pc = 0; pc < program->length; pc++) {
+        needs_math |= program->code[pc].op == OP_MOD ||
+                      (program->code[pc].op == OP_PUSH && !isfinite(program->code[pc].value));
+        if (program->code[pc].op == OP_CALL) {
+            calls[program->code[pc].slot] = 1;
+        }
+    }
+    needs_math |= calls[CALC_FN_SQRT];
+    calls[CALC_FN_SQRT] = 0;
+    int needs_libcalc = 0;
+    for (int f = 0; f < CALC_FN_COUNT; f++) {
+        needs_libcalc += calls[f];     // functions to list in the header
+    }
+
+    fprintf(out, "/*\n * Generated by cli_calculator --emit-c\n");
+    fprintf(out, " * Expression: ");
+    for (const char *p = source; *p != '\0'; p++) {
+        // Keep the text from closing the comment or breaking the line
+        if (*p == '*' && p[1] == '/') {
+            fputs("* /", out);
+            p++;
+        } else {
+            fputc(*p == '\n' || *p == '\r' ? ' ' : *p, out);
+        }
+    }
+    fprintf(out, "\n *\n");
+    fprintf(out, " * The results are bit-identical to the calculator's when this is\n");
+    fprintf(out, " * compiled without floating-point contraction (GCC and Clang:\n");
+    fprintf(out, " * -ffp-contract=off), which would otherwise fuse a * b + c.\n");
+    if (needs_libcalc) {
+        fprintf(out, " *\n * Not standalone: it calls");
+        for (int f = 0; f < CALC_FN_COUNT; f++) {
+            if (calls[f]) {
+                needs_libcalc--;
+                fprintf(out, " calc_%s()%s", calc_functions[f].name,
+                        needs_libcalc > 1 ? "," : needs_libcalc == 1 ? " and" : "");
+            }
+        }
+        fprintf(out, " from libcalc\n * (mathfn.c), so link with it: cc ... -lcalc -lm\n");
+    }
+    fprintf(out, " */\n\n");
+    fprintf(out, "#include <stddef.h>\n");
+    if (needs_math) {
+        fprintf(out, "#include <math.h>\n");
+    }
+    for (int f = 0; f < CALC_FN_COUNT; f++) {
+        if (calls[f] && calc_functions[f].arity == 2) {
+            fprintf(out, "double calc_%s(double x, double y);    /* libcalc */\n",
+                    calc_functions[f].name);
+        } else if (calls[f]) {
+            fprintf(out, "double calc_%s(double x);    /* libcalc */\n", calc_functions[f].name);
+        }
+    }
+
+    // Scalar version
+    fprintf(out, "\n/*\n * Evaluate for one set of values\n");
+    fprintf(out, " * Returns: 0, or -1 on division by zero (*result is then unchanged)\n */\n");
+    fprintf(out, "static inline int %s(", name);
+    for (int v = 0; v < program->variable_count; v++) {
+        fprintf(out, "double %s, ", program->variables[v]);
+    }
+    fprintf(out, "double *result) {\n");
+    emit_body(program, &names, "    ", 0, out);
+    fprintf(out, "    *result = %s;\n    return 0;\n}\n", names.stack[0]);
+
+    // Array version
+    fprintf(out, "\n/*\n * Evaluate row calc_i of every array, for calc_i in [0, n)\n");
+    fprintf(out, " * errors[calc_i] is set to 1 where the row divides by zero (its result\n");
+    fprintf(out, " * is then meaningless) and to 0 elsewhere.\n");
+    fprintf(out, " * Returns: number of rows that divided by zero\n */\n");
+    // One parameter per line, aligned after the opening parenthesis
+    int column = fprintf(out, "static inline size_t %s_array(", name);
+    for (int v = 0; v < program->variable_count; v++) {
+        fprintf(out, "const double *restrict %s,\n%*s", program->variables[v], column, "");
+    }
+    fprintf(out, "double *restrict results,\n%*s", column, "");
+    fprintf(out, "unsigned char *restrict errors, size_t n) {\n");
+    fprintf(out, "    size_t calc_failed = 0;\n");
+    fprintf(out, "    for (size_t calc_i = 0; calc_i < n; calc_i++) {\n");
+    fprintf(out, "        unsigned char calc_zero = 0;\n");
+    emit_body(program, &names, "        ", 1, out);
+    fprintf(out, "        results[calc_i] = %s;\n", names.stack[0]);
+    fprintf(out, "        errors[calc_i] = calc_zero;\n");
+    fprintf(out, "        calc_failed += calc_zero;\n    }\n");
+    fprintf(out, "    return calc_failed;\n}\n");
+
+    free(names.stack);
+    free(names.temps);
+    return 1;
+}
+
+/*
+ * Handle "cli_calculator --emit-c EXPRESSION [--name NAME]"
+ * Returns: process exit status
+ */
+int emit_c_main(int argc, char *argv[]) {
+    const char *expression = NULL;
+    const char *name = "calc_expression";
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (expression == NULL) {
+            expression = argv[i];
+        } else {
+            expression = NULL;
+            break;
+        }
+    }
+    if (expression == NULL) {
+        printf("Usage: %s --emit-c EXPRESSION [--name NAME]\n", argv[0]);
+        return 1;
+    }
+
+    Arena arena;
+    Program compiled, program;
+    CalcError error;
+    arena_init(&arena);
+    if (compile_expression(expression, &compiled, &arena, &error) != CALC_OK ||
+        optimize_program(&compiled, &program, &arena, 0, &error) != CALC_OK) {
+        printf("Error: %s\n", error.message);
+        arena_free(&arena);
+        return 1;
+    }
+    int ok = emit_c_program(&program, name, expression, stdout);
+    arena_free(&arena);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+/*
+ * C Code Generation Header File
+ * Turns an expression into C functions for other programs to compile
+ */
+
+#ifndef EMIT_C_H
+#define EMIT_C_H
+
+#include <stdio.h>
+#include "calc.h"
+
+int emit_c_program(const Program *program, const char *name, const char *source, FILE *out);
+int emit_c_main(int argc, char *argv[]);
+
+#endif  // EMIT_C_H
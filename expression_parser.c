@@ -138,11 +138,19 @@
  * ============================================================================
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <math.h>
+#include <stdarg.h>
 #include "calc.h"
+#include "arena.h"
+#include "numparse.h"
+#include "reduce.h"
 
 /*
  * ----------------------------------------------------------------------------
@@ -156,8 +164,8 @@
  * 2. 字符栈（存储 char 类型）- 用于存储运算符
  */
 
-#define MAX_STACK_SIZE 100  /* 栈的最大容量 */
-#define MAX_EXPR_LEN 256    /* 表达式的最大长度 */
+#define STACK_INITIAL_CAPACITY 64  /* 栈的初始容量，满了会自动加倍 */
+#define EVAL_STACK_LOCAL 256       /* evaluate_program() 放在函数栈上的栈大小 */
 
 /*
  * 【任务1】定义数字栈结构
@@ -165,18 +173,26 @@
  * 提示：栈需要两个成员
  * - 一个数组用于存储数据
  * - 一个整数记录栈顶位置（-1 表示空栈）
+ *
+ * 数组的内存来自 Arena（见 arena.h），容量不够时自动加倍，
+ * 所以表达式再长也不会溢出；每个表达式算完后 Arena 被重置而不是释放，
+ * 下一个表达式直接复用同一块内存。
  */
 typedef struct {
-    double data[MAX_STACK_SIZE];  /* 存储数字的数组 */
+    double *data;                  /* 存储数字的数组 */
     int top;                       /* 栈顶索引，-1表示空栈 */
+    int capacity;                  /* 数组当前容量 */
+    Arena *arena;                  /* 数组内存的来源 */
 } NumStack;
 
 /*
  * 【任务2】定义字符栈结构（用于存储运算符）
  */
 typedef struct {
-    char data[MAX_STACK_SIZE];    /* 存储字符的数组 */
+    char *data;                    /* 存储字符的数组 */
     int top;                       /* 栈顶索引，-1表示空栈 */
+    int capacity;                  /* 数组当前容量 */
+    Arena *arena;                  /* 数组内存的来源 */
 } CharStack;
 
 /*
@@ -189,8 +205,11 @@ typedef struct {
  * 【任务3】初始化数字栈
  * 将栈顶索引设为 -1，表示空栈
  */
-void num_stack_init(NumStack *stack) {
+void num_stack_init(NumStack *stack, Arena *arena) {
+    stack->data = NULL;
     stack->top = -1;
+    stack->capacity = 0;
+    stack->arena = arena;
 }
 
 /*
@@ -205,15 +224,24 @@ int num_stack_is_empty(NumStack *stack) {
  * 【任务5】向数字栈压入一个数字
  *
  * 步骤：
- * 1. 检查栈是否已满（top >= MAX_STACK_SIZE - 1）
- * 2. 如果未满，先将 top 加 1，再将数字存入 data[top]
+ * 1. 检查栈是否已满（top >= capacity - 1），满了就把容量加倍
+ * 2. 先将 top 加 1，再将数字存入 data[top]
+ * 返回：1 成功，0 内存不足
  */
-void num_stack_push(NumStack *stack, double value) {
-    if (stack->top >= MAX_STACK_SIZE - 1) {
-        printf("Error: Stack overflow\n");
-        return;
+int num_stack_push(NumStack *stack, double value) {
+    if (stack->top >= stack->capacity - 1) {
+        int capacity = stack->capacity > 0 ? stack->capacity * 2 : STACK_INITIAL_CAPACITY;
+        double *data = arena_grow(stack->arena, stack->data,
+                                  (size_t)stack->capacity * sizeof(double),
+                                  (size_t)capacity * sizeof(double));
+        if (data == NULL) {
+            return 0;
+        }
+        stack->data = data;
+        stack->capacity = capacity;
     }
     stack->data[++stack->top] = value;
+    return 1;
 }
 
 /*
@@ -222,10 +250,10 @@ void num_stack_push(NumStack *stack, double value) {
  * 步骤：
  * 1. 检查栈是否为空
  * 2. 如果非空，返回 data[top]，然后将 top 减 1
+ * 空栈返回 0；调用者应该先用 num_stack_is_empty() 检查，这里不打印任何内容
  */
 double num_stack_pop(NumStack *stack) {
     if (num_stack_is_empty(stack)) {
-        printf("Error: Stack is empty, cannot pop!\n");
         return 0;
     }
     return stack->data[stack->top--];
@@ -235,25 +263,34 @@ double num_stack_pop(NumStack *stack) {
  * 【任务7-10】实现字符栈的操作函数
  * 与数字栈类似，请自行实现以下函数：
  */
-void char_stack_init(CharStack *stack) {
+void char_stack_init(CharStack *stack, Arena *arena) {
+    stack->data = NULL;
     stack->top = -1;
+    stack->capacity = 0;
+    stack->arena = arena;
 }
 
 int char_stack_is_empty(CharStack *stack) {
     return stack->top == -1;
 }
 
-void char_stack_push(CharStack *stack, char c) {
-    if (stack->top >= MAX_STACK_SIZE - 1) {
-        printf("Error: Stack overflow\n");
-        return;
+int char_stack_push(CharStack *stack, char c) {
+    if (stack->top >= stack->capacity - 1) {
+        int capacity = stack->capacity > 0 ? stack->capacity * 2 : STACK_INITIAL_CAPACITY;
+        char *data = arena_grow(stack->arena, stack->data,
+                                (size_t)stack->capacity, (size_t)capacity);
+        if (data == NULL) {
+            return 0;
+        }
+        stack->data = data;
+        stack->capacity = capacity;
     }
     stack->data[++stack->top] = c;
+    return 1;
 }
 
 char char_stack_pop(CharStack *stack) {
     if (char_stack_is_empty(stack)) {
-        printf("Error: Stack is empty, cannot pop!\n");
         return '\0';
     }
     return stack->data[stack->top--];
@@ -276,27 +313,109 @@ char char_stack_peek(CharStack *stack) {
  * ============================================================================
  */
 
+/*
+ * 记录错误：状态码、出错位置和一条可读的消息
+ * 库里的函数本身不打印任何内容，由调用者决定如何显示错误，
+ * 这样多个线程可以同时编译和计算而不会互相干扰输出
+ * 返回：status，方便写成 return set_error(...);
+ */
+static CalcStatus set_error(CalcError *error, CalcStatus status, int position,
+                            const char *format, ...) {
+    if (error == NULL) {
+        return status;
+    }
+    error->status = status;
+    error->position = position;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(error->message, sizeof(error->message), format, args);
+    va_end(args);
+    return status;
+}
+
+/*
+ * 状态码对应的简短说明（不带位置等细节）
+ */
+const char *calc_status_string(CalcStatus status) {
+    switch (status) {
+        case CALC_OK:                    return "OK";
+        case CALC_ERR_SYNTAX:            return "Invalid expression format";
+        case CALC_ERR_PARENTHESES:       return "Mismatched parentheses";
+        case CALC_ERR_UNKNOWN_CHARACTER: return "Unrecognized character";
+        case CALC_ERR_DIVISION_BY_ZERO:  return "Division by zero";
+        case CALC_ERR_OUT_OF_MEMORY:     return "Out of memory";
+        case CALC_ERR_UNBOUND_VARIABLE:  return "Unbound variable";
+        case CALC_ERR_OVERFLOW:          return "Result out of range";
+        case CALC_ERR_CYCLE:             return "Circular reference";
+    }
+    return "Unknown error";
+}
+
 /*
  * 【任务12】判断字符是否为运算符
  */
 int is_operator(char c) {
-    return c == '+' || c == '-' || c == '*' || c == '/';
+    return c == '+' || c == '-' || c == '*' || c == '/' || c == '%';
+}
+
+/*
+ * 判断字符是否为空白（空格或制表符）
+ * infix_to_postfix() 和 compile_expression() 都用它跳过空白，两条路径对同一输入结果一致
+ */
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+/*
+ * 判断字符能否开始/组成一个标识符（变量名），如 price、qty_2、_tmp
+ */
+static int is_identifier_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+static int is_identifier_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/*
+ * 函数调用在字符栈里的记号：压在 '(' 下面，记住是哪个函数
+ * 记号是 1 到 CALC_FN_COUNT 之间的控制字符，不会和运算符、括号混淆
+ */
+static char function_marker(int function) {
+    return (char)(1 + function);
+}
+
+/* 返回：记号对应的函数编号，不是记号时返回 -1 */
+static int marker_function(char c) {
+    return c >= 1 && c <= CALC_FN_COUNT ? c - 1 : -1;
 }
 
 /*
  * 【任务13】获取运算符优先级
  *
  * 优先级规则：
- * - '*' 和 '/' 优先级为 2（高）
+ * - '*'、'/' 和 '%' 优先级为 2（高）
  * - '+' 和 '-' 优先级为 1（低）
  * - 其他返回 0
  */
 int get_precedence(char op) {
-    if (op == '*' || op == '/') return 2;
+    if (op == '*' || op == '/' || op == '%') return 2;
     if (op == '+' || op == '-') return 1;
     return 0;
 }
 
+/*
+ * 解析一个数字（整数、小数或科学计数法，如 1e-9），从 text[*index] 开始
+ * 解析完成后 *index 指向数字后面的第一个字符
+ * 具体实现见 numparse.c：结果是正确舍入的 double，每个数字只扫描一遍
+ */
+static double parse_number(const char *text, int *index) {
+    double value = 0;
+    const char *end = scan_number(text + *index, &value);
+    *index = (int)(end - text);
+    return value;
+}
+
 /*
  * 【任务14】执行单次运算
  *
@@ -305,22 +424,32 @@ int get_precedence(char op) {
  * - b: 第二个操作数（右边的数）
  * - op: 运算符
  *
+ * - result: 计算结果写到这里
+ *
  * 注意：从栈中弹出时，先弹出的是 b，后弹出的是 a
+ * 返回：CALC_OK，或者出错的原因（例如除以零），而不是用 0 表示出错——
+ *       0 本身也是一个合法的结果
  */
-double apply_operator(double a, double b, char op) {
+CalcStatus apply_operator(double a, double b, char op, double *result) {
     switch (op) {
-        case '+': return add(a, b);
-        case '-': return subtract(a, b);
-        case '*': return multiply(a, b);
+        case '+': *result = add(a, b); return CALC_OK;
+        case '-': *result = subtract(a, b); return CALC_OK;
+        case '*': *result = multiply(a, b); return CALC_OK;
         case '/':
             if (b == 0) {
-                printf("Error: Division by zero\n");
-                return 0;
+                return CALC_ERR_DIVISION_BY_ZERO;
+            }
+            *result = divide(a, b);
+            return CALC_OK;
+        case '%':
+            // 取模和除法一样，除数为零时出错（fmod 会返回 NaN）
+            if (b == 0) {
+                return CALC_ERR_DIVISION_BY_ZERO;
             }
-            return divide(a, b);
+            *result = modulo(a, b);
+            return CALC_OK;
         default:
-            printf("Error: Unknown operator'%c'\n", op);
-            return 0;
+            return CALC_ERR_UNKNOWN_CHARACTER;
     }
 }
 
@@ -359,36 +488,88 @@ double apply_operator(double a, double b, char op) {
  *
  *     return 输出字符串
  */
-int infix_to_postfix(const char *infix, char *postfix) {
+CalcStatus infix_to_postfix(const char *infix, char **postfix, Arena *arena, CalcError *error) {
     CharStack op_stack;
-    char_stack_init(&op_stack);
+    char_stack_init(&op_stack, arena);
 
     int j = 0;  /* postfix 字符串的索引 */
     int i = 0;  /* infix 字符串的索引 */
     int len = strlen(infix);
 
+    /*
+     * 每个输入字符最多产生两个输出字符（数字的最后一位或运算符，再加一个空格），
+     * 所以 2 * len + 1 的空间一定够用，写入时不会越界
+     */
+    char *out = arena_alloc(arena, (size_t)len * 2 + 1);
+    if (out == NULL) {
+        return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    }
+
     while (i < len) {
         char c = infix[i];
 
-        /* 跳过空格 */
-        if (c == ' ') {
+        /* 跳过空白 */
+        if (is_blank(c)) {
             i++;
             continue;
         }
 
         /* 情况1：数字（包括多位数和小数） */
         if (isdigit(c) || (c == '.' && i + 1 < len && isdigit(infix[i + 1]))) {
-            /* 复制整个数字到输出 */
-            while (i < len && (isdigit(infix[i]) || infix[i] == '.')) {
-                postfix[j++] = infix[i++];
+            /* 复制整个数字（包括指数部分）到输出 */
+            double value;
+            int end = (int)(scan_number(infix + i, &value) - infix);
+            while (i < end) {
+                out[j++] = infix[i++];
+            }
+            out[j++] = ' ';  /* 数字之间用空格分隔 */
+            continue;
+        }
+
+        /*
+         * 情况1（续）：变量名，和数字一样原样输出
+         * 后面紧跟 '(' 的是函数调用，如 sqrt(2)：函数名先不输出，而是在 '('
+         * 下面压一个记号，遇到对应的 ')' 时再把函数名写到参数后面，
+         * 就像一个运算符："sqrt(2)" -> "2 sqrt"，"pow(2, 3)" -> "2 3 pow"
+         */
+        if (is_identifier_start(c)) {
+            int start = i;
+            while (i < len && is_identifier_char(infix[i])) {
+                i++;
+            }
+            int next = i;
+            while (is_blank(infix[next])) {
+                next++;
+            }
+            if (infix[next] == '(') {
+                if (reduction_lookup(infix + start, i - start) >= 0) {
+                    /* 归约的函数体要对每个 i 重新计算，只有编译后的程序能做到 */
+                    return set_error(error, CALC_ERR_SYNTAX, start, "%.*s() needs a compiled program",
+                                     i - start, infix + start);
+                }
+                int function = calc_function_lookup(infix + start, i - start);
+                if (function < 0) {
+                    return set_error(error, CALC_ERR_SYNTAX, start, "Unknown function '%.*s'",
+                                     i - start > 40 ? 40 : i - start, infix + start);
+                }
+                if (!char_stack_push(&op_stack, function_marker(function)) ||
+                    !char_stack_push(&op_stack, '(')) {
+                    return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+                }
+                i = next + 1;
+                continue;
             }
-            postfix[j++] = ' ';  /* 数字之间用空格分隔 */
+            memcpy(out + j, infix + start, (size_t)(i - start));
+            j += i - start;
+            out[j++] = ' ';
             continue;
         }
 
         /* 情况2：左括号 */
         if (c == '(') {
-            char_stack_push(&op_stack, c);
+            if (!char_stack_push(&op_stack, c)) {
+                return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+            }
             i++;
             continue;
         }
@@ -397,14 +578,36 @@ int infix_to_postfix(const char *infix, char *postfix) {
         if (c == ')') {
             while (!char_stack_is_empty(&op_stack) &&
                    char_stack_peek(&op_stack) != '(') {
-                postfix[j++] = char_stack_pop(&op_stack);
-                postfix[j++] = ' ';
+                out[j++] = char_stack_pop(&op_stack);
+                out[j++] = ' ';
             }
             if (char_stack_is_empty(&op_stack)) {
-                printf("Error: Mismatched parentheses\n");
-                return 0;
+                return set_error(error, CALC_ERR_PARENTHESES, i, "Mismatched parentheses");
             }
             char_stack_pop(&op_stack);  /* 弹出 '(' */
+            int function = marker_function(char_stack_peek(&op_stack));
+            if (function >= 0) {
+                /* 函数调用的右括号：参数都已输出，现在输出函数名 */
+                char_stack_pop(&op_stack);
+                size_t length = strlen(calc_functions[function].name);
+                memcpy(out + j, calc_functions[function].name, length);
+                j += (int)length;
+                out[j++] = ' ';
+            }
+            i++;
+            continue;
+        }
+
+        /* 情况3（续）：逗号分隔函数的参数，把当前参数里的运算符都输出 */
+        if (c == ',') {
+            while (!char_stack_is_empty(&op_stack) &&
+                   char_stack_peek(&op_stack) != '(') {
+                out[j++] = char_stack_pop(&op_stack);
+                out[j++] = ' ';
+            }
+            if (op_stack.top < 1 || marker_function(op_stack.data[op_stack.top - 1]) < 0) {
+                return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
+            }
             i++;
             continue;
         }
@@ -414,37 +617,38 @@ int infix_to_postfix(const char *infix, char *postfix) {
             while (!char_stack_is_empty(&op_stack) &&
                    char_stack_peek(&op_stack) != '(' &&
                    get_precedence(char_stack_peek(&op_stack)) >= get_precedence(c)) {
-                postfix[j++] = char_stack_pop(&op_stack);
-                postfix[j++] = ' ';
+                out[j++] = char_stack_pop(&op_stack);
+                out[j++] = ' ';
+            }
+            if (!char_stack_push(&op_stack, c)) {
+                return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
             }
-            char_stack_push(&op_stack, c);
             i++;
             continue;
         }
 
         /* 未知字符 */
-        printf("Error: Unrecognized character '%c'\n", c);
-        return 0;
+        return set_error(error, CALC_ERR_UNKNOWN_CHARACTER, i, "Unrecognized character '%c'", c);
     }
 
     /* 弹出栈中剩余的运算符 */
     while (!char_stack_is_empty(&op_stack)) {
         char op = char_stack_pop(&op_stack);
         if (op == '(') {
-            printf("Error: Mismatched parentheses\n");
-            return 0;
+            return set_error(error, CALC_ERR_PARENTHESES, len, "Mismatched parentheses");
         }
-        postfix[j++] = op;
-        postfix[j++] = ' ';
+        out[j++] = op;
+        out[j++] = ' ';
     }
 
     /* 去掉末尾多余的空格 */
-    if (j > 0 && postfix[j - 1] == ' ') {
+    if (j > 0 && out[j - 1] == ' ') {
         j--;
     }
-    postfix[j] = '\0';
+    out[j] = '\0';
+    *postfix = out;
 
-    return 1;  /* 成功 */
+    return CALC_OK;
 }
 
 /*
@@ -469,10 +673,12 @@ int infix_to_postfix(const char *infix, char *postfix) {
  *             压入 result
  *
  *     return 栈顶元素（最终结果）
+ *
+ * 结果写入 *result；出错时返回错误状态，错误位置是在后缀字符串中的偏移
  */
-double evaluate_postfix(const char *postfix) {
+CalcStatus evaluate_postfix(const char *postfix, Arena *arena, double *result, CalcError *error) {
     NumStack num_stack;
-    num_stack_init(&num_stack);
+    num_stack_init(&num_stack, arena);
 
     int i = 0;
     int len = strlen(postfix);
@@ -488,36 +694,48 @@ double evaluate_postfix(const char *postfix) {
 
         /* 如果是数字 */
         if (isdigit(c) || (c == '.' && i + 1 < len && isdigit(postfix[i + 1]))) {
-            /* 解析数字 */
-            double num = 0;
-            double decimal = 0.1;
-            int is_decimal = 0;
-
-            while (i < len && (isdigit(postfix[i]) || postfix[i] == '.')) {
-                if (postfix[i] == '.') {
-                    is_decimal = 1;
-                } else if (is_decimal) {
-                    num += (postfix[i] - '0') * decimal;
-                    decimal *= 0.1;
-                } else {
-                    num = num * 10 + (postfix[i] - '0');
-                }
+            if (!num_stack_push(&num_stack, parse_number(postfix, &i))) {
+                return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+            }
+            continue;
+        }
+
+        /*
+         * 函数名：和运算符一样，从栈中取出参数，再压入结果
+         * 变量：文本流水线没有办法给变量赋值，请使用 compile_expression()
+         */
+        if (is_identifier_start(c)) {
+            int start = i;
+            while (is_identifier_char(postfix[i])) {
                 i++;
             }
-            num_stack_push(&num_stack, num);
+            int function = calc_function_lookup(postfix + start, i - start);
+            if (function < 0) {
+                return set_error(error, CALC_ERR_UNBOUND_VARIABLE, start, "Unbound variable");
+            }
+            int arity = calc_functions[function].arity;
+            if (num_stack.top < arity - 1) {
+                return set_error(error, CALC_ERR_SYNTAX, start, "Invalid expression format");
+            }
+            double b = arity == 2 ? num_stack_pop(&num_stack) : 0;
+            double a = num_stack_pop(&num_stack);
+            num_stack_push(&num_stack, calc_function_apply(function, a, b));
             continue;
         }
 
         /* 如果是运算符 */
         if (is_operator(c)) {
             if (num_stack.top < 1) {
-                printf("Error: Invalid expression format\n");
-                return 0;
+                return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
             }
             double b = num_stack_pop(&num_stack);
             double a = num_stack_pop(&num_stack);
-            double result = apply_operator(a, b, c);
-            num_stack_push(&num_stack, result);
+            double value;
+            CalcStatus status = apply_operator(a, b, c, &value);
+            if (status != CALC_OK) {
+                return set_error(error, status, i, "%s", calc_status_string(status));
+            }
+            num_stack_push(&num_stack, value);  /* 刚弹出两个，一定有空间 */
             i++;
             continue;
         }
@@ -526,70 +744,896 @@ double evaluate_postfix(const char *postfix) {
     }
 
     if (num_stack.top != 0) {
-        printf("错误：表达式格式不正确！\n");
-        return 0;
+        return set_error(error, CALC_ERR_SYNTAX, len, "Invalid expression format");
     }
 
-    return num_stack_pop(&num_stack);
+    *result = num_stack_pop(&num_stack);
+    return CALC_OK;
 }
 
 /*
  * ============================================================================
- *                      第九部分：主函数（表达式计算）
+ *                  第八部分（续）：编译为指令程序
  * ============================================================================
  *
- * 【任务17】实现表达式解析器的入口函数
+ * infix_to_postfix() 把结果重新写成字符串，evaluate_postfix() 又要逐个字符
+ * 扫描、重新解析每一个数字。同一个表达式被反复计算时，这些工作全是重复的。
  *
- * 这个函数将被添加到主菜单中，作为选项12
- */
-void expression_calculator(void) {
-    char infix[MAX_EXPR_LEN];
-    char postfix[MAX_EXPR_LEN];
-
-    printf("\n");
-    printf("========================================\n");
-    printf("         Expression Calculator\n");
-    printf("========================================\n");
-    printf("\n");
-    printf("Supported operator: + - * /\n");
-    printf("support ()\n");
-    printf("Examples:3 + 4 * 2, (1 + 2) * 3\n");
-    printf("\n");
-    printf("Please enter expression:");
-
-    if (fgets(infix, sizeof(infix), stdin) == NULL) {
-        printf("Error: loading inputs fails\n");
-        return;
+ * compile_expression() 在 Shunting Yard 的同一遍扫描中直接生成指令序列：
+ *   "3 + 4 * 2"  ->  PUSH 3, PUSH 4, PUSH 2, MUL, ADD
+ * 数字只在编译时解析一次，存为 double 常量；编译时还会检查每个运算符
+ * 是否有足够的操作数，并记录栈的最大深度。
+ *
+ * evaluate_program() 因此不需要任何检查，只是一个紧凑的循环。
+ * 一个 Program 编译一次，可以计算任意多次。
+ */
+
+/* 运算符字符 -> 操作码 */
+static OpCode operator_opcode(char op) {
+    switch (op) {
+        case '+': return OP_ADD;
+        case '-': return OP_SUB;
+        case '*': return OP_MUL;
+        case '%': return OP_MOD;
+        default:  return OP_DIV;
     }
+}
 
-    /* 去掉换行符 */
-    int len = strlen(infix);
-    if (len > 0 && infix[len - 1] == '\n') {
-        infix[len - 1] = '\0';
+/*
+ * 编译时的运算符栈元素
+ * 除了运算符本身，还记住它在输入中的位置，
+ * 这样运算符出栈生成指令时，错误信息仍然能指回原来的位置
+ */
+typedef struct {
+    char op;
+    int position;
+    int function;       /* '(' 属于函数调用时是函数编号，否则为 -1 */
+    int arguments;      /* 函数调用中已经读完的参数个数 */
+    int reduction;      /* '(' 属于 sum() 等归约时是 program->reductions 的下标，否则为 -1 */
+} PendingOperator;
+
+/* 编译过程中的状态 */
+typedef struct {
+    Program *program;
+    Arena *arena;        /* 指令数组和运算符栈的内存来源 */
+    int depth;           /* 计算时栈中数字的个数 */
+    CalcError *error;
+    PendingOperator *ops;
+    int op_count;
+    int op_capacity;
+    int variable_capacity;
+    int reduction_capacity;
+} Compiler;
+
+static CalcStatus push_operator(Compiler *compiler, char op, int position) {
+    if (compiler->op_count == compiler->op_capacity) {
+        int capacity = compiler->op_capacity > 0 ? compiler->op_capacity * 2 : STACK_INITIAL_CAPACITY;
+        PendingOperator *ops = arena_grow(compiler->arena, compiler->ops,
+                                          (size_t)compiler->op_capacity * sizeof(PendingOperator),
+                                          (size_t)capacity * sizeof(PendingOperator));
+        if (ops == NULL) {
+            return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+        compiler->ops = ops;
+        compiler->op_capacity = capacity;
     }
+    compiler->ops[compiler->op_count].op = op;
+    compiler->ops[compiler->op_count].position = position;
+    compiler->ops[compiler->op_count].function = -1;
+    compiler->ops[compiler->op_count].arguments = 0;
+    compiler->ops[compiler->op_count].reduction = -1;
+    compiler->op_count++;
+    return CALC_OK;
+}
 
-    if (strlen(infix) == 0) {
-        printf("Error: Expression is empty.\n");
-        return;
+/*
+ * 向程序追加一条指令，同时跟踪栈深度
+ * 指令数组满了就把容量加倍，所以编译时间和表达式长度成正比
+ * 返回：CALC_OK，或失败原因（内存不足、操作数不足）
+ */
+static CalcStatus emit_instruction(Compiler *compiler, OpCode op, double value, int position) {
+    Program *program = compiler->program;
+
+    if (program->length == program->capacity) {
+        int capacity = program->capacity > 0 ? program->capacity * 2 : STACK_INITIAL_CAPACITY;
+        Instruction *code = arena_grow(compiler->arena, program->code,
+                                       (size_t)program->capacity * sizeof(Instruction),
+                                       (size_t)capacity * sizeof(Instruction));
+        if (code == NULL) {
+            return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+        program->code = code;
+        program->capacity = capacity;
+    }
+
+    if (op == OP_PUSH || op == OP_VAR) {
+        compiler->depth++;
+        if (compiler->depth > program->max_depth) {
+            program->max_depth = compiler->depth;
+        }
+    } else if (op == OP_CALL) {
+        /* value 是函数编号：取出 arity 个参数，压入一个结果 */
+        int arity = calc_functions[(int)value].arity;
+        if (compiler->depth < arity) {
+            return set_error(compiler->error, CALC_ERR_SYNTAX, position,
+                             "Invalid expression format");
+        }
+        compiler->depth -= arity - 1;
+    } else {
+        if (compiler->depth < 2) {
+            return set_error(compiler->error, CALC_ERR_SYNTAX, position,
+                             "Invalid expression format");
+        }
+        compiler->depth--;
+    }
+    program->code[program->length].op = op;
+    program->code[program->length].position = position;
+    program->code[program->length].value = value;
+    if (op == OP_CALL || op == OP_REDUCE) {
+        program->code[program->length].slot = (int)value;
+    }
+    program->length++;
+    return CALC_OK;
+}
+
+/*
+ * 查找变量名，第一次出现时加入 program->variables
+ * 返回：变量编号（OP_VAR 的 slot），-1 表示内存不足
+ */
+static int intern_variable(Compiler *compiler, const char *name, int length) {
+    Program *program = compiler->program;
+    for (int v = 0; v < program->variable_count; v++) {
+        if (strncmp(program->variables[v], name, (size_t)length) == 0 &&
+            program->variables[v][length] == '\0') {
+            return v;
+        }
+    }
+
+    if (program->variable_count == compiler->variable_capacity) {
+        int capacity = compiler->variable_capacity > 0 ? compiler->variable_capacity * 2 : 8;
+        char **variables = arena_grow(compiler->arena, program->variables,
+                                      (size_t)compiler->variable_capacity * sizeof(char *),
+                                      (size_t)capacity * sizeof(char *));
+        if (variables == NULL) {
+            return -1;
+        }
+        program->variables = variables;
+        compiler->variable_capacity = capacity;
+    }
+    char *copy = arena_alloc(compiler->arena, (size_t)length + 1);
+    if (copy == NULL) {
+        return -1;
+    }
+    memcpy(copy, name, (size_t)length);
+    copy[length] = '\0';
+    program->variables[program->variable_count] = copy;
+    return program->variable_count++;
+}
+
+/* 弹出栈顶运算符并生成对应的指令 */
+static CalcStatus emit_pending_operator(Compiler *compiler) {
+    PendingOperator pending = compiler->ops[--compiler->op_count];
+    return emit_instruction(compiler, operator_opcode(pending.op), 0, pending.position);
+}
+
+/* 归约的参数写错时的错误信息 */
+static CalcStatus reduction_error(Compiler *compiler, int kind, int position) {
+    return set_error(compiler->error, CALC_ERR_SYNTAX, position,
+                     "%s() needs an index, two bounds and a body", reduction_names[kind]);
+}
+
+/*
+ * 开始一个归约，如 sum(i, 1, n, 1 / (i * i))
+ * infix[*i] 是 '(' 后面的字符。读出下标名和它后面的逗号，
+ * 在 program->reductions 中加一项，再像函数调用一样压入 '('，
+ * 之后两个上下限按普通参数编译
+ * 返回：CALC_OK（*i 指向下限的开头），或失败原因
+ */
+static CalcStatus begin_reduction(Compiler *compiler, const char *infix, int *i, int kind,
+                                  int position) {
+    Program *program = compiler->program;
+    int p = *i;
+    while (is_blank(infix[p])) {
+        p++;
+    }
+    int start = p;
+    if (!is_identifier_start(infix[p])) {
+        return reduction_error(compiler, kind, position);
+    }
+    while (is_identifier_char(infix[p])) {
+        p++;
+    }
+    int length = p - start;
+    while (is_blank(infix[p])) {
+        p++;
+    }
+    if (infix[p] != ',') {
+        return reduction_error(compiler, kind, position);
+    }
+
+    if (program->reduction_count == compiler->reduction_capacity) {
+        int capacity = compiler->reduction_capacity > 0 ? compiler->reduction_capacity * 2 : 4;
+        Reduction *reductions = arena_grow(compiler->arena, program->reductions,
+                                           (size_t)compiler->reduction_capacity * sizeof(Reduction),
+                                           (size_t)capacity * sizeof(Reduction));
+        if (reductions == NULL) {
+            return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+        program->reductions = reductions;
+        compiler->reduction_capacity = capacity;
+    }
+    char *name = arena_alloc(compiler->arena, (size_t)length + 1);
+    if (name == NULL) {
+        return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    }
+    memcpy(name, infix + start, (size_t)length);
+    name[length] = '\0';
+
+    Reduction *reduction = &program->reductions[program->reduction_count];
+    memset(reduction, 0, sizeof(*reduction));
+    reduction->kind = (ReductionKind)kind;
+    reduction->position = position;
+    reduction->index_name = name;
+    reduction->index = -1;
+
+    CalcStatus status = push_operator(compiler, '(', position);
+    if (status != CALC_OK) {
+        return status;
+    }
+    compiler->ops[compiler->op_count - 1].reduction = program->reduction_count++;
+    *i = p + 1;
+    return CALC_OK;
+}
+
+/*
+ * 编译归约的函数体：从 infix[start] 到对应的 ')'
+ * 函数体单独编译成一个 Program（下标只是其中的一个变量），由 reduce.c
+ * 对每个 i 计算。编译用的是原文的一份拷贝，函数体前面的部分换成空格，
+ * 这样函数体里的错误位置仍然是整个表达式中的位置。
+ * 函数体里的其他变量在外层程序中也登记一次，outer[] 记下对应关系
+ * 返回：CALC_OK（*end 是 ')' 的位置），或失败原因
+ */
+static CalcStatus compile_reduction_body(Compiler *compiler, const char *infix, int start,
+                                         int slot, int *end) {
+    Reduction *reduction = &compiler->program->reductions[slot];
+    int depth = 0;
+    int p = start;
+    for (; infix[p] != '\0'; p++) {
+        if (infix[p] == '(') {
+            depth++;
+        } else if (infix[p] == ')') {
+            if (depth == 0) {
+                break;
+            }
+            depth--;
+        }
+    }
+    if (infix[p] == '\0') {
+        return set_error(compiler->error, CALC_ERR_PARENTHESES, reduction->position,
+                         "Mismatched parentheses");
+    }
+
+    char *text = arena_alloc(compiler->arena, (size_t)p + 1);
+    if (text == NULL) {
+        return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    }
+    memset(text, ' ', (size_t)start);
+    memcpy(text + start, infix + start, (size_t)(p - start));
+    text[p] = '\0';
+    CalcStatus status = compile_expression(text, &reduction->body, compiler->arena, compiler->error);
+    if (status != CALC_OK) {
+        return status;
     }
 
-    printf("\n");
-    printf("------------------------------------------\n");
-    printf("  Expression: %s\n", infix);
+    const Program *body = &reduction->body;
+    if (body->variable_count > 0) {
+        reduction->outer = arena_alloc(compiler->arena, (size_t)body->variable_count * sizeof(int));
+        if (reduction->outer == NULL) {
+            return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+    }
+    for (int v = 0; v < body->variable_count; v++) {
+        const char *name = body->variables[v];
+        if (strcmp(name, reduction->index_name) == 0) {
+            reduction->index = v;
+            reduction->outer[v] = -1;
+            continue;
+        }
+        reduction->outer[v] = intern_variable(compiler, name, (int)strlen(name));
+        if (reduction->outer[v] < 0) {
+            return set_error(compiler->error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+    }
+    *end = p;
+    return CALC_OK;
+}
 
-    /* 转换为后缀表达式 */
-    if (!infix_to_postfix(infix, postfix)) {
+/*
+ * 整数快速路径的准备
+ * 如果每个数字都是整数字面量（只有数字，没有小数点和指数）并且在
+ * int64 范围内，程序中也没有变量，就把每个常量的精确整数值记在
+ * program->integers 中，evaluate_program_value() 会用整数来计算。
+ * 常量的 double 值已经舍入过（超过 2^53 的整数不能精确表示），
+ * 所以要根据指令记下的位置，从原文重新读取数字。
+ * 调用了函数（如 sqrt）或含有归约（如 sum）的程序也不走这条路。
+ * 任何一个条件不满足时 program->integers 保持 NULL。
+ */
+static void mark_integer_program(const char *infix, Program *program, Arena *arena) {
+    if (program->variable_count > 0) {
         return;
     }
-    printf("  Postfix Expression: %s\n", postfix);
+    int64_t *integers = arena_alloc(arena, (size_t)program->length * sizeof(int64_t));
+    if (integers == NULL) {
+        return;     /* 没有快速路径也能正确计算 */
+    }
 
-    /* 计算结果 */
-    double result = evaluate_postfix(postfix);
-    printf("  Result:   %.2lf\n", result);
-    printf("------------------------------------------\n");
-    printf("\n");
+    for (int pc = 0; pc < program->length; pc++) {
+        if (program->code[pc].op == OP_CALL || program->code[pc].op == OP_REDUCE) {
+            return;         /* 函数和归约的结果一般不是整数 */
+        }
+        if (program->code[pc].op != OP_PUSH) {
+            continue;
+        }
+        const char *p = infix + program->code[pc].position;
+        int64_t value = 0;
+        while (isdigit(*p)) {
+            int digit = *p - '0';
+            if (value > (INT64_MAX - digit) / 10) {
+                return;     /* 超出 int64 */
+            }
+            value = value * 10 + digit;
+            p++;
+        }
+        double ignored;
+        if (p == infix + program->code[pc].position ||
+            scan_number(infix + program->code[pc].position, &ignored) != p) {
+            return;         /* 有小数点或指数，例如 "2.5"、"1e3" */
+        }
+        integers[pc] = value;
+    }
+    program->integers = integers;
 }
 
+/*
+ * 编译中缀表达式为指令程序
+ * 与 infix_to_postfix() 的步骤完全相同，只是输出的是指令而不是字符
+ * 另外记录上一个记号是不是操作数：两个数字相邻（如 "1 2"）或数字紧跟
+ * 右括号（如 "(1)2"）时，能直接指出出错的位置
+ * 标识符（如 price）编译成变量，计算时由 evaluate_program_with() 提供值；
+ * 后面紧跟 '(' 的标识符是函数调用（见 mathfn.h），编译成 OP_CALL；
+ * sum、product、min、max 后面紧跟 '(' 是归约（见 reduce.h），编译成 OP_REDUCE
+ * 指令数组分配在 arena 中，arena 被重置之前 program 一直有效
+ * 返回：CALC_OK，或失败原因（详细信息写入 *error）
+ */
+CalcStatus compile_expression(const char *infix, Program *program, Arena *arena, CalcError *error) {
+    Compiler compiler = { program, arena, 0, error, NULL, 0, 0, 0, 0 };
+    CalcStatus status;
+    int after_operand = 0;  /* 上一个记号是数字或 ')' */
+
+    program->code = NULL;
+    program->length = 0;
+    program->capacity = 0;
+    program->max_depth = 0;
+    program->temp_count = 0;
+    program->variables = NULL;
+    program->variable_count = 0;
+    program->integers = NULL;
+    program->reductions = NULL;
+    program->reduction_count = 0;
+
+    int i = 0;
+
+    while (infix[i] != '\0') {
+        char c = infix[i];
+
+        if (is_blank(c)) {
+            i++;
+            continue;
+        }
+
+        /* 数字：只解析一次，存为常量 */
+        if (isdigit(c) || (c == '.' && isdigit(infix[i + 1]))) {
+            if (after_operand) {
+                return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
+            }
+            int start = i;
+            double value = parse_number(infix, &i);
+            status = emit_instruction(&compiler, OP_PUSH, value, start);
+            if (status != CALC_OK) {
+                return status;
+            }
+            after_operand = 1;
+            continue;
+        }
+
+        /* 变量：同名的变量共用一个编号 */
+        if (is_identifier_start(c)) {
+            if (after_operand) {
+                return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
+            }
+            int start = i;
+            while (is_identifier_char(infix[i])) {
+                i++;
+            }
+            int next = i;
+            while (is_blank(infix[next])) {
+                next++;
+            }
+            if (infix[next] == '(') {
+                /* 归约：上下限和函数调用的参数一样编译，函数体在读到第二个逗号时编译 */
+                int kind = reduction_lookup(infix + start, i - start);
+                if (kind >= 0) {
+                    i = next + 1;
+                    status = begin_reduction(&compiler, infix, &i, kind, start);
+                    if (status != CALC_OK) {
+                        return status;
+                    }
+                    continue;
+                }
+                /* 函数调用：像 '(' 一样压栈，记住函数，遇到 ')' 时生成 OP_CALL */
+                int function = calc_function_lookup(infix + start, i - start);
+                if (function < 0) {
+                    return set_error(error, CALC_ERR_SYNTAX, start, "Unknown function '%.*s'",
+                                     i - start > 40 ? 40 : i - start, infix + start);
+                }
+                status = push_operator(&compiler, '(', start);
+                if (status != CALC_OK) {
+                    return status;
+                }
+                compiler.ops[compiler.op_count - 1].function = function;
+                i = next + 1;
+                continue;
+            }
+            int slot = intern_variable(&compiler, infix + start, i - start);
+            if (slot < 0) {
+                return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+            }
+            status = emit_instruction(&compiler, OP_VAR, 0, start);
+            if (status != CALC_OK) {
+                return status;
+            }
+            program->code[program->length - 1].slot = slot;
+            after_operand = 1;
+            continue;
+        }
+
+        if (c == '(') {
+            if (after_operand) {
+                return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
+            }
+            status = push_operator(&compiler, c, i);
+            if (status != CALC_OK) {
+                return status;
+            }
+            i++;
+            continue;
+        }
+
+        if (c == ')') {
+            while (compiler.op_count > 0 && compiler.ops[compiler.op_count - 1].op != '(') {
+                status = emit_pending_operator(&compiler);
+                if (status != CALC_OK) {
+                    return status;
+                }
+            }
+            if (compiler.op_count == 0) {
+                return set_error(error, CALC_ERR_PARENTHESES, i, "Mismatched parentheses");
+            }
+            PendingOperator open = compiler.ops[--compiler.op_count];  /* 弹出 '(' */
+            if (open.function >= 0) {
+                /* 参数个数不对（包括 "sin()"）时指向函数名 */
+                if (!after_operand || open.arguments + 1 != calc_functions[open.function].arity) {
+                    return set_error(error, CALC_ERR_SYNTAX, open.position,
+                                     "%s() takes %d argument%s", calc_functions[open.function].name,
+                                     calc_functions[open.function].arity,
+                                     calc_functions[open.function].arity == 1 ? "" : "s");
+                }
+                status = emit_instruction(&compiler, OP_CALL, open.function, open.position);
+                if (status != CALC_OK) {
+                    return status;
+                }
+            } else if (open.reduction >= 0) {
+                /* 函数体已经在第二个逗号处编译好了：栈上是两个上下限 */
+                if (open.arguments != 2) {
+                    return reduction_error(&compiler, program->reductions[open.reduction].kind,
+                                           open.position);
+                }
+                status = emit_instruction(&compiler, OP_REDUCE, open.reduction, open.position);
+                if (status != CALC_OK) {
+                    return status;
+                }
+            }
+            after_operand = 1;
+            i++;
+            continue;
+        }
+
+        /* 逗号结束函数或归约的一个参数 */
+        if (c == ',') {
+            while (compiler.op_count > 0 && compiler.ops[compiler.op_count - 1].op != '(') {
+                status = emit_pending_operator(&compiler);
+                if (status != CALC_OK) {
+                    return status;
+                }
+            }
+            if (!after_operand || compiler.op_count == 0 ||
+                (compiler.ops[compiler.op_count - 1].function < 0 &&
+                 compiler.ops[compiler.op_count - 1].reduction < 0)) {
+                return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
+            }
+            PendingOperator *open = &compiler.ops[compiler.op_count - 1];
+            open->arguments++;
+            after_operand = 0;
+            i++;
+            if (open->reduction >= 0 && open->arguments == 2) {
+                /* 上下限都读完了，剩下直到 ')' 的部分是函数体 */
+                status = compile_reduction_body(&compiler, infix, i, open->reduction, &i);
+                if (status != CALC_OK) {
+                    return status;
+                }
+                after_operand = 1;
+            } else if (open->reduction >= 0 && open->arguments > 2) {
+                return reduction_error(&compiler, program->reductions[open->reduction].kind,
+                                       open->position);
+            }
+            continue;
+        }
+
+        if (is_operator(c)) {
+            while (compiler.op_count > 0 && compiler.ops[compiler.op_count - 1].op != '(' &&
+                   get_precedence(compiler.ops[compiler.op_count - 1].op) >= get_precedence(c)) {
+                status = emit_pending_operator(&compiler);
+                if (status != CALC_OK) {
+                    return status;
+                }
+            }
+            status = push_operator(&compiler, c, i);
+            if (status != CALC_OK) {
+                return status;
+            }
+            after_operand = 0;
+            i++;
+            continue;
+        }
+
+        return set_error(error, CALC_ERR_UNKNOWN_CHARACTER, i, "Unrecognized character '%c'", c);
+    }
+
+    while (compiler.op_count > 0) {
+        if (compiler.ops[compiler.op_count - 1].op == '(') {
+            return set_error(error, CALC_ERR_PARENTHESES, compiler.ops[compiler.op_count - 1].position,
+                             "Mismatched parentheses");
+        }
+        status = emit_pending_operator(&compiler);
+        if (status != CALC_OK) {
+            return status;
+        }
+    }
+
+    /* 正确的表达式计算完后栈中恰好剩一个数字 */
+    if (compiler.depth != 1) {
+        return set_error(error, CALC_ERR_SYNTAX, i, "Invalid expression format");
+    }
+
+    mark_integer_program(infix, program, arena);
+    return CALC_OK;
+}
+
+/*
+ * 计算已编译的程序
+ * 编译时已经检查过操作数个数，这里只需要检查除数是否为零
+ * 临时变量（优化器为重复的子表达式生成，见 optimizer.c）放在栈的后面，
+ * 和栈共用一块内存
+ * 常见深度的栈直接放在函数栈上；只有极深的嵌套才需要 malloc
+ * program 只读，所以同一个程序可以被多个线程同时计算
+ * variables[i] 是变量 program->variables[i] 的值；没有变量的程序可以传 NULL
+ * 返回：CALC_OK（结果写入 *result），或失败原因（详细信息写入 *error）
+ */
+CalcStatus evaluate_program_with(const Program *program, const double *variables, double *result,
+                                 CalcError *error) {
+    double local_stack[EVAL_STACK_LOCAL];
+    double *stack = local_stack;
+    int top = -1;
+    CalcStatus status = CALC_OK;
+    int needed = program->max_depth + program->temp_count;
+
+    if (program->variable_count > 0 && variables == NULL) {
+        for (int pc = 0; pc < program->length; pc++) {
+            if (program->code[pc].op == OP_VAR) {
+                const char *name = program->variables != NULL
+                                       ? program->variables[program->code[pc].slot] : "?";
+                return set_error(error, CALC_ERR_UNBOUND_VARIABLE, program->code[pc].position,
+                                 "Unbound variable '%.40s'", name);
+            }
+            if (program->code[pc].op == OP_REDUCE) {
+                /* 变量只在归约的函数体里用到，如 sum(i, 1, 3, x) */
+                const char *name = program->variables != NULL ? program->variables[0] : "?";
+                return set_error(error, CALC_ERR_UNBOUND_VARIABLE, program->code[pc].position,
+                                 "Unbound variable '%.40s'", name);
+            }
+        }
+    }
+
+    if (needed > EVAL_STACK_LOCAL) {
+        stack = malloc((size_t)needed * sizeof(double));
+        if (stack == NULL) {
+            return set_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+    }
+    double *temps = stack + program->max_depth;
+
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        switch (ins->op) {
+            case OP_PUSH:
+                stack[++top] = ins->value;
+                break;
+            case OP_ADD:
+                top--;
+                stack[top] = stack[top] + stack[top + 1];
+                break;
+            case OP_SUB:
+                top--;
+                stack[top] = stack[top] - stack[top + 1];
+                break;
+            case OP_MUL:
+                top--;
+                stack[top] = stack[top] * stack[top + 1];
+                break;
+            case OP_DIV:
+                top--;
+                if (stack[top + 1] == 0) {
+                    status = set_error(error, CALC_ERR_DIVISION_BY_ZERO, ins->position,
+                                       "Division by zero");
+                    pc = program->length;
+                    break;
+                }
+                stack[top] = stack[top] / stack[top + 1];
+                break;
+            case OP_MOD:
+                top--;
+                if (stack[top + 1] == 0) {
+                    status = set_error(error, CALC_ERR_DIVISION_BY_ZERO, ins->position,
+                                       "Division by zero");
+                    pc = program->length;
+                    break;
+                }
+                stack[top] = fmod(stack[top], stack[top + 1]);
+                break;
+            case OP_STORE:
+                temps[ins->slot] = stack[top];
+                break;
+            case OP_LOAD:
+                stack[++top] = temps[ins->slot];
+                break;
+            case OP_VAR:
+                stack[++top] = variables[ins->slot];
+                break;
+            case OP_CALL:
+                if (calc_functions[ins->slot].arity == 2) {
+                    top--;
+                    stack[top] = calc_function_apply(ins->slot, stack[top], stack[top + 1]);
+                } else {
+                    stack[top] = calc_function_apply(ins->slot, stack[top], 0);
+                }
+                break;
+            case OP_REDUCE:
+                top--;
+                status = evaluate_reduction(&program->reductions[ins->slot], stack[top],
+                                            stack[top + 1], variables, &stack[top], error);
+                if (status != CALC_OK) {
+                    pc = program->length;
+                }
+                break;
+        }
+    }
+
+    if (status == CALC_OK) {
+        *result = stack[0];
+    }
+    if (stack != local_stack) {
+        free(stack);
+    }
+    return status;
+}
+
+/* 没有变量的程序 */
+CalcStatus evaluate_program(const Program *program, double *result, CalcError *error) {
+    return evaluate_program_with(program, NULL, result, error);
+}
+
+/*
+ * 用 int64 计算整数程序
+ * 每一步都用带溢出检查的内建函数（__builtin_add_overflow 等）。溢出标志
+ * 只是累积起来，循环结束后才检查一次，这样循环里不会多出分支。
+ * 栈顶的数字一直放在局部变量 top_value 里（通常就是一个寄存器），
+ * 每个运算只需要从内存里读一个操作数。
+ * 除法只有在能整除时才得到整数；有余数、溢出（包括 INT64_MIN / -1）
+ * 时返回 0，由调用者改用 double 重新计算。除以零和 double 路径一样是错误。
+ * 返回：1 表示得到了精确结果（或除以零的错误），0 表示需要改用 double
+ */
+static int evaluate_integers(const Program *program, int64_t *result, CalcStatus *status,
+                             CalcError *error) {
+    int64_t local_stack[EVAL_STACK_LOCAL];
+    int64_t *stack = local_stack;   /* 栈顶以下的数字 */
+    int64_t top_value = 0;
+    int top = -1;
+    int inexact = 0;
+    int needed = program->max_depth + program->temp_count;
+
+    if (needed > EVAL_STACK_LOCAL) {
+        stack = malloc((size_t)needed * sizeof(int64_t));
+        if (stack == NULL) {
+            return 0;
+        }
+    }
+    int64_t *temps = stack + program->max_depth;
+    const int64_t *integers = program->integers;
+    *status = CALC_OK;
+
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        int64_t a;
+        switch (ins->op) {
+            case OP_PUSH:
+                stack[++top] = top_value;
+                top_value = integers[pc];
+                break;
+            case OP_ADD:
+                inexact |= __builtin_add_overflow(stack[top--], top_value, &top_value);
+                break;
+            case OP_SUB:
+                inexact |= __builtin_sub_overflow(stack[top--], top_value, &top_value);
+                break;
+            case OP_MUL:
+                inexact |= __builtin_mul_overflow(stack[top--], top_value, &top_value);
+                break;
+            case OP_DIV:
+                a = stack[top--];
+                if (top_value == 0) {
+                    *status = set_error(error, CALC_ERR_DIVISION_BY_ZERO, ins->position,
+                                        "Division by zero");
+                    pc = program->length;
+                } else if (top_value == -1) {
+                    inexact |= __builtin_sub_overflow((int64_t)0, a, &top_value);
+                } else {
+                    inexact |= a % top_value != 0;
+                    top_value = a / top_value;
+                }
+                break;
+            case OP_MOD:
+                /* C 的 % 和 fmod 一样，余数的符号跟被除数相同，而且总是精确的 */
+                a = stack[top--];
+                if (top_value == 0) {
+                    *status = set_error(error, CALC_ERR_DIVISION_BY_ZERO, ins->position,
+                                        "Division by zero");
+                    pc = program->length;
+                } else {
+                    top_value = top_value == -1 ? 0 : a % top_value;  /* INT64_MIN % -1 会陷入 */
+                }
+                break;
+            case OP_STORE:
+                temps[ins->slot] = top_value;
+                break;
+            case OP_LOAD:
+                stack[++top] = top_value;
+                top_value = temps[ins->slot];
+                break;
+            case OP_VAR:
+            case OP_CALL:
+            case OP_REDUCE:
+                inexact = 1;    /* 整数程序里没有变量、函数调用和归约 */
+                break;
+        }
+    }
+
+    if (!inexact && *status == CALC_OK) {
+        *result = top_value;
+    }
+    if (stack != local_stack) {
+        free(stack);
+    }
+    return !inexact;
+}
+
+/*
+ * 计算没有变量的程序，整数程序尽量得到精确的整数结果
+ * 返回：CALC_OK（结果写入 *result），或失败原因（详细信息写入 *error）
+ */
+CalcStatus evaluate_program_value(const Program *program, CalcValue *result, CalcError *error) {
+    if (program->integers != NULL) {
+        CalcStatus status;
+        int64_t integer;
+        if (evaluate_integers(program, &integer, &status, error)) {
+            if (status == CALC_OK) {
+                result->integer = integer;
+                result->value = (double)integer;
+                result->is_integer = 1;
+            }
+            return status;
+        }
+    }
+    result->is_integer = 0;
+    return evaluate_program_with(program, NULL, &result->value, error);
+}
+
+/*
+ * 按名字查找变量
+ * 返回：变量编号（variables 数组中的下标），-1 表示表达式中没有这个变量
+ */
+int program_variable_index(const Program *program, const char *name) {
+    for (int v = 0; v < program->variable_count; v++) {
+        if (strcmp(program->variables[v], name) == 0) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+/*
+ * 把已编译的程序写回后缀表达式文本（用于显示）
+ */
+void program_to_postfix(const Program *program, char *buffer, size_t size) {
+    static const char op_chars[] = { 0, '+', '-', '*', '/', '%' };
+    size_t used = 0;
+
+    buffer[0] = '\0';
+    for (int pc = 0; pc < program->length && used < size; pc++) {
+        const Instruction *ins = &program->code[pc];
+        const char *separator = pc > 0 ? " " : "";
+        int written;
+        if (ins->op == OP_PUSH) {
+            written = snprintf(buffer + used, size - used, "%s%g", separator, ins->value);
+        } else if (ins->op == OP_STORE) {
+            written = snprintf(buffer + used, size - used, "%s=t%d", separator, ins->slot);
+        } else if (ins->op == OP_LOAD) {
+            written = snprintf(buffer + used, size - used, "%st%d", separator, ins->slot);
+        } else if (ins->op == OP_VAR && program->variables != NULL) {
+            written = snprintf(buffer + used, size - used, "%s%s", separator,
+                               program->variables[ins->slot]);
+        } else if (ins->op == OP_VAR) {
+            written = snprintf(buffer + used, size - used, "%sv%d", separator, ins->slot);
+        } else if (ins->op == OP_CALL) {
+            written = snprintf(buffer + used, size - used, "%s%s", separator,
+                               calc_functions[ins->slot].name);
+        } else if (ins->op == OP_REDUCE) {
+            /* 上下限之后写 "sum(i: 函数体的后缀表达式)" */
+            const Reduction *reduction = &program->reductions[ins->slot];
+            written = snprintf(buffer + used, size - used, "%s%s(%s: ", separator,
+                               reduction_names[reduction->kind], reduction->index_name);
+            if (written < 0) {
+                break;
+            }
+            used += (size_t)written;
+            if (used >= size) {
+                break;
+            }
+            program_to_postfix(&reduction->body, buffer + used, size - used);
+            used += strlen(buffer + used);
+            written = snprintf(buffer + used, size - used, ")");
+        } else {
+            written = snprintf(buffer + used, size - used, "%s%c", separator, op_chars[ins->op]);
+        }
+        if (written < 0) {
+            break;
+        }
+        used += (size_t)written;
+    }
+}
+
+/*
+ * ============================================================================
+ *                      第九部分：主函数（表达式计算）
+ * ============================================================================
+ *
+ * 【任务17】实现表达式解析器的入口函数
+ *
+ * 这个函数被添加到主菜单中，作为选项12。
+ * 它负责读取输入、打印结果，属于命令行程序，所以放在 main.c 中：
+ * 本文件是 libcalc 库的一部分，库里的函数不读写标准输入输出，
+ * 出错时只返回 CalcStatus 和 CalcError。
+ */
+
 /*
  * ============================================================================
  *                      第十部分：集成到主程序
@@ -599,8 +1643,7 @@ void expression_calculator(void) {
  *
  * 步骤：
  *
- * 1. 在 calc.h 中添加函数声明：
- *    void expression_calculator(void);
+ * 1. 在 main.c 中实现 expression_calculator()（见第九部分）
  *
  * 2. 修改 main.c 中的菜单，添加选项12：
  *
@@ -0,0 +1,387 @@
+/*
+ * Number Formatting Implementation File
+ *
+ * format_shortest() prints the fewest significant digits that read back
+ * (through strtod or scan_number) as exactly the same double. Candidate
+ * digit strings are produced with one scaling by a power of ten and then
+ * verified with an exact Clinger-style multiply or divide, so the common
+ * case needs no big-number arithmetic and no snprintf. Values the exact
+ * check cannot decide (more than 15-16 digits, or extreme exponents) fall
+ * back to snprintf("%.*e") with increasing precision.
+ *
+ * format_fixed() prints a fixed number of decimals, exactly like
+ * printf("%.*f"), using integer arithmetic when the scaled value is far
+ * enough from a rounding tie to be decided safely.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calc.h"
+#include "format.h"
+
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXACT_POW10 22
+#define SHORTEST_MAX_DIGITS 17
+
+static const double exact_pow10[MAX_EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Write the decimal digits of n, most significant first
+ * Returns: number of digits written
+ */
+static int write_u64(uint64_t n, char *out) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char)('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+    for (int i = 0; i < count; i++) {
+        out[i] = digits[count - 1 - i];
+    }
+    return count;
+}
+
+/*
+ * Exact check: does the decimal m * 10^scale read back as value?
+ * Only decides cases where m and 10^|scale| are exact doubles, so the
+ * single multiply or divide is correctly rounded.
+ * Returns: 1 yes, 0 no, -1 cannot decide
+ */
+static int round_trips(uint64_t m, int scale, double value) {
+    if (m > MAX_EXACT_MANTISSA || scale > MAX_EXACT_POW10 || scale < -MAX_EXACT_POW10) {
+        return -1;
+    }
+    double back = scale >= 0 ? (double)m * exact_pow10[scale]
+                             : (double)m / exact_pow10[-scale];
+    return back == value;
+}
+
+/*
+ * Try to represent value with p significant digits
+ * Returns: 1 and the digits in *m / *scale when they round-trip,
+ *          0 when p digits are not enough, -1 when undecidable here
+ */
+static int try_digits(double value, int e, int p, uint64_t *m, int *scale) {
+    *scale = e - p + 1;       // value ~ m * 10^scale with a p-digit m
+    if (*scale > MAX_EXACT_POW10 || *scale < -MAX_EXACT_POW10) {
+        return -1;
+    }
+    double scaled = *scale >= 0 ? value / exact_pow10[*scale]
+                                : value * exact_pow10[-*scale];
+    double rounded = nearbyint(scaled);
+    if (rounded >= (double)MAX_EXACT_MANTISSA) {
+        return -1;
+    }
+    *m = (uint64_t)rounded;
+    int check = round_trips(*m, *scale, value);
+    // Near a tie the scaling error can pick the wrong neighbour; try the other one
+    if (check == 0 && scaled != rounded) {
+        uint64_t other = scaled > rounded ? *m + 1 : *m - 1;
+        if (round_trips(other, *scale, value) == 1) {
+            *m = other;
+            check = 1;
+        }
+    }
+    return check;
+}
+
+/*
+ * Slow path: snprintf("%.*e") produces the digits and strtod() confirms
+ * them; the precision is found by binary search starting from lo digits
+ * Returns: digit count, as for shortest_digits()
+ */
+static int shortest_digits_slow(double value, int lo, char *digits, int *exponent) {
+    char text[FORMAT_BUFFER_SIZE];
+    int hi = SHORTEST_MAX_DIGITS;   // 17 digits always round-trip
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        snprintf(text, sizeof(text), "%.*e", mid - 1, value);
+        if (strtod(text, NULL) == value) {
+            hi = mid;
+        } else {
+            lo = mid + 1;
+        }
+    }
+    snprintf(text, sizeof(text), "%.*e", lo - 1, value);
+
+    int count = 0;
+    const char *c = text;
+    for (; *c != 'e'; c++) {
+        if (*c != '.') {
+            digits[count++] = *c;
+        }
+    }
+    *exponent = atoi(c + 1);
+    return count;
+}
+
+/*
+ * Find the shortest digit string for a finite, positive value
+ * Digit strings that round-trip with p digits also do with p + 1, so the
+ * digit count is found by binary search.
+ * Returns: number of digits in digits[]; *exponent receives the decimal
+ *          exponent of the first digit (value ~ d.ddd * 10^exponent)
+ */
+static int shortest_digits(double value, char *digits, int *exponent) {
+    int e = (int)floor(log10(value));
+    uint64_t m;
+    uint64_t best_m = 0;
+    int scale;
+    int best_scale = 0;
+    int lo = 1;
+    int hi = 0;     // smallest p known to work, 0 while none is known
+
+    // Most doubles need at most 15 digits; try the longer ones only if needed
+    for (int p = 15; p <= SHORTEST_MAX_DIGITS && hi == 0; p++) {
+        int check = try_digits(value, e, p, &m, &scale);
+        if (check < 0) {
+            return shortest_digits_slow(value, p == 15 ? 1 : p, digits, exponent);
+        }
+        if (check == 1) {
+            hi = p;
+            best_m = m;
+            best_scale = scale;
+        }
+    }
+    if (hi == 0) {
+        return shortest_digits_slow(value, SHORTEST_MAX_DIGITS, digits, exponent);
+    }
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (try_digits(value, e, mid, &m, &scale) == 1) {
+            hi = mid;
+            best_m = m;
+            best_scale = scale;
+        } else {
+            lo = mid + 1;
+        }
+    }
+
+    int count = write_u64(best_m, digits);
+    // log10() may be off by one near powers of ten; the digit count tells the truth
+    *exponent = best_scale + count - 1;
+    while (count > 1 && digits[count - 1] == '0') {
+        count--;
+    }
+    return count;
+}
+
+/*
+ * Shortest round-trip representation
+ * Plain notation is used for 1e-6 <= |value| < 1e21, scientific notation
+ * (1.5e+300) outside that range, like JavaScript's Number.toString().
+ * out must hold FORMAT_BUFFER_SIZE characters.
+ * Returns: length of the text
+ */
+int format_shortest(double value, char *out) {
+    char *p = out;
+
+    if (isnan(value)) {
+        memcpy(out, "nan", 4);
+        return 3;
+    }
+    if (signbit(value)) {
+        *p++ = '-';
+        value = -value;
+    }
+    if (isinf(value)) {
+        memcpy(p, "inf", 4);
+        return (int)(p - out) + 3;
+    }
+    if (value == 0) {
+        *p++ = '0';
+        *p = '\0';
+        return (int)(p - out);
+    }
+
+    // Integers below 2^53 print exactly as themselves
+    if (value < (double)MAX_EXACT_MANTISSA && value == floor(value)) {
+        p += write_u64((uint64_t)value, p);
+        *p = '\0';
+        return (int)(p - out);
+    }
+
+    char digits[SHORTEST_MAX_DIGITS + 1];
+    int exponent;
+    int count = shortest_digits(value, digits, &exponent);
+
+    if (exponent >= 21 || exponent < -6) {
+        *p++ = digits[0];
+        if (count > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, (size_t)(count - 1));
+            p += count - 1;
+        }
+        p += sprintf(p, "e%c%02d", exponent < 0 ? '-' : '+', abs(exponent));
+    } else if (exponent < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = -1; i > exponent; i--) {
+            *p++ = '0';
+        }
+        memcpy(p, digits, (size_t)count);
+        p += count;
+    } else {
+        for (int i = 0; i < count || i <= exponent; i++) {
+            if (i == exponent + 1) {
+                *p++ = '.';
+            }
+            *p++ = i < count ? digits[i] : '0';
+        }
+    }
+    *p = '\0';
+    return (int)(p - out);
+}
+
+/*
+ * Fixed number of decimals, identical to printf("%.*f", precision, value)
+ * out must hold FORMAT_BUFFER_SIZE characters; values too large for that
+ * are printed in %g style instead.
+ * Returns: length of the text
+ */
+int format_fixed(double value, int precision, char *out) {
+    if (precision < 0) {
+        precision = 0;
+    }
+    if (precision > FORMAT_MAX_PRECISION) {
+        precision = FORMAT_MAX_PRECISION;
+    }
+
+    if (isfinite(value) && precision <= 15) {
+        double magnitude = fabs(value);
+        double scaled = magnitude * exact_pow10[precision];
+        double rounded = nearbyint(scaled);
+        // The scaling is off by at most half an ulp of scaled; when the result is
+        // further than that from a rounding tie, it rounds the same way printf does
+        if (scaled < (double)(MAX_EXACT_MANTISSA / 2) &&
+            fabs(fabs(scaled - rounded) - 0.5) > scaled * 0x1p-50) {
+            uint64_t m = (uint64_t)rounded;
+            uint64_t divisor = 1;
+            for (int i = 0; i < precision; i++) {
+                divisor *= 10;
+            }
+            char *p = out;
+            if (signbit(value)) {
+                *p++ = '-';
+            }
+            p += write_u64(m / divisor, p);
+            if (precision > 0) {
+                uint64_t fraction = m % divisor;
+                *p++ = '.';
+                for (int i = precision - 1; i >= 0; i--) {
+                    p[i] = (char)('0' + fraction % 10);
+                    fraction /= 10;
+                }
+                p += precision;
+            }
+            *p = '\0';
+            return (int)(p - out);
+        }
+    }
+
+    int length = snprintf(out, FORMAT_BUFFER_SIZE, "%.*f", precision, value);
+    if (length >= FORMAT_BUFFER_SIZE) {
+        length = snprintf(out, FORMAT_BUFFER_SIZE, "%.*g", precision > 0 ? precision : 1, value);
+    }
+    return length;
+}
+
+/*
+ * Exact decimal form of an integer; a fixed precision appends zero decimals
+ * Returns: length of the text
+ */
+int format_integer(int64_t value, int precision, char *out) {
+    int length = 0;
+    // Negate as unsigned: INT64_MIN has no positive counterpart
+    uint64_t magnitude = (uint64_t)value;
+    if (value < 0) {
+        out[length++] = '-';
+        magnitude = 0 - magnitude;
+    }
+    length += write_u64(magnitude, out + length);
+    if (precision > 0) {
+        out[length++] = '.';
+        memset(out + length, '0', (size_t)precision);
+        length += precision;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+/*
+ * Integers exactly, doubles like format_double()
+ */
+int format_value(const CalcValue *value, int precision, char *out) {
+    if (value->is_integer) {
+        return format_integer(value->integer, precision == FORMAT_SHORTEST ? 0 : precision, out);
+    }
+    return format_double(value->value, precision, out);
+}
+
+/*
+ * Shortest form for FORMAT_SHORTEST, fixed decimals otherwise
+ */
+int format_double(double value, int precision, char *out) {
+    if (precision == FORMAT_SHORTEST) {
+        return format_shortest(value, out);
+    }
+    return format_fixed(value, precision, out);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Buffered output
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Returns: 1 on success, 0 when the buffer cannot be allocated
+ */
+int output_init(OutputBuffer *output, FILE *file, size_t capacity) {
+    output->file = file;
+    output->used = 0;
+    output->capacity = capacity;
+    output->data = malloc(capacity);
+    return output->data != NULL;
+}
+
+void output_flush(OutputBuffer *output) {
+    if (output->used > 0) {
+        fwrite(output->data, 1, output->used, output->file);
+        output->used = 0;
+    }
+}
+
+void output_write(OutputBuffer *output, const char *text, size_t length) {
+    if (output->capacity - output->used < length) {
+        output_flush(output);
+        if (length > output->capacity) {
+            fwrite(text, 1, length, output->file);
+            return;
+        }
+    }
+    memcpy(output->data + output->used, text, length);
+    output->used += length;
+}
+
+void output_double(OutputBuffer *output, double value, int precision) {
+    if (output->capacity - output->used < FORMAT_BUFFER_SIZE) {
+        output_flush(output);
+    }
+    output->used += (size_t)format_double(value, precision, output->data + output->used);
+}
+
+void output_free(OutputBuffer *output) {
+    output_flush(output);
+    fflush(output->file);
+    free(output->data);
+    output->data = NULL;
+}
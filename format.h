@@ -0,0 +1,45 @@
+/*
+ * Number Formatting Header File
+ * Fast double-to-text conversion and a buffered result writer
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "calc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FORMAT_BUFFER_SIZE 40       // enough for any formatted double
+#define FORMAT_SHORTEST (-1)        // precision value selecting format_shortest()
+#define FORMAT_MAX_PRECISION 17
+
+int format_shortest(double value, char *out);
+int format_fixed(double value, int precision, char *out);
+int format_double(double value, int precision, char *out);
+int format_integer(int64_t value, int precision, char *out);
+int format_value(const CalcValue *value, int precision, char *out);
+
+// Large user-space buffer written to the file in bulk
+typedef struct {
+    FILE *file;
+    char *data;
+    size_t used;
+    size_t capacity;
+} OutputBuffer;
+
+int output_init(OutputBuffer *output, FILE *file, size_t capacity);
+void output_write(OutputBuffer *output, const char *text, size_t length);
+void output_double(OutputBuffer *output, double value, int precision);
+void output_flush(OutputBuffer *output);
+void output_free(OutputBuffer *output);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // FORMAT_H
@@ -0,0 +1,285 @@
+/*
+ * History Store Implementation File
+ *
+ * File layout: a 16-byte header ("CALCHIST", version, record size)
+ * followed by fixed-size Records. Every calculation appends exactly one
+ * record with a single write() on an O_APPEND descriptor, so adding to a
+ * history of any size costs the same. Nothing is ever rewritten.
+ *
+ * Opening the log maps it read-only instead of parsing it, so startup
+ * time does not depend on the number of entries. A crash in the middle
+ * of an append can only damage the last record: open() drops a partial
+ * or badly checksummed tail, and every record read later is checked
+ * against its own CRC-32.
+ *
+ * Readers that must not change the file (history queries) open it with
+ * history_open_readonly() instead: a torn tail is then skipped, not cut
+ * off, and history_refresh() picks up records appended since.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "history.h"
+
+#define HISTORY_MAGIC "CALCHIST"
+#define HISTORY_VERSION 1
+#define HISTORY_HEADER_SIZE 16
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} HistoryHeader;
+
+/*
+ * CRC-32 (IEEE 802.3), table built on first use
+ */
+static uint32_t crc32(const void *data, size_t length) {
+    static uint32_t table[256];
+    static int table_ready = 0;
+    const unsigned char *bytes = data;
+
+    if (!table_ready) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[i] = c;
+        }
+        table_ready = 1;
+    }
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+int history_record_valid(const Record *record) {
+    return record->checksum == crc32(record, offsetof(Record, checksum));
+}
+
+/*
+ * (Re)map the whole file so that every record is readable
+ * Returns: 1 on success, 0 on failure
+ */
+static int history_remap(HistoryStore *store) {
+    if (store->map != NULL) {
+        munmap(store->map, store->map_size);
+        store->map = NULL;
+        store->map_size = 0;
+        store->mapped_count = 0;
+    }
+
+    size_t size = HISTORY_HEADER_SIZE + store->count * sizeof(Record);
+    void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, store->fd, 0);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+    store->map = map;
+    store->map_size = size;
+    store->mapped_count = store->count;
+    return 1;
+}
+
+/*
+ * Open (or create) the log at path
+ * Returns: 1 on success, 0 if the file cannot be used
+ */
+int history_open(HistoryStore *store, const char *path) {
+    store->map = NULL;
+    store->map_size = 0;
+    store->count = 0;
+    store->mapped_count = 0;
+    store->path = NULL;
+
+    store->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (store->fd < 0) {
+        return 0;
+    }
+
+    struct stat info;
+    if (fstat(store->fd, &info) != 0) {
+        history_close(store);
+        return 0;
+    }
+
+    HistoryHeader header;
+    if ((size_t)info.st_size < HISTORY_HEADER_SIZE) {
+        // New (or hopelessly truncated) file: start over with a fresh header
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, HISTORY_MAGIC, sizeof(header.magic));
+        header.version = HISTORY_VERSION;
+        header.record_size = sizeof(Record);
+        if (ftruncate(store->fd, 0) != 0 ||
+            write(store->fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+            history_close(store);
+            return 0;
+        }
+        return history_remap(store);
+    }
+
+    if (pread(store->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != HISTORY_VERSION || header.record_size != sizeof(Record)) {
+        history_close(store);
+        return 0;
+    }
+
+    // Drop a torn tail left by a crash in the middle of an append
+    store->count = ((size_t)info.st_size - HISTORY_HEADER_SIZE) / sizeof(Record);
+    if (!history_remap(store)) {
+        history_close(store);
+        return 0;
+    }
+    while (store->count > 0 && !history_record_valid(history_get(store, store->count - 1))) {
+        store->count--;
+    }
+    size_t valid_size = HISTORY_HEADER_SIZE + store->count * sizeof(Record);
+    if (valid_size != (size_t)info.st_size) {
+        if (ftruncate(store->fd, (off_t)valid_size) != 0 || !history_remap(store)) {
+            history_close(store);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Open the log at path for reading only
+ * Nothing is created or repaired: a missing or header-less file reads as
+ * an empty history, and a torn last record is skipped (it may be an
+ * append still in progress in another process).
+ * Returns: 1 on success, 0 if the file is not a history log
+ */
+int history_open_readonly(HistoryStore *store, const char *path) {
+    store->fd = -1;
+    store->map = NULL;
+    store->map_size = 0;
+    store->count = 0;
+    store->mapped_count = 0;
+    store->path = path;
+    return history_refresh(store);
+}
+
+/*
+ * Catch up with a read-only store: records appended by other processes
+ * since it was opened or last refreshed become visible, and a cleared
+ * log shows up as fewer records
+ * Returns: 1 on success, 0 on failure
+ */
+int history_refresh(HistoryStore *store) {
+    if (store->fd < 0) {
+        store->fd = open(store->path, O_RDONLY);
+        if (store->fd < 0) {
+            return errno == ENOENT;     // still no log: nothing to read
+        }
+    }
+
+    struct stat info;
+    HistoryHeader header;
+    if (fstat(store->fd, &info) != 0) {
+        return 0;
+    }
+    if ((size_t)info.st_size < HISTORY_HEADER_SIZE) {
+        store->count = 0;
+        return 1;
+    }
+    if (pread(store->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != HISTORY_VERSION || header.record_size != sizeof(Record)) {
+        return 0;
+    }
+
+    store->count = ((size_t)info.st_size - HISTORY_HEADER_SIZE) / sizeof(Record);
+    if (store->map == NULL && !history_remap(store)) {
+        return 0;
+    }
+    while (store->count > 0) {
+        const Record *last = history_get(store, store->count - 1);
+        if (last == NULL) {
+            return 0;
+        }
+        if (history_record_valid(last)) {
+            break;
+        }
+        store->count--;
+    }
+    return 1;
+}
+
+/*
+ * Append one calculation to the log
+ * Returns: 1 on success, 0 on a write error
+ */
+int history_append(HistoryStore *store, double num1, double num2, double result,
+                   const char *operator_str) {
+    Record record;
+    memset(&record, 0, sizeof(record));
+    record.num1 = num1;
+    record.num2 = num2;
+    record.result = result;
+    record.timestamp = (int64_t)time(NULL);
+    snprintf(record.operator, sizeof(record.operator), "%s", operator_str);
+    record.checksum = crc32(&record, offsetof(Record, checksum));
+
+    if (write(store->fd, &record, sizeof(record)) != (ssize_t)sizeof(record)) {
+        // A short write leaves a torn record; cut it off again (or let open() do it)
+        off_t valid_size = (off_t)(HISTORY_HEADER_SIZE + store->count * sizeof(Record));
+        (void)ftruncate(store->fd, valid_size);
+        return 0;
+    }
+    store->count++;
+    return 1;
+}
+
+size_t history_size(const HistoryStore *store) {
+    return store->count;
+}
+
+/*
+ * Returns: the record at index (0 = oldest), or NULL if it cannot be mapped
+ * Records appended since the last mapping are mapped on demand.
+ */
+const Record *history_get(HistoryStore *store, size_t index) {
+    if (index >= store->count) {
+        return NULL;
+    }
+    if (index >= store->mapped_count && !history_remap(store)) {
+        return NULL;
+    }
+    return (const Record *)(store->map + HISTORY_HEADER_SIZE) + index;
+}
+
+/*
+ * Remove every record, keeping the header
+ * Returns: 1 on success, 0 on failure
+ */
+int history_clear(HistoryStore *store) {
+    if (ftruncate(store->fd, HISTORY_HEADER_SIZE) != 0) {
+        return 0;
+    }
+    store->count = 0;
+    return history_remap(store);
+}
+
+void history_close(HistoryStore *store) {
+    if (store->map != NULL) {
+        munmap(store->map, store->map_size);
+        store->map = NULL;
+    }
+    if (store->fd >= 0) {
+        close(store->fd);
+        store->fd = -1;
+    }
+}
@@ -0,0 +1,46 @@
+/*
+ * History Store Header File
+ * Append-only binary log of calculations, memory-mapped for reading
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HISTORY_FILE "calculator_history.log"
+
+// History record structure
+// One fixed-size entry in the log; the checksum covers every byte before it
+typedef struct {
+    double num1;
+    double num2;
+    double result;
+    int64_t timestamp;      // seconds since the Unix epoch
+    char operator[8];
+    uint32_t reserved;
+    uint32_t checksum;
+} Record;
+
+typedef struct {
+    int fd;
+    unsigned char *map;     // read-only mapping of the file
+    size_t map_size;
+    size_t count;           // records in the file
+    size_t mapped_count;    // records covered by the current mapping
+    const char *path;       // read-only stores: where to look for a log created later
+} HistoryStore;
+
+int history_open(HistoryStore *store, const char *path);
+int history_open_readonly(HistoryStore *store, const char *path);
+int history_refresh(HistoryStore *store);
+int history_append(HistoryStore *store, double num1, double num2, double result,
+                   const char *operator_str);
+size_t history_size(const HistoryStore *store);
+const Record *history_get(HistoryStore *store, size_t index);
+int history_record_valid(const Record *record);
+int history_clear(HistoryStore *store);
+void history_close(HistoryStore *store);
+
+#endif  // HISTORY_H
@@ -0,0 +1,875 @@
+/*
+ * History Query Implementation File
+ *
+ * Indexes built once over the log (history.c):
+ * - by_result / by_num1 / by_num2: record numbers sorted by that field,
+ *   so a range filter is two binary searches and a contiguous slice
+ * - result_prefix: running sums along by_result, so count/sum/min/max
+ *   of a result range need no scan at all
+ * - operator postings: record numbers per operator, in log order
+ * - time: the log is appended in time order, so a time window is a
+ *   binary search over record numbers (by_time covers logs whose clock
+ *   went backwards)
+ *
+ * A query walks only the smallest candidate slice any of its filters
+ * selects and checks the remaining filters on those records, so its cost
+ * follows the size of that slice rather than the size of the log.
+ *
+ * Building the indexes costs a sort of the whole log, which only pays off
+ * over many queries. "--query FILTERS" therefore answers its one query
+ * with a single scan, and "--query --session" reads one query per line
+ * from stdin, indexes the log once and, before each query, merges in the
+ * records other processes appended since (history_index_update()).
+ * Queries open the log read-only and never change it.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "format.h"
+#include "history_query.h"
+
+typedef enum {
+    FIELD_RESULT,
+    FIELD_NUM1,
+    FIELD_NUM2,
+    FIELD_TIME
+} RecordField;
+
+typedef struct {
+    uint64_t key;
+    uint32_t id;
+} SortItem;
+
+static double field_value(const Record *record, RecordField field) {
+    switch (field) {
+        case FIELD_RESULT: return record->result;
+        case FIELD_NUM1:   return record->num1;
+        case FIELD_NUM2:   return record->num2;
+        default:           return (double)record->timestamp;
+    }
+}
+
+/* Map a double to an integer with the same ordering */
+static uint64_t double_key(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+/*
+ * LSD radix sort on 16-bit digits; digits shared by every key are skipped
+ * Returns: 1 on success, 0 when out of memory
+ */
+static int radix_sort(SortItem *items, size_t n) {
+    SortItem *buffer = malloc(n * sizeof(SortItem));
+    size_t *counts = malloc(65536 * sizeof(size_t));
+    if (buffer == NULL || counts == NULL) {
+        free(buffer);
+        free(counts);
+        return 0;
+    }
+
+    SortItem *from = items;
+    SortItem *to = buffer;
+    for (int shift = 0; shift < 64; shift += 16) {
+        memset(counts, 0, 65536 * sizeof(size_t));
+        for (size_t i = 0; i < n; i++) {
+            counts[(from[i].key >> shift) & 0xFFFF]++;
+        }
+        if (n == 0 || counts[(from[0].key >> shift) & 0xFFFF] == n) {
+            continue;
+        }
+        size_t position = 0;
+        for (size_t d = 0; d < 65536; d++) {
+            size_t c = counts[d];
+            counts[d] = position;
+            position += c;
+        }
+        for (size_t i = 0; i < n; i++) {
+            to[counts[(from[i].key >> shift) & 0xFFFF]++] = from[i];
+        }
+        SortItem *swap_items = from;
+        from = to;
+        to = swap_items;
+    }
+    if (from != items) {
+        memcpy(items, from, n * sizeof(SortItem));
+    }
+
+    free(buffer);
+    free(counts);
+    return 1;
+}
+
+/*
+ * Record numbers of the valid records sorted by one field
+ * Returns: the array, or NULL when out of memory
+ */
+static uint32_t *sorted_by(const Record *records, const uint32_t *ids, size_t n,
+                           RecordField field) {
+    SortItem *items = malloc((n > 0 ? n : 1) * sizeof(SortItem));
+    uint32_t *sorted = malloc((n > 0 ? n : 1) * sizeof(uint32_t));
+    if (items == NULL || sorted == NULL) {
+        free(items);
+        free(sorted);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        items[i].key = double_key(field_value(&records[ids[i]], field));
+        items[i].id = ids[i];
+    }
+    if (!radix_sort(items, n)) {
+        free(items);
+        free(sorted);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        sorted[i] = items[i].id;
+    }
+    free(items);
+    return sorted;
+}
+
+/*
+ * Build every index over the records currently in the store
+ * Damaged records (bad checksum) are left out.
+ * Returns: 1 on success, 0 on failure
+ */
+int history_index_build(HistoryIndex *index, HistoryStore *store) {
+    memset(index, 0, sizeof(*index));
+
+    size_t total = history_size(store);
+    if (total > UINT32_MAX) {
+        return 0;
+    }
+    index->store_count = total;
+    if (total == 0) {
+        return 1;
+    }
+    if (history_get(store, total - 1) == NULL) {
+        return 0;   // maps everything, so records[] below is complete
+    }
+    const Record *records = history_get(store, 0);
+
+    uint32_t *ids = malloc(total * sizeof(uint32_t));
+    if (ids == NULL) {
+        return 0;
+    }
+    size_t n = 0;
+    int in_time_order = 1;
+    size_t op_counts[HISTORY_MAX_OPERATORS] = { 0 };
+
+    for (size_t i = 0; i < total; i++) {
+        const Record *record = &records[i];
+        if (!history_record_valid(record)) {
+            continue;
+        }
+        if (n > 0 && record->timestamp < records[ids[n - 1]].timestamp) {
+            in_time_order = 0;
+        }
+        ids[n++] = (uint32_t)i;
+
+        int op = 0;
+        while (op < index->operator_count &&
+               strncmp(index->operators[op].operator, record->operator,
+                       sizeof(record->operator)) != 0) {
+            op++;
+        }
+        if (op == index->operator_count && op < HISTORY_MAX_OPERATORS) {
+            memcpy(index->operators[op].operator, record->operator, sizeof(record->operator));
+            index->operators[op].operator[sizeof(record->operator) - 1] = '\0';
+            index->operator_count++;
+        }
+        if (op < HISTORY_MAX_OPERATORS) {
+            op_counts[op]++;
+        }
+    }
+    index->count = n;
+    if (n > 0) {
+        index->last_timestamp = records[ids[n - 1]].timestamp;
+    }
+
+    // Operator postings, filled in log order
+    for (int op = 0; op < index->operator_count; op++) {
+        index->operators[op].records = malloc((op_counts[op] > 0 ? op_counts[op] : 1) *
+                                              sizeof(uint32_t));
+        if (index->operators[op].records == NULL) {
+            free(ids);
+            history_index_free(index);
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        const Record *record = &records[ids[i]];
+        for (int op = 0; op < index->operator_count; op++) {
+            OperatorPostings *postings = &index->operators[op];
+            if (strncmp(postings->operator, record->operator, sizeof(record->operator)) == 0) {
+                postings->records[postings->count++] = ids[i];
+                break;
+            }
+        }
+    }
+
+    index->by_result = sorted_by(records, ids, n, FIELD_RESULT);
+    index->by_num1 = sorted_by(records, ids, n, FIELD_NUM1);
+    index->by_num2 = sorted_by(records, ids, n, FIELD_NUM2);
+    if (!in_time_order) {
+        index->by_time = sorted_by(records, ids, n, FIELD_TIME);
+    }
+    index->result_prefix = malloc((n + 1) * sizeof(long double));
+    free(ids);
+
+    if (index->by_result == NULL || index->by_num1 == NULL || index->by_num2 == NULL ||
+        (!in_time_order && index->by_time == NULL) || index->result_prefix == NULL) {
+        history_index_free(index);
+        return 0;
+    }
+
+    index->result_prefix[0] = 0;
+    for (size_t i = 0; i < n; i++) {
+        index->result_prefix[i + 1] = index->result_prefix[i] +
+                                      records[index->by_result[i]].result;
+    }
+    return 1;
+}
+
+void history_index_free(HistoryIndex *index) {
+    free(index->by_result);
+    free(index->by_num1);
+    free(index->by_num2);
+    free(index->by_time);
+    free(index->result_prefix);
+    for (int op = 0; op < index->operator_count; op++) {
+        free(index->operators[op].records);
+    }
+    memset(index, 0, sizeof(*index));
+}
+
+/*
+ * Merge the records ids[0..k) into old, an index of n records sorted by
+ * field; equal keys keep log order, as if the index had been built anew
+ * Returns: the merged index, or NULL when out of memory; old is freed
+ *          either way
+ */
+static uint32_t *merge_sorted(const Record *records, uint32_t *old, size_t n,
+                              const uint32_t *ids, size_t k, RecordField field) {
+    uint32_t *added = sorted_by(records, ids, k, field);
+    uint32_t *merged = malloc((n + k) * sizeof(uint32_t));
+    if (added == NULL || merged == NULL) {
+        free(added);
+        free(merged);
+        free(old);
+        return NULL;
+    }
+    size_t i = 0, j = 0, out = 0;
+    while (i < n && j < k) {
+        // Every added record comes after every old one in the log
+        if (double_key(field_value(&records[old[i]], field)) <=
+            double_key(field_value(&records[added[j]], field))) {
+            merged[out++] = old[i++];
+        } else {
+            merged[out++] = added[j++];
+        }
+    }
+    while (i < n) {
+        merged[out++] = old[i++];
+    }
+    while (j < k) {
+        merged[out++] = added[j++];
+    }
+    free(added);
+    free(old);
+    return merged;
+}
+
+/*
+ * Bring the indexes up to date with the records appended since they were
+ * built. The new records are sorted on their own and merged into each
+ * index, so this costs one pass over the index plus a sort of the new
+ * records; a log that was cleared (or whose clock went backwards for the
+ * first time) is indexed again from scratch.
+ * Returns: 1 on success, 0 on failure (the index is then empty)
+ */
+int history_index_update(HistoryIndex *index, HistoryStore *store) {
+    size_t total = history_size(store);
+    size_t first = index->store_count;
+    if (total == first) {
+        return 1;
+    }
+    if (total < first || total > UINT32_MAX || history_get(store, total - 1) == NULL) {
+        history_index_free(index);
+        return history_index_build(index, store);
+    }
+    const Record *records = history_get(store, 0);
+
+    uint32_t *ids = malloc((total - first) * sizeof(uint32_t));
+    if (ids == NULL) {
+        history_index_free(index);
+        return 0;
+    }
+    size_t k = 0;
+    int64_t last_timestamp = index->last_timestamp;
+    int in_time_order = 1;
+    size_t op_counts[HISTORY_MAX_OPERATORS] = { 0 };
+
+    for (size_t i = first; i < total; i++) {
+        const Record *record = &records[i];
+        if (!history_record_valid(record)) {
+            continue;
+        }
+        if ((index->count > 0 || k > 0) && record->timestamp < last_timestamp) {
+            in_time_order = 0;
+        }
+        last_timestamp = record->timestamp;
+        ids[k++] = (uint32_t)i;
+
+        int op = 0;
+        while (op < index->operator_count &&
+               strncmp(index->operators[op].operator, record->operator,
+                       sizeof(record->operator)) != 0) {
+            op++;
+        }
+        if (op == index->operator_count && op < HISTORY_MAX_OPERATORS) {
+            memcpy(index->operators[op].operator, record->operator, sizeof(record->operator));
+            index->operators[op].operator[sizeof(record->operator) - 1] = '\0';
+            index->operators[op].records = NULL;
+            index->operators[op].count = 0;
+            index->operator_count++;
+        }
+        if (op < HISTORY_MAX_OPERATORS) {
+            op_counts[op]++;
+        }
+    }
+
+    if (k == 0) {
+        free(ids);      // only damaged records were added
+        index->store_count = total;
+        return 1;
+    }
+    if (!in_time_order && index->by_time == NULL) {
+        // by_time has to cover the old records too
+        free(ids);
+        history_index_free(index);
+        return history_index_build(index, store);
+    }
+    int has_by_time = index->by_time != NULL;
+
+    for (int op = 0; op < index->operator_count; op++) {
+        OperatorPostings *postings = &index->operators[op];
+        if (op_counts[op] == 0) {
+            continue;
+        }
+        uint32_t *grown = realloc(postings->records,
+                                  (postings->count + op_counts[op]) * sizeof(uint32_t));
+        if (grown == NULL) {
+            free(ids);
+            history_index_free(index);
+            return 0;
+        }
+        postings->records = grown;
+    }
+    for (size_t i = 0; i < k; i++) {
+        const Record *record = &records[ids[i]];
+        for (int op = 0; op < index->operator_count; op++) {
+            OperatorPostings *postings = &index->operators[op];
+            if (strncmp(postings->operator, record->operator, sizeof(record->operator)) == 0) {
+                postings->records[postings->count++] = ids[i];
+                break;
+            }
+        }
+    }
+
+    size_t n = index->count;
+    index->by_result = merge_sorted(records, index->by_result, n, ids, k, FIELD_RESULT);
+    index->by_num1 = merge_sorted(records, index->by_num1, n, ids, k, FIELD_NUM1);
+    index->by_num2 = merge_sorted(records, index->by_num2, n, ids, k, FIELD_NUM2);
+    if (index->by_time != NULL) {
+        index->by_time = merge_sorted(records, index->by_time, n, ids, k, FIELD_TIME);
+    }
+    long double *prefix = realloc(index->result_prefix, (n + k + 1) * sizeof(long double));
+    free(ids);
+    if (prefix != NULL) {
+        index->result_prefix = prefix;
+    }
+    if (index->by_result == NULL || index->by_num1 == NULL || index->by_num2 == NULL ||
+        (has_by_time && index->by_time == NULL) || prefix == NULL) {
+        history_index_free(index);
+        return 0;
+    }
+
+    // Summed again from the start, in the same order as a fresh build
+    index->count = n + k;
+    prefix[0] = 0;
+    for (size_t i = 0; i < index->count; i++) {
+        prefix[i + 1] = prefix[i] + records[index->by_result[i]].result;
+    }
+    index->store_count = total;
+    index->last_timestamp = last_timestamp;
+    return 1;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Query execution
+ * ----------------------------------------------------------------------------
+ */
+
+/* A slice of record numbers that contains every match */
+typedef struct {
+    const uint32_t *ids;    // NULL: record numbers begin..end-1 themselves
+    size_t begin;
+    size_t end;
+} Candidates;
+
+/* First position in ids[begin, end) whose field is >= value (or > value when strict) */
+static size_t lower_bound(const Record *records, const uint32_t *ids, size_t begin, size_t end,
+                          RecordField field, double value, int strict) {
+    while (begin < end) {
+        size_t mid = begin + (end - begin) / 2;
+        double v = field_value(&records[ids != NULL ? ids[mid] : mid], field);
+        if (strict ? v <= value : v < value) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+static Candidates range_slice(const Record *records, const uint32_t *ids, size_t n,
+                              RecordField field, const QueryRange *range) {
+    Candidates slice = { ids, 0, n };
+    slice.begin = lower_bound(records, ids, 0, n, field, range->lo, 0);
+    slice.end = lower_bound(records, ids, slice.begin, n, field, range->hi, 1);
+    return slice;
+}
+
+static int in_range(const QueryRange *range, double value) {
+    return !range->active || (value >= range->lo && value <= range->hi);
+}
+
+static int matches(const Record *record, const HistoryQuery *query) {
+    return (query->operator_str == NULL ||
+            strncmp(record->operator, query->operator_str, sizeof(record->operator)) == 0) &&
+           in_range(&query->result, record->result) &&
+           in_range(&query->num1, record->num1) &&
+           in_range(&query->num2, record->num2) &&
+           in_range(&query->time, (double)record->timestamp);
+}
+
+static void print_record(FILE *out, size_t number, const Record *record) {
+    char a[FORMAT_BUFFER_SIZE];
+    char b[FORMAT_BUFFER_SIZE];
+    char r[FORMAT_BUFFER_SIZE];
+    char when[32];
+    time_t timestamp = (time_t)record->timestamp;
+    struct tm local;
+
+    format_shortest(record->num1, a);
+    format_shortest(record->num2, b);
+    format_shortest(record->result, r);
+    if (localtime_r(&timestamp, &local) == NULL ||
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &local) == 0) {
+        snprintf(when, sizeof(when), "%lld", (long long)record->timestamp);
+    }
+
+    if (strcmp(record->operator, "sqrt") == 0) {
+        fprintf(out, "%zu. [%s] sqrt %s = %s\n", number, when, a, r);
+    } else {
+        fprintf(out, "%zu. [%s] %s %s %s = %s\n", number, when, a, record->operator, b, r);
+    }
+}
+
+/* Min-heap on result, used to keep the N largest matches */
+static void heap_sift_down(const Record *records, uint32_t *heap, size_t size, size_t i) {
+    for (;;) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < size && records[heap[left]].result < records[heap[smallest]].result) {
+            smallest = left;
+        }
+        if (right < size && records[heap[right]].result < records[heap[smallest]].result) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        uint32_t swap_id = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap_id;
+        i = smallest;
+    }
+}
+
+static void heap_sift_up(const Record *records, uint32_t *heap, size_t i) {
+    while (i > 0 && records[heap[i]].result < records[heap[(i - 1) / 2]].result) {
+        uint32_t swap_id = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = swap_id;
+        i = (i - 1) / 2;
+    }
+}
+
+/*
+ * Pick the smallest slice any of the query's filters selects
+ */
+static Candidates choose_candidates(const HistoryIndex *index, const Record *records,
+                                    const HistoryQuery *query) {
+    Candidates best = { index->by_result, 0, index->count };
+
+    if (query->operator_str != NULL) {
+        best.end = 0;   // an operator that was never used matches nothing
+        for (int op = 0; op < index->operator_count; op++) {
+            const OperatorPostings *postings = &index->operators[op];
+            if (strcmp(postings->operator, query->operator_str) == 0) {
+                best.ids = postings->records;
+                best.end = postings->count;
+                if (query->time.active && index->by_time == NULL) {
+                    best = range_slice(records, postings->records, postings->count,
+                                       FIELD_TIME, &query->time);
+                }
+            }
+        }
+    }
+
+    const QueryRange *ranges[] = { &query->result, &query->num1, &query->num2 };
+    const uint32_t *sorted[] = { index->by_result, index->by_num1, index->by_num2 };
+    const RecordField fields[] = { FIELD_RESULT, FIELD_NUM1, FIELD_NUM2 };
+    for (int k = 0; k < 3; k++) {
+        if (ranges[k]->active) {
+            Candidates slice = range_slice(records, sorted[k], index->count, fields[k], ranges[k]);
+            if (slice.end - slice.begin < best.end - best.begin) {
+                best = slice;
+            }
+        }
+    }
+
+    if (query->time.active) {
+        Candidates slice;
+        if (index->by_time != NULL) {
+            slice = range_slice(records, index->by_time, index->count, FIELD_TIME, &query->time);
+        } else {
+            // Record numbers are already in time order (damaged records are skipped later)
+            slice = range_slice(records, NULL, index->store_count, FIELD_TIME, &query->time);
+        }
+        if (slice.end - slice.begin < best.end - best.begin) {
+            best = slice;
+        }
+    }
+    return best;
+}
+
+/*
+ * Run one query and print its answer
+ * Without an index (index NULL) every record of the log is checked.
+ * Returns: number of matching records
+ */
+int history_query_run(HistoryIndex *index, HistoryStore *store, const HistoryQuery *query,
+                      FILE *out) {
+    size_t total = history_size(store);
+    if ((index != NULL ? index->count : total) == 0 || history_get(store, total - 1) == NULL) {
+        if (query->aggregate) {
+            fprintf(out, "count=0\n");
+        }
+        return 0;
+    }
+    const Record *records = history_get(store, 0);
+
+    int only_result_filter = index != NULL && query->operator_str == NULL &&
+                             !query->num1.active && !query->num2.active && !query->time.active;
+    Candidates slice = { NULL, 0, total };
+    if (index != NULL) {
+        slice = choose_candidates(index, records, query);
+    }
+    size_t matched = 0;
+
+    // Aggregates over a result range come straight from the prefix sums
+    if (query->aggregate && only_result_filter) {
+        if (!query->result.active) {
+            slice.begin = 0;
+            slice.end = index->count;
+        }
+        matched = slice.end - slice.begin;
+        fprintf(out, "count=%zu", matched);
+        if (matched > 0) {
+            char sum[FORMAT_BUFFER_SIZE];
+            char min[FORMAT_BUFFER_SIZE];
+            char max[FORMAT_BUFFER_SIZE];
+            format_shortest((double)(index->result_prefix[slice.end] -
+                                     index->result_prefix[slice.begin]), sum);
+            format_shortest(records[index->by_result[slice.begin]].result, min);
+            format_shortest(records[index->by_result[slice.end - 1]].result, max);
+            fprintf(out, " sum=%s min=%s max=%s", sum, min, max);
+        }
+        fprintf(out, "\n");
+        return (int)matched;
+    }
+
+    // Top N of a result range: walk the result index from the top
+    if (query->top > 0 && only_result_filter) {
+        if (!query->result.active) {
+            slice.begin = 0;
+            slice.end = index->count;
+        }
+        for (size_t i = slice.end; i > slice.begin && matched < query->top; i--, matched++) {
+            uint32_t id = index->by_result[i - 1];
+            print_record(out, (size_t)id + 1, &records[id]);
+        }
+        return (int)matched;
+    }
+
+    // General case: walk the chosen slice, checking every other filter
+    uint32_t *heap = NULL;
+    size_t heap_size = 0;
+    if (query->top > 0) {
+        heap = malloc(query->top * sizeof(uint32_t));
+        if (heap == NULL) {
+            return 0;
+        }
+    }
+    long double sum = 0;
+    double min = 0;
+    double max = 0;
+
+    for (size_t i = slice.begin; i < slice.end; i++) {
+        uint32_t id = slice.ids != NULL ? slice.ids[i] : (uint32_t)i;
+        const Record *record = &records[id];
+        if ((slice.ids == NULL && !history_record_valid(record)) || !matches(record, query)) {
+            continue;
+        }
+
+        if (query->aggregate) {
+            if (matched == 0 || record->result < min) {
+                min = record->result;
+            }
+            if (matched == 0 || record->result > max) {
+                max = record->result;
+            }
+            sum += record->result;
+        } else if (heap != NULL) {
+            if (heap_size < query->top) {
+                heap[heap_size++] = id;
+                heap_sift_up(records, heap, heap_size - 1);
+            } else if (record->result > records[heap[0]].result) {
+                heap[0] = id;
+                heap_sift_down(records, heap, heap_size, 0);
+            }
+        } else if (query->limit == 0 || matched < query->limit) {
+            print_record(out, (size_t)id + 1, record);
+        }
+        matched++;
+    }
+
+    if (query->aggregate) {
+        fprintf(out, "count=%zu", matched);
+        if (matched > 0) {
+            char text[3][FORMAT_BUFFER_SIZE];
+            format_shortest((double)sum, text[0]);
+            format_shortest(min, text[1]);
+            format_shortest(max, text[2]);
+            fprintf(out, " sum=%s min=%s max=%s", text[0], text[1], text[2]);
+        }
+        fprintf(out, "\n");
+    } else if (heap != NULL) {
+        // Pop the heap into descending order
+        size_t shown = heap_size;
+        for (size_t end = heap_size; end > 1; end--) {
+            uint32_t swap_id = heap[0];
+            heap[0] = heap[end - 1];
+            heap[end - 1] = swap_id;
+            heap_sift_down(records, heap, end - 1, 0);
+        }
+        for (size_t i = 0; i < shown; i++) {
+            print_record(out, (size_t)heap[i] + 1, &records[heap[i]]);
+        }
+        matched = shown;
+    }
+    free(heap);
+    return (int)matched;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Command line
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Parse "LO:HI", "LO:", ":HI" or a single value "V"
+ * Returns: 1 on success, 0 on malformed input
+ */
+static int parse_range(const char *text, QueryRange *range) {
+    char *end;
+    const char *colon = strchr(text, ':');
+
+    range->active = 1;
+    range->lo = -HUGE_VAL;
+    range->hi = HUGE_VAL;
+    if (colon == NULL) {
+        range->lo = strtod(text, &end);
+        range->hi = range->lo;
+        return end != text && *end == '\0';
+    }
+    if (colon != text) {
+        range->lo = strtod(text, &end);
+        if (end != colon) {
+            return 0;
+        }
+    }
+    if (colon[1] != '\0') {
+        range->hi = strtod(colon + 1, &end);
+        if (*end != '\0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void query_usage(const char *program) {
+    printf("Usage: %s --query [filters] [output]\n", program);
+    printf("       %s --query --session   (one query per line from stdin)\n", program);
+    printf("Filters:\n");
+    printf("  op=OP             operator (+ - * / ^ sqrt %%)\n");
+    printf("  result=LO:HI      result range (either end may be omitted)\n");
+    printf("  num1=LO:HI        first operand range\n");
+    printf("  num2=LO:HI        second operand range\n");
+    printf("  since=T until=T   time window, seconds since the epoch\n");
+    printf("  last=SECONDS      time window ending now\n");
+    printf("Output:\n");
+    printf("  top=N             the N largest results\n");
+    printf("  limit=N           at most N matching records\n");
+    printf("  agg               count, sum, min and max of the results\n");
+}
+
+/*
+ * Fill query from the filter and output arguments args[0..count)
+ * Returns: -1 on success, or the position of the first invalid argument
+ */
+static int parse_query(char *const *args, int count, HistoryQuery *query) {
+    memset(query, 0, sizeof(*query));
+    query->time.lo = -HUGE_VAL;
+    query->time.hi = HUGE_VAL;
+
+    for (int i = 0; i < count; i++) {
+        const char *arg = args[i];
+        const char *value = strchr(arg, '=');
+        value = value != NULL ? value + 1 : "";
+        int ok = 1;
+
+        if (strncmp(arg, "op=", 3) == 0) {
+            query->operator_str = value;
+        } else if (strncmp(arg, "result=", 7) == 0) {
+            ok = parse_range(value, &query->result);
+        } else if (strncmp(arg, "num1=", 5) == 0) {
+            ok = parse_range(value, &query->num1);
+        } else if (strncmp(arg, "num2=", 5) == 0) {
+            ok = parse_range(value, &query->num2);
+        } else if (strncmp(arg, "since=", 6) == 0) {
+            query->time.active = 1;
+            query->time.lo = strtod(value, NULL);
+        } else if (strncmp(arg, "until=", 6) == 0) {
+            query->time.active = 1;
+            query->time.hi = strtod(value, NULL);
+        } else if (strncmp(arg, "last=", 5) == 0) {
+            query->time.active = 1;
+            query->time.lo = (double)time(NULL) - strtod(value, NULL);
+        } else if (strncmp(arg, "top=", 4) == 0) {
+            query->top = strtoul(value, NULL, 10);
+        } else if (strncmp(arg, "limit=", 6) == 0) {
+            query->limit = strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "agg") == 0) {
+            query->aggregate = 1;
+        } else {
+            ok = 0;
+        }
+        if (!ok) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Answer queries read from stdin, one per line in the same form as the
+ * command-line arguments ("op=+ result=10:20 top=5"). The log is indexed
+ * once; before each query the index takes in whatever was appended since.
+ * Every answer ends with an empty line.
+ */
+static int run_session(HistoryStore *store) {
+    HistoryIndex index;
+    if (!history_index_build(&index, store)) {
+        fprintf(stderr, "Error: Could not index history\n");
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, stdin) != -1) {
+        char *args[HISTORY_MAX_QUERY_ARGS];
+        char *saved;
+        int count = 0;
+        for (char *word = strtok_r(line, " \t\r\n", &saved); word != NULL;
+             word = strtok_r(NULL, " \t\r\n", &saved)) {
+            if (count == HISTORY_MAX_QUERY_ARGS) {
+                count++;
+                break;
+            }
+            args[count++] = word;
+        }
+        if (count == 0 || args[0][0] == '#') {
+            continue;
+        }
+
+        HistoryQuery query;
+        int bad = count > HISTORY_MAX_QUERY_ARGS ? -2 : parse_query(args, count, &query);
+        if (bad == -2) {
+            printf("Error: More than %d query arguments\n", HISTORY_MAX_QUERY_ARGS);
+        } else if (bad >= 0) {
+            printf("Error: Invalid query argument '%s'\n", args[bad]);
+        } else if (!history_refresh(store) || !history_index_update(&index, store)) {
+            printf("Error: Could not index history\n");
+        } else {
+            history_query_run(&index, store, &query, stdout);
+        }
+        printf("\n");
+        fflush(stdout);
+    }
+
+    free(line);
+    history_index_free(&index);
+    return 0;
+}
+
+/*
+ * Entry point for: cli_calculator --query [--session | filters...]
+ */
+int history_query_main(int argc, char *argv[]) {
+    int session = argc == 3 && strcmp(argv[2], "--session") == 0;
+    HistoryQuery query;
+    int bad = session ? -1 : parse_query(argv + 2, argc - 2, &query);
+    if (bad >= 0) {
+        printf("Error: Invalid query argument '%s'\n", argv[2 + bad]);
+        query_usage(argv[0]);
+        return 1;
+    }
+
+    HistoryStore store;
+    if (!history_open_readonly(&store, HISTORY_FILE)) {
+        printf("Error: Could not open history file '%s'\n", HISTORY_FILE);
+        history_close(&store);
+        return 1;
+    }
+    int status = 0;
+    if (session) {
+        status = run_session(&store);
+    } else {
+        history_query_run(NULL, &store, &query, stdout);
+    }
+    history_close(&store);
+    return status;
+}
@@ -0,0 +1,65 @@
+/*
+ * History Query Header File
+ * Secondary indexes over the history log and the queries they answer
+ */
+
+#ifndef HISTORY_QUERY_H
+#define HISTORY_QUERY_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "history.h"
+
+#define HISTORY_MAX_OPERATORS 16
+#define HISTORY_MAX_QUERY_ARGS 32   // per line of a --query --session
+
+// Record numbers of every entry with one operator, oldest first
+typedef struct {
+    char operator[8];
+    uint32_t *records;
+    size_t count;
+} OperatorPostings;
+
+// Built once over the first `count` records of a store, then kept up to
+// date with history_index_update(). Record numbers are 32-bit, which
+// covers logs of up to four billion entries.
+typedef struct {
+    size_t count;               // records indexed (valid entries only)
+    uint32_t *by_result;        // record numbers sorted by result
+    uint32_t *by_num1;          // ... by first operand
+    uint32_t *by_num2;          // ... by second operand
+    uint32_t *by_time;          // ... by timestamp; NULL when the log is already in time order
+    long double *result_prefix; // result_prefix[i] = sum of the first i results in by_result order
+    OperatorPostings operators[HISTORY_MAX_OPERATORS];
+    int operator_count;
+    size_t store_count;         // history_size() when the index was last brought up to date
+    int64_t last_timestamp;     // of the newest indexed record, to check appends stay in order
+} HistoryIndex;
+
+typedef struct {
+    double lo;
+    double hi;
+    int active;
+} QueryRange;
+
+typedef struct {
+    const char *operator_str;   // NULL for any operator
+    QueryRange result;
+    QueryRange num1;
+    QueryRange num2;
+    QueryRange time;            // seconds since the epoch, inclusive
+    size_t top;                 // > 0: only the N largest results
+    size_t limit;               // > 0: print at most N matches
+    int aggregate;              // print count/sum/min/max instead of records
+} HistoryQuery;
+
+int history_index_build(HistoryIndex *index, HistoryStore *store);
+int history_index_update(HistoryIndex *index, HistoryStore *store);
+void history_index_free(HistoryIndex *index);
+// index may be NULL: the log is then scanned once, which is cheaper than
+// indexing it for a single query
+int history_query_run(HistoryIndex *index, HistoryStore *store, const HistoryQuery *query,
+                      FILE *out);
+int history_query_main(int argc, char *argv[]);
+
+#endif  // HISTORY_QUERY_H
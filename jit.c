@@ -0,0 +1,662 @@
+/*
+ * JIT Implementation File
+ *
+ * jit_compile() turns a RegisterProgram into two native functions in one
+ * mmap'ed buffer:
+ *
+ *   scalar  int f(const double *variables, double *result)
+ *           SSE2, one evaluation. Returns 0, or k+1 when instruction k
+ *           divided by zero.
+ *   packed  size_t f(const double *const *columns, size_t start,
+ *                    size_t end, double *results)
+ *           AVX2, four rows per iteration. Runs from row start until
+ *           fewer than four rows are left or a group of four has a zero
+ *           divisor, and returns the row it stopped at. Only generated
+ *           when the CPU has AVX2 (see vector_isa()).
+ *
+ * Register allocation is direct: every result register of the program
+ * (one per stack level and temporary) gets its own xmm/ymm register,
+ * constants are read from a pool after the code (RIP-relative, stored
+ * four times over for the packed version), and variables are read from
+ * memory as instruction operands. Programs that need more than
+ * JIT_MAX_LIVE_VALUES result registers, or that use the remainder
+ * operator (fmod has no SSE instruction) or call a function, are not
+ * compiled.
+ *
+ *   xmm0-12   result registers
+ *   xmm13     0.0, for division checks
+ *   xmm14/15  scratch
+ *
+ * The buffer is written while mapped read/write and then switched to
+ * read/execute, so it is never writable and executable at once.
+ * On anything but x86-64 jit_compile() returns NULL and callers keep
+ * using the register VM.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jit.h"
+#include "vector_eval.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+#define JIT_ROW_LOCAL 64
+
+typedef int (*JitScalarFunction)(const double *variables, double *result);
+typedef size_t (*JitPackedFunction)(const double *const *columns, size_t start, size_t end,
+                                    double *results);
+
+struct JitCode {
+    void *memory;
+    size_t size;
+    JitScalarFunction scalar;
+    JitPackedFunction packed;   // NULL without AVX2
+};
+
+static CalcStatus jit_error(CalcError *error, CalcStatus status, int position,
+                            const char *message) {
+    if (error != NULL) {
+        error->status = status;
+        error->position = position;
+        snprintf(error->message, sizeof(error->message), "%s", message);
+    }
+    return status;
+}
+
+#ifdef JIT_X86_64
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Machine code emitter
+ * ----------------------------------------------------------------------------
+ */
+
+enum { RAX = 0, RCX = 1, RDX = 2, RSI = 6, RDI = 7 };
+enum { ZERO_REGISTER = 13, CHECK_REGISTER = 14, SCRATCH_REGISTER = 15 };
+enum { POOL_SCALAR, POOL_PACKED };
+
+// A reference to a constant, patched once the pools are placed
+typedef struct {
+    size_t offset;      // of the disp32 field
+    int pool;
+    int constant;
+} PoolFixup;
+
+typedef struct {
+    uint8_t *code;
+    size_t length;
+    size_t capacity;
+    int overflow;
+    PoolFixup *fixups;
+    int fixup_count;
+} Emitter;
+
+typedef enum { MEM_BASE_DISP, MEM_BASE_INDEX8, MEM_CONSTANT } MemoryKind;
+
+// ModRM r/m operand: a vector register or memory
+typedef struct {
+    int is_register;
+    int reg;
+    MemoryKind kind;
+    int base;
+    int index;
+    int32_t disp;
+    int pool;
+    int constant;
+} Operand;
+
+static void emit_u8(Emitter *e, uint8_t byte) {
+    if (e->length < e->capacity) {
+        e->code[e->length] = byte;
+    } else {
+        e->overflow = 1;
+    }
+    e->length++;
+}
+
+static void emit_bytes(Emitter *e, const uint8_t *bytes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        emit_u8(e, bytes[i]);
+    }
+}
+
+static void emit_u32(Emitter *e, uint32_t value) {
+    for (int i = 0; i < 4; i++) {
+        emit_u8(e, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void patch_rel32(Emitter *e, size_t at, size_t target) {
+    int32_t rel = (int32_t)((int64_t)target - (int64_t)(at + 4));
+    for (int i = 0; i < 4 && at + 4 <= e->capacity; i++) {
+        e->code[at + i] = (uint8_t)((uint32_t)rel >> (8 * i));
+    }
+}
+
+static Operand vector_register(int reg) {
+    Operand op = { 0 };
+    op.is_register = 1;
+    op.reg = reg;
+    return op;
+}
+
+static Operand memory_base_disp(int base, int32_t disp) {
+    Operand op = { 0 };
+    op.kind = MEM_BASE_DISP;
+    op.base = base;
+    op.disp = disp;
+    return op;
+}
+
+static Operand memory_base_index8(int base, int index) {
+    Operand op = { 0 };
+    op.kind = MEM_BASE_INDEX8;
+    op.base = base;
+    op.index = index;
+    return op;
+}
+
+static Operand memory_constant(int pool, int constant) {
+    Operand op = { 0 };
+    op.kind = MEM_CONSTANT;
+    op.pool = pool;
+    op.constant = constant;
+    return op;
+}
+
+// REX/VEX extension bits of an r/m operand
+static int operand_x(const Operand *rm) {
+    return !rm->is_register && rm->kind == MEM_BASE_INDEX8 ? rm->index >> 3 : 0;
+}
+
+static int operand_b(const Operand *rm) {
+    if (rm->is_register) {
+        return rm->reg >> 3;
+    }
+    return rm->kind == MEM_CONSTANT ? 0 : rm->base >> 3;
+}
+
+static void emit_modrm(Emitter *e, int reg, const Operand *rm) {
+    if (rm->is_register) {
+        emit_u8(e, (uint8_t)(0xC0 | (reg & 7) << 3 | (rm->reg & 7)));
+        return;
+    }
+    switch (rm->kind) {
+        case MEM_BASE_DISP:
+            emit_u8(e, (uint8_t)(0x80 | (reg & 7) << 3 | (rm->base & 7)));
+            if ((rm->base & 7) == 4) {
+                emit_u8(e, 0x24);
+            }
+            emit_u32(e, (uint32_t)rm->disp);
+            break;
+        case MEM_BASE_INDEX8:     // base must not be rbp/r13
+            emit_u8(e, (uint8_t)(0x04 | (reg & 7) << 3));
+            emit_u8(e, (uint8_t)(0xC0 | (rm->index & 7) << 3 | (rm->base & 7)));
+            break;
+        case MEM_CONSTANT:        // [rip + disp32], disp32 patched later
+            emit_u8(e, (uint8_t)(0x05 | (reg & 7) << 3));
+            e->fixups[e->fixup_count].offset = e->length;
+            e->fixups[e->fixup_count].pool = rm->pool;
+            e->fixups[e->fixup_count].constant = rm->constant;
+            e->fixup_count++;
+            emit_u32(e, 0);
+            break;
+    }
+}
+
+// Legacy SSE encoding: prefix [REX] 0F opcode ModRM
+static void emit_sse(Emitter *e, uint8_t prefix, uint8_t opcode, int reg, Operand rm) {
+    uint8_t rex = (uint8_t)(0x40 | (reg >> 3) << 2 | operand_x(&rm) << 1 | operand_b(&rm));
+    emit_u8(e, prefix);
+    if (rex != 0x40) {
+        emit_u8(e, rex);
+    }
+    emit_u8(e, 0x0F);
+    emit_u8(e, opcode);
+    emit_modrm(e, reg, &rm);
+}
+
+// Three-byte VEX encoding, 256-bit, 66 prefix: C4 RXB.map W.vvvv.L.pp opcode ModRM
+static void emit_vex256(Emitter *e, int map, uint8_t opcode, int reg, int vvvv, Operand rm) {
+    emit_u8(e, 0xC4);
+    emit_u8(e, (uint8_t)((!(reg >> 3)) << 7 | (!operand_x(&rm)) << 6 | (!operand_b(&rm)) << 5 | map));
+    emit_u8(e, (uint8_t)((~vvvv & 0xF) << 3 | 1 << 2 | 1));
+    emit_u8(e, opcode);
+    emit_modrm(e, reg, &rm);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Code generation
+ * ----------------------------------------------------------------------------
+ */
+
+// Where a program register lives in generated code
+typedef enum { LOC_VECTOR, LOC_CONSTANT, LOC_VARIABLE } LocationKind;
+
+typedef struct {
+    LocationKind kind;
+    int index;
+} Location;
+
+static Location locate(const RegisterProgram *program, uint32_t reg) {
+    Location loc;
+    int variable_base = program->constant_count;
+    int result_base = variable_base + program->variable_count;
+    if ((int)reg < variable_base) {
+        loc.kind = LOC_CONSTANT;
+        loc.index = (int)reg;
+    } else if ((int)reg < result_base) {
+        loc.kind = LOC_VARIABLE;
+        loc.index = (int)reg - variable_base;
+    } else {
+        loc.kind = LOC_VECTOR;
+        loc.index = (int)reg - result_base;
+    }
+    return loc;
+}
+
+static Operand scalar_operand(Location loc) {
+    switch (loc.kind) {
+        case LOC_CONSTANT: return memory_constant(POOL_SCALAR, loc.index);
+        case LOC_VARIABLE: return memory_base_disp(RDI, loc.index * 8);
+        default:           return vector_register(loc.index);
+    }
+}
+
+static void scalar_load(Emitter *e, int xmm, Location loc) {
+    if (loc.kind == LOC_VECTOR) {
+        if (loc.index != xmm) {
+            emit_sse(e, 0x66, 0x28, xmm, vector_register(loc.index));   // movapd
+        }
+    } else {
+        emit_sse(e, 0xF2, 0x10, xmm, scalar_operand(loc));              // movsd
+    }
+}
+
+/*
+ * int f(const double *variables /rdi/, double *result /rsi/)
+ */
+static void generate_scalar(Emitter *e, const RegisterProgram *program) {
+    static const uint8_t sse_ops[] = { 0x58, 0x5C, 0x59, 0x5E };    // addsd subsd mulsd divsd
+
+    emit_sse(e, 0x66, 0x57, ZERO_REGISTER, vector_register(ZERO_REGISTER));     // xorpd
+    for (int k = 0; k + 1 < program->length; k++) {
+        const RegisterInstruction *ins = &program->code[k];
+        Location dst = locate(program, ins->dst);
+        Location a = locate(program, ins->a);
+        Location b = locate(program, ins->b);
+
+        if (b.kind == LOC_VECTOR && b.index == dst.index) {
+            scalar_load(e, SCRATCH_REGISTER, b);
+            b.index = SCRATCH_REGISTER;
+        }
+        if (ins->op == REG_DIV) {
+            // ucomisd b, 0; jp ok; jne ok; mov eax, k+1; ret; ok:
+            if (b.kind != LOC_VECTOR) {
+                scalar_load(e, SCRATCH_REGISTER, b);
+                b.kind = LOC_VECTOR;
+                b.index = SCRATCH_REGISTER;
+            }
+            emit_sse(e, 0x66, 0x2E, b.index, vector_register(ZERO_REGISTER));
+            static const uint8_t skip[] = { 0x7A, 0x08, 0x75, 0x06, 0xB8 };
+            emit_bytes(e, skip, sizeof(skip));
+            emit_u32(e, (uint32_t)k + 1);
+            emit_u8(e, 0xC3);
+        }
+        scalar_load(e, dst.index, a);
+        emit_sse(e, 0xF2, sse_ops[ins->op], dst.index, scalar_operand(b));
+    }
+
+    Location result = locate(program, program->result);
+    if (result.kind != LOC_VECTOR) {
+        scalar_load(e, SCRATCH_REGISTER, result);
+        result.kind = LOC_VECTOR;
+        result.index = SCRATCH_REGISTER;
+    }
+    emit_sse(e, 0xF2, 0x11, result.index, memory_base_disp(RSI, 0));    // movsd [rsi], x
+    static const uint8_t epilogue[] = { 0x31, 0xC0, 0xC3 };             // xor eax, eax; ret
+    emit_bytes(e, epilogue, sizeof(epilogue));
+}
+
+// Memory operand for four rows of a location; variables go through rax
+static Operand packed_operand(Emitter *e, Location loc) {
+    switch (loc.kind) {
+        case LOC_CONSTANT:
+            return memory_constant(POOL_PACKED, loc.index);
+        case LOC_VARIABLE: {
+            static const uint8_t load_column[] = { 0x48, 0x8B, 0x87 };     // mov rax, [rdi + disp32]
+            emit_bytes(e, load_column, sizeof(load_column));
+            emit_u32(e, (uint32_t)loc.index * 8);
+            return memory_base_index8(RAX, RSI);                           // [rax + rsi*8]
+        }
+        default:
+            return vector_register(loc.index);
+    }
+}
+
+static void packed_load(Emitter *e, int ymm, Location loc) {
+    if (loc.kind == LOC_VECTOR) {
+        if (loc.index != ymm) {
+            emit_vex256(e, 1, 0x28, ymm, 0, vector_register(loc.index));  // vmovapd
+        }
+    } else {
+        emit_vex256(e, 1, 0x10, ymm, 0, packed_operand(e, loc));          // vmovupd
+    }
+}
+
+/*
+ * size_t f(const double *const *columns /rdi/, size_t row /rsi/,
+ *          size_t end /rdx/, double *results /rcx/)
+ */
+static void generate_packed(Emitter *e, const RegisterProgram *program, size_t *exits,
+                            int *exit_count) {
+    static const uint8_t avx_ops[] = { 0x58, 0x5C, 0x59, 0x5E };    // vaddpd vsubpd vmulpd vdivpd
+
+    emit_vex256(e, 1, 0x57, ZERO_REGISTER, ZERO_REGISTER, vector_register(ZERO_REGISTER));
+    size_t loop = e->length;
+    static const uint8_t loop_test[] = {
+        0x48, 0x8D, 0x46, 0x04,     // lea rax, [rsi + 4]
+        0x48, 0x39, 0xD0,           // cmp rax, rdx
+        0x0F, 0x87                  // ja exit
+    };
+    emit_bytes(e, loop_test, sizeof(loop_test));
+    exits[(*exit_count)++] = e->length;
+    emit_u32(e, 0);
+
+    for (int k = 0; k + 1 < program->length; k++) {
+        const RegisterInstruction *ins = &program->code[k];
+        Location dst = locate(program, ins->dst);
+        Location a = locate(program, ins->a);
+        Location b = locate(program, ins->b);
+
+        if (b.kind == LOC_VECTOR && b.index == dst.index) {
+            packed_load(e, SCRATCH_REGISTER, b);
+            b.index = SCRATCH_REGISTER;
+        }
+        if (a.kind != LOC_VECTOR) {
+            packed_load(e, dst.index, a);
+            a.kind = LOC_VECTOR;
+            a.index = dst.index;
+        }
+        if (ins->op == REG_DIV) {
+            // Leave the group to the caller if any divisor is zero
+            if (b.kind != LOC_VECTOR) {
+                packed_load(e, SCRATCH_REGISTER, b);
+                b.kind = LOC_VECTOR;
+                b.index = SCRATCH_REGISTER;
+            }
+            emit_vex256(e, 1, 0xC2, CHECK_REGISTER, b.index, vector_register(ZERO_REGISTER));
+            emit_u8(e, 0x00);                                           // vcmppd EQ_OQ
+            emit_vex256(e, 1, 0x50, RAX, 0, vector_register(CHECK_REGISTER));  // vmovmskpd eax
+            static const uint8_t any_zero[] = { 0x85, 0xC0, 0x0F, 0x85 };     // test eax, eax; jnz exit
+            emit_bytes(e, any_zero, sizeof(any_zero));
+            exits[(*exit_count)++] = e->length;
+            emit_u32(e, 0);
+        }
+        emit_vex256(e, 1, avx_ops[ins->op], dst.index, a.index, packed_operand(e, b));
+    }
+
+    Location result = locate(program, program->result);
+    if (result.kind != LOC_VECTOR) {
+        packed_load(e, SCRATCH_REGISTER, result);
+        result.index = SCRATCH_REGISTER;
+    }
+    emit_vex256(e, 1, 0x11, result.index, 0, memory_base_index8(RCX, RSI));   // vmovupd [rcx + rsi*8]
+    static const uint8_t next[] = { 0x48, 0x83, 0xC6, 0x04, 0xE9 };         // add rsi, 4; jmp loop
+    emit_bytes(e, next, sizeof(next));
+    emit_u32(e, 0);
+    patch_rel32(e, e->length - 4, loop);
+
+    size_t exit = e->length;
+    for (int i = 0; i < *exit_count; i++) {
+        patch_rel32(e, exits[i], exit);
+    }
+    static const uint8_t epilogue[] = {
+        0x48, 0x89, 0xF0,           // mov rax, rsi
+        0xC5, 0xF8, 0x77,           // vzeroupper
+        0xC3                        // ret
+    };
+    emit_bytes(e, epilogue, sizeof(epilogue));
+}
+
+static void align_to(Emitter *e, size_t alignment, uint8_t fill) {
+    while (e->length % alignment != 0) {
+        emit_u8(e, fill);
+    }
+}
+
+/*
+ * Compile program to native code
+ * Returns: the code, or NULL if the program cannot be compiled
+ */
+JitCode *jit_compile(const RegisterProgram *program) {
+    int live = program->register_count - program->constant_count - program->variable_count;
+    if (live > JIT_MAX_LIVE_VALUES) {
+        return NULL;
+    }
+    for (int i = 0; i < program->length; i++) {
+        if (program->code[i].op >= REG_MOD && program->code[i].op < REG_HALT) {
+            return NULL;
+        }
+    }
+    int packed = strcmp(vector_isa(), "avx2") == 0;
+
+    // Generous upper bound: no instruction sequence below exceeds it
+    size_t capacity = 512 + (size_t)program->length * 160 + (size_t)program->constant_count * 40;
+    size_t page = 4096;
+    capacity = (capacity + page - 1) / page * page;
+
+    Emitter e = { 0 };
+    e.capacity = capacity;
+    e.fixups = malloc(((size_t)program->length * 8 + 8) * sizeof(PoolFixup));
+    size_t *exits = malloc(((size_t)program->length + 2) * sizeof(size_t));
+    JitCode *code = malloc(sizeof(JitCode));
+    void *memory = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (e.fixups == NULL || exits == NULL || code == NULL || memory == MAP_FAILED) {
+        free(e.fixups);
+        free(exits);
+        free(code);
+        if (memory != MAP_FAILED) {
+            munmap(memory, capacity);
+        }
+        return NULL;
+    }
+    e.code = memory;
+
+    generate_scalar(&e, program);
+    size_t packed_entry = 0;
+    if (packed) {
+        int exit_count = 0;
+        align_to(&e, 16, 0xCC);
+        packed_entry = e.length;
+        generate_packed(&e, program, exits, &exit_count);
+    }
+
+    // Constant pools: one double each for scalar code, four for packed
+    align_to(&e, 32, 0);
+    size_t scalar_pool = e.length;
+    for (int c = 0; c < program->constant_count; c++) {
+        uint64_t bits;
+        memcpy(&bits, &program->constants[c], sizeof(bits));
+        emit_u32(&e, (uint32_t)bits);
+        emit_u32(&e, (uint32_t)(bits >> 32));
+    }
+    align_to(&e, 32, 0);
+    size_t packed_pool = e.length;
+    for (int c = 0; packed && c < program->constant_count; c++) {
+        uint64_t bits;
+        memcpy(&bits, &program->constants[c], sizeof(bits));
+        for (int lane = 0; lane < 4; lane++) {
+            emit_u32(&e, (uint32_t)bits);
+            emit_u32(&e, (uint32_t)(bits >> 32));
+        }
+    }
+    for (int f = 0; f < e.fixup_count; f++) {
+        const PoolFixup *fixup = &e.fixups[f];
+        size_t target = fixup->pool == POOL_SCALAR ? scalar_pool + (size_t)fixup->constant * 8
+                                                   : packed_pool + (size_t)fixup->constant * 32;
+        patch_rel32(&e, fixup->offset, target);
+    }
+    free(e.fixups);
+    free(exits);
+
+    if (e.overflow || mprotect(memory, capacity, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, capacity);
+        free(code);
+        return NULL;
+    }
+
+    code->memory = memory;
+    code->size = capacity;
+    // Object-to-function pointer conversion, as with dlsym()
+    memcpy(&code->scalar, &(void *){ memory }, sizeof(code->scalar));
+    code->packed = NULL;
+    if (packed) {
+        void *entry = (uint8_t *)memory + packed_entry;
+        memcpy(&code->packed, &entry, sizeof(code->packed));
+    }
+    return code;
+}
+
+void jit_free(JitCode *code) {
+    if (code != NULL) {
+        munmap(code->memory, code->size);
+        free(code);
+    }
+}
+
+#else  // !JIT_X86_64
+
+JitCode *jit_compile(const RegisterProgram *program) {
+    (void)program;
+    return NULL;
+}
+
+void jit_free(JitCode *code) {
+    (void)code;
+}
+
+#endif  // JIT_X86_64
+
+/*
+ * Returns: which native code was generated, for diagnostics
+ */
+const char *jit_description(const JitCode *code) {
+    if (code == NULL) {
+        return "interpreter";
+    }
+    return code->packed != NULL ? "x86-64 sse2+avx2" : "x86-64 sse2";
+}
+
+/*
+ * Evaluate compiled code once
+ * Returns: CALC_OK, CALC_ERR_DIVISION_BY_ZERO or CALC_ERR_UNBOUND_VARIABLE
+ */
+CalcStatus jit_evaluate(const JitCode *code, const RegisterProgram *program,
+                        const double *variables, double *result, CalcError *error) {
+    if (program->variable_count > 0 && variables == NULL) {
+        return jit_error(error, CALC_ERR_UNBOUND_VARIABLE, -1, "Unbound variable");
+    }
+    int failed = code->scalar(variables, result);
+    if (failed != 0) {
+        return jit_error(error, CALC_ERR_DIVISION_BY_ZERO, program->positions[failed - 1],
+                         "Division by zero");
+    }
+    return CALC_OK;
+}
+
+/*
+ * Evaluate compiled code for every row of columns, like evaluate_columns()
+ * Groups of four rows go through the packed code; groups it refuses (a
+ * zero divisor) and the last few rows go through the scalar code, which
+ * reports each row's status.
+ * Returns: CALC_OK, or the first failure when row_status is NULL
+ */
+CalcStatus jit_evaluate_columns(const JitCode *code, const RegisterProgram *program,
+                                const double *const *columns, size_t rows, double *results,
+                                unsigned char *row_status, CalcError *error) {
+    double local_row[JIT_ROW_LOCAL];
+    double *row = local_row;
+    CalcStatus status = CALC_OK;
+
+    if (program->variable_count > 0 && columns == NULL) {
+        return jit_error(error, CALC_ERR_UNBOUND_VARIABLE, -1, "Unbound variable");
+    }
+    if (program->variable_count > JIT_ROW_LOCAL) {
+        row = malloc((size_t)program->variable_count * sizeof(double));
+        if (row == NULL) {
+            return jit_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+    }
+
+    size_t r = 0;
+    while (r < rows && status == CALC_OK) {
+        if (code->packed != NULL) {
+            size_t done = code->packed(columns, r, rows, results);
+            if (row_status != NULL) {
+                memset(row_status + r, CALC_OK, done - r);
+            }
+            r = done;
+        }
+        size_t end = rows - r < 4 ? rows : r + 4;
+        for (; r < end; r++) {
+            for (int v = 0; v < program->variable_count; v++) {
+                row[v] = columns[v][r];
+            }
+            CalcStatus row_result = jit_evaluate(code, program, row, &results[r], error);
+            if (row_status != NULL) {
+                row_status[r] = (unsigned char)row_result;
+            } else if (row_result != CALC_OK) {
+                status = row_result;
+                break;
+            }
+        }
+    }
+
+    if (row != local_row) {
+        free(row);
+    }
+    return status;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Hot expressions
+ * ----------------------------------------------------------------------------
+ */
+
+CalcStatus hot_expression_init(HotExpression *hot, const Program *program, Arena *arena,
+                               unsigned long threshold, CalcError *error) {
+    hot->code = NULL;
+    hot->evaluations = 0;
+    hot->threshold = threshold;
+    return compile_registers(program, &hot->program, arena, error);
+}
+
+/*
+ * Evaluate with the register VM, switching to native code once the
+ * expression has been evaluated threshold times
+ */
+CalcStatus hot_evaluate(HotExpression *hot, const double *variables, double *result,
+                        CalcError *error) {
+    if (hot->code != NULL) {
+        return jit_evaluate(hot->code, &hot->program, variables, result, error);
+    }
+    if (hot->threshold > 0 && ++hot->evaluations == hot->threshold) {
+        hot->code = jit_compile(&hot->program);   // stays NULL if it cannot compile
+    }
+    return evaluate_registers(&hot->program, variables, result, error);
+}
+
+void hot_expression_free(HotExpression *hot) {
+    jit_free(hot->code);
+    hot->code = NULL;
+}
@@ -0,0 +1,60 @@
+/*
+ * JIT Header File
+ * Compiles register programs to native x86-64 code
+ */
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include "calc.h"
+#include "arena.h"
+#include "register_vm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Evaluations before hot_evaluate() compiles an expression
+#define JIT_DEFAULT_THRESHOLD 1000
+
+// Most intermediate values a program may keep live to be compiled
+#define JIT_MAX_LIVE_VALUES 13
+
+typedef struct JitCode JitCode;
+
+// jit_compile() returns NULL when the program cannot be compiled (not
+// x86-64, too many live values, or out of memory): callers then keep
+// using evaluate_registers(). Compiled code is read-only and may be
+// called from several threads at once.
+JitCode *jit_compile(const RegisterProgram *program);
+void jit_free(JitCode *code);
+const char *jit_description(const JitCode *code);
+CalcStatus jit_evaluate(const JitCode *code, const RegisterProgram *program,
+                        const double *variables, double *result, CalcError *error);
+CalcStatus jit_evaluate_columns(const JitCode *code, const RegisterProgram *program,
+                                const double *const *columns, size_t rows, double *results,
+                                unsigned char *row_status, CalcError *error);
+
+// An expression that is interpreted until it has been evaluated
+// threshold times, then compiled. Not thread-safe: use one per thread.
+// For library callers that evaluate one row at a time; the command-line
+// modes evaluate whole columns and call jit_compile() directly.
+typedef struct {
+    RegisterProgram program;
+    JitCode *code;
+    unsigned long evaluations;
+    unsigned long threshold;    // 0 never compiles
+} HotExpression;
+
+CalcStatus hot_expression_init(HotExpression *hot, const Program *program, Arena *arena,
+                               unsigned long threshold, CalcError *error);
+CalcStatus hot_evaluate(HotExpression *hot, const double *variables, double *result,
+                        CalcError *error);
+void hot_expression_free(HotExpression *hot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // JIT_H
@@ -9,7 +9,18 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <unistd.h>
 #include "calc.h"
+#include "format.h"
+#include "reduce.h"
+#include "batch.h"
+#include "columns.h"
+#include "sweep.h"
+#include "emit_c.h"
+#include "workspace_cli.h"
+#include "history.h"
+#include "history_query.h"
+#include "server.h"
 
 /*
  * Safely read an integer from stdin using fgets + sscanf
@@ -41,56 +52,135 @@ int safe_read_double(double *value) {
     return 1;
 }
 
-// History management
-#define MAX_HISTORY 100
-#define HISTORY_FILE "calculator_history.txt"
-Record history[MAX_HISTORY];
-int history_count = 0;
+/*
+ * Write value into out (FORMAT_BUFFER_SIZE bytes) in shortest round-trip form
+ * Returns: out, for use as a printf argument
+ */
+static const char *shortest(double value, char *out) {
+    format_shortest(value, out);
+    return out;
+}
 
-void save_history() {
-    FILE *file = fopen(HISTORY_FILE, "w");
-    if (file == NULL) {
-        printf("Warning: Could not save history to file.\n");
-        return;
-    }
+/*
+ * Swap function (pass by reference) - correct implementation using pointers
+ * Swaps the values of two double variables using pointer parameters
+ */
+void swap(double *a, double *b) {
+    double temp = *a;
+    *a = *b;
+    *b = temp;
+    char a_text[FORMAT_BUFFER_SIZE], b_text[FORMAT_BUFFER_SIZE];
+    printf("  [Inside swap] *a = %s, *b = %s\n", shortest(*a, a_text), shortest(*b, b_text));
+}
 
-    fprintf(file, "%d\n", history_count);
-    for (int i = 0; i < history_count; i++) {
-        fprintf(file, "%lf %lf %lf %s\n",
-            history[i].num1,
-            history[i].num2,
-            history[i].result,
-            history[i].operator);
+/*
+ * Print a libcalc error, pointing at the column where it was detected
+ */
+void print_calc_error(const CalcError *error) {
+    if (error->position >= 0) {
+        printf("Error: %s (at column %d)\n", error->message, error->position + 1);
+    } else {
+        printf("Error: %s\n", error->message);
     }
-    fclose(file);
 }
 
-void load_history() {
-    FILE *file = fopen(HISTORY_FILE, "r");
-    if (file == NULL) {
+/*
+ * Expression calculator (menu choice 8)
+ * Reads one expression, shows its postfix form and its value. All the
+ * parsing and evaluation is done by libcalc; this is only the console side.
+ */
+void expression_calculator(void) {
+    char *infix = NULL;
+    size_t capacity = 0;
+    Arena arena;
+
+    printf("\n");
+    printf("========================================\n");
+    printf("         Expression Calculator\n");
+    printf("========================================\n");
+    printf("\n");
+    printf("Supported operators: + - * / %%\n");
+    printf("support ()\n");
+    printf("Functions: sqrt(x) pow(x, y) exp(x) log(x) sin(x) cos(x)\n");
+    printf("Reductions: sum(i, 1, 10, i * i) product(...) min(...) max(...)\n");
+    printf("Examples:3 + 4 * 2, (1 + 2) * 3\n");
+    printf("\n");
+    printf("Please enter expression:");
+
+    // getline grows the buffer as needed, so expressions have no length limit
+    if (getline(&infix, &capacity, stdin) == -1) {
+        printf("Error: loading inputs fails\n");
+        free(infix);
         return;
     }
 
-    int count;
-    if (fscanf(file, "%d", &count) != 1) {
-        fclose(file);
+    size_t len = strlen(infix);
+    if (len > 0 && infix[len - 1] == '\n') {
+        infix[len - 1] = '\0';
+    }
+
+    if (strlen(infix) == 0) {
+        printf("Error: Expression is empty.\n");
+        free(infix);
         return;
     }
 
-    for (int i = 0; i < count && i < MAX_HISTORY; i++) {
-        if (fscanf(file, "%lf %lf %lf %s",
-            &history[i].num1,
-            &history[i].num2,
-            &history[i].result,
-            history[i].operator) == 4) {
-            history_count++;
+    printf("\n");
+    printf("------------------------------------------\n");
+    printf("  Expression: %s\n", infix);
+
+    arena_init(&arena);
+    Program program;
+    CalcError error;
+    CalcValue result;
+    if (compile_expression(infix, &program, &arena, &error) != CALC_OK) {
+        print_calc_error(&error);
+    } else {
+        size_t postfix_size = (size_t)program.length * 32 + 1;
+        char *postfix = arena_alloc(&arena, postfix_size);
+        if (postfix != NULL) {
+            program_to_postfix(&program, postfix, postfix_size);
+            printf("  Postfix Expression: %s\n", postfix);
         }
+
+        char out[FORMAT_BUFFER_SIZE];
+        if (evaluate_program_value(&program, &result, &error) != CALC_OK) {
+            print_calc_error(&error);
+        } else {
+            format_value(&result, FORMAT_SHORTEST, out);
+            printf("  Result:   %s\n", out);
+            printf("------------------------------------------\n");
+            printf("\n");
+        }
+    }
+
+    arena_free(&arena);
+    free(infix);
+}
+
+// History management
+// The log on disk is the history; every calculation is appended as it happens
+#define HISTORY_VIEW_LIMIT 100
+HistoryStore history;
+int history_available = 0;
+
+void load_history() {
+    history_available = history_open(&history, HISTORY_FILE);
+    if (!history_available) {
+        printf("Warning: Could not open history file '%s'.\n", HISTORY_FILE);
+    }
+}
+
+void save_history() {
+    if (history_available) {
+        history_close(&history);
+        history_available = 0;
     }
-    fclose(file);
 }
 
 void view_history() {
-     if (history_count == 0) {
+     size_t count = history_available ? history_size(&history) : 0;
+     if (count == 0) {
              printf("\nNo calculation history yet.\n\n");
              return;
         }
@@ -100,19 +190,27 @@ void view_history() {
      printf("========================================\n");
      printf("\n");
 
-     for (int i = 0; i < history_count; i++) {
-             if (strcmp(history[i].operator, "sqrt") == 0) {
-                 printf("%d. sqrt %.2lf = %.2lf\n",
-                        i + 1,
-                        history[i].num1,
-                        history[i].result);
+     // Only the most recent entries; the log itself can be arbitrarily long
+     size_t first = count > HISTORY_VIEW_LIMIT ? count - HISTORY_VIEW_LIMIT : 0;
+     if (first > 0) {
+             printf("(%zu earlier entries not shown)\n", first);
+         }
+     for (size_t i = first; i < count; i++) {
+             const Record *record = history_get(&history, i);
+             char num1_text[FORMAT_BUFFER_SIZE], num2_text[FORMAT_BUFFER_SIZE];
+             char result_text[FORMAT_BUFFER_SIZE];
+             if (record == NULL) {
+                 break;
+             }
+             if (!history_record_valid(record)) {
+                 printf("%zu. (damaged entry)\n", i + 1);
+             } else if (strcmp(record->operator, "sqrt") == 0) {
+                 printf("%zu. sqrt %s = %s\n", i + 1, shortest(record->num1, num1_text),
+                        shortest(record->result, result_text));
              } else {
-                 printf("%d. %.2lf %s %.2lf = %.2lf\n",
-                        i + 1,
-                        history[i].num1,
-                        history[i].operator,
-                        history[i].num2,
-                        history[i].result);
+                 printf("%zu. %s %s %s = %s\n", i + 1, shortest(record->num1, num1_text),
+                        record->operator, shortest(record->num2, num2_text),
+                        shortest(record->result, result_text));
              }
          }
      printf("\n");
@@ -121,15 +219,60 @@ void view_history() {
 }
 
 void clear_history() {
-     history_count = 0;
+     if (history_available && !history_clear(&history)) {
+             printf("\nError: Could not clear history.\n\n");
+             return;
+        }
      printf("\nHistory cleared successfully!\n\n");
 }
 
 
 int main(int argc, char *argv[]) {
     double num1, num2, result;
+    char num1_text[FORMAT_BUFFER_SIZE], num2_text[FORMAT_BUFFER_SIZE];
+    char result_text[FORMAT_BUFFER_SIZE];
     int choice;
 
+    // A single sum(i, ...) may use every CPU; modes that evaluate several
+    // expressions at once set this back to 1
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    reduce_set_threads(online > 0 ? (int)online : 1);
+
+    // Batch mode: one expression per line from a file or stdin
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return batch_main(argc, argv);
+    }
+
+    // Column mode: cli_calculator --columns data.csv "price * qty"
+    if (argc >= 2 && strcmp(argv[1], "--columns") == 0) {
+        return columns_main(argc, argv);
+    }
+
+    // Sweep mode: cli_calculator --sweep "sin(x) * y" x=0:10:0.01 y=0:1:0.5
+    if (argc >= 2 && strcmp(argv[1], "--sweep") == 0) {
+        return sweep_main(argc, argv);
+    }
+
+    // Workspace mode: named formulas such as "margin = revenue - cost"
+    if (argc >= 2 && strcmp(argv[1], "--workspace") == 0) {
+        return workspace_main(argc, argv);
+    }
+
+    // Code generation: cli_calculator --emit-c "a * b + c" --name f
+    if (argc >= 2 && strcmp(argv[1], "--emit-c") == 0) {
+        return emit_c_main(argc, argv);
+    }
+
+    // History queries: cli_calculator --query op=+ result=10:20 top=5 ...
+    if (argc >= 2 && strcmp(argv[1], "--query") == 0) {
+        return history_query_main(argc, argv);
+    }
+
+    // Evaluation server: cli_calculator --serve /tmp/calc.sock
+    if (argc >= 2 && strcmp(argv[1], "--serve") == 0) {
+        return server_main(argc, argv);
+    }
+
     if (argc == 3) {
         char *op = argv[1];
         num1 = atof(argv[2]);
@@ -140,7 +283,7 @@ int main(int argc, char *argv[]) {
                 return 1;
             }
             result = square_root(num1);
-            printf("sqrt(%.2lf) = %.2lf\n", num1, result);
+            printf("sqrt(%s) = %s\n", shortest(num1, num1_text), shortest(result, result_text));
         } else {
             printf("Error: Unknown single-argument operator '%s'\n", op);
             printf("Supported: sqrt\n");
@@ -153,30 +296,36 @@ int main(int argc, char *argv[]) {
         char *op = argv[2];
         if (strcmp(op, "+") == 0) {
             result = add(num1, num2);
-            printf("%.2lf + %.2lf = %.2lf\n", num1, num2, result);
+            printf("%s + %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                   shortest(result, result_text));
         } else if (strcmp(op, "-") == 0) {
             result = subtract(num1, num2);
-            printf("%.2lf - %.2lf = %.2lf\n", num1, num2, result);
+            printf("%s - %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                   shortest(result, result_text));
         } else if (strcmp(op, "x") == 0 || strcmp(op, "*") == 0) {
             result = multiply(num1, num2);
-            printf("%.2lf x %.2lf = %.2lf\n", num1, num2, result);
+            printf("%s x %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                   shortest(result, result_text));
         } else if (strcmp(op, "/") == 0) {
             if (num2 == 0) {
                 printf("Error: Cannot divide by zero!\n");
                 return 1;
             }
             result = divide(num1, num2);
-            printf("%.2lf / %.2lf = %.2lf\n", num1, num2, result);
+            printf("%s / %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                   shortest(result, result_text));
         } else if (strcmp(op, "^") == 0 || strcmp(op, "pow") == 0) {
             result = power(num1, num2);
-            printf("%.2lf ^ %.2lf = %.2lf\n", num1, num2, result);
+            printf("%s ^ %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                   shortest(result, result_text));
         } else if (strcmp(op, "%") == 0 || strcmp(op, "mod") == 0) {
             if (num2 == 0) {
                 printf("Error: Cannot perform modulo with zero!\n");
                 return 1;
             }
             result = modulo(num1, num2);
-            printf("%.2lf mod %.2lf = %.2lf\n", num1, num2, result);
+            printf("%s mod %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                   shortest(result, result_text));
         } else {
             printf("Error: Unknown operator '%s'\n", op);
             printf("Supported operators: + - x / ^ %% pow mod\n");
@@ -187,6 +336,21 @@ int main(int argc, char *argv[]) {
         printf("Usage:\n");
         printf("  %s [num1 operator num2]  - Two operands\n", argv[0]);
         printf("  %s [operator num]        - Single operand\n", argv[0]);
+        printf("  %s --batch [file] [--threads N] [--precision N]\n", argv[0]);
+        printf("          [--cache-size N] [--cache-stats] [--store FILE]\n");
+        printf("          [--decimal SCALE [--rounding MODE]] [--shapes]\n");
+        printf("                           - Evaluate one expression per line\n");
+        printf("  %s --columns FILE.csv EXPRESSION [--precision N] [--jit]\n", argv[0]);
+        printf("                           - Evaluate with variables bound to CSV columns\n");
+        printf("  %s --sweep EXPRESSION NAME=FROM:TO:STEP... [--threads N]\n", argv[0]);
+        printf("          [--precision N] [--binary]\n");
+        printf("                           - Evaluate at every point of a grid\n");
+        printf("  %s --workspace [file] [--threads N] [--precision N] [--stats]\n", argv[0]);
+        printf("                           - Keep named formulas up to date as inputs change\n");
+        printf("  %s --emit-c EXPRESSION [--name NAME]\n", argv[0]);
+        printf("                           - Print the expression as C functions\n");
+        printf("  %s --query [filters]     - Search the calculation history\n", argv[0]);
+        printf("  %s --serve SOCKET_PATH   - Answer expressions over a Unix socket\n", argv[0]);
         printf("\nExamples:\n");
         printf("  %s 10 + 20\n", argv[0]);
         printf("  %s 5 x 3\n", argv[0]);
@@ -266,14 +430,15 @@ int main(int argc, char *argv[]) {
             printf("\n");
 
             // Display initial values
+            char x_text[FORMAT_BUFFER_SIZE], y_text[FORMAT_BUFFER_SIZE];
             printf("Initial values:\n");
-            printf("  x = %.2lf, y = %.2lf\n", x, y);
+            printf("  x = %s, y = %s\n", shortest(x, x_text), shortest(y, y_text));
             printf("\n");
 
             // Test pass by reference (works correctly)
             printf("Test: swap(&x, &y) - Pass by reference\n");
             swap(&x, &y);
-            printf("  [After call] x = %.2lf, y = %.2lf\n", x, y);
+            printf("  [After call] x = %s, y = %s\n", shortest(x, x_text), shortest(y, y_text));
             printf("  Values successfully swapped!\n");
             printf("\n");
 
@@ -290,6 +455,7 @@ int main(int argc, char *argv[]) {
 
         if (choice == 8) {
             expression_calculator();
+            save_history();
             return 0;
         }
 
@@ -337,19 +503,22 @@ int main(int argc, char *argv[]) {
         switch (choice) {
             case 1:
                 result = add(num1, num2);
-                printf("  %.2lf + %.2lf = %.2lf\n", num1, num2, result);
+                printf("  %s + %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                       shortest(result, result_text));
                 snprintf(operator_str, sizeof(operator_str), "%s", "+");
                 break;
 
             case 2:
                 result = subtract(num1, num2);
-                printf("  %.2lf - %.2lf = %.2lf\n", num1, num2, result);
+                printf("  %s - %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                       shortest(result, result_text));
                 snprintf(operator_str, sizeof(operator_str), "%s", "-");
                 break;
 
             case 3:
                 result = multiply(num1, num2);
-                printf("  %.2lf * %.2lf = %.2lf\n", num1, num2, result);
+                printf("  %s * %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                       shortest(result, result_text));
                 snprintf(operator_str, sizeof(operator_str), "%s", "*");
                 break;
 
@@ -359,14 +528,16 @@ int main(int argc, char *argv[]) {
                 } else {
                     result = divide(num1, num2);
                     snprintf(operator_str, sizeof(operator_str), "%s", "/");
-                    printf("  %.2lf / %.2lf = %.2lf\n", num1, num2, result);
+                    printf("  %s / %s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                           shortest(result, result_text));
                 }
                 break;
 
             case 5:
                 result = power(num1, num2);
                 snprintf(operator_str, sizeof(operator_str), "%s", "^");
-                printf("  %.2lf^%.2lf = %.2lf\n", num1, num2, result);
+                printf("  %s^%s = %s\n", shortest(num1, num1_text), shortest(num2, num2_text),
+                       shortest(result, result_text));
                 break;
 
             case 6:
@@ -376,7 +547,8 @@ int main(int argc, char *argv[]) {
                     result = square_root(num1);
                     num2 =  0;
                     snprintf(operator_str, sizeof(operator_str), "%s", "sqrt");
-                    printf("  sqrt(%.2lf) = %.2lf\n", num1, result);
+                    printf("  sqrt(%s) = %s\n", shortest(num1, num1_text),
+                           shortest(result, result_text));
                 }
                 break;
 
@@ -386,17 +558,15 @@ int main(int argc, char *argv[]) {
                 } else {
                     result = modulo(num1, num2);
                     snprintf(operator_str, sizeof(operator_str), "%s", "%");
-                    printf("  %.2lf mod %.2lf = %.2lf\n", num1, num2, result);
+                    printf("  %s mod %s = %s\n", shortest(num1, num1_text),
+                           shortest(num2, num2_text), shortest(result, result_text));
                 }
                 break;
         }
 
-        if (history_count < MAX_HISTORY && strlen(operator_str) > 0) {
-            history[history_count].num1 = num1;
-            history[history_count].num2 = num2;
-            history[history_count].result = result;
-            snprintf(history[history_count].operator, sizeof(history[history_count].operator), "%s", operator_str);
-            history_count++;
+        if (history_available && strlen(operator_str) > 0 &&
+            !history_append(&history, num1, num2, result, operator_str)) {
+            printf("  Warning: Could not save this calculation to history.\n");
         }
 
         printf("------------------------------------------\n");
@@ -0,0 +1,532 @@
+/*
+ * Math Function Implementation File
+ *
+ * sqrt, pow, exp, log, sin and cos for expressions. Every function except
+ * sqrt is written once, on GCC vectors of four doubles (VecD), using only
+ * +, -, *, / and integer bit operations, with no branches on the value:
+ *
+ *   exp(x)     x = k*ln2 + r, |r| <= ln2/2; e^r by its Taylor series to
+ *              r^13, then scaled by 2^k built in the exponent bits
+ *   log(x)     x = m * 2^e, m in [sqrt(2)/2, sqrt(2)); with s = (m-1)/(m+1),
+ *              log(m) = 2s + 2s^3/3 + 2s^5/5 + ... to s^27. The first
+ *              terms are kept as double-double (hi + lo) so that pow()
+ *              gets log(x) to about 2^-65 relative
+ *   pow(x, y)  exp(y * log|x|) with the product in double-double, the
+ *              sign for odd integer y, and C99's special cases (pow(x, 0),
+ *              pow(1, y), zeros, infinities, NaN) patched in lane by lane
+ *   sin, cos   x = k*pi/2 + r, |r| <= pi/4 with pi/2 in four parts
+ *              (exact for |k| < 2^20), then the Taylor series of sin or
+ *              cos of r, chosen and signed by the quadrant k mod 4
+ *
+ * The scalar functions (calc_exp() and the rest) put their argument in
+ * all four lanes and return lane 0, so they and the kernels run the same
+ * operations; the AVX2 kernels do four lanes per instruction and the SSE2
+ * ones two. Results are therefore identical on every path, provided the
+ * compiler does not fuse a*b+c into one rounding (CMakeLists.txt builds
+ * this file with -ffp-contract=off).
+ *
+ * The error bounds in mathfn.h are the largest seen over 10^7 random
+ * arguments per function and range, compared with the C library's long
+ * double functions, plus arguments next to multiples of pi/2 compared
+ * with 400-bit results.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "mathfn.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATH_X86 1
+#endif
+
+#define LANES 4
+#define LANE_INLINE static inline __attribute__((always_inline))
+
+typedef double VecD __attribute__((vector_size(32)));
+typedef int64_t VecI __attribute__((vector_size(32)));
+typedef uint64_t VecU __attribute__((vector_size(32)));
+
+const CalcFunction calc_functions[CALC_FN_COUNT] = {
+    { "sqrt", 1 },
+    { "pow", 2 },
+    { "exp", 1 },
+    { "log", 1 },
+    { "sin", 1 },
+    { "cos", 1 },
+};
+
+/*
+ * Look up a function by name
+ * Returns: its CalcFunctionId, or -1
+ */
+int calc_function_lookup(const char *name, int length) {
+    for (int f = 0; f < CALC_FN_COUNT; f++) {
+        if (strncmp(calc_functions[f].name, name, (size_t)length) == 0 &&
+            calc_functions[f].name[length] == '\0') {
+            return f;
+        }
+    }
+    return -1;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Lane helpers
+ * ----------------------------------------------------------------------------
+ */
+
+#define ROUND_MAGIC 0x1.8p52    // x + ROUND_MAGIC - ROUND_MAGIC rounds x to an integer
+#define SPLITTER 134217729.0    // 2^27 + 1, splits a double into two 26-bit halves
+#define SIGN_BIT INT64_MIN
+
+LANE_INLINE VecD splat(double x) {
+    VecD v = { x, x, x, x };
+    return v;
+}
+
+LANE_INLINE VecI splat_int(int64_t x) {
+    VecI v = { x, x, x, x };
+    return v;
+}
+
+// mask lanes are all ones or all zeros, as produced by comparisons
+LANE_INLINE VecD select_lanes(VecI mask, VecD yes, VecD no) {
+    return (VecD)(((VecI)yes & mask) | ((VecI)no & ~mask));
+}
+
+LANE_INLINE VecD abs_lanes(VecD x) {
+    return (VecD)((VecI)x & ~splat_int(SIGN_BIT));
+}
+
+// Small integers (|k| < 2^51) <-> doubles, without conversion instructions
+LANE_INLINE VecI round_to_int(VecD x, VecD *rounded) {
+    VecD t = x + splat(ROUND_MAGIC);
+    *rounded = t - splat(ROUND_MAGIC);
+    return (VecI)t - (VecI)splat(ROUND_MAGIC);
+}
+
+LANE_INLINE VecD int_to_double(VecI k) {
+    return (VecD)(k + (VecI)splat(ROUND_MAGIC)) - splat(ROUND_MAGIC);
+}
+
+// s + e == a + b exactly (Knuth's two-sum)
+LANE_INLINE void two_sum(VecD a, VecD b, VecD *s, VecD *e) {
+    VecD sum = a + b;
+    VecD bb = sum - a;
+    *e = (a - (sum - bb)) + (b - bb);
+    *s = sum;
+}
+
+// p + e == a * b exactly (Dekker's product)
+LANE_INLINE void two_product(VecD a, VecD b, VecD *p, VecD *e) {
+    VecD ca = a * splat(SPLITTER);
+    VecD a_hi = ca - (ca - a);
+    VecD a_lo = a - a_hi;
+    VecD cb = b * splat(SPLITTER);
+    VecD b_hi = cb - (cb - b);
+    VecD b_lo = b - b_hi;
+    VecD product = a * b;
+    *e = ((a_hi * b_hi - product) + a_hi * b_lo + a_lo * b_hi) + a_lo * b_lo;
+    *p = product;
+}
+
+LANE_INLINE VecD horner(VecD x, const double *coefficients, int count) {
+    VecD sum = splat(coefficients[count - 1]);
+    for (int i = count - 2; i >= 0; i--) {
+        sum = sum * x + splat(coefficients[i]);
+    }
+    return sum;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                                  exp
+ * ----------------------------------------------------------------------------
+ */
+
+#define INV_LN2 1.4426950408889634
+#define LN2_HI 0x1.62e42fee00000p-1     // 32 bits, so k * LN2_HI is exact
+#define LN2_LO 0x1.a39ef35793c76p-33
+#define EXP_MAX 710.0                   // e^710 overflows
+#define EXP_MIN -746.0                  // e^-746 rounds to zero
+
+// 1/2!, 1/3!, ..., 1/13!
+static const double exp_coefficients[] = {
+    1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+    1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800.0,
+};
+
+/*
+ * e^(x + tail) for a small correction tail (0 for exp itself)
+ */
+LANE_INLINE VecD exp_lanes(VecD x, VecD tail) {
+    VecI over = (VecI)(x > splat(EXP_MAX));
+    VecI under = (VecI)(x < splat(EXP_MIN));
+    x = select_lanes(over, splat(EXP_MAX), x);
+    x = select_lanes(under, splat(EXP_MIN), x);
+    tail = select_lanes(over | under, splat(0.0), tail);
+
+    // r = r_hi + r_lo; r_hi is exact, and so is 1 + r_hi as one_hi + one_lo,
+    // which leaves the final addition as the only full-size rounding
+    VecD k, one_hi, one_lo;
+    VecI ki = round_to_int(x * splat(INV_LN2), &k);
+    VecD r_hi = x - k * splat(LN2_HI);
+    VecD r_lo = tail - k * splat(LN2_LO);
+    VecD r = r_hi + r_lo;
+    VecD p = horner(r, exp_coefficients, (int)(sizeof(exp_coefficients) / sizeof(double)));
+    two_sum(splat(1.0), r_hi, &one_hi, &one_lo);
+    p = one_hi + (one_lo + (r_lo + r * r * p));
+
+    // 2^k in two steps, since k (up to +-1076) can leave the normal range
+    VecI k1 = (VecI)((VecU)(ki + 2048) >> 1) - 1024;
+    VecI k2 = ki - k1;
+    VecD scale1 = (VecD)((k1 + 1023) << 52);
+    VecD scale2 = (VecD)((k2 + 1023) << 52);
+    return p * scale1 * scale2;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                                  log
+ * ----------------------------------------------------------------------------
+ */
+
+#define SQRT2 0x1.6a09e667f3bcdp+0
+#define TWO_THIRDS_HI 0x1.5555555555555p-1
+#define TWO_THIRDS_LO 0x1.5555555555555p-55
+
+// 2/5, 2/7, ..., 2/27: the series after 2s + 2s^3/3, in powers of s^2
+static const double log_coefficients[] = {
+    2.0 / 5, 2.0 / 7, 2.0 / 9, 2.0 / 11, 2.0 / 13, 2.0 / 15,
+    2.0 / 17, 2.0 / 19, 2.0 / 21, 2.0 / 23, 2.0 / 25, 2.0 / 27,
+};
+
+/*
+ * log(x) as hi + lo
+ */
+LANE_INLINE void log_lanes(VecD x, VecD *hi, VecD *lo) {
+    // Subnormals are scaled into the normal range first
+    VecI tiny = (VecI)(x < splat(0x1p-1022));
+    VecD y = select_lanes(tiny, x * splat(0x1p54), x);
+    VecU bits = (VecU)y;
+    VecI e = (VecI)(bits >> 52) - 1023 - (tiny & 54);
+    VecD m = (VecD)((bits & 0x000FFFFFFFFFFFFFULL) | 0x3FF0000000000000ULL);
+    VecI big = (VecI)(m > splat(SQRT2));
+    m = select_lanes(big, m * splat(0.5), m);
+    e = e - big;
+    VecD ed = int_to_double(e);
+
+    // s = (m - 1) / (m + 1) as s_hi + s_lo; m - 1 is exact
+    VecD f = m - splat(1.0);
+    VecD d_hi, d_lo, p, pe;
+    two_sum(splat(1.0), m, &d_hi, &d_lo);
+    VecD s_hi = f / d_hi;
+    two_product(s_hi, d_hi, &p, &pe);
+    VecD s_lo = (((f - p) - pe) - s_hi * d_lo) / d_hi;
+
+    // s^3 * (2/3 + s^2 * (2/5 + ...)) in double-double
+    VecD z_hi, z_lo, c_hi, c_lo, q_hi, q_lo, t_hi, t_lo;
+    two_product(s_hi, s_hi, &z_hi, &z_lo);
+    z_lo = z_lo + splat(2.0) * s_hi * s_lo;
+    two_product(s_hi, z_hi, &c_hi, &c_lo);
+    c_lo = c_lo + (s_hi * z_lo + s_lo * z_hi);
+    VecD r = horner(z_hi, log_coefficients, (int)(sizeof(log_coefficients) / sizeof(double)));
+    two_sum(splat(TWO_THIRDS_HI), z_hi * r, &q_hi, &q_lo);
+    q_lo = q_lo + splat(TWO_THIRDS_LO);
+    two_product(c_hi, q_hi, &t_hi, &t_lo);
+    t_lo = t_lo + (c_hi * q_lo + c_lo * q_hi);
+
+    // e*ln2 + 2s + that
+    VecD l_hi, l_lo, h, h_lo;
+    two_sum(splat(2.0) * s_hi, t_hi, &l_hi, &l_lo);
+    l_lo = l_lo + (splat(2.0) * s_lo + t_lo);
+    two_sum(ed * splat(LN2_HI), l_hi, &h, &h_lo);
+    h_lo = h_lo + (l_lo + ed * splat(LN2_LO));
+    VecD sum = h + h_lo;
+    VecD sum_lo = h_lo - (sum - h);
+
+    // log(+-0) = -inf, log(inf) = inf, negative or NaN gives NaN
+    VecI zero = (VecI)(x == splat(0.0));
+    VecI infinite = (VecI)(x == splat(INFINITY));
+    VecI invalid = ~(VecI)(x >= splat(0.0));
+    sum = select_lanes(zero, splat(-INFINITY), sum);
+    sum = select_lanes(infinite, splat(INFINITY), sum);
+    sum = select_lanes(invalid, splat(NAN), sum);
+    *hi = sum;
+    *lo = select_lanes(zero | infinite | invalid, splat(0.0), sum_lo);
+}
+
+LANE_INLINE VecD log1_lanes(VecD x) {
+    VecD hi, lo;
+    log_lanes(x, &hi, &lo);
+    return hi;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                                  pow
+ * ----------------------------------------------------------------------------
+ */
+
+LANE_INLINE VecD pow_lanes(VecD x, VecD y) {
+    VecD ax = abs_lanes(x);
+    VecD ay = abs_lanes(y);
+
+    VecD l_hi, l_lo, w_hi, w_lo;
+    log_lanes(ax, &l_hi, &l_lo);
+    two_product(y, l_hi, &w_hi, &w_lo);
+    w_lo = w_lo + y * l_lo;
+    VecD result = exp_lanes(w_hi, w_lo);
+
+    // Below 2^52, ay + 2^52 rounds ay to an integer whose parity is the
+    // low bit; from 2^52 to 2^53 the low bit of ay itself is the parity
+    VecD t = ay + splat(0x1p52);
+    VecI small = (VecI)(ay < splat(0x1p52));
+    VecI integer = ~small | (VecI)(t - splat(0x1p52) == ay);
+    VecI odd_small = splat_int(0) - ((VecI)t & 1);
+    VecI odd_big = (splat_int(0) - ((VecI)ay & 1)) & (VecI)(ay < splat(0x1p53));
+    VecI odd = integer & ((small & odd_small) | (~small & odd_big));
+
+    // Negative x (including -0 and -inf): odd integer y keeps the sign,
+    // a finite negative x with non-integer y has no real result
+    VecI negative = splat_int(0) - (VecI)((VecU)x >> 63);
+    result = (VecD)((VecI)result ^ (negative & odd & splat_int(SIGN_BIT)));
+    VecI invalid = (VecI)(x < splat(0.0)) & (VecI)(x > splat(-INFINITY)) & ~integer;
+    result = select_lanes(invalid, splat(NAN), result);
+
+    // pow(x, 0) = pow(1, y) = pow(-1, +-inf) = 1, even for NaN
+    VecI one = (VecI)(y == splat(0.0)) | (VecI)(x == splat(1.0)) |
+               ((VecI)(ax == splat(1.0)) & (VecI)(ay == splat(INFINITY)));
+    return select_lanes(one, splat(1.0), result);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                                sin, cos
+ * ----------------------------------------------------------------------------
+ */
+
+#define TWO_OVER_PI 0.6366197723675814
+// pi/2 = PIO2_1 + PIO2_2 + PIO2_3 + PIO2_3T; the first three have 33
+// significant bits, so k * PIO2_n is exact for |k| < 2^20
+#define PIO2_1 0x1.921fb54400000p+0
+#define PIO2_2 0x1.0b4611a600000p-34
+#define PIO2_3 0x1.3198a2e000000p-69
+#define PIO2_3T 0x1.b839a252049c1p-104
+#define SINCOS_LIMIT 0x1.8p20           // |k| stays below 2^20 up to here
+
+// (-1)^n / (2n+1)! for n = 1..8
+static const double sin_coefficients[] = {
+    -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880, -1.0 / 39916800,
+    1.0 / 6227020800.0, -1.0 / 1307674368000.0, 1.0 / 355687428096000.0,
+};
+
+// (-1)^n / (2n)! for n = 2..9
+static const double cos_coefficients[] = {
+    1.0 / 24, -1.0 / 720, 1.0 / 40320, -1.0 / 3628800, 1.0 / 479001600,
+    -1.0 / 87178291200.0, 1.0 / 20922789888000.0, -1.0 / 6402373705728000.0,
+};
+
+/*
+ * sin(x), or cos(x) = sin(x + pi/2) when cosine is 1
+ */
+LANE_INLINE VecD sincos_lanes(VecD x, int cosine) {
+    VecD k;
+    VecI quadrant = round_to_int(x * splat(TWO_OVER_PI), &k) + cosine;
+
+    // x - k*pi/2 as y0 + y1, keeping the rounding error of each step
+    VecD r1 = x - k * splat(PIO2_1);
+    VecD p2 = k * splat(PIO2_2);
+    VecD r2 = r1 - p2;
+    VecD e2 = (r1 - r2) - p2;
+    VecD p3 = k * splat(PIO2_3);
+    VecD r3 = r2 - p3;
+    VecD e3 = (r2 - r3) - p3;
+    VecD w = k * splat(PIO2_3T) - (e2 + e3);
+    VecD y0 = r3 - w;
+    VecD y1 = (r3 - y0) - w;
+
+    VecD z, z_lo;
+    two_product(y0, y0, &z, &z_lo);
+    VecD v = z * y0;
+    VecD sr = horner(z, sin_coefficients + 1, 7);
+    VecD sine = y0 - ((z * (splat(0.5) * y1 - v * sr) - y1) - v * splat(sin_coefficients[0]));
+
+    VecD hz = splat(0.5) * z;
+    VecD cr = z * horner(z, cos_coefficients, 8);
+    VecD one_minus = splat(1.0) - hz;
+    VecD cosine_value = one_minus + (((splat(1.0) - one_minus) - hz) + (z * cr - (y0 * y1 + splat(0.5) * z_lo)));
+
+    VecD result = select_lanes(splat_int(0) - (quadrant & 1), cosine_value, sine);
+    result = (VecD)((VecI)result ^ ((quadrant & 2) << 62));
+
+    // Huge arguments, infinities and NaN go to the C library
+    VecI outside = ~(VecI)(abs_lanes(x) <= splat(SINCOS_LIMIT));
+    if (outside[0] | outside[1] | outside[2] | outside[3]) {
+        for (int i = 0; i < LANES; i++) {
+            if (outside[i]) {
+                result[i] = cosine ? cos(x[i]) : sin(x[i]);
+            }
+        }
+    }
+    return result;
+}
+
+LANE_INLINE VecD exp1_lanes(VecD x) {
+    return exp_lanes(x, splat(0.0));
+}
+
+LANE_INLINE VecD sin_lanes(VecD x) {
+    return sincos_lanes(x, 0);
+}
+
+LANE_INLINE VecD cos_lanes(VecD x) {
+    return sincos_lanes(x, 1);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Scalar functions
+ * ----------------------------------------------------------------------------
+ */
+
+double calc_sqrt(double x) {
+    return sqrt(x);     // correctly rounded, like the SIMD instructions
+}
+
+double calc_pow(double x, double y) {
+    return pow_lanes(splat(x), splat(y))[0];
+}
+
+double calc_exp(double x) {
+    return exp1_lanes(splat(x))[0];
+}
+
+double calc_log(double x) {
+    return log1_lanes(splat(x))[0];
+}
+
+double calc_sin(double x) {
+    return sin_lanes(splat(x))[0];
+}
+
+double calc_cos(double x) {
+    return cos_lanes(splat(x))[0];
+}
+
+/*
+ * Call function on a (and b, for pow)
+ */
+double calc_function_apply(int function, double a, double b) {
+    switch (function) {
+        case CALC_FN_SQRT: return calc_sqrt(a);
+        case CALC_FN_POW:  return calc_pow(a, b);
+        case CALC_FN_EXP:  return calc_exp(a);
+        case CALC_FN_LOG:  return calc_log(a);
+        case CALC_FN_SIN:  return calc_sin(a);
+        case CALC_FN_COS:  return calc_cos(a);
+    }
+    return NAN;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                                  Kernels
+ * ----------------------------------------------------------------------------
+ */
+
+#define SCALAR_MATH_KERNEL(name, call)                                              \
+    static void name(const double *a, const double *b, double *out, size_t n) {    \
+        (void)b;                                                                    \
+        for (size_t i = 0; i < n; i++) {                                            \
+            out[i] = call;                                                          \
+        }                                                                           \
+    }
+
+SCALAR_MATH_KERNEL(sqrt_scalar, calc_sqrt(a[i]))
+SCALAR_MATH_KERNEL(pow_scalar, calc_pow(a[i], b[i]))
+SCALAR_MATH_KERNEL(exp_scalar, calc_exp(a[i]))
+SCALAR_MATH_KERNEL(log_scalar, calc_log(a[i]))
+SCALAR_MATH_KERNEL(sin_scalar, calc_sin(a[i]))
+SCALAR_MATH_KERNEL(cos_scalar, calc_cos(a[i]))
+
+const MathKernel math_kernels_scalar[CALC_FN_COUNT] = {
+    sqrt_scalar, pow_scalar, exp_scalar, log_scalar, sin_scalar, cos_scalar,
+};
+
+#ifdef MATH_X86
+
+/*
+ * Four values per step; a partial last step is padded with 1.0, which
+ * is in the domain of every function
+ */
+#define LANE_KERNEL(name, isa, lanes)                                            \
+    __attribute__((target(isa)))                                                    \
+    static void name(const double *a, const double *b, double *out, size_t n) {    \
+        VecD x, y = splat(1.0), r;                                                  \
+        size_t i = 0;                                                               \
+        for (; i + LANES <= n; i += LANES) {                                        \
+            memcpy(&x, a + i, sizeof(x));                                           \
+            if (b != NULL) {                                                        \
+                memcpy(&y, b + i, sizeof(y));                                       \
+            }                                                                       \
+            r = lanes;                                                              \
+            memcpy(out + i, &r, sizeof(r));                                         \
+        }                                                                           \
+        if (i < n) {                                                                \
+            x = splat(1.0);                                                         \
+            memcpy(&x, a + i, (n - i) * sizeof(double));                            \
+            if (b != NULL) {                                                        \
+                memcpy(&y, b + i, (n - i) * sizeof(double));                        \
+            }                                                                       \
+            r = lanes;                                                              \
+            memcpy(out + i, &r, (n - i) * sizeof(double));                          \
+        }                                                                           \
+    }
+
+LANE_KERNEL(pow_sse2, "sse2", pow_lanes(x, y))
+LANE_KERNEL(exp_sse2, "sse2", exp1_lanes(x))
+LANE_KERNEL(log_sse2, "sse2", log1_lanes(x))
+LANE_KERNEL(sin_sse2, "sse2", sin_lanes(x))
+LANE_KERNEL(cos_sse2, "sse2", cos_lanes(x))
+
+LANE_KERNEL(pow_avx2, "avx2", pow_lanes(x, y))
+LANE_KERNEL(exp_avx2, "avx2", exp1_lanes(x))
+LANE_KERNEL(log_avx2, "avx2", log1_lanes(x))
+LANE_KERNEL(sin_avx2, "avx2", sin_lanes(x))
+LANE_KERNEL(cos_avx2, "avx2", cos_lanes(x))
+
+__attribute__((target("sse2")))
+static void sqrt_sse2(const double *a, const double *b, double *out, size_t n) {
+    (void)b;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = sqrt(a[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void sqrt_avx2(const double *a, const double *b, double *out, size_t n) {
+    (void)b;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+    }
+    for (; i < n; i++) {
+        out[i] = sqrt(a[i]);
+    }
+}
+
+const MathKernel math_kernels_sse2[CALC_FN_COUNT] = {
+    sqrt_sse2, pow_sse2, exp_sse2, log_sse2, sin_sse2, cos_sse2,
+};
+const MathKernel math_kernels_avx2[CALC_FN_COUNT] = {
+    sqrt_avx2, pow_avx2, exp_avx2, log_avx2, sin_avx2, cos_avx2,
+};
+
+#endif  // MATH_X86
@@ -0,0 +1,68 @@
+/*
+ * Math Function Header File
+ * Functions callable from expressions (sqrt, pow, exp, log, sin, cos),
+ * one value at a time and as SIMD kernels over arrays
+ */
+
+#ifndef MATHFN_H
+#define MATHFN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Index into calc_functions[]; OP_CALL instructions carry it in slot
+typedef enum {
+    CALC_FN_SQRT,
+    CALC_FN_POW,
+    CALC_FN_EXP,
+    CALC_FN_LOG,
+    CALC_FN_SIN,
+    CALC_FN_COS,
+    CALC_FN_COUNT
+} CalcFunctionId;
+
+typedef struct {
+    const char *name;
+    int arity;          // 1, or 2 for pow
+} CalcFunction;
+
+extern const CalcFunction calc_functions[CALC_FN_COUNT];
+
+// Returns: the function called name (length characters), or -1
+int calc_function_lookup(const char *name, int length);
+
+// Every evaluator calls these, so a formula gives the same bits whether
+// it is run row by row, over columns, or folded by the optimizer.
+// Largest error seen against the exact result, in units in the last place:
+//   sqrt  0.5 (correctly rounded)     log       0.51
+//   exp   0.77                        sin, cos  0.75 for |x| <= 1.5 * 2^20
+//   pow   0.77                                  (the C library's above)
+// Domain errors give NaN and poles give an infinity, as in C's libm.
+double calc_sqrt(double x);
+double calc_pow(double x, double y);
+double calc_exp(double x);
+double calc_log(double x);
+double calc_sin(double x);
+double calc_cos(double x);
+double calc_function_apply(int function, double a, double b);
+
+// out[i] = f(a[i]) or f(a[i], b[i]); b is ignored by unary functions
+typedef void (*MathKernel)(const double *a, const double *b, double *out, size_t n);
+
+// Kernel tables indexed by CalcFunctionId. The SIMD versions compute
+// four values per step with the same operations as the scalar ones and
+// give identical results.
+extern const MathKernel math_kernels_scalar[CALC_FN_COUNT];
+#if defined(__x86_64__) || defined(__i386__)
+extern const MathKernel math_kernels_sse2[CALC_FN_COUNT];
+extern const MathKernel math_kernels_avx2[CALC_FN_COUNT];
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // MATHFN_H
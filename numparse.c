@@ -0,0 +1,162 @@
+/*
+ * Number Scanner Implementation File
+ * Accepts literals of the form  digits [. digits] [e|E [+|-] digits]
+ * (or starting with ". digits") and returns the correctly rounded double.
+ *
+ * The digits are read once into a 64-bit integer mantissa plus a decimal
+ * exponent. When the mantissa fits in 53 bits and the power of ten is
+ * exactly representable (Clinger's fast path), one multiplication or
+ * division gives the correctly rounded result, which covers nearly every
+ * literal a calculator sees. Anything longer falls back to strtod() on
+ * the literal's own characters, which is also correctly rounded.
+ */
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "numparse.h"
+
+#define MAX_MANTISSA_DIGITS 19          // always fits in uint64_t
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+#define MAX_EXACT_POW10 22              // 10^22 is the largest exact double power
+#define FALLBACK_BUFFER 128
+
+static const double exact_pow10[MAX_EXACT_POW10 + 1] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/*
+ * Clinger's fast path
+ * Returns: 1 and the exact result when m * 10^exp10 can be computed with a
+ *          single correctly rounded operation, 0 otherwise
+ */
+static int fast_path(uint64_t mantissa, int exp10, double *value) {
+    if (mantissa > MAX_EXACT_MANTISSA) {
+        return 0;
+    }
+    if (exp10 >= 0 && exp10 <= MAX_EXACT_POW10) {
+        *value = (double)mantissa * exact_pow10[exp10];
+        return 1;
+    }
+    if (exp10 < 0 && exp10 >= -MAX_EXACT_POW10) {
+        *value = (double)mantissa / exact_pow10[-exp10];
+        return 1;
+    }
+    // 123e25 = 123000 * 1e22: move surplus zeros into the mantissa while it stays exact
+    if (exp10 > MAX_EXACT_POW10) {
+        while (exp10 > MAX_EXACT_POW10 && mantissa <= MAX_EXACT_MANTISSA / 10) {
+            mantissa *= 10;
+            exp10--;
+        }
+        if (exp10 <= MAX_EXACT_POW10) {
+            *value = (double)mantissa * exact_pow10[exp10];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Slow path: hand the literal's characters to strtod()
+ * The span is copied so strtod() cannot read past the validated literal
+ * (it would otherwise accept things like hex digits or "inf").
+ */
+static double slow_path(const char *start, size_t length) {
+    char local[FALLBACK_BUFFER];
+    char *copy = local;
+
+    if (length >= sizeof(local)) {
+        copy = malloc(length + 1);
+        if (copy == NULL) {
+            return strtod(start, NULL);
+        }
+    }
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    double value = strtod(copy, NULL);
+    if (copy != local) {
+        free(copy);
+    }
+    return value;
+}
+
+/*
+ * Scan one unsigned literal starting at text
+ * An exponent marker is only consumed when digits follow it, so "2e" is
+ * the number 2 followed by the character 'e'.
+ * Returns: pointer just past the literal, or NULL if text does not start
+ *          with a number
+ */
+const char *scan_number(const char *text, double *value) {
+    const char *p = text;
+    uint64_t mantissa = 0;
+    int digits = 0;         // significant digits stored in mantissa
+    int exp10 = 0;          // value = mantissa * 10^exp10 (before the exponent part)
+    int truncated = 0;      // a non-zero digit did not fit in mantissa
+    int seen_digit = 0;
+
+    while (isdigit((unsigned char)*p)) {
+        int d = *p - '0';
+        seen_digit = 1;
+        if (digits < MAX_MANTISSA_DIGITS) {
+            mantissa = mantissa * 10 + (uint64_t)d;
+            if (mantissa != 0) {
+                digits++;
+            }
+        } else {
+            exp10++;
+            truncated |= d != 0;
+        }
+        p++;
+    }
+
+    if (*p == '.' && (seen_digit || isdigit((unsigned char)p[1]))) {
+        p++;
+        while (isdigit((unsigned char)*p)) {
+            int d = *p - '0';
+            seen_digit = 1;
+            if (digits < MAX_MANTISSA_DIGITS) {
+                mantissa = mantissa * 10 + (uint64_t)d;
+                if (mantissa != 0) {
+                    digits++;
+                }
+                exp10--;
+            } else {
+                truncated |= d != 0;
+            }
+            p++;
+        }
+    }
+
+    if (!seen_digit) {
+        return NULL;
+    }
+
+    if ((*p == 'e' || *p == 'E') &&
+        (isdigit((unsigned char)p[1]) ||
+         ((p[1] == '+' || p[1] == '-') && isdigit((unsigned char)p[2])))) {
+        const char *q = p + 1;
+        int negative = *q == '-';
+        int exponent = 0;
+        if (*q == '+' || *q == '-') {
+            q++;
+        }
+        while (isdigit((unsigned char)*q)) {
+            if (exponent < 100000) {
+                exponent = exponent * 10 + (*q - '0');
+            }
+            q++;
+        }
+        exp10 += negative ? -exponent : exponent;
+        p = q;
+    }
+
+    if (mantissa == 0) {
+        *value = 0.0;
+    } else if (truncated || !fast_path(mantissa, exp10, value)) {
+        *value = slow_path(text, (size_t)(p - text));
+    }
+    return p;
+}
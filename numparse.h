@@ -0,0 +1,19 @@
+/*
+ * Number Scanner Header File
+ * Converts decimal and scientific literals to correctly rounded doubles
+ */
+
+#ifndef NUMPARSE_H
+#define NUMPARSE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *scan_number(const char *text, double *value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // NUMPARSE_H
@@ -0,0 +1,399 @@
+/*
+ * Optimizer Implementation File
+ *
+ * optimize_program() turns the stack code from compile_expression() back
+ * into an expression DAG and emits it again:
+ *
+ *   - hash-consing: every node is looked up in a table keyed by
+ *     (operator, children, constant bits) before it is created, so
+ *     identical subexpressions become a single node
+ *   - constant folding: an operator whose operands are both constants is
+ *     evaluated once, here, with the same double arithmetic the
+ *     evaluator would use. A division or remainder by a constant zero is left in
+ *     place so that it still fails at run time, with its position.
+ *     Function calls with constant arguments fold through the same
+ *     calc_function_apply() the evaluators call, so sqrt(2) becomes the
+ *     constant every path would have computed.
+ *   - simplification: x*1, 1*x, x/1, x-(+0), x+(-0) and (-0)+x reduce to
+ *     x, which holds for every double including NaN, infinities and
+ *     signed zeros. Rewrites that are exact only for finite operands need
+ *     OPTIMIZE_UNSAFE_MATH.
+ *
+ * Variables are leaves like constants: "(a*b+c) * (a*b+c)" becomes one
+ * a*b+c node used twice.
+ *
+ * A reduction (sum(i, 1, n, ...)) is a node whose children are its bounds;
+ * it is never folded. Its body is optimized separately, as a program of
+ * its own.
+ *
+ * The DAG is emitted in the original left-to-right post-order. A node used
+ * more than once is computed the first time it is reached and kept with
+ * OP_STORE; later uses become OP_LOAD. Constants are pushed again rather
+ * than stored, since a push is as cheap as a load.
+ *
+ * Nodes are created children-first, so node ids are already a
+ * topological order and no pass needs recursion.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "optimizer.h"
+
+typedef struct {
+    OpCode op;          // OP_PUSH / OP_VAR for leaves, otherwise an operator,
+                        // OP_CALL or OP_REDUCE
+    int left;           // child node ids, -1 for leaves
+    int right;          // also -1 for a call of a one-argument function
+    int position;
+    double value;       // constant value, the variable slot for OP_VAR, the
+                        // CalcFunctionId for OP_CALL or the reduction for OP_REDUCE
+    int uses;           // edges from reachable parents
+    int temp;           // temporary holding the value once emitted, or -1
+} DagNode;
+
+typedef struct {
+    DagNode *nodes;
+    int count;
+    int *table;         // node id + 1, 0 marks an empty slot
+    size_t mask;
+    int flags;
+} Dag;
+
+typedef struct {
+    int node;
+    int stage;          // 0: visit left, 1: visit right, 2: emit
+} EmitFrame;
+
+static uint64_t double_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static size_t node_hash(OpCode op, int left, int right, double value) {
+    uint64_t h = double_bits(value);
+    h = (h ^ (uint64_t)op) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (uint64_t)(uint32_t)left) * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (uint64_t)(uint32_t)right) * 0x9E3779B97F4A7C15ULL;
+    // Multiplication only carries bits upwards; fold the high half back
+    // so the low bits used as the slot index see every input bit
+    h ^= h >> 32;
+    h *= 0xD6E8FEB86659FD93ULL;
+    return (size_t)(h ^ (h >> 32));
+}
+
+/*
+ * Return the existing node with this shape, or add it
+ * Constants are matched on their bit pattern, so 0.0 and -0.0 stay apart.
+ */
+static int intern_node(Dag *dag, OpCode op, int left, int right, double value, int position) {
+    size_t slot = node_hash(op, left, right, value) & dag->mask;
+    while (dag->table[slot] != 0) {
+        const DagNode *node = &dag->nodes[dag->table[slot] - 1];
+        if (node->op == op && node->left == left && node->right == right &&
+            double_bits(node->value) == double_bits(value)) {
+            return dag->table[slot] - 1;
+        }
+        slot = (slot + 1) & dag->mask;
+    }
+
+    int id = dag->count++;
+    DagNode *node = &dag->nodes[id];
+    node->op = op;
+    node->left = left;
+    node->right = right;
+    node->position = position;
+    node->value = value;
+    node->uses = 0;
+    node->temp = -1;
+    dag->table[slot] = id + 1;
+    return id;
+}
+
+static int is_constant(const Dag *dag, int id, double value) {
+    const DagNode *node = &dag->nodes[id];
+    return node->op == OP_PUSH && double_bits(node->value) == double_bits(value);
+}
+
+static int is_zero(const Dag *dag, int id) {
+    return dag->nodes[id].op == OP_PUSH && dag->nodes[id].value == 0;
+}
+
+/*
+ * Build (or find) left op right, folding and simplifying where allowed
+ */
+static int make_binary(Dag *dag, OpCode op, int left, int right, int position) {
+    const DagNode *a = &dag->nodes[left];
+    const DagNode *b = &dag->nodes[right];
+
+    if (a->op == OP_PUSH && b->op == OP_PUSH && !((op == OP_DIV || op == OP_MOD) && b->value == 0)) {
+        double value;
+        switch (op) {
+            case OP_ADD: value = a->value + b->value; break;
+            case OP_SUB: value = a->value - b->value; break;
+            case OP_MUL: value = a->value * b->value; break;
+            case OP_MOD: value = fmod(a->value, b->value); break;
+            default:     value = a->value / b->value; break;
+        }
+        return intern_node(dag, OP_PUSH, -1, -1, value, a->position);
+    }
+
+    switch (op) {
+        case OP_MUL:
+            if (is_constant(dag, right, 1.0)) return left;
+            if (is_constant(dag, left, 1.0)) return right;
+            break;
+        case OP_DIV:
+            if (is_constant(dag, right, 1.0)) return left;
+            break;
+        case OP_SUB:
+            if (is_constant(dag, right, 0.0)) return left;
+            break;
+        case OP_ADD:
+            if (is_constant(dag, right, -0.0)) return left;
+            if (is_constant(dag, left, -0.0)) return right;
+            break;
+        default:
+            break;
+    }
+
+    if (dag->flags & OPTIMIZE_UNSAFE_MATH) {
+        switch (op) {
+            case OP_ADD:
+                if (is_zero(dag, right)) return left;
+                if (is_zero(dag, left)) return right;
+                break;
+            case OP_MUL:
+                if (is_zero(dag, left) || is_zero(dag, right)) {
+                    return intern_node(dag, OP_PUSH, -1, -1, 0.0, position);
+                }
+                break;
+            case OP_SUB:
+                if (left == right) return intern_node(dag, OP_PUSH, -1, -1, 0.0, position);
+                break;
+            case OP_DIV:
+                if (left == right) return intern_node(dag, OP_PUSH, -1, -1, 1.0, position);
+                break;
+            default:
+                break;
+        }
+    }
+
+    return intern_node(dag, op, left, right, 0, position);
+}
+
+/*
+ * Build (or find) a call of function, folding it if every argument is constant
+ * right is -1 for one-argument functions.
+ */
+static int make_call(Dag *dag, int function, int left, int right, int position) {
+    const DagNode *a = &dag->nodes[left];
+    if (a->op == OP_PUSH && (right < 0 || dag->nodes[right].op == OP_PUSH)) {
+        double value = calc_function_apply(function, a->value,
+                                           right < 0 ? 0 : dag->nodes[right].value);
+        return intern_node(dag, OP_PUSH, -1, -1, value, position);
+    }
+    return intern_node(dag, OP_CALL, left, right, function, position);
+}
+
+static CalcStatus optimize_out_of_memory(CalcError *error) {
+    if (error != NULL) {
+        error->status = CALC_ERR_OUT_OF_MEMORY;
+        error->position = -1;
+        snprintf(error->message, sizeof(error->message), "Out of memory");
+    }
+    return CALC_ERR_OUT_OF_MEMORY;
+}
+
+static int append_instruction(Program *program, Arena *arena, OpCode op, int position) {
+    if (program->length == program->capacity) {
+        int capacity = program->capacity > 0 ? program->capacity * 2 : 64;
+        Instruction *code = arena_grow(arena, program->code,
+                                       (size_t)program->capacity * sizeof(Instruction),
+                                       (size_t)capacity * sizeof(Instruction));
+        if (code == NULL) {
+            return 0;
+        }
+        program->code = code;
+        program->capacity = capacity;
+    }
+    Instruction *ins = &program->code[program->length++];
+    ins->op = op;
+    ins->position = position;
+    ins->value = 0;
+    return 1;
+}
+
+/*
+ * Optimize a compiled program into output (allocated in arena)
+ * input is not modified and may itself be the output of an earlier call.
+ * Returns: CALC_OK, or CALC_ERR_OUT_OF_MEMORY
+ */
+CalcStatus optimize_program(const Program *input, Program *output, Arena *arena, int flags,
+                            CalcError *error) {
+    int limit = input->length + 1;
+    size_t table_size = 16;
+    while (table_size < (size_t)limit * 2) {
+        table_size *= 2;
+    }
+
+    Dag dag;
+    dag.nodes = arena_alloc(arena, (size_t)limit * sizeof(DagNode));
+    dag.table = arena_alloc(arena, table_size * sizeof(int));
+    dag.count = 0;
+    dag.mask = table_size - 1;
+    dag.flags = flags;
+    int *stack = arena_alloc(arena, (size_t)(input->max_depth + 1) * sizeof(int));
+    int *temp_nodes = arena_alloc(arena, (size_t)(input->temp_count + 1) * sizeof(int));
+    if (dag.nodes == NULL || dag.table == NULL || stack == NULL || temp_nodes == NULL) {
+        return optimize_out_of_memory(error);
+    }
+    memset(dag.table, 0, table_size * sizeof(int));
+
+    // Replay the stack program, building nodes instead of values
+    int top = -1;
+    for (int pc = 0; pc < input->length; pc++) {
+        const Instruction *ins = &input->code[pc];
+        switch (ins->op) {
+            case OP_PUSH:
+                stack[++top] = intern_node(&dag, OP_PUSH, -1, -1, ins->value, ins->position);
+                break;
+            case OP_VAR:
+                stack[++top] = intern_node(&dag, OP_VAR, -1, -1, ins->slot, ins->position);
+                break;
+            case OP_STORE:
+                temp_nodes[ins->slot] = stack[top];
+                break;
+            case OP_LOAD:
+                stack[++top] = temp_nodes[ins->slot];
+                break;
+            case OP_CALL:
+                if (calc_functions[ins->slot].arity == 2) {
+                    top--;
+                    stack[top] = make_call(&dag, ins->slot, stack[top], stack[top + 1],
+                                           ins->position);
+                } else {
+                    stack[top] = make_call(&dag, ins->slot, stack[top], -1, ins->position);
+                }
+                break;
+            case OP_REDUCE:
+                top--;
+                stack[top] = intern_node(&dag, OP_REDUCE, stack[top], stack[top + 1], ins->slot,
+                                         ins->position);
+                break;
+            default:
+                top--;
+                stack[top] = make_binary(&dag, ins->op, stack[top], stack[top + 1], ins->position);
+                break;
+        }
+    }
+    int root = stack[0];
+
+    // Count how often each reachable node is used; ids are topological
+    dag.nodes[root].uses = 1;
+    for (int id = root; id >= 0; id--) {
+        DagNode *node = &dag.nodes[id];
+        if (node->uses > 0 && node->op != OP_PUSH && node->op != OP_VAR) {
+            dag.nodes[node->left].uses++;
+            if (node->right >= 0) {
+                dag.nodes[node->right].uses++;
+            }
+        }
+    }
+
+    // Emit in post-order, storing shared results for their later uses
+    EmitFrame *frames = arena_alloc(arena, (size_t)(root + 2) * sizeof(EmitFrame));
+    if (frames == NULL) {
+        return optimize_out_of_memory(error);
+    }
+    output->code = NULL;
+    output->length = 0;
+    output->capacity = 0;
+    output->max_depth = 0;
+    output->temp_count = 0;
+    output->variables = input->variables;
+    output->variable_count = input->variable_count;
+    output->integers = NULL;    // folding happened in double
+    output->reductions = NULL;
+    output->reduction_count = input->reduction_count;
+    if (input->reduction_count > 0) {
+        output->reductions = arena_alloc(arena, (size_t)input->reduction_count * sizeof(Reduction));
+        if (output->reductions == NULL) {
+            return optimize_out_of_memory(error);
+        }
+    }
+    for (int r = 0; r < input->reduction_count; r++) {
+        output->reductions[r] = input->reductions[r];
+        CalcStatus status = optimize_program(&input->reductions[r].body,
+                                             &output->reductions[r].body, arena, flags, error);
+        if (status != CALC_OK) {
+            return status;
+        }
+    }
+
+    int depth = 0;
+    int frame_count = 0;
+    frames[frame_count].node = root;
+    frames[frame_count].stage = 0;
+    frame_count++;
+
+    while (frame_count > 0) {
+        EmitFrame *frame = &frames[frame_count - 1];
+        DagNode *node = &dag.nodes[frame->node];
+
+        if (frame->stage == 0 && (node->op == OP_PUSH || node->op == OP_VAR || node->temp >= 0)) {
+            // A leaf, or a shared value that is already computed
+            OpCode op = node->temp >= 0 ? OP_LOAD : node->op;
+            if (!append_instruction(output, arena, op, node->position)) {
+                return optimize_out_of_memory(error);
+            }
+            Instruction *ins = &output->code[output->length - 1];
+            if (op == OP_PUSH) {
+                ins->value = node->value;
+            } else if (op == OP_VAR) {
+                ins->slot = (int)node->value;
+            } else {
+                ins->slot = node->temp;
+            }
+            if (++depth > output->max_depth) {
+                output->max_depth = depth;
+            }
+            frame_count--;
+            continue;
+        }
+
+        if (frame->stage == 1 && node->right < 0) {
+            frame->stage = 2;   // one-argument call
+        }
+        if (frame->stage < 2) {
+            int child = frame->stage == 0 ? node->left : node->right;
+            frame->stage++;
+            frames[frame_count].node = child;
+            frames[frame_count].stage = 0;
+            frame_count++;
+            continue;
+        }
+
+        if (!append_instruction(output, arena, node->op, node->position)) {
+            return optimize_out_of_memory(error);
+        }
+        if (node->op == OP_CALL || node->op == OP_REDUCE) {
+            output->code[output->length - 1].slot = (int)node->value;
+        }
+        if (node->right >= 0) {
+            depth--;
+        }
+        if (node->uses > 1) {
+            node->temp = output->temp_count++;
+            if (!append_instruction(output, arena, OP_STORE, node->position)) {
+                return optimize_out_of_memory(error);
+            }
+            output->code[output->length - 1].slot = node->temp;
+        }
+        frame_count--;
+    }
+
+    return CALC_OK;
+}
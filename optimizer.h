@@ -0,0 +1,28 @@
+/*
+ * Optimizer Header File
+ * Rewrites a compiled Program into an equivalent, cheaper one
+ */
+
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "calc.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Also apply rewrites that are exact only for finite operands:
+// x+0 -> x, x*0 -> 0, x-x -> 0, x/x -> 1. They can hide a NaN, an
+// infinity, the sign of a zero, or a division by zero inside x.
+#define OPTIMIZE_UNSAFE_MATH 1
+
+CalcStatus optimize_program(const Program *input, Program *output, Arena *arena, int flags,
+                            CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // OPTIMIZER_H
@@ -0,0 +1,705 @@
+/*
+ * Program Store Implementation File
+ *
+ * Keeps what compile_expression() made of every expression text in a file
+ * that every cli_calculator process maps, so a formula compiled by one
+ * run is not parsed again by the next: --batch, --columns, --sweep and
+ * --workspace all compile through it when given --store FILE.
+ *
+ * Entries are keyed by the exact expression text, so the instruction
+ * positions a stored program (or a stored compile error) reports are
+ * offsets into the caller's own text. An entry holds the compile status,
+ * and then either the error or the whole Program: instructions,
+ * variable names, integer marks and reductions with their bodies. A
+ * program without variables also keeps its value once it has been
+ * evaluated, so --batch answers a constant seen before without running
+ * it. Programs read back are checked (every slot in range, the stack
+ * depth as recorded) before they are used.
+ *
+ * File layout:
+ *   header    64 bytes: "CALCPROG", store version, CALC_BYTECODE_VERSION,
+ *             sizeof(Instruction), slot count, end of the heap
+ *   slots     STORE_SLOT_COUNT x {hash, offset}, open addressing with
+ *             linear probing; hash 0 marks an empty slot
+ *   heap      entries appended one after another: a StoreEntry, the
+ *             expression text, then the encoded program
+ *
+ * Opening the store is one mmap of a fixed-size reservation; the file
+ * grows inside it, so nothing is remapped or parsed as the store fills.
+ * Lookups take no locks. An insert writes the entry first and publishes
+ * its slot hash last, so a reader in another process either sees a
+ * complete entry or none at all. Writers are serialized with a POSIX
+ * record lock between processes and a mutex between threads.
+ *
+ * A file written by another store version or for another bytecode
+ * version is replaced: a fresh store is built in a temporary file and
+ * renamed over it. The old file is never truncated, since processes of
+ * the other version may still have it mapped and would fault on pages
+ * cut from under them. The store is a cache and is always safe to throw
+ * away. Once the slot table is half full new entries are simply not
+ * added.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "program_store.h"
+
+#define STORE_MAGIC "CALCPROG"
+#define STORE_VERSION 4     // 4: whole programs and compile errors, keyed by exact text
+#define STORE_HEADER_SIZE 64
+#define STORE_SLOT_COUNT (1u << 18)
+#define STORE_MAX_SIZE ((size_t)1 << 30)    // address space reserved per store
+#define STORE_GROW_STEP (1u << 20)
+#define STORE_ALIGN 16
+#define STORE_MAX_KEY 4096                  // longer expressions are not stored
+#define STORE_MAX_ENTRY ((size_t)1 << 20)
+#define STORE_MAX_NESTING 64                // reductions inside reductions
+#define STORE_HAS_RESULT 1u                 // result holds the program's value
+#define STORE_INTEGER_RESULT 2u             // ... and it is exact: use integer
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t bytecode_version;
+    uint32_t instruction_size;
+    uint32_t slot_count;
+    uint64_t data_end;          // first free byte of the heap
+    uint64_t entry_count;
+    unsigned char reserved[24];
+} StoreHeader;
+
+typedef struct {
+    uint64_t hash;              // published last; 0 = empty
+    uint64_t offset;            // StoreEntry in the heap
+} StoreSlot;
+
+typedef struct {
+    uint32_t key_length;
+    uint32_t flags;
+    int32_t status;             // of compile_expression()
+    int32_t position;           // of the compile error
+    uint64_t program_size;      // bytes of encoded program after the key
+    double result;              // valid with STORE_HAS_RESULT
+    int64_t integer;            // valid with STORE_INTEGER_RESULT
+    char message[sizeof(((CalcError *)0)->message)];
+} StoreEntry;
+
+#define STORE_HEAP_START (STORE_HEADER_SIZE + (size_t)STORE_SLOT_COUNT * sizeof(StoreSlot))
+
+static size_t align_up(size_t size) {
+    return (size + STORE_ALIGN - 1) & ~(size_t)(STORE_ALIGN - 1);
+}
+
+static int lock_file(int fd, short type) {
+    struct flock lock;
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+    lock.l_whence = SEEK_SET;
+    while (fcntl(fd, F_SETLKW, &lock) != 0) {
+        if (errno != EINTR) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static StoreHeader *store_header(const ProgramStore *store) {
+    return (StoreHeader *)store->map;
+}
+
+static StoreSlot *store_slots(const ProgramStore *store) {
+    return (StoreSlot *)(store->map + STORE_HEADER_SIZE);
+}
+
+/*
+ * FNV-1a of the expression text; never 0, which marks an empty slot
+ */
+static uint64_t text_hash(const char *text, size_t length) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)text[i]) * 0x100000001b3ULL;
+    }
+    return h != 0 ? h : 1;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                              Program encoding
+ * ----------------------------------------------------------------------------
+ *
+ * A program is written as six int32 (length, max_depth, temp_count,
+ * variable_count, reduction_count, whether integers follow), the
+ * instructions, the integer marks, each variable name as an int32 length
+ * and its bytes, and each reduction as four int32 (kind, position, index,
+ * name length), the index name, the body program and the body's outer[]
+ * map. Nothing is aligned; every field is read back with memcpy.
+ */
+
+// Writes at data, or only counts the bytes when data is NULL
+typedef struct {
+    unsigned char *data;
+    size_t used;
+} Writer;
+
+typedef struct {
+    const unsigned char *data;
+    size_t used;
+    size_t size;
+    Arena *arena;
+    int nesting;
+} Reader;
+
+static void put(Writer *writer, const void *bytes, size_t size) {
+    if (writer->data != NULL && size > 0) {
+        memcpy(writer->data + writer->used, bytes, size);
+    }
+    writer->used += size;
+}
+
+static void put_string(Writer *writer, const char *text) {
+    int32_t length = (int32_t)strlen(text);
+    put(writer, &length, sizeof(length));
+    put(writer, text, (size_t)length);
+}
+
+static void put_program(Writer *writer, const Program *program) {
+    int32_t fields[6] = { program->length, program->max_depth, program->temp_count,
+                          program->variable_count, program->reduction_count,
+                          program->integers != NULL };
+    put(writer, fields, sizeof(fields));
+    put(writer, program->code, (size_t)program->length * sizeof(Instruction));
+    if (program->integers != NULL) {
+        put(writer, program->integers, (size_t)program->length * sizeof(int64_t));
+    }
+    for (int v = 0; v < program->variable_count; v++) {
+        put_string(writer, program->variables[v]);
+    }
+    for (int r = 0; r < program->reduction_count; r++) {
+        const Reduction *reduction = &program->reductions[r];
+        int32_t header[3] = { (int32_t)reduction->kind, reduction->position, reduction->index };
+        put(writer, header, sizeof(header));
+        put_string(writer, reduction->index_name);
+        put_program(writer, &reduction->body);
+        put(writer, reduction->outer, (size_t)reduction->body.variable_count * sizeof(int));
+    }
+}
+
+static int get(Reader *reader, void *out, size_t size) {
+    if (size > reader->size - reader->used) {
+        return 0;
+    }
+    memcpy(out, reader->data + reader->used, size);
+    reader->used += size;
+    return 1;
+}
+
+/*
+ * Copy the next size bytes into the arena, with a NUL after them
+ * Returns: the copy, or NULL when the entry is short or out of memory
+ */
+static void *get_copy(Reader *reader, size_t size) {
+    if (size > reader->size - reader->used) {
+        return NULL;
+    }
+    char *copy = arena_alloc(reader->arena, size + 1);
+    if (copy != NULL) {
+        memcpy(copy, reader->data + reader->used, size);
+        copy[size] = '\0';
+        reader->used += size;
+    }
+    return copy;
+}
+
+static char *get_string(Reader *reader) {
+    int32_t length;
+    if (!get(reader, &length, sizeof(length)) || length < 0) {
+        return NULL;
+    }
+    return get_copy(reader, (size_t)length);
+}
+
+/*
+ * Check that program can be run: every slot in range and the stack never
+ * deeper than max_depth nor popped when empty, ending with one value
+ */
+static int program_valid(const Program *program) {
+    int depth = 0;
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        switch (ins->op) {
+            case OP_PUSH:
+                depth++;
+                break;
+            case OP_VAR:
+                if (ins->slot < 0 || ins->slot >= program->variable_count) {
+                    return 0;
+                }
+                depth++;
+                break;
+            case OP_LOAD:
+            case OP_STORE:
+                if (ins->slot < 0 || ins->slot >= program->temp_count ||
+                    (ins->op == OP_STORE && depth < 1)) {
+                    return 0;
+                }
+                depth += ins->op == OP_LOAD;
+                break;
+            case OP_CALL:
+                if (ins->slot < 0 || ins->slot >= CALC_FN_COUNT ||
+                    depth < calc_functions[ins->slot].arity) {
+                    return 0;
+                }
+                depth -= calc_functions[ins->slot].arity - 1;
+                break;
+            case OP_REDUCE:
+                if (ins->slot < 0 || ins->slot >= program->reduction_count || depth < 2) {
+                    return 0;
+                }
+                depth--;
+                break;
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_MOD:
+                if (depth < 2) {
+                    return 0;
+                }
+                depth--;
+                break;
+            default:
+                return 0;
+        }
+        if (depth > program->max_depth) {
+            return 0;
+        }
+    }
+    return depth == 1;
+}
+
+/*
+ * Rebuild a program written by put_program() in the reader's arena
+ * Returns: 1 on success, 0 on a damaged entry or out of memory
+ */
+static int get_program(Reader *reader, Program *program) {
+    int32_t fields[6];
+    if (reader->nesting > STORE_MAX_NESTING || !get(reader, fields, sizeof(fields)) ||
+        fields[0] <= 0 || fields[1] <= 0 || fields[2] < 0 || fields[3] < 0 || fields[4] < 0) {
+        return 0;
+    }
+    memset(program, 0, sizeof(*program));
+    program->length = fields[0];
+    program->capacity = fields[0];
+    program->max_depth = fields[1];
+    program->temp_count = fields[2];
+    program->variable_count = fields[3];
+    program->reduction_count = fields[4];
+
+    size_t length = (size_t)program->length;
+    program->code = get_copy(reader, length * sizeof(Instruction));
+    if (program->code == NULL) {
+        return 0;
+    }
+    if (fields[5]) {
+        program->integers = get_copy(reader, length * sizeof(int64_t));
+        if (program->integers == NULL) {
+            return 0;
+        }
+    }
+    if (program->variable_count > 0) {
+        program->variables = arena_alloc(reader->arena,
+                                         (size_t)program->variable_count * sizeof(char *));
+        if (program->variables == NULL) {
+            return 0;
+        }
+    }
+    for (int v = 0; v < program->variable_count; v++) {
+        program->variables[v] = get_string(reader);
+        if (program->variables[v] == NULL) {
+            return 0;
+        }
+    }
+    if (program->reduction_count > 0) {
+        program->reductions = arena_alloc(reader->arena,
+                                          (size_t)program->reduction_count * sizeof(Reduction));
+        if (program->reductions == NULL) {
+            return 0;
+        }
+    }
+    for (int r = 0; r < program->reduction_count; r++) {
+        Reduction *reduction = &program->reductions[r];
+        int32_t header[3];
+        memset(reduction, 0, sizeof(*reduction));
+        if (!get(reader, header, sizeof(header)) || header[0] < REDUCE_SUM ||
+            header[0] > REDUCE_MAX) {
+            return 0;
+        }
+        reduction->kind = (ReductionKind)header[0];
+        reduction->position = header[1];
+        reduction->index = header[2];
+        reduction->index_name = get_string(reader);
+        reader->nesting++;
+        int ok = reduction->index_name != NULL && get_program(reader, &reduction->body);
+        reader->nesting--;
+        int body_variables = reduction->body.variable_count;
+        if (!ok || reduction->index < -1 || reduction->index >= body_variables) {
+            return 0;
+        }
+        if (body_variables > 0) {
+            reduction->outer = get_copy(reader, (size_t)body_variables * sizeof(int));
+            if (reduction->outer == NULL) {
+                return 0;
+            }
+        }
+        for (int v = 0; v < body_variables; v++) {
+            int outer = reduction->outer[v];
+            if (v == reduction->index ? outer != -1
+                                      : outer < 0 || outer >= program->variable_count) {
+                return 0;
+            }
+        }
+    }
+    return program_valid(program);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ *                                  The file
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * Check a header read from disk against what this build writes
+ */
+static int header_usable(const StoreHeader *header, size_t file_size) {
+    return memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == STORE_VERSION &&
+           header->bytecode_version == CALC_BYTECODE_VERSION &&
+           header->instruction_size == sizeof(Instruction) &&
+           header->slot_count == STORE_SLOT_COUNT &&
+           header->data_end >= STORE_HEAP_START && header->data_end <= file_size &&
+           header->data_end <= STORE_MAX_SIZE;
+}
+
+static int file_usable(int fd) {
+    struct stat info;
+    StoreHeader header;
+    return fstat(fd, &info) == 0 && (size_t)info.st_size >= STORE_HEAP_START &&
+           pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+           header_usable(&header, (size_t)info.st_size);
+}
+
+/*
+ * Put an empty store at path: build it in a temporary file next to it and
+ * rename that over path, so that processes still mapping the old file
+ * keep their pages. The slot table is left as a hole in the file, so it
+ * costs no disk until used.
+ * Returns: 1 on success, 0 on failure
+ */
+static int replace_store(const char *path) {
+    size_t length = strlen(path);
+    char *temp = malloc(length + sizeof(".XXXXXX"));
+    if (temp == NULL) {
+        return 0;
+    }
+    memcpy(temp, path, length);
+    memcpy(temp + length, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkstemp(temp);
+    if (fd < 0) {
+        free(temp);
+        return 0;
+    }
+
+    StoreHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, STORE_MAGIC, sizeof(header.magic));
+    header.version = STORE_VERSION;
+    header.bytecode_version = CALC_BYTECODE_VERSION;
+    header.instruction_size = sizeof(Instruction);
+    header.slot_count = STORE_SLOT_COUNT;
+    header.data_end = STORE_HEAP_START;
+    int ok = fchmod(fd, 0644) == 0 &&
+             ftruncate(fd, (off_t)STORE_HEAP_START) == 0 &&
+             pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+             rename(temp, path) == 0;
+    if (!ok) {
+        unlink(temp);
+    }
+    close(fd);
+    free(temp);
+    return ok;
+}
+
+/*
+ * Open (or create) the store at path
+ * Returns: 1 on success, 0 if the file cannot be used
+ */
+int program_store_open(ProgramStore *store, const char *path) {
+    store->map = NULL;
+    store->map_size = 0;
+    store->fd = -1;
+
+    // If another process replaces the file between our check and its
+    // rename, the second attempt opens whichever store won
+    for (int attempt = 0; attempt < 2 && store->fd < 0; attempt++) {
+        int fd = open(path, O_RDWR);
+        if (fd < 0 && errno != ENOENT) {
+            return 0;
+        }
+        if (fd >= 0 && file_usable(fd)) {
+            store->fd = fd;
+        } else {
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (!replace_store(path)) {
+                return 0;
+            }
+        }
+    }
+    if (store->fd < 0) {
+        store->fd = open(path, O_RDWR);
+        if (store->fd < 0 || !file_usable(store->fd)) {
+            program_store_close(store);
+            return 0;
+        }
+    }
+
+    void *map = mmap(NULL, STORE_MAX_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+    if (map == MAP_FAILED) {
+        close(store->fd);
+        store->fd = -1;
+        return 0;
+    }
+    store->map = map;
+    store->map_size = STORE_MAX_SIZE;
+    pthread_mutex_init(&store->lock, NULL);
+    return 1;
+}
+
+void program_store_close(ProgramStore *store) {
+    if (store->map != NULL) {
+        munmap(store->map, store->map_size);
+        pthread_mutex_destroy(&store->lock);
+        store->map = NULL;
+    }
+    if (store->fd >= 0) {
+        close(store->fd);
+        store->fd = -1;
+    }
+}
+
+static size_t home_slot(uint64_t hash) {
+    return (size_t)(hash ^ (hash >> 32)) & (STORE_SLOT_COUNT - 1);
+}
+
+/*
+ * Find the entry of an expression text
+ * Returns: the entry (its key and program are in bounds), or NULL
+ */
+static const StoreEntry *find_entry(ProgramStore *store, const char *expression, size_t length,
+                                    uint64_t hash) {
+    StoreSlot *slots = store_slots(store);
+    uint64_t data_end = __atomic_load_n(&store_header(store)->data_end, __ATOMIC_ACQUIRE);
+
+    size_t slot = home_slot(hash);
+    for (size_t probes = 0; probes < STORE_SLOT_COUNT; probes++) {
+        uint64_t slot_hash = __atomic_load_n(&slots[slot].hash, __ATOMIC_ACQUIRE);
+        if (slot_hash == 0) {
+            return NULL;
+        }
+        if (slot_hash == hash) {
+            // Another process may have published more since data_end was read
+            if (slots[slot].offset >= data_end) {
+                data_end = __atomic_load_n(&store_header(store)->data_end, __ATOMIC_ACQUIRE);
+            }
+            uint64_t offset = slots[slot].offset;
+            if (offset < STORE_HEAP_START || offset + sizeof(StoreEntry) > data_end) {
+                return NULL;      // damaged slot
+            }
+            const StoreEntry *entry = (const StoreEntry *)(store->map + offset);
+            if (entry->key_length == length &&
+                entry->program_size <= STORE_MAX_ENTRY &&
+                offset + sizeof(StoreEntry) + length + entry->program_size <= data_end &&
+                memcmp(entry + 1, expression, length) == 0) {
+                return entry;
+            }
+        }
+        slot = (slot + 1) & (STORE_SLOT_COUNT - 1);
+    }
+    return NULL;
+}
+
+/*
+ * Look up an expression text
+ * A damaged entry counts as a miss.
+ * Returns: 1 with *found filled in, 0 if the text is not in the store
+ */
+int program_store_lookup(ProgramStore *store, const char *expression, size_t length,
+                         StoredExpression *found, Arena *arena) {
+    const StoreEntry *entry = find_entry(store, expression, length,
+                                         text_hash(expression, length));
+    if (entry == NULL) {
+        return 0;
+    }
+
+    if (entry->status < CALC_OK || entry->status > CALC_ERR_CYCLE ||
+        (entry->status != CALC_OK &&
+         (entry->position < -1 || (size_t)entry->position > length))) {
+        return 0;
+    }
+    memset(found, 0, sizeof(*found));
+    found->status = (CalcStatus)entry->status;
+    if (found->status != CALC_OK) {
+        found->error.status = found->status;
+        found->error.position = entry->position;
+        memcpy(found->error.message, entry->message, sizeof(found->error.message));
+        found->error.message[sizeof(found->error.message) - 1] = '\0';
+        return 1;
+    }
+
+    Reader reader = { (const unsigned char *)(entry + 1) + length, 0,
+                      (size_t)entry->program_size, arena, 0 };
+    if (!get_program(&reader, &found->program)) {
+        return 0;
+    }
+    if (entry->flags & STORE_HAS_RESULT) {
+        found->has_result = 1;
+        found->result.value = entry->result;
+        found->result.integer = entry->integer;
+        found->result.is_integer = (entry->flags & STORE_INTEGER_RESULT) != 0;
+    }
+    return 1;
+}
+
+/*
+ * Save what an expression text compiled to
+ * Returns: 1 if the text is in the store, 0 if it could not be added
+ *          (too long, store full or a write error)
+ */
+int program_store_insert(ProgramStore *store, const char *expression, size_t length,
+                         const StoredExpression *entry) {
+    StoreHeader *header = store_header(store);
+    uint64_t hash = text_hash(expression, length);
+    int stored = 0;
+
+    Writer measure = { NULL, 0 };
+    if (entry->status == CALC_OK) {
+        put_program(&measure, &entry->program);
+    }
+    if (length > STORE_MAX_KEY || measure.used > STORE_MAX_ENTRY) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    if (!lock_file(store->fd, F_WRLCK)) {
+        pthread_mutex_unlock(&store->lock);
+        return 0;
+    }
+
+    size_t size = sizeof(StoreEntry) + length + measure.used;
+    size_t offset = (size_t)header->data_end;
+    struct stat info;
+
+    if (find_entry(store, expression, length, hash) != NULL) {
+        stored = 1;     // another thread or process got there first
+    } else if (header->entry_count * 2 < STORE_SLOT_COUNT &&
+               offset + size <= STORE_MAX_SIZE &&
+               fstat(store->fd, &info) == 0) {
+        // Grow the file in large steps before touching the new pages
+        size_t file_size = (size_t)info.st_size;
+        if (offset + size > file_size) {
+            file_size = (offset + size + STORE_GROW_STEP - 1) / STORE_GROW_STEP * STORE_GROW_STEP;
+            if (file_size > STORE_MAX_SIZE) {
+                file_size = STORE_MAX_SIZE;
+            }
+        }
+        if (file_size == (size_t)info.st_size || ftruncate(store->fd, (off_t)file_size) == 0) {
+            StoreEntry *written = (StoreEntry *)(store->map + offset);
+            memset(written, 0, sizeof(*written));
+            written->key_length = (uint32_t)length;
+            written->status = (int32_t)entry->status;
+            written->program_size = measure.used;
+            if (entry->status != CALC_OK) {
+                written->position = entry->error.position;
+                memcpy(written->message, entry->error.message, sizeof(written->message));
+            } else if (entry->has_result) {
+                written->flags = STORE_HAS_RESULT |
+                                 (entry->result.is_integer ? STORE_INTEGER_RESULT : 0);
+                written->result = entry->result.value;
+                written->integer = entry->result.integer;
+            }
+            memcpy(written + 1, expression, length);
+            if (entry->status == CALC_OK) {
+                Writer writer = { (unsigned char *)(written + 1) + length, 0 };
+                put_program(&writer, &entry->program);
+            }
+            __atomic_store_n(&header->data_end, (uint64_t)(offset + align_up(size)),
+                             __ATOMIC_RELEASE);
+            header->entry_count++;
+
+            StoreSlot *slots = store_slots(store);
+            size_t slot = home_slot(hash);
+            while (slots[slot].hash != 0) {
+                slot = (slot + 1) & (STORE_SLOT_COUNT - 1);
+            }
+            slots[slot].offset = offset;
+            __atomic_store_n(&slots[slot].hash, hash, __ATOMIC_RELEASE);
+            stored = 1;
+        }
+    }
+
+    lock_file(store->fd, F_UNLCK);
+    pthread_mutex_unlock(&store->lock);
+    return stored;
+}
+
+/*
+ * Compile an expression, or take its program from the store
+ * Out-of-memory failures are not saved, since the next run may not hit them.
+ * Returns: the status compile_expression() gives for the expression
+ */
+CalcStatus program_store_compile(ProgramStore *store, const char *expression, Program *program,
+                                 Arena *arena, CalcError *error, int *hit) {
+    StoredExpression entry;
+    size_t length = strlen(expression);
+    int usable = store != NULL && length <= STORE_MAX_KEY;
+
+    if (hit != NULL) {
+        *hit = 0;
+    }
+    if (usable && program_store_lookup(store, expression, length, &entry, arena)) {
+        if (hit != NULL) {
+            *hit = 1;
+        }
+        if (entry.status != CALC_OK) {
+            if (error != NULL) {
+                *error = entry.error;
+            }
+            return entry.status;
+        }
+        *program = entry.program;
+        return CALC_OK;
+    }
+
+    entry.status = compile_expression(expression, program, arena, &entry.error);
+    if (entry.status != CALC_OK && error != NULL) {
+        *error = entry.error;
+    }
+    if (usable && entry.status != CALC_ERR_OUT_OF_MEMORY) {
+        if (entry.status == CALC_OK) {
+            entry.program = *program;
+        }
+        entry.has_result = 0;
+        program_store_insert(store, expression, length, &entry);
+    }
+    return entry.status;
+}
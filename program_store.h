@@ -0,0 +1,57 @@
+/*
+ * Program Store Header File
+ * Compiled expressions saved in a memory-mapped file shared across runs
+ */
+
+#ifndef PROGRAM_STORE_H
+#define PROGRAM_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "calc.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int fd;
+    unsigned char *map;     // reserved once; the file grows inside it
+    size_t map_size;
+    pthread_mutex_t lock;   // serializes inserts between threads
+} ProgramStore;
+
+// What compile_expression() made of one expression text
+typedef struct {
+    CalcStatus status;      // compile status
+    CalcError error;        // when status is not CALC_OK
+    Program program;        // when it is
+    int has_result;         // the program has no variables and its value is known
+    CalcValue result;
+} StoredExpression;
+
+int program_store_open(ProgramStore *store, const char *path);
+void program_store_close(ProgramStore *store);
+
+// Look up the exact text expression (length characters). On a hit the
+// program is rebuilt in arena, as compile_expression() would have built it.
+// Returns: 1 on a hit, 0 on a miss
+int program_store_lookup(ProgramStore *store, const char *expression, size_t length,
+                         StoredExpression *found, Arena *arena);
+// Returns: 1 if the expression is in the store, 0 if it could not be added
+int program_store_insert(ProgramStore *store, const char *expression, size_t length,
+                         const StoredExpression *entry);
+
+// compile_expression() through the store (which may be NULL): a text seen
+// by an earlier run gets its saved program, or its saved compile error,
+// and a new one is compiled and saved. *hit (may be NULL) tells which.
+CalcStatus program_store_compile(ProgramStore *store, const char *expression, Program *program,
+                                 Arena *arena, CalcError *error, int *hit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // PROGRAM_STORE_H
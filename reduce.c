@@ -0,0 +1,335 @@
+/*
+ * Reduction Implementation File
+ *
+ *   sum(i, 1, 100000000, 1 / (i * i))
+ *
+ * compile_expression() compiles the body of a reduction into a Program
+ * of its own, in which the index is just another variable. The terms are
+ * evaluated REDUCE_BLOCK_TERMS at a time with evaluate_columns(), so the
+ * body runs on the SIMD kernels with the index as a column.
+ *
+ * The terms are combined in an order fixed by the range alone:
+ *
+ *   - the range is cut into units of REDUCE_UNIT_TERMS consecutive
+ *     terms, and each unit into blocks of REDUCE_BLOCK_TERMS
+ *   - a list of values (a block's terms, a unit's block results, the
+ *     units' results) is combined pairwise: split in half, combine each
+ *     half, then combine the two results; lists of up to
+ *     REDUCE_LEAF_TERMS values are combined in four interleaved lanes
+ *
+ * Threads only decide who computes which unit, never how results are
+ * combined, so a sum gives the same bits on one thread or sixty-four.
+ * Pairwise summation also keeps the rounding error growing with log n
+ * rather than n. Min and max order -0 below +0 and propagate NaN, so
+ * they too are independent of the order.
+ *
+ * Threads take units in increasing order. When a term fails (division
+ * by zero), no units after it are started and the error reported is
+ * always the one for the lowest failing i, found again by evaluating
+ * that single term with evaluate_program_with().
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reduce.h"
+#include "vector_eval.h"
+
+#define REDUCE_BLOCK_TERMS 2048
+#define REDUCE_UNIT_BLOCKS 32
+#define REDUCE_UNIT_TERMS (REDUCE_UNIT_BLOCKS * REDUCE_BLOCK_TERMS)
+#define REDUCE_LEAF_TERMS 32
+#define REDUCE_MAX_TERMS 0x1p36     // keeps the unit results within 8 MB
+#define REDUCE_INDEX_LIMIT 0x1p53   // every index is an exact double
+
+const char *const reduction_names[REDUCE_KIND_COUNT] = { "sum", "product", "min", "max" };
+
+static int reduce_threads = 1;
+
+// Set on threads that are already evaluating a reduction, whose nested
+// reductions then run on that thread instead of starting more
+static _Thread_local int inside_reduction;
+
+typedef struct {
+    const Reduction *reduction;
+    const double *variables;
+    double first;               // value of i for term 0
+    uint64_t count;
+    uint64_t unit_count;
+    double *unit_results;
+    pthread_mutex_t lock;
+    uint64_t next_unit;
+    uint64_t failed_term;       // lowest failing term so far, count if none
+    CalcStatus failed_status;
+} ReduceJob;
+
+/*
+ * Returns: the ReductionKind called name (length characters), or -1
+ */
+int reduction_lookup(const char *name, int length) {
+    for (int kind = 0; kind < REDUCE_KIND_COUNT; kind++) {
+        if (strncmp(reduction_names[kind], name, (size_t)length) == 0 &&
+            reduction_names[kind][length] == '\0') {
+            return kind;
+        }
+    }
+    return -1;
+}
+
+void reduce_set_threads(int threads) {
+    reduce_threads = threads > 0 ? threads : 1;
+}
+
+static CalcStatus reduce_error(CalcError *error, CalcStatus status, int position,
+                               const char *message) {
+    if (error != NULL) {
+        error->status = status;
+        error->position = position;
+        snprintf(error->message, sizeof(error->message), "%s", message);
+    }
+    return status;
+}
+
+static double combine(ReductionKind kind, double a, double b) {
+    switch (kind) {
+        case REDUCE_SUM:
+            return a + b;
+        case REDUCE_PRODUCT:
+            return a * b;
+        case REDUCE_MIN:
+            if (isnan(a) || isnan(b)) {
+                return a + b;
+            }
+            if (a == b) {
+                return signbit(a) ? a : b;
+            }
+            return a < b ? a : b;
+        default:
+            if (isnan(a) || isnan(b)) {
+                return a + b;
+            }
+            if (a == b) {
+                return signbit(a) ? b : a;
+            }
+            return a > b ? a : b;
+    }
+}
+
+static double identity(ReductionKind kind) {
+    switch (kind) {
+        case REDUCE_SUM:     return -0.0;   // -0 + x is x for every x, even +0
+        case REDUCE_PRODUCT: return 1.0;
+        case REDUCE_MIN:     return INFINITY;
+        default:             return -INFINITY;
+    }
+}
+
+/*
+ * Combine n >= 1 values in the fixed pairwise order
+ */
+static double combine_values(ReductionKind kind, const double *values, size_t n) {
+    if (n > REDUCE_LEAF_TERMS) {
+        size_t half = n / 2;
+        return combine(kind, combine_values(kind, values, half),
+                       combine_values(kind, values + half, n - half));
+    }
+    double lane[4];
+    for (int j = 0; j < 4; j++) {
+        lane[j] = identity(kind);
+    }
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        for (int j = 0; j < 4; j++) {
+            lane[j] = combine(kind, lane[j], values[i + j]);
+        }
+    }
+    for (; i < n; i++) {
+        lane[i & 3] = combine(kind, lane[i & 3], values[i]);
+    }
+    return combine(kind, combine(kind, lane[0], lane[1]), combine(kind, lane[2], lane[3]));
+}
+
+static void record_failure(ReduceJob *job, uint64_t term, CalcStatus status) {
+    pthread_mutex_lock(&job->lock);
+    if (term < job->failed_term) {
+        job->failed_term = term;
+        job->failed_status = status;
+    }
+    pthread_mutex_unlock(&job->lock);
+}
+
+/*
+ * Evaluate units until none are left (or one before them failed)
+ */
+static void *reduce_worker(void *arg) {
+    ReduceJob *job = arg;
+    const Reduction *reduction = job->reduction;
+    const Program *body = &reduction->body;
+    int variable_count = body->variable_count;
+    // One block per body variable, then one for the terms
+    double *blocks = malloc(((size_t)variable_count + 1) * REDUCE_BLOCK_TERMS * sizeof(double));
+    const double **columns = malloc(((size_t)variable_count + 1) * sizeof(double *));
+    unsigned char status[REDUCE_BLOCK_TERMS];
+    double block_results[REDUCE_UNIT_BLOCKS];
+
+    if (blocks == NULL || columns == NULL) {
+        free(blocks);
+        free(columns);
+        record_failure(job, 0, CALC_ERR_OUT_OF_MEMORY);
+        return NULL;
+    }
+    double *terms = blocks + (size_t)variable_count * REDUCE_BLOCK_TERMS;
+    double *index_block = reduction->index >= 0
+                              ? blocks + (size_t)reduction->index * REDUCE_BLOCK_TERMS : NULL;
+    for (int v = 0; v < variable_count; v++) {
+        double *block = blocks + (size_t)v * REDUCE_BLOCK_TERMS;
+        if (v != reduction->index) {
+            for (size_t k = 0; k < REDUCE_BLOCK_TERMS; k++) {
+                block[k] = job->variables[reduction->outer[v]];
+            }
+        }
+        columns[v] = block;
+    }
+
+    inside_reduction++;
+    for (;;) {
+        pthread_mutex_lock(&job->lock);
+        uint64_t unit = job->next_unit++;
+        int stop = unit >= job->unit_count || unit * REDUCE_UNIT_TERMS >= job->failed_term;
+        pthread_mutex_unlock(&job->lock);
+        if (stop) {
+            break;
+        }
+
+        uint64_t start = unit * REDUCE_UNIT_TERMS;
+        uint64_t end = job->count - start < REDUCE_UNIT_TERMS ? job->count : start + REDUCE_UNIT_TERMS;
+        int block_count = 0;
+        int failed = 0;
+        for (uint64_t first = start; first < end && !failed; first += REDUCE_BLOCK_TERMS) {
+            size_t n = end - first < REDUCE_BLOCK_TERMS ? (size_t)(end - first) : REDUCE_BLOCK_TERMS;
+            if (index_block != NULL) {
+                for (size_t k = 0; k < n; k++) {
+                    index_block[k] = job->first + (double)(first + k);
+                }
+            }
+            CalcStatus result = evaluate_columns(body, columns, n, terms, status, NULL);
+            if (result != CALC_OK) {
+                record_failure(job, first, result);
+                failed = 1;
+                break;
+            }
+            for (size_t k = 0; k < n; k++) {
+                if (status[k] != CALC_OK) {
+                    record_failure(job, first + k, (CalcStatus)status[k]);
+                    failed = 1;
+                    break;
+                }
+            }
+            if (!failed) {
+                block_results[block_count++] = combine_values(reduction->kind, terms, n);
+            }
+        }
+        if (!failed) {
+            job->unit_results[unit] = combine_values(reduction->kind, block_results,
+                                                     (size_t)block_count);
+        }
+    }
+    inside_reduction--;
+
+    free(blocks);
+    free(columns);
+    return NULL;
+}
+
+/*
+ * Evaluate a reduction for the bounds popped by OP_REDUCE
+ * Safe to call from several threads at once.
+ */
+CalcStatus evaluate_reduction(const Reduction *reduction, double from, double to,
+                              const double *variables, double *result, CalcError *error) {
+    if (isnan(from) || isnan(to)) {
+        *result = NAN;
+        return CALC_OK;
+    }
+    double first = ceil(from);
+    double last = floor(to);
+    if (last < first) {
+        *result = reduction->kind == REDUCE_SUM ? 0.0 : identity(reduction->kind);
+        return CALC_OK;
+    }
+    if (fabs(first) > REDUCE_INDEX_LIMIT || fabs(last) > REDUCE_INDEX_LIMIT ||
+        last - first >= REDUCE_MAX_TERMS) {
+        return reduce_error(error, CALC_ERR_OVERFLOW, reduction->position,
+                            "Reduction has too many terms");
+    }
+
+    ReduceJob job;
+    job.reduction = reduction;
+    job.variables = variables;
+    job.first = first;
+    job.count = (uint64_t)(last - first) + 1;
+    job.unit_count = (job.count + REDUCE_UNIT_TERMS - 1) / REDUCE_UNIT_TERMS;
+    job.unit_results = malloc(job.unit_count * sizeof(double));
+    job.next_unit = 0;
+    job.failed_term = job.count;
+    job.failed_status = CALC_OK;
+    if (job.unit_results == NULL) {
+        return reduce_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    }
+    pthread_mutex_init(&job.lock, NULL);
+
+    // The calling thread is one of the workers
+    int thread_count = inside_reduction ? 1 : reduce_threads;
+    if ((uint64_t)thread_count > job.unit_count) {
+        thread_count = (int)job.unit_count;
+    }
+    pthread_t threads[thread_count > 1 ? thread_count - 1 : 1];
+    int started = 0;
+    for (; started < thread_count - 1; started++) {
+        if (pthread_create(&threads[started], NULL, reduce_worker, &job) != 0) {
+            break;
+        }
+    }
+    reduce_worker(&job);
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&job.lock);
+
+    CalcStatus status = CALC_OK;
+    if (job.failed_status == CALC_ERR_OUT_OF_MEMORY) {
+        status = reduce_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    } else if (job.failed_status != CALC_OK) {
+        // Run the failing term alone for its full error report
+        const Program *body = &reduction->body;
+        double local[64];
+        double *values = body->variable_count <= 64
+                             ? local : malloc((size_t)body->variable_count * sizeof(double));
+        double ignored;
+        if (values == NULL) {
+            status = reduce_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        } else {
+            for (int v = 0; v < body->variable_count; v++) {
+                values[v] = v == reduction->index ? first + (double)job.failed_term
+                                                  : variables[reduction->outer[v]];
+            }
+            status = evaluate_program_with(body, values, &ignored, error);
+            if (status == CALC_OK) {
+                status = reduce_error(error, job.failed_status, reduction->position,
+                                      calc_status_string(job.failed_status));
+            }
+            if (values != local) {
+                free(values);
+            }
+        }
+    } else {
+        *result = combine_values(reduction->kind, job.unit_results, (size_t)job.unit_count);
+    }
+    free(job.unit_results);
+    return status;
+}
@@ -0,0 +1,41 @@
+/*
+ * Reduction Header File
+ * Evaluation of sum(), product(), min() and max() over an integer range
+ */
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include "calc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REDUCE_KIND_COUNT 4
+
+// Indexed by ReductionKind
+extern const char *const reduction_names[REDUCE_KIND_COUNT];
+
+// Returns: the ReductionKind called name (length characters), or -1
+int reduction_lookup(const char *name, int length);
+
+// Threads one reduction may use (1 by default). Results are the same for
+// any value; callers that already run several evaluations at once keep it
+// at 1.
+void reduce_set_threads(int threads);
+
+// Combine reduction->body over every integer i with from <= i <= to.
+// variables holds the enclosing program's variable values (may be NULL if
+// it has none). Empty ranges give 0 (sum), 1 (product), +inf (min) or
+// -inf (max); NaN bounds give NaN.
+// Returns: CALC_OK, the first failing term's error (lowest i), or
+//          CALC_ERR_OVERFLOW when the range has too many terms
+CalcStatus evaluate_reduction(const Reduction *reduction, double from, double to,
+                              const double *variables, double *result, CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // REDUCE_H
@@ -0,0 +1,274 @@
+/*
+ * Register VM Implementation File
+ *
+ * compile_registers() turns a stack Program into three-address code:
+ *
+ *   a * 2 + a * 2        stack:    a 2 * =t0 t0 +
+ *                        register: r5 = r2 * r0
+ *                                  r4 = r5 + r5
+ *                                  halt r4
+ *
+ * Every operand is resolved at compile time to a register: constants and
+ * variables get fixed registers that are filled before the first
+ * instruction, and each stack level and temporary gets one result
+ * register. Pushes, loads and stores disappear; only arithmetic is left,
+ * one instruction per operator.
+ *
+ * evaluate_registers() runs the code with a threaded interpreter: with
+ * GCC or Clang each instruction handler jumps straight to the next
+ * one's handler through a table of label addresses (computed goto),
+ * instead of returning to a central switch. Function calls get one
+ * handler per function, so none of them dispatches twice. There are no calls and no
+ * bounds checks inside the loop; the only error, division (or remainder)
+ * by zero, jumps out to code that looks up the source position.
+ *
+ * Reductions (sum(i, ...)) run their body many times over, which this
+ * straight-line code cannot express; programs with one are declined and
+ * stay on the stack evaluator.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "register_vm.h"
+
+#define REGISTER_FILE_LOCAL 256
+
+static CalcStatus register_error(CalcError *error, CalcStatus status, int position,
+                                 const char *message) {
+    if (error != NULL) {
+        error->status = status;
+        error->position = position;
+        snprintf(error->message, sizeof(error->message), "%s", message);
+    }
+    return status;
+}
+
+/*
+ * Translate program into register form
+ * The output lives in arena and shares program->variables.
+ * Returns: CALC_OK, CALC_ERR_OUT_OF_MEMORY, or CALC_ERR_SYNTAX for a
+ *          program with a reduction
+ */
+CalcStatus compile_registers(const Program *program, RegisterProgram *output, Arena *arena,
+                             CalcError *error) {
+    int constant_count = 0;
+    int operator_count = 0;
+    for (int pc = 0; pc < program->length; pc++) {
+        OpCode op = program->code[pc].op;
+        constant_count += op == OP_PUSH;
+        operator_count += (op >= OP_ADD && op <= OP_MOD) || op == OP_CALL;
+        if (op == OP_REDUCE) {
+            return register_error(error, CALC_ERR_SYNTAX, program->code[pc].position,
+                                  "Reductions need the stack evaluator");
+        }
+    }
+
+    uint32_t variable_base = (uint32_t)constant_count;
+    uint32_t stack_base = variable_base + (uint32_t)program->variable_count;
+    uint32_t temp_base = stack_base + (uint32_t)program->max_depth;
+
+    double *constants = arena_alloc(arena, (size_t)(constant_count + 1) * sizeof(double));
+    RegisterInstruction *code = arena_alloc(arena, (size_t)(operator_count + 1) * sizeof(RegisterInstruction));
+    int *positions = arena_alloc(arena, (size_t)(operator_count + 1) * sizeof(int));
+    uint32_t *stack = arena_alloc(arena, (size_t)(program->max_depth + 1) * sizeof(uint32_t));
+    uint32_t *temps = arena_alloc(arena, (size_t)(program->temp_count + 1) * sizeof(uint32_t));
+    if (constants == NULL || code == NULL || positions == NULL || stack == NULL || temps == NULL) {
+        return register_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+    }
+
+    // Simulate the stack, holding the register each entry lives in
+    int top = -1;
+    int length = 0;
+    constant_count = 0;
+    for (int pc = 0; pc < program->length; pc++) {
+        const Instruction *ins = &program->code[pc];
+        switch (ins->op) {
+            case OP_PUSH:
+                constants[constant_count] = ins->value;
+                stack[++top] = (uint32_t)constant_count++;
+                break;
+            case OP_VAR:
+                stack[++top] = variable_base + (uint32_t)ins->slot;
+                break;
+            case OP_LOAD:
+                stack[++top] = temps[ins->slot];
+                break;
+            case OP_STORE:
+                // A stack register is overwritten by later operators, so a
+                // value that must outlive it is computed into the
+                // temporary's own register instead (the instruction that
+                // produced the top is always the last one emitted).
+                // Constants and variables never change and are shared as is.
+                if (stack[top] >= stack_base && stack[top] < temp_base) {
+                    code[length - 1].dst = temp_base + (uint32_t)ins->slot;
+                    stack[top] = temp_base + (uint32_t)ins->slot;
+                }
+                temps[ins->slot] = stack[top];
+                break;
+            case OP_CALL:
+                top -= calc_functions[ins->slot].arity - 1;
+                code[length].op = (uint32_t)ins->slot + REG_SQRT;
+                code[length].dst = stack_base + (uint32_t)top;
+                code[length].a = stack[top];
+                code[length].b = calc_functions[ins->slot].arity == 2 ? stack[top + 1] : stack[top];
+                positions[length] = ins->position;
+                stack[top] = code[length].dst;
+                length++;
+                break;
+            default:
+                top--;
+                code[length].op = (uint32_t)(ins->op - OP_ADD) + REG_ADD;
+                code[length].dst = stack_base + (uint32_t)top;
+                code[length].a = stack[top];
+                code[length].b = stack[top + 1];
+                positions[length] = ins->position;
+                stack[top] = code[length].dst;
+                length++;
+                break;
+        }
+    }
+    code[length].op = REG_HALT;
+    code[length].dst = code[length].a = code[length].b = 0;
+    positions[length] = -1;
+
+    output->code = code;
+    output->positions = positions;
+    output->length = length + 1;
+    output->constants = constants;
+    output->constant_count = constant_count;
+    output->variable_count = program->variable_count;
+    output->register_count = (int)temp_base + program->temp_count;
+    output->result = stack[0];
+    output->variables = program->variables;
+    return CALC_OK;
+}
+
+/*
+ * Run a register program
+ * variables holds one value per program variable (may be NULL if there
+ * are none). Safe to call from several threads on the same program.
+ * Returns: CALC_OK, CALC_ERR_DIVISION_BY_ZERO, CALC_ERR_UNBOUND_VARIABLE
+ *          or CALC_ERR_OUT_OF_MEMORY
+ */
+CalcStatus evaluate_registers(const RegisterProgram *program, const double *variables,
+                              double *result, CalcError *error) {
+    double local_registers[REGISTER_FILE_LOCAL];
+    double *r = local_registers;
+    const RegisterInstruction *ip = program->code;
+
+    if (program->variable_count > 0 && variables == NULL) {
+        if (error != NULL) {
+            error->status = CALC_ERR_UNBOUND_VARIABLE;
+            error->position = -1;
+            snprintf(error->message, sizeof(error->message), "Unbound variable '%.40s'",
+                     program->variables != NULL ? program->variables[0] : "?");
+        }
+        return CALC_ERR_UNBOUND_VARIABLE;
+    }
+    if (program->register_count > REGISTER_FILE_LOCAL) {
+        r = malloc((size_t)program->register_count * sizeof(double));
+        if (r == NULL) {
+            return register_error(error, CALC_ERR_OUT_OF_MEMORY, -1, "Out of memory");
+        }
+    }
+    memcpy(r, program->constants, (size_t)program->constant_count * sizeof(double));
+    if (program->variable_count > 0) {
+        memcpy(r + program->constant_count, variables,
+               (size_t)program->variable_count * sizeof(double));
+    }
+
+#if defined(__GNUC__)
+    // Indexed by RegisterOp
+    static const void *const handlers[] = { &&do_add, &&do_sub, &&do_mul, &&do_div, &&do_mod,
+                                              &&do_sqrt, &&do_pow, &&do_exp, &&do_log,
+                                              &&do_sin, &&do_cos, &&do_halt };
+#define DISPATCH() goto *handlers[ip->op]
+#define NEXT() do { ip++; DISPATCH(); } while (0)
+
+    DISPATCH();
+do_add:
+    r[ip->dst] = r[ip->a] + r[ip->b];
+    NEXT();
+do_sub:
+    r[ip->dst] = r[ip->a] - r[ip->b];
+    NEXT();
+do_mul:
+    r[ip->dst] = r[ip->a] * r[ip->b];
+    NEXT();
+do_div:
+    if (r[ip->b] == 0) {
+        goto division_by_zero;
+    }
+    r[ip->dst] = r[ip->a] / r[ip->b];
+    NEXT();
+do_mod:
+    if (r[ip->b] == 0) {
+        goto division_by_zero;
+    }
+    r[ip->dst] = fmod(r[ip->a], r[ip->b]);
+    NEXT();
+do_sqrt:
+    r[ip->dst] = calc_sqrt(r[ip->a]);
+    NEXT();
+do_pow:
+    r[ip->dst] = calc_pow(r[ip->a], r[ip->b]);
+    NEXT();
+do_exp:
+    r[ip->dst] = calc_exp(r[ip->a]);
+    NEXT();
+do_log:
+    r[ip->dst] = calc_log(r[ip->a]);
+    NEXT();
+do_sin:
+    r[ip->dst] = calc_sin(r[ip->a]);
+    NEXT();
+do_cos:
+    r[ip->dst] = calc_cos(r[ip->a]);
+    NEXT();
+do_halt:
+#undef NEXT
+#undef DISPATCH
+#else
+    for (;; ip++) {
+        switch (ip->op) {
+            case REG_ADD: r[ip->dst] = r[ip->a] + r[ip->b]; continue;
+            case REG_SUB: r[ip->dst] = r[ip->a] - r[ip->b]; continue;
+            case REG_MUL: r[ip->dst] = r[ip->a] * r[ip->b]; continue;
+            case REG_DIV:
+                if (r[ip->b] == 0) {
+                    goto division_by_zero;
+                }
+                r[ip->dst] = r[ip->a] / r[ip->b];
+                continue;
+            case REG_MOD:
+                if (r[ip->b] == 0) {
+                    goto division_by_zero;
+                }
+                r[ip->dst] = fmod(r[ip->a], r[ip->b]);
+                continue;
+            case REG_SQRT: r[ip->dst] = calc_sqrt(r[ip->a]); continue;
+            case REG_POW: r[ip->dst] = calc_pow(r[ip->a], r[ip->b]); continue;
+            case REG_EXP: r[ip->dst] = calc_exp(r[ip->a]); continue;
+            case REG_LOG: r[ip->dst] = calc_log(r[ip->a]); continue;
+            case REG_SIN: r[ip->dst] = calc_sin(r[ip->a]); continue;
+            case REG_COS: r[ip->dst] = calc_cos(r[ip->a]); continue;
+        }
+        break;
+    }
+#endif
+
+    *result = r[program->result];
+    if (r != local_registers) {
+        free(r);
+    }
+    return CALC_OK;
+
+division_by_zero:
+    if (r != local_registers) {
+        free(r);
+    }
+    return register_error(error, CALC_ERR_DIVISION_BY_ZERO,
+                          program->positions[ip - program->code], "Division by zero");
+}
@@ -0,0 +1,62 @@
+/*
+ * Register VM Header File
+ * Three-address form of a compiled Program, run by a threaded interpreter
+ */
+
+#ifndef REGISTER_VM_H
+#define REGISTER_VM_H
+
+#include <stdint.h>
+#include "calc.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    REG_ADD,
+    REG_SUB,
+    REG_MUL,
+    REG_DIV,
+    REG_MOD,
+    REG_SQRT,   // function calls, in CalcFunctionId order; one-argument
+    REG_POW,    // functions read only a
+    REG_EXP,
+    REG_LOG,
+    REG_SIN,
+    REG_COS,
+    REG_HALT    // always the last instruction
+} RegisterOp;
+
+// registers[dst] = registers[a] op registers[b], or f(registers[a]...)
+typedef struct {
+    uint32_t op;
+    uint32_t dst;
+    uint32_t a;
+    uint32_t b;
+} RegisterInstruction;
+
+// Register file layout: [constants | variables | results]
+typedef struct {
+    RegisterInstruction *code;
+    int *positions;         // source offset of each instruction, for errors
+    int length;             // including REG_HALT
+    const double *constants;
+    int constant_count;
+    int variable_count;
+    int register_count;
+    uint32_t result;        // register holding the value at REG_HALT
+    char **variables;       // shared with the source Program
+} RegisterProgram;
+
+CalcStatus compile_registers(const Program *program, RegisterProgram *output, Arena *arena,
+                             CalcError *error);
+CalcStatus evaluate_registers(const RegisterProgram *program, const double *variables,
+                              double *result, CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // REGISTER_VM_H
@@ -0,0 +1,394 @@
+/*
+ * Evaluation Server Implementation File
+ *
+ * cli_calculator --serve PATH listens on a Unix domain socket and answers
+ * expressions without starting a process per calculation.
+ *
+ * Protocol (text, one request per line, any number of clients):
+ *   request:   <expression>\n
+ *   response:  OK <result>\n
+ *              ERR <code> <offset> <message>\n
+ * Clients may pipeline: send many lines without waiting, and responses
+ * come back in the same order.
+ *
+ * Error codes are the CalcStatus values declared in calc.h (message text
+ * as in calc_status_string()), plus 64 (SERVER_ERR_TOO_LONG) when the
+ * request line is longer than SERVER_MAX_LINE. offset is the byte offset
+ * in the request line where the problem was found, or -1.
+ *
+ * One thread runs an edge-triggered epoll loop over every connection.
+ * Each connection has an input buffer (partial lines wait there for the
+ * rest) and an output buffer drained as the socket allows. A client that
+ * stops reading its responses is not read from until it catches up.
+ *
+ * Expressions are evaluated on that same thread, so a slow request, such
+ * as a sum(i, ...) over many terms, holds up every other client until it
+ * is done. The reduction itself is spread over the CPUs (see reduce.c),
+ * which shortens the stall but does not remove it; clients that need
+ * their latency isolated should use separate server processes.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "calc.h"
+#include "arena.h"
+#include "format.h"
+#include "server.h"
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_READ_CHUNK (64 * 1024)
+#define SERVER_MAX_LINE (16 * 1024 * 1024)
+#define SERVER_OUTPUT_HIGH_WATER (4 * 1024 * 1024)
+#define SERVER_RESPONSE_MAX 128
+
+// Outside the CalcStatus range
+#define SERVER_ERR_TOO_LONG 64
+
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+    int fd;
+    ByteBuffer input;
+    ByteBuffer output;
+    size_t output_sent;     // bytes of output already written to the socket
+    int discarding;         // skipping the rest of an over-long line
+    int reading;            // EPOLLIN is enabled
+    int peer_closed;
+} Connection;
+
+static volatile sig_atomic_t server_stopping = 0;
+
+static void handle_stop_signal(int signal_number) {
+    (void)signal_number;
+    server_stopping = 1;
+}
+
+/*
+ * Make room for at least extra more bytes
+ * Returns: 1 on success, 0 when out of memory
+ */
+static int buffer_reserve(ByteBuffer *buffer, size_t extra) {
+    if (buffer->capacity - buffer->length >= extra) {
+        return 1;
+    }
+    size_t capacity = buffer->capacity > 0 ? buffer->capacity : 4096;
+    while (capacity - buffer->length < extra) {
+        capacity *= 2;
+    }
+    char *data = realloc(buffer->data, capacity);
+    if (data == NULL) {
+        return 0;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 1;
+}
+
+static int buffer_append(ByteBuffer *buffer, const char *text, size_t length) {
+    if (!buffer_reserve(buffer, length)) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->length, text, length);
+    buffer->length += length;
+    return 1;
+}
+
+/*
+ * Evaluate one request line and append its response
+ */
+static int respond(Connection *connection, char *line, size_t length, Arena *arena) {
+    char response[SERVER_RESPONSE_MAX];
+    int written;
+
+    if (length > 0 && line[length - 1] == '\r') {
+        line[--length] = '\0';
+    }
+
+    Program program;
+    CalcError error;
+    CalcValue result;
+    arena_reset(arena);
+    if (compile_expression(line, &program, arena, &error) != CALC_OK ||
+        evaluate_program_value(&program, &result, &error) != CALC_OK) {
+        written = snprintf(response, sizeof(response), "ERR %d %d %s\n",
+                           (int)error.status, error.position, error.message);
+    } else {
+        memcpy(response, "OK ", 3);
+        written = 3 + format_value(&result, FORMAT_SHORTEST, response + 3);
+        response[written++] = '\n';
+    }
+    return buffer_append(&connection->output, response, (size_t)written);
+}
+
+/*
+ * Answer every complete line in the input buffer
+ * Returns: 1 on success, 0 when the connection must be dropped
+ */
+static int process_input(Connection *connection, Arena *arena) {
+    ByteBuffer *input = &connection->input;
+    size_t start = 0;
+
+    for (;;) {
+        char *newline = memchr(input->data + start, '\n', input->length - start);
+        if (newline == NULL) {
+            break;
+        }
+        size_t line_length = (size_t)(newline - (input->data + start));
+        *newline = '\0';
+        if (connection->discarding) {
+            connection->discarding = 0;
+        } else if (!respond(connection, input->data + start, line_length, arena)) {
+            return 0;
+        }
+        start += line_length + 1;
+    }
+
+    // Keep the unfinished line at the front of the buffer
+    memmove(input->data, input->data + start, input->length - start);
+    input->length -= start;
+
+    if (input->length > SERVER_MAX_LINE) {
+        char response[SERVER_RESPONSE_MAX];
+        int written = snprintf(response, sizeof(response), "ERR %d -1 Request line is too long\n",
+                               SERVER_ERR_TOO_LONG);
+        if (!buffer_append(&connection->output, response, (size_t)written)) {
+            return 0;
+        }
+        input->length = 0;
+        connection->discarding = 1;
+    }
+    return 1;
+}
+
+/*
+ * Write as much pending output as the socket accepts
+ * Returns: 1 on success, 0 on a socket error
+ */
+static int flush_output(Connection *connection) {
+    ByteBuffer *output = &connection->output;
+    while (connection->output_sent < output->length) {
+        ssize_t n = send(connection->fd, output->data + connection->output_sent,
+                         output->length - connection->output_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        connection->output_sent += (size_t)n;
+    }
+    output->length = 0;
+    connection->output_sent = 0;
+    return 1;
+}
+
+/*
+ * Read everything available (edge-triggered) and answer complete lines
+ * Returns: 1 on success, 0 when the connection must be dropped
+ */
+static int read_input(Connection *connection, Arena *arena) {
+    while (connection->output.length - connection->output_sent < SERVER_OUTPUT_HIGH_WATER) {
+        if (!buffer_reserve(&connection->input, SERVER_READ_CHUNK)) {
+            return 0;
+        }
+        ssize_t n = recv(connection->fd, connection->input.data + connection->input.length,
+                         SERVER_READ_CHUNK, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0) {
+            connection->peer_closed = 1;
+            // A last line without a newline still gets an answer
+            if (connection->input.length > 0 && !connection->discarding &&
+                buffer_reserve(&connection->input, 1)) {
+                connection->input.data[connection->input.length++] = '\n';
+                return process_input(connection, arena);
+            }
+            return 1;
+        }
+        connection->input.length += (size_t)n;
+        if (!process_input(connection, arena)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void close_connection(int epoll_fd, Connection *connection) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    free(connection->input.data);
+    free(connection->output.data);
+    free(connection);
+}
+
+/*
+ * Ask epoll for readability only while the client is keeping up with
+ * its responses, and for writability only while output is pending
+ */
+static int update_interest(int epoll_fd, Connection *connection) {
+    struct epoll_event event;
+    size_t pending = connection->output.length - connection->output_sent;
+    event.events = EPOLLET | EPOLLRDHUP;
+    connection->reading = pending < SERVER_OUTPUT_HIGH_WATER && !connection->peer_closed;
+    if (connection->reading) {
+        event.events |= EPOLLIN;
+    }
+    if (pending > 0) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.ptr = connection;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, connection->fd, &event) == 0;
+}
+
+static void accept_connections(int epoll_fd, int listen_fd) {
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            return;     // EAGAIN: no more pending connections (or a transient error)
+        }
+        Connection *connection = calloc(1, sizeof(Connection));
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->reading = 1;
+
+        struct epoll_event event;
+        event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+        event.data.ptr = connection;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            free(connection);
+        }
+    }
+}
+
+/*
+ * Serve until SIGINT or SIGTERM
+ * Returns: 0 after a clean shutdown, 1 if the socket cannot be set up
+ */
+int run_server(const char *socket_path) {
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error: Socket path is too long\n");
+        return 1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+        perror("socket");
+        return 1;
+    }
+    unlink(socket_path);
+    if (bind(listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        perror("bind");
+        close(listen_fd);
+        return 1;
+    }
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;     // NULL marks the listening socket
+    if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+        perror("epoll");
+        close(listen_fd);
+        unlink(socket_path);
+        return 1;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "Listening on %s\n", socket_path);
+
+    Arena arena;
+    arena_init(&arena);
+    struct epoll_event events[SERVER_MAX_EVENTS];
+
+    while (!server_stopping) {
+        int count = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            Connection *connection = events[i].data.ptr;
+            if (connection == NULL) {
+                accept_connections(epoll_fd, listen_fd);
+                continue;
+            }
+
+            int ok = 1;
+            if (events[i].events & EPOLLERR) {
+                ok = 0;
+            }
+            if (ok && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+                ok = read_input(connection, &arena);
+            }
+            if (ok) {
+                ok = flush_output(connection);
+            }
+            // Output drained below the high-water mark: resume reading
+            // whatever arrived while the client was not being read
+            if (ok && !connection->reading && !connection->peer_closed &&
+                connection->output.length - connection->output_sent < SERVER_OUTPUT_HIGH_WATER) {
+                ok = read_input(connection, &arena) && flush_output(connection);
+            }
+
+            int finished = connection->peer_closed &&
+                           connection->output.length == connection->output_sent;
+            if (!ok || finished || !update_interest(epoll_fd, connection)) {
+                close_connection(epoll_fd, connection);
+            }
+        }
+    }
+
+    arena_free(&arena);
+    close(epoll_fd);
+    close(listen_fd);
+    unlink(socket_path);
+    fprintf(stderr, "Server stopped\n");
+    return 0;
+}
+
+/*
+ * Entry point for: cli_calculator --serve PATH
+ */
+int server_main(int argc, char *argv[]) {
+    if (argc != 3) {
+        printf("Usage: %s --serve SOCKET_PATH\n", argv[0]);
+        return 1;
+    }
+    return run_server(argv[2]);
+}
@@ -0,0 +1,12 @@
+/*
+ * Evaluation Server Header File
+ * Long-running evaluator listening on a Unix domain socket
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+int server_main(int argc, char *argv[]);
+int run_server(const char *socket_path);
+
+#endif  // SERVER_H
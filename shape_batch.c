@@ -0,0 +1,238 @@
+/*
+ * Shape Batching Implementation File
+ *
+ * Generated workloads are often millions of expressions with one
+ * structure and different numbers:
+ *
+ *   1.5 * 2.25 + 7.5 / 3.25        1.5 2.25 * 7.5 3.25 / +
+ *   4.75 * 0.5 + 9.25 / 1.75       4.75 0.5 * 9.25 1.75 / +
+ *
+ * Leave the constants out of the postfix program and what remains, the
+ * shape, is the same: c0 c1 * c2 c3 / +. evaluate_shape_batch() groups
+ * the programs by shape with a hash table, turns each OP_PUSH of the
+ * shape into a variable, and lays the constants out as one column per
+ * constant (structure of arrays):
+ *
+ *   c0: 1.5   4.75  ...
+ *   c1: 2.25  0.5   ...
+ *
+ * The code of each program is read once, while it is in cache: the same
+ * pass hashes it, compares it with its group's shape and copies its
+ * constants out to a compact array, from which the columns are filled.
+ *
+ * Each group is then one evaluate_columns() call, which runs every
+ * operator as a SIMD loop across the group's expressions, exactly as it
+ * does across the rows of a CSV file. Those kernels give the same bits
+ * as evaluate_program(), so batching never changes a result.
+ *
+ * Groups smaller than SHAPE_MIN_GROUP are not worth the column setup and
+ * are evaluated one program at a time.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "shape_batch.h"
+#include "vector_eval.h"
+
+#define SHAPE_MIN_GROUP 4
+
+typedef struct {
+    uint64_t hash;
+    size_t first;       // program that stands for the shape
+    size_t count;
+    size_t offset;      // the group's members start at order[offset]
+    size_t filled;
+} ShapeGroup;
+
+static CalcStatus shape_out_of_memory(CalcError *error) {
+    if (error != NULL) {
+        error->status = CALC_ERR_OUT_OF_MEMORY;
+        error->position = -1;
+        snprintf(error->message, sizeof(error->message), "Out of memory");
+    }
+    return CALC_ERR_OUT_OF_MEMORY;
+}
+
+int shape_batchable(const Program *program) {
+    return program->variable_count == 0 && program->reduction_count == 0 &&
+           program->integers == NULL;
+}
+
+// Whether the instruction's slot is part of the shape (a constant's
+// value never is)
+static int has_slot(OpCode op) {
+    return op == OP_VAR || op == OP_STORE || op == OP_LOAD || op == OP_CALL;
+}
+
+static int same_shape(const Program *a, const Program *b) {
+    if (a->length != b->length) {
+        return 0;
+    }
+    for (int pc = 0; pc < a->length; pc++) {
+        if (a->code[pc].op != b->code[pc].op ||
+            (has_slot(a->code[pc].op) && a->code[pc].slot != b->code[pc].slot)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Evaluate one group: its shape as a program over constant columns
+ * Program k's constants are constants[first_constant[k]] onwards.
+ */
+static CalcStatus evaluate_group(const Program *programs, const ShapeGroup *group,
+                                 const size_t *order, const double *constants,
+                                 const size_t *first_constant, double *results,
+                                 unsigned char *status, Arena *arena, CalcError *error) {
+    const Program *model = &programs[group->first];
+    size_t n = group->count;
+    int constant_count = 0;
+    for (int pc = 0; pc < model->length; pc++) {
+        constant_count += model->code[pc].op == OP_PUSH;
+    }
+
+    Program shape = *model;
+    shape.code = arena_alloc(arena, (size_t)model->length * sizeof(Instruction));
+    double *soa = arena_alloc(arena, (size_t)constant_count * n * sizeof(double));
+    const double **columns = arena_alloc(arena, ((size_t)constant_count + 1) * sizeof(double *));
+    double *values = arena_alloc(arena, n * sizeof(double));
+    unsigned char *row_status = arena_alloc(arena, n);
+    if (shape.code == NULL || soa == NULL || columns == NULL || values == NULL ||
+        row_status == NULL) {
+        return shape_out_of_memory(error);
+    }
+
+    int next = 0;
+    for (int pc = 0; pc < model->length; pc++) {
+        shape.code[pc] = model->code[pc];
+        if (model->code[pc].op == OP_PUSH) {
+            shape.code[pc].op = OP_VAR;
+            shape.code[pc].slot = next++;
+        }
+    }
+    shape.variables = NULL;
+    shape.variable_count = constant_count;
+    shape.integers = NULL;
+
+    for (int c = 0; c < constant_count; c++) {
+        columns[c] = soa + (size_t)c * n;
+    }
+    for (size_t m = 0; m < n; m++) {
+        const double *source = constants + first_constant[order[group->offset + m]];
+        for (int c = 0; c < constant_count; c++) {
+            soa[(size_t)c * n + m] = source[c];
+        }
+    }
+
+    CalcStatus result = evaluate_columns(&shape, columns, n, values, row_status, error);
+    if (result != CALC_OK) {
+        return result;
+    }
+    for (size_t m = 0; m < n; m++) {
+        size_t k = order[group->offset + m];
+        results[k] = values[m];
+        status[k] = row_status[m];
+    }
+    return CALC_OK;
+}
+
+/*
+ * Evaluate count programs, grouped by shape
+ */
+CalcStatus evaluate_shape_batch(const Program *programs, size_t count, double *results,
+                                unsigned char *status, Arena *arena, CalcError *error) {
+    if (count == 0) {
+        return CALC_OK;
+    }
+    size_t table_size = 16;
+    while (table_size < count * 2) {
+        table_size *= 2;
+    }
+    size_t *table = arena_alloc(arena, table_size * sizeof(size_t));   // group + 1, 0 if empty
+    ShapeGroup *groups = arena_alloc(arena, count * sizeof(ShapeGroup));
+    size_t *group_of = arena_alloc(arena, count * sizeof(size_t));
+    size_t *order = arena_alloc(arena, count * sizeof(size_t));
+    size_t *first_constant = arena_alloc(arena, count * sizeof(size_t));
+    size_t constant_capacity = count * 4;
+    double *constants = arena_alloc(arena, constant_capacity * sizeof(double));
+    if (table == NULL || groups == NULL || group_of == NULL || order == NULL ||
+        first_constant == NULL || constants == NULL) {
+        return shape_out_of_memory(error);
+    }
+    memset(table, 0, table_size * sizeof(size_t));
+
+    size_t group_count = 0;
+    size_t constant_count = 0;
+    for (size_t k = 0; k < count; k++) {
+        const Program *program = &programs[k];
+        if (constant_count + (size_t)program->length > constant_capacity) {
+            size_t capacity = constant_capacity * 2 + (size_t)program->length;
+            constants = arena_grow(arena, constants, constant_capacity * sizeof(double),
+                                   capacity * sizeof(double));
+            if (constants == NULL) {
+                return shape_out_of_memory(error);
+            }
+            constant_capacity = capacity;
+        }
+        // One loop hashes the shape (FNV-1a) and copies the constants out
+        first_constant[k] = constant_count;
+        uint64_t hash = 0xCBF29CE484222325ULL;
+        for (int pc = 0; pc < program->length; pc++) {
+            const Instruction *ins = &program->code[pc];
+            hash = (hash ^ (uint64_t)ins->op) * 0x100000001B3ULL;
+            if (ins->op == OP_PUSH) {
+                constants[constant_count++] = ins->value;
+            } else if (has_slot(ins->op)) {
+                hash = (hash ^ (uint64_t)(uint32_t)ins->slot) * 0x100000001B3ULL;
+            }
+        }
+        size_t slot = (size_t)hash & (table_size - 1);
+        while (table[slot] != 0) {
+            const ShapeGroup *group = &groups[table[slot] - 1];
+            if (group->hash == hash && same_shape(&programs[group->first], &programs[k])) {
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (table[slot] == 0) {
+            ShapeGroup *group = &groups[group_count++];
+            group->hash = hash;
+            group->first = k;
+            group->count = 0;
+            group->filled = 0;
+            table[slot] = group_count;
+        }
+        group_of[k] = table[slot] - 1;
+        groups[group_of[k]].count++;
+    }
+
+    // Members of each group in input order, groups one after another
+    size_t offset = 0;
+    for (size_t g = 0; g < group_count; g++) {
+        groups[g].offset = offset;
+        offset += groups[g].count;
+    }
+    for (size_t k = 0; k < count; k++) {
+        ShapeGroup *group = &groups[group_of[k]];
+        order[group->offset + group->filled++] = k;
+    }
+
+    for (size_t g = 0; g < group_count; g++) {
+        const ShapeGroup *group = &groups[g];
+        if (group->count < SHAPE_MIN_GROUP) {
+            for (size_t m = 0; m < group->count; m++) {
+                size_t k = order[group->offset + m];
+                status[k] = (unsigned char)evaluate_program(&programs[k], &results[k], NULL);
+            }
+            continue;
+        }
+        CalcStatus result = evaluate_group(programs, group, order, constants, first_constant,
+                                           results, status, arena, error);
+        if (result != CALC_OK) {
+            return result;
+        }
+    }
+    return CALC_OK;
+}
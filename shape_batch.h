@@ -0,0 +1,33 @@
+/*
+ * Shape Batching Header File
+ * Evaluates many programs that differ only in their constants together
+ */
+
+#ifndef SHAPE_BATCH_H
+#define SHAPE_BATCH_H
+
+#include <stddef.h>
+#include "calc.h"
+#include "arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Whether evaluate_shape_batch() accepts program: no variables, no
+// reductions, and not integer-only (those keep their exact int64 path)
+int shape_batchable(const Program *program);
+
+// Evaluate count batchable programs. results[k] and status[k] receive
+// program k's value and CALC_OK or its error (as for a row of
+// evaluate_columns()); values are bit-identical to evaluate_program().
+// Scratch memory comes from arena.
+// Returns: CALC_OK, or CALC_ERR_OUT_OF_MEMORY (nothing was evaluated)
+CalcStatus evaluate_shape_batch(const Program *programs, size_t count, double *results,
+                                unsigned char *status, Arena *arena, CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SHAPE_BATCH_H
@@ -0,0 +1,507 @@
+/*
+ * Sweep Mode Implementation File
+ *
+ *   cli_calculator --sweep "sin(x) * y" x=0:10:0.001 y=-1:1:0.5
+ *
+ * Each axis NAME=FROM:TO:STEP binds a variable of the expression to the
+ * points FROM, FROM + STEP, FROM + 2*STEP, ... up to TO. TO is included
+ * when it lies on the grid (to within a billionth of a step, so 0:0.3:0.1
+ * has four points). Point k is computed as FROM + k*STEP rather than by
+ * repeated addition, so long axes do not drift. With several axes the
+ * grid is every combination, in row-major order: the last axis changes
+ * fastest.
+ *
+ * The expression is compiled and optimized once. The grid is never
+ * stored: it is cut into chunks of SWEEP_CHUNK_POINTS points, and a worker
+ * fills one column per variable for its chunk and runs evaluate_columns()
+ * on it, so the arithmetic uses the SIMD kernels (see vector_eval.c).
+ * Workers take chunks in order from a shared counter and format their
+ * own output; the main thread writes finished chunks in grid order. A
+ * worker never gets more than SWEEP_WINDOW_PER_THREAD chunks per thread
+ * ahead of the writer, so memory stays fixed however large the grid is.
+ *
+ * Output is text by default: one line per point, with the coordinates and
+ * then the value, comma separated ("0.5,-1,-0.479425538604203"), which
+ * --columns can read back once a header line is added. A point that
+ * fails gets its error ("Error: Division by zero") in place of its value.
+ * With --binary only the values are written, as native-endian IEEE
+ * doubles (8 bytes per point, in grid order), and a point that fails is
+ * NaN.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "calc.h"
+#include "arena.h"
+#include "format.h"
+#include "numparse.h"
+#include "optimizer.h"
+#include "program_store.h"
+#include "reduce.h"
+#include "vector_eval.h"
+#include "sweep.h"
+
+#define SWEEP_CHUNK_POINTS 8192
+#define SWEEP_WINDOW_PER_THREAD 2
+#define SWEEP_MAX_AXES 8
+
+#define SWEEP_ERROR_SIZE 48     // "Error: " and the longest calc_status_string()
+
+typedef struct {
+    const char *name;
+    double from;
+    double step;
+    size_t count;       // points on this axis
+    size_t stride;      // grid points between consecutive points of this axis
+    int variable;       // program variable the axis binds
+} SweepAxis;
+
+// Output of one chunk, reused for every chunk with the same index modulo
+// the window
+typedef struct {
+    double **columns;       // one per program variable
+    double *results;
+    unsigned char *row_status;
+    char *text;
+    size_t length;          // bytes to write from text (or results, in binary)
+    int done;
+    int failed;
+} SweepSlot;
+
+typedef struct {
+    const Program *program;
+    SweepAxis *axes;
+    int axis_count;
+    int precision;
+    int binary;
+    size_t points;
+    size_t chunk_count;
+    SweepSlot *slots;
+    size_t window;
+    size_t next_chunk;      // next chunk a worker will take
+    size_t written;         // chunks the main thread has written
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_done;
+    pthread_cond_t slot_free;
+} SweepJob;
+
+/*
+ * Parse a signed number that fills [p, end)
+ * Returns: 1 on success, 0 if the text is not a number
+ */
+static int parse_bound(const char *p, const char *end, double *value) {
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p >= end || !(*p == '.' || (*p >= '0' && *p <= '9'))) {
+        return 0;
+    }
+    if (scan_number(p, value) != end) {
+        return 0;
+    }
+    if (negative) {
+        *value = -*value;
+    }
+    return 1;
+}
+
+/*
+ * Parse "NAME=FROM:TO:STEP" into axis
+ * Returns: 1 on success, 0 (after printing why) on a malformed axis
+ */
+static int parse_axis(char *text, SweepAxis *axis) {
+    char *equals = strchr(text, '=');
+    char *first = equals != NULL ? strchr(equals, ':') : NULL;
+    char *second = first != NULL ? strchr(first + 1, ':') : NULL;
+    double to;
+    if (equals == NULL || equals == text || second == NULL ||
+        !parse_bound(equals + 1, first, &axis->from) ||
+        !parse_bound(first + 1, second, &to) ||
+        !parse_bound(second + 1, second + strlen(second), &axis->step)) {
+        fprintf(stderr, "Error: Axis '%s' is not NAME=FROM:TO:STEP\n", text);
+        return 0;
+    }
+    *equals = '\0';
+    axis->name = text;
+
+    double steps = (to - axis->from) / axis->step;
+    if (!isfinite(axis->from) || !isfinite(to) || axis->step == 0 || !(steps >= 0)) {
+        fprintf(stderr, "Error: Axis '%s' never reaches its end; check the sign of STEP\n",
+                axis->name);
+        return 0;
+    }
+    steps = floor(steps + 1e-9);
+    if (steps >= 0x1p52) {
+        fprintf(stderr, "Error: Axis '%s' has too many points\n", axis->name);
+        return 0;
+    }
+    axis->count = (size_t)steps + 1;
+    return 1;
+}
+
+/*
+ * Fill columns with the coordinates of points [first, first + count)
+ * Each axis walks its index like a digit of a mixed-radix counter.
+ */
+static void fill_points(const SweepJob *job, size_t first, size_t count, double **columns) {
+    for (int a = 0; a < job->axis_count; a++) {
+        const SweepAxis *axis = &job->axes[a];
+        double *column = columns[axis->variable];
+        size_t index = first / axis->stride % axis->count;
+        size_t within = first % axis->stride;
+        for (size_t p = 0; p < count; p++) {
+            column[p] = axis->from + (double)index * axis->step;
+            if (++within == axis->stride) {
+                within = 0;
+                if (++index == axis->count) {
+                    index = 0;
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Evaluate chunk and leave its output in its slot
+ */
+static void run_chunk(const SweepJob *job, size_t chunk) {
+    SweepSlot *slot = &job->slots[chunk % job->window];
+    size_t first = chunk * SWEEP_CHUNK_POINTS;
+    size_t count = job->points - first < SWEEP_CHUNK_POINTS ? job->points - first
+                                                            : SWEEP_CHUNK_POINTS;
+
+    fill_points(job, first, count, slot->columns);
+    if (evaluate_columns(job->program, (const double *const *)slot->columns, count,
+                         slot->results, slot->row_status, NULL) != CALC_OK) {
+        slot->failed = 1;
+        return;
+    }
+
+    if (job->binary) {
+        for (size_t p = 0; p < count; p++) {
+            if (slot->row_status[p] != CALC_OK) {
+                slot->results[p] = NAN;
+            }
+        }
+        slot->length = count * sizeof(double);
+        return;
+    }
+
+    char *out = slot->text;
+    for (size_t p = 0; p < count; p++) {
+        for (int a = 0; a < job->axis_count; a++) {
+            out += format_shortest(slot->columns[job->axes[a].variable][p], out);
+            *out++ = ',';
+        }
+        if (slot->row_status[p] != CALC_OK) {
+            out += snprintf(out, SWEEP_ERROR_SIZE, "Error: %s",
+                            calc_status_string((CalcStatus)slot->row_status[p]));
+        } else {
+            out += format_double(slot->results[p], job->precision, out);
+        }
+        *out++ = '\n';
+    }
+    slot->length = (size_t)(out - slot->text);
+}
+
+static void *sweep_worker(void *arg) {
+    SweepJob *job = arg;
+
+    pthread_mutex_lock(&job->lock);
+    for (;;) {
+        while (!job->stop && job->next_chunk < job->chunk_count &&
+               job->next_chunk >= job->written + job->window) {
+            pthread_cond_wait(&job->slot_free, &job->lock);
+        }
+        if (job->stop || job->next_chunk >= job->chunk_count) {
+            break;
+        }
+        size_t chunk = job->next_chunk++;
+        pthread_mutex_unlock(&job->lock);
+
+        run_chunk(job, chunk);
+
+        pthread_mutex_lock(&job->lock);
+        job->slots[chunk % job->window].done = 1;
+        pthread_cond_broadcast(&job->chunk_done);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+}
+
+/*
+ * Allocate every slot's buffers
+ * Returns: 1 on success, 0 when out of memory (free_slots() cleans up)
+ */
+static int init_slots(SweepJob *job) {
+    int variable_count = job->program->variable_count;
+    // A line holds every coordinate, the value or the error, and separators
+    size_t line = (size_t)(job->axis_count + 1) * (FORMAT_BUFFER_SIZE + 1) +
+                  SWEEP_ERROR_SIZE;
+
+    job->slots = calloc(job->window, sizeof(SweepSlot));
+    if (job->slots == NULL) {
+        return 0;
+    }
+    for (size_t s = 0; s < job->window; s++) {
+        SweepSlot *slot = &job->slots[s];
+        slot->columns = calloc((size_t)variable_count + 1, sizeof(double *));
+        slot->results = malloc(SWEEP_CHUNK_POINTS * sizeof(double));
+        slot->row_status = malloc(SWEEP_CHUNK_POINTS);
+        slot->text = job->binary ? NULL : malloc(SWEEP_CHUNK_POINTS * line);
+        if (slot->columns == NULL || slot->results == NULL || slot->row_status == NULL ||
+            (!job->binary && slot->text == NULL)) {
+            return 0;
+        }
+        for (int v = 0; v < variable_count; v++) {
+            slot->columns[v] = malloc(SWEEP_CHUNK_POINTS * sizeof(double));
+            if (slot->columns[v] == NULL) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static void free_slots(SweepJob *job) {
+    if (job->slots == NULL) {
+        return;
+    }
+    for (size_t s = 0; s < job->window; s++) {
+        SweepSlot *slot = &job->slots[s];
+        if (slot->columns != NULL) {
+            for (int v = 0; v < job->program->variable_count; v++) {
+                free(slot->columns[v]);
+            }
+        }
+        free(slot->columns);
+        free(slot->results);
+        free(slot->row_status);
+        free(slot->text);
+    }
+    free(job->slots);
+}
+
+/*
+ * Evaluate the whole grid on thread_count workers, writing it to stdout
+ * Returns: 0 on success, 1 on an allocation error
+ */
+static int run_sweep(SweepJob *job, int thread_count) {
+    job->chunk_count = (job->points + SWEEP_CHUNK_POINTS - 1) / SWEEP_CHUNK_POINTS;
+    if ((size_t)thread_count > job->chunk_count) {
+        thread_count = (int)job->chunk_count;
+    }
+    job->window = (size_t)thread_count * SWEEP_WINDOW_PER_THREAD;
+    if (thread_count > 1) {
+        reduce_set_threads(1);  // the chunks already keep every thread busy
+    }
+    job->next_chunk = 0;
+    job->written = 0;
+    job->stop = 0;
+    pthread_t *threads = calloc((size_t)thread_count, sizeof(pthread_t));
+    if (threads == NULL || !init_slots(job)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        free(threads);
+        free_slots(job);
+        return 1;
+    }
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->chunk_done, NULL);
+    pthread_cond_init(&job->slot_free, NULL);
+
+    int started = 0;
+    for (; started < thread_count; started++) {
+        if (pthread_create(&threads[started], NULL, sweep_worker, job) != 0) {
+            break;
+        }
+    }
+
+    // Write chunks in grid order; each chunk is one write
+    int status = 0;
+    for (size_t c = 0; c < job->chunk_count; c++) {
+        SweepSlot *slot = &job->slots[c % job->window];
+        if (started == 0) {
+            run_chunk(job, c);  // no threads available; do the work here
+        } else {
+            pthread_mutex_lock(&job->lock);
+            while (!slot->done) {
+                pthread_cond_wait(&job->chunk_done, &job->lock);
+            }
+            pthread_mutex_unlock(&job->lock);
+        }
+
+        if (slot->failed) {
+            status = 1;
+        } else {
+            fwrite(job->binary ? (const void *)slot->results : slot->text, 1, slot->length, stdout);
+        }
+
+        pthread_mutex_lock(&job->lock);
+        slot->done = 0;
+        job->written++;
+        job->stop = status != 0;
+        pthread_cond_broadcast(&job->slot_free);
+        pthread_mutex_unlock(&job->lock);
+        if (status != 0) {
+            break;
+        }
+    }
+    fflush(stdout);
+
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->chunk_done);
+    pthread_cond_destroy(&job->slot_free);
+    if (status != 0) {
+        fprintf(stderr, "Error: Out of memory\n");
+    }
+    free(threads);
+    free_slots(job);
+    return status;
+}
+
+/*
+ * Compile expression, through the program store at store_path when one
+ * is given so that a formula compiled by an earlier run is not parsed
+ * again. A store that cannot be opened only costs the warm start.
+ * Returns: the status of compile_expression()
+ */
+static CalcStatus compile_with_store(const char *expression, const char *store_path,
+                                     Program *program, Arena *arena, CalcError *error) {
+    ProgramStore store;
+    if (store_path == NULL) {
+        return compile_expression(expression, program, arena, error);
+    }
+    if (!program_store_open(&store, store_path)) {
+        fprintf(stderr, "Warning: Could not open program store '%s'\n", store_path);
+        return compile_expression(expression, program, arena, error);
+    }
+    // The program is copied into arena, so the store can be closed at once
+    CalcStatus status = program_store_compile(&store, expression, program, arena, error, NULL);
+    program_store_close(&store);
+    return status;
+}
+
+/*
+ * Handle "cli_calculator --sweep EXPRESSION AXIS... [--threads N]
+ *         [--precision N] [--binary] [--store FILE]"
+ * --threads defaults to one per online CPU.
+ * Returns: process exit status
+ */
+int sweep_main(int argc, char *argv[]) {
+    const char *expression = NULL;
+    SweepAxis axes[SWEEP_MAX_AXES];
+    int axis_count = 0;
+    const char *store_path = NULL;
+    int precision = FORMAT_SHORTEST;
+    int binary = 0;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = online > 0 ? (int)online : 1;
+    int usage = 0;
+
+    for (int i = 2; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--binary") == 0) {
+            binary = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            int requested = atoi(argv[++i]);
+            if (requested > 0) {
+                threads = requested;
+            }
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store_path = argv[++i];
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            precision = atoi(argv[++i]);
+            if (precision < 0 || precision > FORMAT_MAX_PRECISION) {
+                printf("Error: Precision must be between 0 and %d\n", FORMAT_MAX_PRECISION);
+                return 1;
+            }
+        } else if (expression == NULL) {
+            expression = argv[i];
+        } else if (axis_count < SWEEP_MAX_AXES) {
+            if (!parse_axis(argv[i], &axes[axis_count])) {
+                return 1;
+            }
+            axis_count++;
+        } else {
+            usage = 1;
+        }
+    }
+    if (usage || expression == NULL || axis_count == 0) {
+        printf("Usage: %s --sweep EXPRESSION NAME=FROM:TO:STEP... [--threads N] "
+               "[--precision N] [--binary] [--store FILE]\n", argv[0]);
+        return 1;
+    }
+
+    Arena arena;
+    Program compiled, program;
+    CalcError error;
+    arena_init(&arena);
+    if (compile_with_store(expression, store_path, &compiled, &arena, &error) != CALC_OK ||
+        optimize_program(&compiled, &program, &arena, 0, &error) != CALC_OK) {
+        printf("Error: %s\n", error.message);
+        arena_free(&arena);
+        return 1;
+    }
+
+    // Bind the axes to variables; strides make the last axis the fastest
+    size_t points = 1;
+    int bound = 0;
+    for (int a = axis_count - 1; a >= 0; a--) {
+        axes[a].variable = program_variable_index(&program, axes[a].name);
+        for (int b = a + 1; b < axis_count; b++) {
+            if (axes[a].variable >= 0 && axes[b].variable == axes[a].variable) {
+                axes[a].variable = -2;
+            }
+        }
+        if (axes[a].variable < 0) {
+            fprintf(stderr, axes[a].variable == -1 ? "Error: Expression has no variable '%s'\n"
+                                                   : "Error: Axis '%s' is given twice\n",
+                    axes[a].name);
+            arena_free(&arena);
+            return 1;
+        }
+        axes[a].stride = points;
+        if (__builtin_mul_overflow(points, axes[a].count, &points)) {
+            fprintf(stderr, "Error: The grid has too many points\n");
+            arena_free(&arena);
+            return 1;
+        }
+        bound++;
+    }
+    if (bound < program.variable_count) {
+        for (int v = 0; v < program.variable_count; v++) {
+            int a = 0;
+            while (a < axis_count && axes[a].variable != v) {
+                a++;
+            }
+            if (a == axis_count) {
+                fprintf(stderr, "Error: Variable '%s' has no axis\n", program.variables[v]);
+                break;
+            }
+        }
+        arena_free(&arena);
+        return 1;
+    }
+
+    SweepJob job = { 0 };
+    job.program = &program;
+    job.axes = axes;
+    job.axis_count = axis_count;
+    job.precision = precision;
+    job.binary = binary;
+    job.points = points;
+    int status = run_sweep(&job, threads);
+    arena_free(&arena);
+    return status;
+}
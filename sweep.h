@@ -0,0 +1,11 @@
+/*
+ * Sweep Mode Header File
+ * Evaluates one expression over every point of a 1-D or N-D grid
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+int sweep_main(int argc, char *argv[]);
+
+#endif  // SWEEP_H
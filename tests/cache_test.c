@@ -0,0 +1,47 @@
+/*
+ * Result Cache Regression Test
+ * Lines that differ only in blanks next to an exponent sign must not
+ * share a cache entry: "1e+5" is a number, "1e +5" and "1e+ 5" are not.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "cache.h"
+
+static const char *const lines[] = { "1e+5", "1e +5", "1e+ 5", "1e-5", "1e -5", "2 e+5" };
+
+int main(void) {
+    ResultCache cache;
+    Arena arena;
+    int failures = 0;
+    arena_init(&arena);
+    if (!result_cache_init(&cache, CACHE_DEFAULT_SIZE)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    // Evaluate the lines twice each, cached and not, in the order given
+    for (int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+            CalcValue cached, plain;
+            CalcError error;
+            arena_reset(&arena);
+            CalcStatus cached_status = cached_evaluate(&cache, lines[i], &arena, &cached, &error);
+            arena_reset(&arena);
+            CalcStatus plain_status = cached_evaluate(NULL, lines[i], &arena, &plain, &error);
+            if (cached_status != plain_status ||
+                (plain_status == CALC_OK && memcmp(&cached.value, &plain.value, sizeof(double)) != 0)) {
+                fprintf(stderr, "FAIL: '%s' gives %s (%g) from the cache, %s (%g) without\n",
+                        lines[i], calc_status_string(cached_status), cached.value,
+                        calc_status_string(plain_status), plain.value);
+                failures++;
+            }
+        }
+    }
+
+    result_cache_free(&cache);
+    arena_free(&arena);
+    return failures == 0 ? 0 : 1;
+}
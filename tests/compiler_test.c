@@ -0,0 +1,75 @@
+/*
+ * Compiler Differential Test
+ * compile_expression() + evaluate_program() against the string pipeline,
+ * infix_to_postfix() + evaluate_postfix(), on random expressions with
+ * blanks and tabs, and on damaged ones: both must give the same status,
+ * and the same result bits when they succeed. The string pipeline only
+ * counts operands, so on damaged input it lets through some expressions
+ * the compiler rejects ("pow(2 3)", "cos(1,)") and reports others
+ * differently ("2x" is an unbound variable there); what the compiler
+ * accepts, though, it must accept with the same result. Error positions
+ * are not compared, since the postfix evaluator counts them in the
+ * postfix text.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "random_expression.h"
+
+#define EXPRESSION_SIZE 512
+
+static CalcStatus run_postfix(const char *expression, Arena *arena, double *result) {
+    char *postfix;
+    CalcError error;
+    CalcStatus status = infix_to_postfix(expression, &postfix, arena, &error);
+    return status == CALC_OK ? evaluate_postfix(postfix, arena, result, &error) : status;
+}
+
+static CalcStatus run_compiled(const char *expression, Arena *arena, double *result) {
+    Program program;
+    CalcError error;
+    CalcStatus status = compile_expression(expression, &program, arena, &error);
+    return status == CALC_OK ? evaluate_program(&program, result, &error) : status;
+}
+
+int main(int argc, char *argv[]) {
+    const ExpressionShape shape = { 4, 0, 1, 1, 0, 1 };
+    TestRandom random = { 0x9E3779B97F4A7C15ULL };
+    long count = test_count(argc, argv, 100000);
+    long failures = 0;
+    Arena arena;
+    arena_init(&arena);
+
+    for (long n = 0; n < count; n++) {
+        char expression[EXPRESSION_SIZE];
+        random_expression(&random, &shape, expression, sizeof(expression));
+        int damaged = n % 4 == 3;
+        if (damaged) {
+            random_damage(&random, expression, sizeof(expression));
+        }
+
+        double postfix_result = 0, compiled_result = 0;
+        arena_reset(&arena);
+        CalcStatus postfix_status = run_postfix(expression, &arena, &postfix_result);
+        arena_reset(&arena);
+        CalcStatus compiled_status = run_compiled(expression, &arena, &compiled_result);
+        int agree = damaged ? compiled_status != CALC_OK || postfix_status == CALC_OK
+                            : postfix_status == compiled_status;
+        if (!agree ||
+            (compiled_status == CALC_OK &&
+             memcmp(&postfix_result, &compiled_result, sizeof(double)) != 0)) {
+            if (failures < 10) {
+                fprintf(stderr, "FAIL: '%s' gives %s (%.17g) compiled, %s (%.17g) through postfix\n",
+                        expression, calc_status_string(compiled_status), compiled_result,
+                        calc_status_string(postfix_status), postfix_result);
+            }
+            failures++;
+        }
+    }
+
+    arena_free(&arena);
+    printf("%ld expressions, %ld mismatches\n", count, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,186 @@
+/*
+ * Decimal Mode Differential Test
+ * Random expressions over decimal literals are evaluated while they are
+ * generated, with a plain 128-bit reference that rounds every literal,
+ * product and quotient once with the mode under test. evaluate_decimal()
+ * must agree on the result, or on the division by zero and its position,
+ * at several scales and in every rounding mode. Cases whose operands grow
+ * too large for the reference's own arithmetic are skipped.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "decimal.h"
+#include "random_expression.h"
+
+#define EXPRESSION_SIZE 2048
+#define OPERAND_LIMIT ((__int128)1 << 60)     // products of two still fit
+
+typedef struct {
+    TestRandom *random;
+    TextBuilder text;
+    DecimalContext context;
+    __int128 unit;
+    int skipped;            // an operand outgrew the reference
+    int error_position;     // first division by zero, -1 if none
+} Reference;
+
+static const char *const literals[] = {
+    "0", "1", "2", "3", "7", "10", "250", "0.1", "0.2", "0.5", "19.99", "0.005", "12.345",
+    "1.0005", "0.3333", "2.675", "1e2", "1.5e-3", "25E-1", "0.000001", "99999.99999",
+};
+
+static const ExpressionShape blanks = { 0, 0, 0, 0, 0, 1 };
+
+/*
+ * n / d rounded to an integer with the rounding mode
+ */
+static __int128 divide_rounded(__int128 n, __int128 d, DecimalRounding rounding) {
+    __int128 q = n / d, r = n % d;
+    if (r == 0) {
+        return q;
+    }
+    int negative = (n < 0) != (d < 0);
+    __int128 twice = 2 * (r < 0 ? -r : r), divisor = d < 0 ? -d : d;
+    int compare = twice < divisor ? -1 : twice > divisor;
+    int away = 0;
+    switch (rounding) {
+        case DECIMAL_HALF_EVEN: away = compare > 0 || (compare == 0 && (q & 1) != 0); break;
+        case DECIMAL_HALF_UP:   away = compare >= 0; break;
+        case DECIMAL_DOWN:      away = 0; break;
+        case DECIMAL_UP:        away = 1; break;
+        case DECIMAL_FLOOR:     away = negative; break;
+        case DECIMAL_CEILING:   away = !negative; break;
+    }
+    return away ? q + (negative ? -1 : 1) : q;
+}
+
+static __int128 power_of_ten(int exponent) {
+    __int128 power = 1;
+    while (exponent-- > 0) {
+        power *= 10;
+    }
+    return power;
+}
+
+// Scaled value of a literal: its digits times 10^(scale - fraction digits)
+static __int128 literal_value(const char *text, const Reference *ref) {
+    __int128 digits = 0;
+    int shift = ref->context.scale;
+    int after_point = 0;
+    const char *p = text;
+    for (; *p != '\0' && *p != 'e' && *p != 'E'; p++) {
+        if (*p == '.') {
+            after_point = 1;
+        } else {
+            digits = digits * 10 + (*p - '0');
+            shift -= after_point;
+        }
+    }
+    if (*p != '\0') {
+        shift += atoi(p + 1);
+    }
+    return shift >= 0 ? digits * power_of_ten(shift)
+                      : divide_rounded(digits, power_of_ten(-shift), ref->context.rounding);
+}
+
+/*
+ * Write a random expression and compute its scaled value
+ */
+static __int128 generate(Reference *ref, int depth) {
+    TestRandom *random = ref->random;
+    text_blank(random, &blanks, &ref->text);
+
+    if (depth == 0 || random_below(random, 4) == 0) {
+        const char *literal = literals[random_below(random, sizeof(literals) / sizeof(literals[0]))];
+        text_append(&ref->text, literal);
+        return literal_value(literal, ref);
+    }
+
+    text_append(&ref->text, "(");
+    __int128 a = generate(ref, depth - 1);
+    static const char ops[] = "+-*/%";
+    char op = ops[random_below(random, 5)];
+    int position = (int)ref->text.used;
+    text_append(&ref->text, (char[]){ op, '\0' });
+    __int128 b = generate(ref, depth - 1);
+    text_append(&ref->text, ")");
+
+    if (ref->skipped || ref->error_position >= 0) {
+        return 0;
+    }
+    if (a > OPERAND_LIMIT || a < -OPERAND_LIMIT || b > OPERAND_LIMIT || b < -OPERAND_LIMIT) {
+        ref->skipped = 1;
+        return 0;
+    }
+    switch (op) {
+        case '+': return a + b;
+        case '-': return a - b;
+        case '*': return divide_rounded(a * b, ref->unit, ref->context.rounding);
+        default:
+            if (b == 0) {
+                ref->error_position = position;
+                return 0;
+            }
+            if (op == '/') {
+                return divide_rounded(a * ref->unit, b, ref->context.rounding);
+            }
+            return b == -1 ? 0 : a % b;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    static const int scales[] = { 0, 2, 4, 6, 9 };
+    TestRandom random = { 0x94D049BB133111EBULL };
+    long count = test_count(argc, argv, 100000);
+    long failures = 0, checked = 0;
+    Arena arena;
+    arena_init(&arena);
+
+    for (long n = 0; n < count; n++) {
+        char expression[EXPRESSION_SIZE];
+        Reference ref = { &random, { expression, 0, sizeof(expression) },
+                          { scales[n % 5], (DecimalRounding)((n / 5) % 6) }, 0, 0, -1 };
+        ref.unit = power_of_ten(ref.context.scale);
+        expression[0] = '\0';
+        __int128 expected = generate(&ref, 1 + (int)(n % 4));
+        if (ref.skipped || ref.text.used + 1 >= sizeof(expression)) {
+            continue;
+        }
+        checked++;
+
+        Program program;
+        DecimalProgram decimal;
+        CalcError error;
+        CalcDecimal result = 0;
+        arena_reset(&arena);
+        CalcStatus status = compile_expression(expression, &program, &arena, &error);
+        if (status == CALC_OK) {
+            status = compile_decimal(expression, &program, &ref.context, &decimal, &arena, &error);
+        }
+        if (status == CALC_OK) {
+            status = evaluate_decimal(&decimal, NULL, &result, &error);
+        }
+
+        int agree = ref.error_position >= 0
+                        ? status == CALC_ERR_DIVISION_BY_ZERO && error.position == ref.error_position
+                        : status == CALC_OK && result == expected;
+        if (!agree) {
+            if (failures < 10) {
+                char got[DECIMAL_BUFFER_SIZE], want[DECIMAL_BUFFER_SIZE];
+                format_decimal(result, ref.context.scale, got);
+                format_decimal(expected, ref.context.scale, want);
+                fprintf(stderr, "FAIL: '%s' at scale %d, rounding %d: %s %s, expected %s\n",
+                        expression, ref.context.scale, (int)ref.context.rounding,
+                        calc_status_string(status), got, ref.error_position >= 0 ? "error" : want);
+            }
+            failures++;
+        }
+    }
+
+    arena_free(&arena);
+    printf("%ld expressions (%ld checked), %ld mismatches\n", count, checked, failures);
+    return failures == 0 ? 0 : 1;
+}
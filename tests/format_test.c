@@ -0,0 +1,173 @@
+/*
+ * Number Formatting and Scanning Differential Test
+ * Random doubles, from random bits and from short decimals, are printed
+ * with format_shortest(): strtod() and scan_number() must read back the
+ * same bits, and no %.*g precision that reads back must have fewer
+ * significant digits. format_fixed() must print what printf("%.*f")
+ * prints, at every precision, including values on rounding ties. Random
+ * literals with long mantissas and large exponents must scan to what
+ * strtod() gives, ending at the same character.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calc.h"
+#include "format.h"
+#include "numparse.h"
+#include "random_expression.h"
+
+#define LITERAL_SIZE 64
+
+static long failures = 0;
+
+static void fail(const char *what, const char *got, const char *expected, double value) {
+    if (failures < 10) {
+        fprintf(stderr, "FAIL: %s of %.17g gives '%s', expected '%s'\n", what, value, got,
+                expected);
+    }
+    failures++;
+}
+
+static int same_bits(double a, double b) {
+    return memcmp(&a, &b, sizeof(double)) == 0;
+}
+
+// Significant digits in text, leaving out leading and trailing zeros
+static int significant_digits(const char *text) {
+    const char *first = NULL, *last = NULL;
+    int count = 0, trailing = 0;
+    for (const char *p = text; *p != '\0' && *p != 'e' && *p != 'E'; p++) {
+        if (*p < '0' || *p > '9' || (first == NULL && *p == '0')) {
+            continue;
+        }
+        if (first == NULL) {
+            first = p;
+        }
+        last = p;
+        count++;
+        trailing = *p == '0' ? trailing + 1 : 0;
+    }
+    return last == NULL ? 0 : count - trailing;
+}
+
+// A double near a short decimal, so that ties and few digits are common
+static double random_decimal(TestRandom *random) {
+    static const double scales[] = { 1, 10, 100, 1000, 1e4, 1e6, 8, 16, 1024 };
+    double digits = (double)random_below(random, 2000001);
+    double value = digits / scales[random_below(random, sizeof(scales) / sizeof(scales[0]))];
+    return random_below(random, 2) ? -value : value;
+}
+
+static void check_shortest(double value, int check_length) {
+    char text[FORMAT_BUFFER_SIZE], expected[FORMAT_BUFFER_SIZE];
+    format_shortest(value, text);
+    double back = strtod(text, NULL), scanned = 0;
+    const char *unsigned_text = text[0] == '-' ? text + 1 : text;
+    const char *end = scan_number(unsigned_text, &scanned);
+    if (text[0] == '-') {
+        scanned = -scanned;
+    }
+    snprintf(expected, sizeof(expected), "%.17g", value);
+    if (!same_bits(back, value)) {
+        fail("format_shortest, read back by strtod", text, expected, value);
+    } else if (end == NULL || *end != '\0' || !same_bits(scanned, value)) {
+        fail("format_shortest, read back by scan_number", text, expected, value);
+    } else if (check_length) {
+        int precision = 1;
+        for (; precision < FORMAT_MAX_PRECISION; precision++) {
+            snprintf(expected, sizeof(expected), "%.*g", precision, value);
+            if (strtod(expected, NULL) == value) {
+                break;
+            }
+        }
+        snprintf(expected, sizeof(expected), "%.*g", precision, value);
+        if (significant_digits(text) > significant_digits(expected)) {
+            fail("format_shortest, length", text, expected, value);
+        }
+    }
+}
+
+static void check_fixed(double value, int precision) {
+    char text[FORMAT_BUFFER_SIZE], expected[FORMAT_BUFFER_SIZE * 10];
+    int length = snprintf(expected, sizeof(expected), "%.*f", precision, value);
+    if (length >= FORMAT_BUFFER_SIZE) {
+        return;     // printed in %g style instead
+    }
+    format_fixed(value, precision, text);
+    if (strcmp(text, expected) != 0) {
+        char what[32];
+        snprintf(what, sizeof(what), "format_fixed at %d", precision);
+        fail(what, text, expected, value);
+    }
+}
+
+// A literal scan_number() accepts: digits, a point, an exponent
+static void random_literal(TestRandom *random, char *out) {
+    int length = 0;
+    int digits = 1 + (int)random_below(random, 25);
+    int point = (int)random_below(random, (uint32_t)digits + 2) - 1;    // -1: none
+    if (point == 0 && random_below(random, 2)) {
+        out[length++] = '.';    // ".5" form
+        point = -1;
+    }
+    for (int d = 0; d < digits; d++) {
+        if (d == point && d > 0) {
+            out[length++] = '.';
+        }
+        out[length++] = (char)('0' + random_below(random, 10));
+    }
+    if (random_below(random, 3) != 0) {
+        length += snprintf(out + length, (size_t)(LITERAL_SIZE - length), "%c%s%d",
+                           random_below(random, 2) ? 'e' : 'E',
+                           random_below(random, 3) == 0 ? "+" : random_below(random, 2) ? "-" : "",
+                           (int)random_below(random, 340));
+    }
+    out[length] = '\0';
+}
+
+int main(int argc, char *argv[]) {
+    TestRandom random = { 0xC2B2AE3D27D4EB4FULL };
+    long count = test_count(argc, argv, 250000);
+    static const double specials[] = {
+        0.0, -0.0, 1.0, 0.1, 0.3, 1e21, 1e-7, 1e-6, 123456789012345680.0, 9007199254740993.0,
+        5e-324, 2.2250738585072014e-308, 1.7976931348623157e308, 0.5, 2.5, 0.125, 1.005
+    };
+
+    for (size_t i = 0; i < sizeof(specials) / sizeof(specials[0]); i++) {
+        check_shortest(specials[i], 1);
+        for (int precision = 0; precision <= FORMAT_MAX_PRECISION; precision++) {
+            check_fixed(specials[i], precision);
+        }
+    }
+
+    for (long n = 0; n < count; n++) {
+        // Finding the shortest %.*g takes many printf calls, so it is sampled
+        double value = random_finite_double(&random);
+        check_shortest(value, n % 16 == 0);
+        double decimal = random_decimal(&random);
+        check_shortest(decimal, n % 16 == 8);
+        if (n % 4 == 0) {
+            int precision = (int)random_below(&random, FORMAT_MAX_PRECISION + 1);
+            check_fixed(decimal, precision);
+            check_fixed(value, precision);
+            check_fixed(ldexp(value, -(int)random_below(&random, 1000)), precision);
+        }
+        if (n % 4 == 2) {
+            char literal[LITERAL_SIZE];
+            random_literal(&random, literal);
+            char *expected_end;
+            double expected = strtod(literal, &expected_end), scanned = 0;
+            const char *end = scan_number(literal, &scanned);
+            if (end != expected_end || !same_bits(scanned, expected)) {
+                char got[LITERAL_SIZE];
+                snprintf(got, sizeof(got), "%.17g", scanned);
+                fail(literal, got, "the strtod() value", expected);
+            }
+        }
+    }
+
+    printf("%ld doubles, %ld mismatches\n", count * 2, failures);
+    return failures == 0 ? 0 : 1;
+}
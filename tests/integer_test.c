@@ -0,0 +1,158 @@
+/*
+ * Integer Path Differential Test
+ * Random integer expressions are evaluated exactly in 128 bits while they
+ * are generated. Whenever every step stays in int64 and every division
+ * is exact, evaluate_program_value() must give that integer (or the
+ * division by zero, at its position); otherwise it must give exactly what
+ * the double evaluator gives. Programs with a literal that is not a plain
+ * int64 must take the double path too.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "random_expression.h"
+
+#define EXPRESSION_SIZE 2048
+
+typedef struct {
+    TestRandom *random;
+    TextBuilder text;
+    int inexact;            // some step left int64 or had a remainder
+    int integer_literals;   // every literal is a plain int64
+    int error_position;     // first division by zero, -1 if none
+} Reference;
+
+static const char *const literals[] = {
+    "0", "1", "2", "3", "5", "7", "10", "64", "1000", "65536", "4294967296", "1000000007",
+    "3037000499", "9007199254740993", "9223372036854775807", "4611686018427387904",
+};
+
+static const ExpressionShape blanks = { 0, 0, 0, 0, 0, 1 };
+
+static int fits_int64(__int128 value) {
+    return value >= INT64_MIN && value <= INT64_MAX;
+}
+
+/*
+ * Write a random expression and compute its value
+ * Returns: the exact value while ref->inexact is 0
+ */
+static __int128 generate(Reference *ref, int depth) {
+    TestRandom *random = ref->random;
+    uint32_t pick = random_below(random, 40);
+    text_blank(random, &blanks, &ref->text);
+
+    if (depth == 0 || pick < 12) {
+        if (pick == 0) {
+            // Not a plain int64: the program must not use the integer path
+            static const char *const others[] = { "9223372036854775808", "2.0", "1e3", ".5" };
+            text_append(&ref->text, others[random_below(random, 4)]);
+            ref->integer_literals = 0;
+            return 1;
+        }
+        const char *literal = literals[random_below(random, sizeof(literals) / sizeof(literals[0]))];
+        text_append(&ref->text, literal);
+        __int128 value = 0;
+        for (const char *p = literal; *p != '\0'; p++) {
+            value = value * 10 + (*p - '0');
+        }
+        return value;
+    }
+
+    text_append(&ref->text, "(");
+    __int128 a = generate(ref, depth - 1);
+    static const char ops[] = "+-*/%";
+    char op = ops[random_below(random, 5)];
+    int position = (int)ref->text.used;
+    text_append(&ref->text, (char[]){ op, '\0' });
+    __int128 b = generate(ref, depth - 1);
+    text_append(&ref->text, ")");
+
+    if (ref->inexact || ref->error_position >= 0) {
+        return 0;
+    }
+    __int128 value = 0;
+    switch (op) {
+        case '+': value = a + b; break;
+        case '-': value = a - b; break;
+        case '*': value = a * b; break;     // both fit in int64, so no overflow
+        case '/':
+        case '%':
+            if (b == 0) {
+                ref->error_position = position;
+                return 0;
+            }
+            if (op == '/') {
+                ref->inexact |= a % b != 0;
+                value = a / b;
+            } else {
+                value = a % b;
+            }
+            break;
+    }
+    ref->inexact |= !fits_int64(value);
+    return value;
+}
+
+int main(int argc, char *argv[]) {
+    TestRandom random = { 0xD1B54A32D192ED03ULL };
+    long count = test_count(argc, argv, 200000);
+    long failures = 0, exact = 0;
+    Arena arena;
+    arena_init(&arena);
+
+    for (long n = 0; n < count; n++) {
+        char expression[EXPRESSION_SIZE];
+        Reference ref = { &random, { expression, 0, sizeof(expression) }, 0, 1, -1 };
+        expression[0] = '\0';
+        __int128 expected = generate(&ref, 1 + (int)(n % 5));
+        if (ref.text.used + 1 >= sizeof(expression)) {
+            continue;   // cut short: not the expression the reference saw
+        }
+
+        Program program;
+        CalcError error, double_error;
+        CalcValue value;
+        double double_value = 0;
+        arena_reset(&arena);
+        if (compile_expression(expression, &program, &arena, &error) != CALC_OK) {
+            fprintf(stderr, "FAIL: '%s' does not compile: %s\n", expression, error.message);
+            failures++;
+            continue;
+        }
+        CalcStatus status = evaluate_program_value(&program, &value, &error);
+        CalcStatus double_status = evaluate_program(&program, &double_value, &double_error);
+
+        const char *problem = NULL;
+        if (ref.integer_literals != (program.integers != NULL)) {
+            problem = "integer path chosen wrongly";
+        } else if (ref.integer_literals && !ref.inexact && ref.error_position >= 0) {
+            if (status != CALC_ERR_DIVISION_BY_ZERO || error.position != ref.error_position) {
+                problem = "division by zero not reported at its operator";
+            }
+        } else if (ref.integer_literals && !ref.inexact) {
+            exact++;
+            if (status != CALC_OK || !value.is_integer || value.integer != (int64_t)expected ||
+                value.value != (double)value.integer) {
+                problem = "exact result lost";
+            }
+        } else if (status != double_status || value.is_integer ||
+                   (status == CALC_OK && memcmp(&value.value, &double_value, sizeof(double)) != 0) ||
+                   (status != CALC_OK && error.position != double_error.position)) {
+            problem = "fallback differs from the double evaluator";
+        }
+        if (problem != NULL) {
+            if (failures < 10) {
+                fprintf(stderr, "FAIL: '%s': %s (%s, %lld, %.17g)\n", expression, problem,
+                        calc_status_string(status), (long long)value.integer, value.value);
+            }
+            failures++;
+        }
+    }
+
+    arena_free(&arena);
+    printf("%ld expressions (%ld exact), %ld mismatches\n", count, exact, failures);
+    return failures == 0 ? 0 : 1;
+}
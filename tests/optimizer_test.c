@@ -0,0 +1,118 @@
+/*
+ * Optimizer Differential Test
+ * Random expressions, some repeating a subexpression so that there is
+ * something to share, are evaluated before and after optimize_program(),
+ * and after optimizing the optimized program again, with several sets of
+ * variable values including zeros, infinities and NaN. Status, error
+ * position and result bits must be identical every time.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "optimizer.h"
+#include "random_expression.h"
+
+#define EXPRESSION_SIZE 8192
+#define VALUE_SETS 4
+
+static const double interesting[] = { 0.0, -0.0, 1.0, 2.0, 0.5, 3.0, -7.25, 1e300, 1e-300 };
+
+typedef struct {
+    CalcStatus status;
+    int position;
+    double value;
+} Outcome;
+
+static Outcome evaluate(const Program *program, const double *variables) {
+    Outcome outcome = { CALC_OK, -1, 0 };
+    CalcError error;
+    outcome.status = evaluate_program_with(program, variables, &outcome.value, &error);
+    if (outcome.status != CALC_OK) {
+        outcome.position = error.position;
+    }
+    return outcome;
+}
+
+static int same_outcome(const Outcome *a, const Outcome *b) {
+    return a->status == b->status && a->position == b->position &&
+           (a->status != CALC_OK || memcmp(&a->value, &b->value, sizeof(double)) == 0);
+}
+
+/*
+ * Values for the variables of an optimized program, which may have fewer
+ * than the original: each name keeps the value it had there
+ */
+static void bind(const Program *from, const double *values, const Program *to, double *out) {
+    for (int v = 0; v < to->variable_count; v++) {
+        out[v] = values[program_variable_index(from, to->variables[v])];
+    }
+}
+
+int main(int argc, char *argv[]) {
+    const ExpressionShape shape = { 3, 3, 1, 1, 1, 0 };
+    TestRandom random = { 0x2545F4914F6CDD1DULL };
+    long count = test_count(argc, argv, 50000);
+    long failures = 0;
+    Arena arena;
+    arena_init(&arena);
+
+    for (long n = 0; n < count; n++) {
+        char part[EXPRESSION_SIZE / 4], expression[EXPRESSION_SIZE];
+        random_expression(&random, &shape, part, sizeof(part));
+        if (n % 3 == 0) {
+            // The same subexpression twice, for common subexpression elimination
+            char other[EXPRESSION_SIZE / 4];
+            random_expression(&random, &shape, other, sizeof(other));
+            snprintf(expression, sizeof(expression), "(%s)*(%s) - (%s)/(%s)", part, other, other,
+                     part);
+        } else {
+            snprintf(expression, sizeof(expression), "%s", part);
+        }
+
+        Program program, optimized, twice;
+        CalcError error;
+        arena_reset(&arena);
+        if (compile_expression(expression, &program, &arena, &error) != CALC_OK) {
+            continue;   // the generator wrote an expression with a syntax error
+        }
+        if (optimize_program(&program, &optimized, &arena, 0, &error) != CALC_OK ||
+            optimize_program(&optimized, &twice, &arena, 0, &error) != CALC_OK) {
+            fprintf(stderr, "FAIL: '%s' does not optimize: %s\n", expression, error.message);
+            failures++;
+            continue;
+        }
+
+        for (int set = 0; set < VALUE_SETS; set++) {
+            double values[TEST_VARIABLE_COUNT], optimized_values[TEST_VARIABLE_COUNT];
+            double twice_values[TEST_VARIABLE_COUNT];
+            for (int v = 0; v < program.variable_count; v++) {
+                uint32_t pick = random_below(&random, 12);
+                values[v] = pick < 9 ? interesting[pick] : pick == 9 ? INFINITY
+                          : pick == 10 ? NAN : random_finite_double(&random);
+            }
+            bind(&program, values, &optimized, optimized_values);
+            bind(&program, values, &twice, twice_values);
+
+            Outcome plain = evaluate(&program, values);
+            Outcome once = evaluate(&optimized, optimized_values);
+            Outcome again = evaluate(&twice, twice_values);
+            if (!same_outcome(&plain, &once) || !same_outcome(&plain, &again)) {
+                if (failures < 10) {
+                    fprintf(stderr, "FAIL: '%s' gives %s at %d (%.17g), optimized %s at %d "
+                            "(%.17g), twice %s at %d (%.17g)\n", expression,
+                            calc_status_string(plain.status), plain.position, plain.value,
+                            calc_status_string(once.status), once.position, once.value,
+                            calc_status_string(again.status), again.position, again.value);
+                }
+                failures++;
+            }
+        }
+    }
+
+    arena_free(&arena);
+    printf("%ld expressions, %ld mismatches\n", count, failures);
+    return failures == 0 ? 0 : 1;
+}
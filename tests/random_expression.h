@@ -0,0 +1,183 @@
+/*
+ * Random Expressions for the Differential Tests
+ * A fixed-seed generator, so that every run checks the same cases and a
+ * failure can be reproduced from the expression it prints.
+ */
+
+#ifndef RANDOM_EXPRESSION_H
+#define RANDOM_EXPRESSION_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t state;     // never 0
+} TestRandom;
+
+// xorshift64*
+static inline uint64_t random_next(TestRandom *random) {
+    random->state ^= random->state >> 12;
+    random->state ^= random->state << 25;
+    random->state ^= random->state >> 27;
+    return random->state * 0x2545F4914F6CDD1DULL;
+}
+
+// Returns: a number in [0, n)
+static inline uint32_t random_below(TestRandom *random, uint32_t n) {
+    return (uint32_t)((random_next(random) >> 32) % n);
+}
+
+// Returns: a finite double with random bits
+static inline double random_finite_double(TestRandom *random) {
+    for (;;) {
+        uint64_t bits = random_next(random);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value - value == 0) {
+            return value;
+        }
+    }
+}
+
+// Number of cases to run: the first argument if given, so that a test can
+// be run at a larger size than ctest uses
+static inline long test_count(int argc, char *argv[], long fallback) {
+    long count = argc > 1 ? atol(argv[1]) : 0;
+    return count > 0 ? count : fallback;
+}
+
+// What random_expression() may put in an expression
+typedef struct {
+    int max_depth;      // operator nesting
+    int variables;      // how many of test_variables[] may appear
+    int functions;      // sqrt(), pow(), ...
+    int modulo;         // the % operator
+    int reductions;     // sum(), product(), min(), max()
+    int tabs;           // blanks may be tabs as well as spaces
+} ExpressionShape;
+
+static const char *const test_variables[] = { "x", "y", "rate", "qty", "t_0", "z" };
+#define TEST_VARIABLE_COUNT ((int)(sizeof(test_variables) / sizeof(test_variables[0])))
+
+static const char *const test_numbers[] = {
+    "0", "1", "2", "3", "7", "10", "0.5", ".25", "2.5", "1e3", "1.5e-3", "4E+2",
+    "123456789", "9007199254740993", "0.1", "1e300", "6.02e23", "3.14159"
+};
+
+typedef struct {
+    char *text;
+    size_t used;
+    size_t size;        // the text is cut short rather than overrun
+} TextBuilder;
+
+static inline void text_append(TextBuilder *builder, const char *text) {
+    size_t length = strlen(text);
+    if (builder->used + length < builder->size) {
+        memcpy(builder->text + builder->used, text, length + 1);
+        builder->used += length;
+    }
+}
+
+static inline void text_blank(TestRandom *random, const ExpressionShape *shape,
+                              TextBuilder *builder) {
+    switch (random_below(random, 6)) {
+        case 0: text_append(builder, " "); break;
+        case 1: text_append(builder, shape->tabs ? "\t" : "  "); break;
+        default: break;
+    }
+}
+
+static inline void random_term(TestRandom *random, const ExpressionShape *shape, int depth,
+                               const char *index, TextBuilder *builder);
+
+static inline void random_operand(TestRandom *random, const ExpressionShape *shape, int depth,
+                                  const char *index, TextBuilder *builder) {
+    static const char *const functions[] = { "sqrt", "exp", "log", "sin", "cos" };
+    static const char *const reductions[] = { "sum", "product", "min", "max" };
+    uint32_t pick = random_below(random, 16);
+
+    text_blank(random, shape, builder);
+    if (depth > 0 && pick < 4) {
+        text_append(builder, "(");
+        random_term(random, shape, depth - 1, index, builder);
+        text_append(builder, ")");
+    } else if (depth > 0 && shape->functions && pick == 4) {
+        text_append(builder, functions[random_below(random, 5)]);
+        text_append(builder, "(");
+        random_term(random, shape, depth - 1, index, builder);
+        text_append(builder, ")");
+    } else if (depth > 0 && shape->functions && pick == 5) {
+        text_append(builder, "pow(");
+        random_term(random, shape, depth - 1, index, builder);
+        text_append(builder, ",");
+        text_append(builder, test_numbers[random_below(random, 6)]);
+        text_append(builder, ")");
+    } else if (depth > 0 && shape->reductions && pick == 6 && index == NULL) {
+        // sum(i, FROM, TO, BODY) over a short range; the body may read i
+        char bounds[32];
+        int from = (int)random_below(random, 5);
+        snprintf(bounds, sizeof(bounds), ", %d, %d, ", from, from + (int)random_below(random, 40));
+        text_append(builder, reductions[random_below(random, 4)]);
+        text_append(builder, "(i");
+        text_append(builder, bounds);
+        random_term(random, shape, depth - 1, "i", builder);
+        text_append(builder, ")");
+    } else if (index != NULL && pick < 9) {
+        text_append(builder, index);
+    } else if (shape->variables > 0 && pick < 11) {
+        text_append(builder, test_variables[random_below(random, (uint32_t)shape->variables)]);
+    } else {
+        text_append(builder,
+                    test_numbers[random_below(random, sizeof(test_numbers) / sizeof(test_numbers[0]))]);
+    }
+    text_blank(random, shape, builder);
+}
+
+static inline void random_term(TestRandom *random, const ExpressionShape *shape, int depth,
+                               const char *index, TextBuilder *builder) {
+    random_operand(random, shape, depth, index, builder);
+    int operators = depth > 0 ? (int)random_below(random, 4) : 0;
+    for (int i = 0; i < operators; i++) {
+        static const char ops[] = "+-*/%";
+        char op[2] = { ops[random_below(random, shape->modulo ? 5 : 4)], '\0' };
+        text_append(builder, op);
+        random_operand(random, shape, depth - 1, index, builder);
+    }
+}
+
+// Write a well-formed random expression of the given shape to out
+static inline void random_expression(TestRandom *random, const ExpressionShape *shape, char *out,
+                                     size_t size) {
+    TextBuilder builder = { out, 0, size };
+    out[0] = '\0';
+    random_term(random, shape, shape->max_depth, NULL, &builder);
+}
+
+// Damage an expression at one random spot, for the error paths
+static inline void random_damage(TestRandom *random, char *text, size_t size) {
+    static const char junk[] = "()+*/.e1 ,$x";
+    size_t length = strlen(text);
+    size_t at = length > 0 ? random_below(random, (uint32_t)length) : 0;
+    switch (random_below(random, 3)) {
+        case 0:     // delete a character
+            if (length > 0) {
+                memmove(text + at, text + at + 1, length - at);
+            }
+            break;
+        case 1:     // insert one
+            if (length + 1 < size) {
+                memmove(text + at + 1, text + at, length - at + 1);
+                text[at] = junk[random_below(random, sizeof(junk) - 1)];
+            }
+            break;
+        default:    // replace one
+            if (length > 0) {
+                text[at] = junk[random_below(random, sizeof(junk) - 1)];
+            }
+            break;
+    }
+}
+
+#endif  // RANDOM_EXPRESSION_H
@@ -0,0 +1,167 @@
+/*
+ * Reduction Differential Test
+ * Random sum(), product(), min() and max() expressions are evaluated with
+ * 1, 2, 3 and 8 threads, over ranges long enough to be split: status,
+ * error position and result bits must not depend on the thread count.
+ * Each body is also compiled on its own, with i as a variable, and run
+ * term by term: min() and max() must match that exactly, and so must
+ * sum() whenever every partial sum is an exact integer. Any NaN matches
+ * any other there, since which one propagates is not specified.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "reduce.h"
+#include "random_expression.h"
+
+#define EXPRESSION_SIZE 1024
+#define EXACT_LIMIT 9007199254740992.0      // 2^53
+
+static const int thread_counts[] = { 1, 2, 3, 8 };
+
+typedef struct {
+    CalcStatus status;
+    int position;
+    double value;
+} Outcome;
+
+static Outcome evaluate(const Program *program, const double *variables) {
+    Outcome outcome = { CALC_OK, -1, 0 };
+    CalcError error;
+    outcome.status = evaluate_program_with(program, variables, &outcome.value, &error);
+    if (outcome.status != CALC_OK) {
+        outcome.position = error.position;
+    }
+    return outcome;
+}
+
+static int same_outcome(const Outcome *a, const Outcome *b) {
+    return a->status == b->status && a->position == b->position &&
+           (a->status != CALC_OK || memcmp(&a->value, &b->value, sizeof(double)) == 0);
+}
+
+// min() and max() order -0 below +0 and let NaN through
+static double combine(ReductionKind kind, double total, double term) {
+    if (isnan(total) || isnan(term)) {
+        return NAN;
+    }
+    int less = term < total || (term == total && signbit(term) && !signbit(total));
+    int more = term > total || (term == total && !signbit(term) && signbit(total));
+    return kind == REDUCE_MIN ? (less ? term : total) : (more ? term : total);
+}
+
+/*
+ * Run the body term by term for i = from..to
+ * Returns: 1 if the result is order-independent and *expected holds it
+ */
+static int reference(ReductionKind kind, const char *body, long from, long to, double x,
+                     double y, Arena *arena, double *expected) {
+    Program program;
+    CalcError error;
+    if (compile_expression(body, &program, arena, &error) != CALC_OK) {
+        return 0;
+    }
+    double values[TEST_VARIABLE_COUNT + 1];
+    for (int v = 0; v < program.variable_count; v++) {
+        values[v] = strcmp(program.variables[v], "x") == 0 ? x : y;
+    }
+    int index = program_variable_index(&program, "i");
+
+    double total = kind == REDUCE_MIN ? INFINITY : kind == REDUCE_MAX ? -INFINITY : 0;
+    int exact = 1;
+    for (long i = from; i <= to; i++) {
+        double term;
+        if (index >= 0) {
+            values[index] = (double)i;
+        }
+        if (evaluate_program_with(&program, values, &term, &error) != CALC_OK) {
+            return 0;
+        }
+        if (kind == REDUCE_SUM) {
+            total = i == from ? term : total + term;    // -0 stays -0 if every term is
+            exact &= term == floor(term) && fabs(total) < EXACT_LIMIT && fabs(term) < EXACT_LIMIT;
+        } else {
+            total = combine(kind, total, term);
+        }
+    }
+    *expected = total;
+    return kind == REDUCE_MIN || kind == REDUCE_MAX || (kind == REDUCE_SUM && exact);
+}
+
+int main(int argc, char *argv[]) {
+    const ExpressionShape shape = { 2, 2, 1, 1, 0, 0 };
+    TestRandom random = { 0xBF58476D1CE4E5B9ULL };
+    long count = test_count(argc, argv, 300);
+    long failures = 0, referenced = 0;
+    Arena arena;
+    arena_init(&arena);
+
+    for (long n = 0; n < count; n++) {
+        char body[EXPRESSION_SIZE / 2], expression[EXPRESSION_SIZE];
+        TextBuilder builder = { body, 0, sizeof(body) };
+        body[0] = '\0';
+        random_term(&random, &shape, shape.max_depth, "i", &builder);
+
+        // Every tenth range has several units of work for the threads
+        ReductionKind kind = (ReductionKind)random_below(&random, REDUCE_KIND_COUNT);
+        long from = (long)random_below(&random, 20);
+        long to = from + (long)random_below(&random, n % 10 == 0 ? 300000 : 3000);
+        snprintf(expression, sizeof(expression), "%s(i, %ld, %ld, %s)", reduction_names[kind],
+                 from, to, body);
+        double variables[2] = { (double)random_below(&random, 7) - 3, 0.5 + random_below(&random, 4) };
+
+        arena_reset(&arena);
+        Program program;
+        CalcError error;
+        if (compile_expression(expression, &program, &arena, &error) != CALC_OK) {
+            if (failures < 10) {
+                fprintf(stderr, "FAIL: '%s' does not compile: %s\n", expression, error.message);
+            }
+            failures++;
+            continue;
+        }
+        double values[2];
+        for (int v = 0; v < program.variable_count; v++) {
+            values[v] = variables[strcmp(program.variables[v], "x") == 0 ? 0 : 1];
+        }
+
+        Outcome first;
+        for (size_t t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++) {
+            reduce_set_threads(thread_counts[t]);
+            Outcome outcome = evaluate(&program, values);
+            if (t == 0) {
+                first = outcome;
+            } else if (!same_outcome(&first, &outcome)) {
+                if (failures < 10) {
+                    fprintf(stderr, "FAIL: '%s' gives %s (%.17g) on 1 thread, %s (%.17g) on %d\n",
+                            expression, calc_status_string(first.status), first.value,
+                            calc_status_string(outcome.status), outcome.value, thread_counts[t]);
+                }
+                failures++;
+            }
+        }
+        reduce_set_threads(1);
+
+        double expected;
+        if (first.status == CALC_OK &&
+            reference(kind, body, from, to, variables[0], variables[1], &arena, &expected)) {
+            referenced++;
+            if (isnan(expected) ? !isnan(first.value)
+                                : memcmp(&expected, &first.value, sizeof(double)) != 0) {
+                if (failures < 10) {
+                    fprintf(stderr, "FAIL: '%s' gives %.17g, term by term %.17g\n", expression,
+                            first.value, expected);
+                }
+                failures++;
+            }
+        }
+    }
+
+    arena_free(&arena);
+    printf("%ld reductions (%ld against a term-by-term loop), %ld mismatches\n", count,
+           referenced, failures);
+    return failures == 0 ? 0 : 1;
+}
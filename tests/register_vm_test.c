@@ -0,0 +1,139 @@
+/*
+ * Register VM and JIT Differential Test
+ * Random expressions over variables are run row by row with
+ * evaluate_program_with(), which every other backend must match:
+ * evaluate_registers(), jit_evaluate(), and over whole columns
+ * evaluate_columns() and jit_evaluate_columns(). Per row the status must
+ * agree, the error position too for the one-row backends, and the result
+ * bits when the row succeeds. Any NaN matches any other: when both
+ * operands of + or * are NaN the vector kernels may return either one.
+ * The rows cover whole blocks and a partial one, with zeros for
+ * divisions. ctest also runs this test with CALC_SIMD set, so that every
+ * kernel set is checked.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "register_vm.h"
+#include "jit.h"
+#include "vector_eval.h"
+#include "random_expression.h"
+
+#define EXPRESSION_SIZE 4096
+#define ROWS (2 * VECTOR_BLOCK_ROWS + 13)
+
+static const double interesting[] = { 0.0, -0.0, 1.0, 2.0, 0.5, 3.0, -7.25, 1e300, INFINITY };
+
+static double columns[TEST_VARIABLE_COUNT][ROWS];
+static double expected[ROWS], results[ROWS];
+static CalcStatus expected_status[ROWS];
+static int expected_position[ROWS];
+static unsigned char row_status[ROWS];
+
+static long failures = 0;
+
+static void report(const char *backend, const char *expression, size_t row, CalcStatus status,
+                   double value) {
+    if (failures < 10) {
+        fprintf(stderr, "FAIL: '%s' row %zu: %s gives %s (%.17g), the stack evaluator %s (%.17g)\n",
+                expression, row, backend, calc_status_string(status), value,
+                calc_status_string(expected_status[row]), expected[row]);
+    }
+    failures++;
+}
+
+static int row_matches(size_t row, CalcStatus status, double value) {
+    if (status != expected_status[row] || status != CALC_OK) {
+        return status == expected_status[row];
+    }
+    return isnan(expected[row]) ? isnan(value)
+                                : memcmp(&value, &expected[row], sizeof(double)) == 0;
+}
+
+// Check the results of a whole-column backend
+static void check_columns(const char *backend, const char *expression) {
+    for (size_t row = 0; row < ROWS; row++) {
+        if (!row_matches(row, (CalcStatus)row_status[row], results[row])) {
+            report(backend, expression, row, (CalcStatus)row_status[row], results[row]);
+            return;
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    TestRandom random = { 0x3C6EF372FE94F82BULL };
+    long count = test_count(argc, argv, 3000);
+    long jitted = 0;
+    Arena arena;
+    arena_init(&arena);
+
+    for (long n = 0; n < count; n++) {
+        // The JIT declines calls and %, so half the expressions leave them out
+        const ExpressionShape shape = { 3, 4, n % 2, n % 2, 0, 0 };
+        char expression[EXPRESSION_SIZE];
+        random_expression(&random, &shape, expression, sizeof(expression));
+
+        Program program;
+        RegisterProgram registers;
+        CalcError error;
+        arena_reset(&arena);
+        if (compile_expression(expression, &program, &arena, &error) != CALC_OK) {
+            continue;
+        }
+        if (compile_registers(&program, &registers, &arena, &error) != CALC_OK) {
+            fprintf(stderr, "FAIL: '%s' has no register program: %s\n", expression, error.message);
+            failures++;
+            continue;
+        }
+        JitCode *jit = jit_compile(&registers);
+        jitted += jit != NULL;
+
+        const double *column_pointers[TEST_VARIABLE_COUNT];
+        for (int v = 0; v < program.variable_count; v++) {
+            for (size_t row = 0; row < ROWS; row++) {
+                uint32_t pick = random_below(&random, 12);
+                columns[v][row] = pick < 9 ? interesting[pick] : (double)random_below(&random, 100);
+            }
+            column_pointers[v] = columns[v];
+        }
+
+        for (size_t row = 0; row < ROWS; row++) {
+            double values[TEST_VARIABLE_COUNT], value = 0;
+            for (int v = 0; v < program.variable_count; v++) {
+                values[v] = columns[v][row];
+            }
+            expected_status[row] = evaluate_program_with(&program, values, &expected[row], &error);
+            expected_position[row] = expected_status[row] == CALC_OK ? -1 : error.position;
+
+            CalcStatus status = evaluate_registers(&registers, values, &value, &error);
+            if (!row_matches(row, status, value) ||
+                (status != CALC_OK && error.position != expected_position[row])) {
+                report("evaluate_registers", expression, row, status, value);
+            }
+            if (jit != NULL) {
+                status = jit_evaluate(jit, &registers, values, &value, &error);
+                if (!row_matches(row, status, value) ||
+                    (status != CALC_OK && error.position != expected_position[row])) {
+                    report("jit_evaluate", expression, row, status, value);
+                }
+            }
+        }
+
+        evaluate_columns(&program, column_pointers, ROWS, results, row_status, &error);
+        check_columns("evaluate_columns", expression);
+        if (jit != NULL) {
+            jit_evaluate_columns(jit, &registers, column_pointers, ROWS, results, row_status,
+                                 &error);
+            check_columns("jit_evaluate_columns", expression);
+        }
+        jit_free(jit);
+    }
+
+    arena_free(&arena);
+    printf("%ld expressions (%ld compiled to native code) on %s kernels, %ld mismatches\n", count,
+           jitted, vector_isa(), failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,276 @@
+/*
+ * Workspace Differential Test
+ * Random formulas are defined and redefined over a few thousand cells
+ * that read each other, with some syntax errors, circular references and
+ * cells that are never defined. Two workspaces take the same definitions
+ * and recompute incrementally, one on 1 thread and one on 4. After every
+ * recompute each cell must match in both, in a workspace given only the
+ * accepted definitions at once, and in a plain recursive evaluation of
+ * those definitions. A definition must be refused as circular exactly
+ * when it would close a cycle.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "calc.h"
+#include "arena.h"
+#include "workspace.h"
+#include "random_expression.h"
+
+#define CELLS 3000
+#define MAX_REFERENCES 4
+#define FORMULA_SIZE 128
+#define NAME_SIZE 16
+
+static const char *const literals[] = { "0", "1", "2", "3", "0.5", "10", "1e300", "7" };
+static const char ops[] = "+-*/";
+
+// The accepted definitions
+typedef struct {
+    char formula[FORMULA_SIZE];
+    int references[MAX_REFERENCES];
+    int reference_count;
+    int defined;
+} ModelCell;
+
+static ModelCell model[CELLS];
+static uint32_t marks[CELLS], mark_epoch;
+static CalcStatus reference_status[CELLS];
+static double reference_value[CELLS];
+static int reference_done[CELLS];
+
+static long failures = 0;
+
+static void fail(const char *name, const char *problem) {
+    if (failures < 10) {
+        fprintf(stderr, "FAIL: cell %s = '%s': %s\n", name,
+                model[atoi(name + 1)].formula, problem);
+    }
+    failures++;
+}
+
+/*
+ * Write a random formula into cell, recording which cells it reads
+ * Returns: 1 if the formula is valid
+ */
+static int random_formula(TestRandom *random, ModelCell *cell) {
+    int terms = 1 + (int)random_below(random, MAX_REFERENCES);
+    int used = 0;
+    cell->reference_count = 0;
+    for (int t = 0; t < terms; t++) {
+        if (t > 0) {
+            used += snprintf(cell->formula + used, FORMULA_SIZE - (size_t)used, " %c ",
+                             ops[random_below(random, 4)]);
+        }
+        if (random_below(random, 4) == 0) {
+            used += snprintf(cell->formula + used, FORMULA_SIZE - (size_t)used, "%s",
+                             literals[random_below(random, sizeof(literals) / sizeof(literals[0]))]);
+        } else {
+            int input = (int)random_below(random, CELLS);
+            cell->references[cell->reference_count++] = input;
+            used += snprintf(cell->formula + used, FORMULA_SIZE - (size_t)used, "c%d", input);
+        }
+    }
+    if (random_below(random, 40) == 0) {
+        snprintf(cell->formula + used, FORMULA_SIZE - (size_t)used, " *");
+        return 0;
+    }
+    return 1;
+}
+
+// Returns: 1 if target can be reached from cell through the definitions
+static int reaches(int cell, int target) {
+    if (cell == target) {
+        return 1;
+    }
+    if (marks[cell] == mark_epoch || !model[cell].defined) {
+        return 0;
+    }
+    marks[cell] = mark_epoch;
+    for (int r = 0; r < model[cell].reference_count; r++) {
+        if (reaches(model[cell].references[r], target)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Evaluate cell from the definitions alone: a cell reading a failed cell
+ * fails with the status of the first one it names
+ */
+static CalcStatus reference(int cell, Arena *arena) {
+    if (reference_done[cell]) {
+        return reference_status[cell];
+    }
+    reference_done[cell] = 1;
+    reference_value[cell] = 0;
+    if (!model[cell].defined) {
+        return reference_status[cell] = CALC_ERR_UNBOUND_VARIABLE;
+    }
+    Program program;
+    CalcError error;
+    if (compile_expression(model[cell].formula, &program, arena, &error) != CALC_OK) {
+        return reference_status[cell] = error.status;
+    }
+    double values[MAX_REFERENCES];
+    for (int v = 0; v < program.variable_count; v++) {
+        int input = atoi(program.variables[v] + 1);
+        CalcStatus status = reference(input, arena);
+        if (status != CALC_OK) {
+            return reference_status[cell] = status;
+        }
+        values[v] = reference_value[input];
+    }
+    return reference_status[cell] = evaluate_program_with(&program, values,
+                                                          &reference_value[cell], &error);
+}
+
+static int same_cell(const Workspace *a, int a_cell, const Workspace *b, int b_cell) {
+    CalcValue a_value, b_value;
+    CalcError a_error, b_error;
+    CalcStatus a_status = workspace_value(a, a_cell, &a_value, &a_error);
+    CalcStatus b_status = workspace_value(b, b_cell, &b_value, &b_error);
+    if (a_status != b_status) {
+        return 0;
+    }
+    if (a_status != CALC_OK) {
+        return strcmp(a_error.message, b_error.message) == 0;
+    }
+    return memcmp(&a_value.value, &b_value.value, sizeof(double)) == 0 &&
+           a_value.is_integer == b_value.is_integer &&
+           (!a_value.is_integer || a_value.integer == b_value.integer);
+}
+
+/*
+ * Compare every cell of the incremental workspaces with a fresh one and
+ * with the recursive evaluation
+ */
+static void check(Workspace *single, Workspace *threaded, Arena *arena) {
+    Workspace fresh;
+    CalcError error;
+    if (!workspace_init(&fresh)) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (int c = 0; c < CELLS; c++) {
+        char name[NAME_SIZE];
+        int length = snprintf(name, sizeof(name), "c%d", c);
+        if (model[c].defined &&
+            workspace_define(&fresh, name, (size_t)length, model[c].formula, &error) != CALC_OK) {
+            fail(name, "accepted once, refused in a fresh workspace");
+        }
+    }
+    if (workspace_recompute(&fresh, NULL, &error) != CALC_OK) {
+        fprintf(stderr, "FAIL: recompute: %s\n", error.message);
+        failures++;
+    }
+
+    arena_reset(arena);
+    memset(reference_done, 0, sizeof(reference_done));
+    for (int c = 0; c < CELLS; c++) {
+        char name[NAME_SIZE];
+        int length = snprintf(name, sizeof(name), "c%d", c);
+        int a = workspace_find(single, name, (size_t)length);
+        int b = workspace_find(threaded, name, (size_t)length);
+        if ((a < 0) != (b < 0)) {
+            fail(name, "exists in only one of the incremental workspaces");
+            continue;
+        }
+        if (a < 0) {
+            if (model[c].defined) {
+                fail(name, "defined but missing");
+            }
+            continue;
+        }
+        if (!same_cell(single, a, threaded, b)) {
+            fail(name, "differs between 1 and 4 threads");
+            continue;
+        }
+        CalcValue value;
+        CalcStatus status = workspace_value(single, a, &value, &error);
+        if (reference(c, arena) != status ||
+            (status == CALC_OK &&
+             memcmp(&value.value, &reference_value[c], sizeof(double)) != 0)) {
+            fail(name, "differs from the recursive evaluation");
+            continue;
+        }
+        int f = workspace_find(&fresh, name, (size_t)length);
+        if (f < 0 ? model[c].defined : !same_cell(single, a, &fresh, f)) {
+            fail(name, "differs from a fresh workspace");
+        }
+    }
+    workspace_free(&fresh);
+}
+
+int main(int argc, char *argv[]) {
+    TestRandom random = { 0x9E3779B97F4A7C15ULL };
+    long rounds = test_count(argc, argv, 100);
+    long defined = 0, cycles = 0;
+    Workspace single, threaded;
+    Arena arena;
+    arena_init(&arena);
+    if (!workspace_init(&single) || !workspace_init(&threaded)) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    workspace_set_threads(&threaded, 4);
+
+    // The first round defines nearly every cell, later ones a few at a time
+    for (long round = 0; round < rounds && failures < 10; round++) {
+        int changes = round == 0 ? CELLS : 1 + (int)random_below(&random, 50);
+        for (int n = 0; n < changes; n++) {
+            int c = round == 0 ? n : (int)random_below(&random, CELLS);
+            if (round == 0 && random_below(&random, 50) == 0) {
+                continue;   // left undefined
+            }
+            char name[NAME_SIZE];
+            int length = snprintf(name, sizeof(name), "c%d", c);
+            ModelCell candidate;
+            int valid = random_formula(&random, &candidate);
+
+            mark_epoch++;
+            int circular = 0;
+            for (int r = 0; r < candidate.reference_count && !circular; r++) {
+                circular = reaches(candidate.references[r], c);
+            }
+
+            CalcError error;
+            CalcStatus status = workspace_define(&single, name, (size_t)length,
+                                                 candidate.formula, &error);
+            CalcStatus threaded_status = workspace_define(&threaded, name, (size_t)length,
+                                                          candidate.formula, &error);
+            CalcStatus expected = !valid ? CALC_ERR_SYNTAX : circular ? CALC_ERR_CYCLE : CALC_OK;
+            if (status != expected || threaded_status != expected) {
+                if (failures < 10) {
+                    fprintf(stderr, "FAIL: defining %s = '%s' gives %s, expected %s\n", name,
+                            candidate.formula, calc_status_string(status),
+                            calc_status_string(expected));
+                }
+                failures++;
+            }
+            if (status == CALC_OK) {
+                candidate.defined = 1;
+                model[c] = candidate;
+                defined++;
+            }
+            cycles += valid && circular;
+        }
+
+        CalcError error;
+        if (workspace_recompute(&single, NULL, &error) != CALC_OK ||
+            workspace_recompute(&threaded, NULL, &error) != CALC_OK) {
+            fprintf(stderr, "FAIL: recompute: %s\n", error.message);
+            failures++;
+        }
+        check(&single, &threaded, &arena);
+    }
+
+    workspace_free(&single);
+    workspace_free(&threaded);
+    arena_free(&arena);
+    printf("%ld rounds (%ld definitions, %ld circular), %ld mismatches\n", rounds, defined,
+           cycles, failures);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+/*
+ * Vector Evaluation Header File
+ * Evaluates one compiled Program over many rows of variable values
+ */
+
+#ifndef VECTOR_EVAL_H
+#define VECTOR_EVAL_H
+
+#include <stddef.h>
+#include "calc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Rows evaluated per pass over the program
+#define VECTOR_BLOCK_ROWS 512
+
+const char *vector_isa(void);
+CalcStatus evaluate_columns(const Program *program, const double *const *columns, size_t rows,
+                            double *results, unsigned char *row_status, CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // VECTOR_EVAL_H
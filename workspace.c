@@ -0,0 +1,712 @@
+/*
+ * Workspace Implementation File
+ *
+ *   revenue = 1200
+ *   cost = 700 + overhead
+ *   overhead = 150
+ *   margin = revenue - cost
+ *
+ * Every cell keeps its compiled formula, the cells it reads (inputs[v]
+ * for program variable v) and the cells that read it (dependents): the
+ * edges of the dependency graph in both directions.
+ *
+ * workspace_define() compiles the formula, resolves its identifiers to
+ * cells (creating the ones not defined yet) and relinks the edges. It
+ * refuses a formula that would close a cycle: if one of the new inputs
+ * is among the cells downstream of the cell being defined, the cell
+ * would end up reading itself.
+ *
+ * workspace_recompute() walks the dependents of every cell defined since
+ * the previous call; the cells reached are the only ones whose values
+ * can change. Each of them counts how many of its inputs were reached
+ * too, and they are evaluated in waves (Kahn's algorithm): a wave is
+ * every cell whose reached inputs are all done. Cells of one wave never
+ * read each other, so a large wave is split between threads. A value
+ * depends only on the values of the inputs, so the results are the same
+ * for any number of threads.
+ *
+ * Redefinitions leave the old programs behind in the arena. Once those
+ * outweigh the live ones (measured by formula length), every formula is
+ * compiled again into a fresh arena.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "workspace.h"
+
+#define WORKSPACE_INITIAL_CELLS 64
+#define WORKSPACE_CELLS_PER_THREAD 512  // smallest share of a wave worth a thread
+#define WORKSPACE_REBUILD_MIN (64 * 1024)
+#define WORKSPACE_LOCAL_INPUTS 64
+
+struct WorkspaceCell {
+    char *name;
+    char *formula;          // NULL while the cell is only read by others
+    Program program;
+    int *inputs;            // inputs[v]: cell bound to program variable v
+    int *dependents;        // cells whose formulas read this one
+    int dependent_count;
+    int dependent_capacity;
+    int64_t integer;        // exact value when is_integer (see CalcValue)
+    int is_integer;
+    CalcError error;        // why the cell failed, when status[c] says so
+};
+
+// Cells of one wave that a thread evaluates
+typedef struct {
+    Workspace *workspace;
+    const int *cells;
+    int count;
+} WaveSlice;
+
+static CalcStatus workspace_error(CalcError *error, CalcStatus status, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+static CalcStatus workspace_error(CalcError *error, CalcStatus status, const char *format, ...) {
+    if (error != NULL) {
+        va_list args;
+        error->status = status;
+        error->position = -1;
+        va_start(args, format);
+        vsnprintf(error->message, sizeof(error->message), format, args);
+        va_end(args);
+    }
+    return status;
+}
+
+static uint64_t name_hash(const char *name, size_t length) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)name[i]) * 0x100000001B3ULL;
+    }
+    return h;
+}
+
+/*
+ * Make room for capacity cells in the cell array and the arrays beside it
+ * Returns: 1 on success, 0 if out of memory (nothing is lost)
+ */
+static int grow_cells(Workspace *workspace, int capacity) {
+    WorkspaceCell *cells = realloc(workspace->cells, (size_t)capacity * sizeof(WorkspaceCell));
+    if (cells != NULL) {
+        workspace->cells = cells;
+    }
+    double *values = realloc(workspace->values, (size_t)capacity * sizeof(double));
+    if (values != NULL) {
+        workspace->values = values;
+    }
+    unsigned char *status = realloc(workspace->status, (size_t)capacity);
+    if (status != NULL) {
+        workspace->status = status;
+    }
+    uint32_t *marks = realloc(workspace->marks, (size_t)capacity * sizeof(uint32_t));
+    if (marks != NULL) {
+        workspace->marks = marks;
+    }
+    int *waiting = realloc(workspace->waiting, (size_t)capacity * sizeof(int));
+    if (waiting != NULL) {
+        workspace->waiting = waiting;
+    }
+    if (cells == NULL || values == NULL || status == NULL || marks == NULL || waiting == NULL) {
+        return 0;
+    }
+    workspace->cell_capacity = capacity;
+    return 1;
+}
+
+int workspace_init(Workspace *workspace) {
+    memset(workspace, 0, sizeof(*workspace));
+    arena_init(&workspace->programs);
+    arena_init(&workspace->scratch);
+    workspace->threads = 1;
+    workspace->slot_mask = (size_t)WORKSPACE_INITIAL_CELLS * 2 - 1;
+    workspace->slots = calloc(workspace->slot_mask + 1, sizeof(uint32_t));
+    if (!grow_cells(workspace, WORKSPACE_INITIAL_CELLS) || workspace->slots == NULL) {
+        workspace_free(workspace);
+        return 0;
+    }
+    return 1;
+}
+
+void workspace_free(Workspace *workspace) {
+    for (int c = 0; c < workspace->cell_count; c++) {
+        WorkspaceCell *cell = &workspace->cells[c];
+        free(cell->name);
+        free(cell->formula);
+        free(cell->inputs);
+        free(cell->dependents);
+    }
+    free(workspace->cells);
+    free(workspace->values);
+    free(workspace->status);
+    free(workspace->marks);
+    free(workspace->waiting);
+    free(workspace->slots);
+    free(workspace->pending);
+    arena_free(&workspace->programs);
+    arena_free(&workspace->scratch);
+    memset(workspace, 0, sizeof(*workspace));
+}
+
+void workspace_set_threads(Workspace *workspace, int threads) {
+    workspace->threads = threads > 0 ? threads : 1;
+}
+
+/*
+ * Compile formulas through store (which may be NULL)
+ * The store must stay open while the workspace is in use.
+ */
+void workspace_attach_store(Workspace *workspace, ProgramStore *store) {
+    workspace->store = store;
+}
+
+/*
+ * Returns: the cell called name (length characters), or -1
+ */
+int workspace_find(const Workspace *workspace, const char *name, size_t length) {
+    size_t slot = (size_t)name_hash(name, length) & workspace->slot_mask;
+    while (workspace->slots[slot] != 0) {
+        const WorkspaceCell *cell = &workspace->cells[workspace->slots[slot] - 1];
+        if (strncmp(cell->name, name, length) == 0 && cell->name[length] == '\0') {
+            return (int)workspace->slots[slot] - 1;
+        }
+        slot = (slot + 1) & workspace->slot_mask;
+    }
+    return -1;
+}
+
+/*
+ * Show cell c as unbound until it is defined
+ */
+static void set_undefined(Workspace *workspace, int c) {
+    WorkspaceCell *cell = &workspace->cells[c];
+    workspace->values[c] = NAN;
+    cell->is_integer = 0;
+    workspace->status[c] = (unsigned char)workspace_error(&cell->error, CALC_ERR_UNBOUND_VARIABLE,
+                                                          "'%s' is not defined", cell->name);
+}
+
+/*
+ * Find the cell called name, creating an undefined one if there is none
+ * Returns: the cell, or -1 if out of memory
+ */
+static int cell_for(Workspace *workspace, const char *name, size_t length) {
+    int found = workspace_find(workspace, name, length);
+    if (found >= 0) {
+        return found;
+    }
+
+    if (workspace->cell_count == workspace->cell_capacity &&
+        !grow_cells(workspace, workspace->cell_capacity * 2)) {
+        return -1;
+    }
+    // Keep the name index at most half full
+    if (((size_t)workspace->cell_count + 1) * 2 > workspace->slot_mask + 1) {
+        size_t mask = workspace->slot_mask * 2 + 1;
+        uint32_t *slots = calloc(mask + 1, sizeof(uint32_t));
+        if (slots == NULL) {
+            return -1;
+        }
+        for (int c = 0; c < workspace->cell_count; c++) {
+            const char *existing = workspace->cells[c].name;
+            size_t slot = (size_t)name_hash(existing, strlen(existing)) & mask;
+            while (slots[slot] != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot] = (uint32_t)c + 1;
+        }
+        free(workspace->slots);
+        workspace->slots = slots;
+        workspace->slot_mask = mask;
+    }
+
+    WorkspaceCell *cell = &workspace->cells[workspace->cell_count];
+    memset(cell, 0, sizeof(*cell));
+    cell->name = malloc(length + 1);
+    if (cell->name == NULL) {
+        return -1;
+    }
+    memcpy(cell->name, name, length);
+    cell->name[length] = '\0';
+    workspace->marks[workspace->cell_count] = 0;
+    set_undefined(workspace, workspace->cell_count);
+
+    size_t slot = (size_t)name_hash(name, length) & workspace->slot_mask;
+    while (workspace->slots[slot] != 0) {
+        slot = (slot + 1) & workspace->slot_mask;
+    }
+    workspace->slots[slot] = (uint32_t)workspace->cell_count + 1;
+    return workspace->cell_count++;
+}
+
+/*
+ * Make room for one more entry in a growable int array
+ * Returns: 1 on success, 0 if out of memory
+ */
+static int reserve_one(int **array, int count, int *capacity) {
+    if (count < *capacity) {
+        return 1;
+    }
+    int grown = *capacity > 0 ? *capacity * 2 : 4;
+    int *data = realloc(*array, (size_t)grown * sizeof(int));
+    if (data == NULL) {
+        return 0;
+    }
+    *array = data;
+    *capacity = grown;
+    return 1;
+}
+
+/*
+ * Start a new graph walk; cells with mark == the result have been reached
+ */
+static uint32_t next_epoch(Workspace *workspace) {
+    if (++workspace->epoch == 0) {
+        memset(workspace->marks, 0, (size_t)workspace->cell_count * sizeof(uint32_t));
+        workspace->epoch = 1;
+    }
+    return workspace->epoch;
+}
+
+/*
+ * Find an input that is downstream of cell, so that reading it would
+ * make cell depend on itself
+ * Returns: the index into inputs, -1 if there is none, -2 if out of memory
+ */
+static int find_cycle(Workspace *workspace, int cell, const int *inputs, int input_count) {
+    for (int v = 0; v < input_count; v++) {
+        if (inputs[v] == cell) {
+            return v;
+        }
+    }
+    if (workspace->cells[cell].dependent_count == 0 || input_count == 0) {
+        return -1;
+    }
+
+    uint32_t epoch = next_epoch(workspace);
+    int *stack = malloc((size_t)workspace->cell_count * sizeof(int));
+    if (stack == NULL) {
+        return -2;
+    }
+    int depth = 0;
+    uint32_t *marks = workspace->marks;
+    marks[cell] = epoch;
+    stack[depth++] = cell;
+    while (depth > 0) {
+        const WorkspaceCell *current = &workspace->cells[stack[--depth]];
+        for (int d = 0; d < current->dependent_count; d++) {
+            int dependent = current->dependents[d];
+            if (marks[dependent] != epoch) {
+                marks[dependent] = epoch;
+                stack[depth++] = dependent;
+            }
+        }
+    }
+    free(stack);
+
+    for (int v = 0; v < input_count; v++) {
+        if (marks[inputs[v]] == epoch) {
+            return v;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Copy program, compiled from formula into scratch memory, to arena at
+ * its exact size: compile_expression() leaves room for a longer program,
+ * and packing the code keeps a recompute's memory traffic down. Programs
+ * with reductions, whose bodies are programs of their own, are compiled
+ * again into arena instead.
+ * Returns: 1 on success, 0 if out of memory
+ */
+static int pack_program(const Workspace *workspace, const Program *program, const char *formula,
+                        Arena *arena, Program *packed) {
+    if (program->reduction_count > 0) {
+        return program_store_compile(workspace->store, formula, packed, arena, NULL, NULL) ==
+               CALC_OK;
+    }
+    *packed = *program;
+    packed->capacity = program->length;
+    packed->code = arena_alloc(arena, (size_t)program->length * sizeof(Instruction));
+    packed->variables = arena_alloc(arena, ((size_t)program->variable_count + 1) * sizeof(char *));
+    if (packed->code == NULL || packed->variables == NULL) {
+        return 0;
+    }
+    memcpy(packed->code, program->code, (size_t)program->length * sizeof(Instruction));
+    for (int v = 0; v < program->variable_count; v++) {
+        size_t size = strlen(program->variables[v]) + 1;
+        packed->variables[v] = arena_alloc(arena, size);
+        if (packed->variables[v] == NULL) {
+            return 0;
+        }
+        memcpy(packed->variables[v], program->variables[v], size);
+    }
+    if (program->integers != NULL) {
+        packed->integers = arena_alloc(arena, (size_t)program->length * sizeof(int64_t));
+        if (packed->integers == NULL) {
+            return 0;
+        }
+        memcpy(packed->integers, program->integers, (size_t)program->length * sizeof(int64_t));
+    }
+    return 1;
+}
+
+/*
+ * Compile every formula again into a fresh arena, dropping the programs
+ * of replaced definitions; on failure the old arena is kept
+ */
+static void compact_programs(Workspace *workspace) {
+    Arena fresh;
+    Program *programs = malloc((size_t)workspace->cell_count * sizeof(Program));
+    if (programs == NULL) {
+        return;
+    }
+    arena_init(&fresh);
+    for (int c = 0; c < workspace->cell_count; c++) {
+        const WorkspaceCell *cell = &workspace->cells[c];
+        Program compiled;
+        if (cell->formula == NULL) {
+            continue;
+        }
+        arena_reset(&workspace->scratch);
+        if (program_store_compile(workspace->store, cell->formula, &compiled, &workspace->scratch,
+                                  NULL, NULL) != CALC_OK ||
+            !pack_program(workspace, &compiled, cell->formula, &fresh, &programs[c])) {
+            arena_free(&fresh);
+            free(programs);
+            return;
+        }
+    }
+    // The same text compiles to the same variables, so inputs still apply
+    for (int c = 0; c < workspace->cell_count; c++) {
+        if (workspace->cells[c].formula != NULL) {
+            workspace->cells[c].program = programs[c];
+        }
+    }
+    free(programs);
+    arena_free(&workspace->programs);
+    workspace->programs = fresh;
+    workspace->dead_text = 0;
+}
+
+/*
+ * Define or redefine the cell name as formula
+ */
+CalcStatus workspace_define(Workspace *workspace, const char *name, size_t length,
+                            const char *formula, CalcError *error) {
+    size_t formula_length = strlen(formula);
+    Program program;
+    arena_reset(&workspace->scratch);
+    CalcStatus status = program_store_compile(workspace->store, formula, &program,
+                                              &workspace->scratch, error, NULL);
+    if (status != CALC_OK) {
+        return status;
+    }
+
+    char *text = malloc(formula_length + 1);
+    int *inputs = malloc(((size_t)program.variable_count + 1) * sizeof(int));
+    int cell = cell_for(workspace, name, length);
+    int failed = text == NULL || inputs == NULL || cell < 0;
+    for (int v = 0; v < program.variable_count && !failed; v++) {
+        inputs[v] = cell_for(workspace, program.variables[v], strlen(program.variables[v]));
+        failed = inputs[v] < 0;
+    }
+    // Reserve everything relinking needs, so that it cannot fail halfway
+    for (int v = 0; v < program.variable_count && !failed; v++) {
+        WorkspaceCell *input = &workspace->cells[inputs[v]];
+        failed = !reserve_one(&input->dependents, input->dependent_count,
+                              &input->dependent_capacity);
+    }
+    if (!failed) {
+        failed = !reserve_one(&workspace->pending, workspace->pending_count,
+                              &workspace->pending_capacity);
+    }
+    int cycle = failed ? -1 : find_cycle(workspace, cell, inputs, program.variable_count);
+    Program packed;
+    if (!failed && cycle == -1) {
+        failed = !pack_program(workspace, &program, formula, &workspace->programs, &packed);
+    }
+    if (failed || cycle != -1) {
+        free(text);
+        free(inputs);
+        if (cycle >= 0) {
+            return workspace_error(error, CALC_ERR_CYCLE, "Circular reference through '%s'",
+                                   program.variables[cycle]);
+        }
+        return workspace_error(error, CALC_ERR_OUT_OF_MEMORY, "Out of memory");
+    }
+    memcpy(text, formula, formula_length + 1);
+
+    WorkspaceCell *target = &workspace->cells[cell];
+    for (int v = 0; target->formula != NULL && v < target->program.variable_count; v++) {
+        WorkspaceCell *input = &workspace->cells[target->inputs[v]];
+        for (int d = 0; d < input->dependent_count; d++) {
+            if (input->dependents[d] == cell) {
+                input->dependents[d] = input->dependents[--input->dependent_count];
+                break;
+            }
+        }
+    }
+    for (int v = 0; v < program.variable_count; v++) {
+        WorkspaceCell *input = &workspace->cells[inputs[v]];
+        input->dependents[input->dependent_count++] = cell;
+    }
+    if (target->formula != NULL) {
+        size_t old_length = strlen(target->formula);
+        workspace->live_text -= old_length;
+        workspace->dead_text += old_length;
+    }
+    free(target->formula);
+    free(target->inputs);
+    target->formula = text;
+    target->program = packed;
+    target->inputs = inputs;
+    workspace->live_text += formula_length;
+    workspace->pending[workspace->pending_count++] = cell;
+
+    if (workspace->dead_text >= WORKSPACE_REBUILD_MIN &&
+        workspace->dead_text > workspace->live_text) {
+        compact_programs(workspace);
+    }
+    return CALC_OK;
+}
+
+/*
+ * Evaluate cell c from the current values of its inputs
+ */
+static void evaluate_cell(Workspace *workspace, int c) {
+    WorkspaceCell *cell = &workspace->cells[c];
+    if (cell->formula == NULL) {
+        set_undefined(workspace, c);
+        return;
+    }
+
+    int count = cell->program.variable_count;
+    CalcStatus status;
+    if (count <= 0) {
+        CalcValue value;
+        status = evaluate_program_value(&cell->program, &value, &cell->error);
+        workspace->values[c] = value.value;
+        cell->integer = value.integer;
+        cell->is_integer = status == CALC_OK && value.is_integer;
+    } else {
+        status = CALC_OK;
+        for (int v = 0; v < count && status == CALC_OK; v++) {
+            int input = cell->inputs[v];
+            if (workspace->status[input] != CALC_OK) {
+                CalcStatus failed = (CalcStatus)workspace->status[input];
+                status = workspace_error(&cell->error, failed, "%s in '%s'",
+                                         calc_status_string(failed),
+                                         workspace->cells[input].name);
+            }
+        }
+        double local[WORKSPACE_LOCAL_INPUTS];
+        double *values = count <= WORKSPACE_LOCAL_INPUTS ? local
+                                                         : malloc((size_t)count * sizeof(double));
+        if (values == NULL) {
+            status = workspace_error(&cell->error, CALC_ERR_OUT_OF_MEMORY, "Out of memory");
+        } else if (status == CALC_OK) {
+            for (int v = 0; v < count; v++) {
+                values[v] = workspace->values[cell->inputs[v]];
+            }
+            status = evaluate_program_with(&cell->program, values, &workspace->values[c],
+                                           &cell->error);
+        }
+        if (values != local) {
+            free(values);
+        }
+        cell->is_integer = 0;
+    }
+    workspace->status[c] = (unsigned char)status;
+    if (status != CALC_OK) {
+        workspace->values[c] = NAN;
+    }
+}
+
+static void *wave_worker(void *arg) {
+    const WaveSlice *slice = arg;
+    for (int i = 0; i < slice->count; i++) {
+        evaluate_cell(slice->workspace, slice->cells[i]);
+    }
+    return NULL;
+}
+
+/*
+ * Evaluate the cells of one wave, on several threads if there are enough
+ */
+static void evaluate_wave(Workspace *workspace, const int *cells, int count) {
+    int thread_count = workspace->threads;
+    if (thread_count > count / WORKSPACE_CELLS_PER_THREAD) {
+        thread_count = count / WORKSPACE_CELLS_PER_THREAD;
+    }
+    if (thread_count <= 1) {
+        for (int i = 0; i < count; i++) {
+            evaluate_cell(workspace, cells[i]);
+        }
+        return;
+    }
+
+    // The calling thread takes the first slice
+    WaveSlice slices[thread_count];
+    pthread_t threads[thread_count];
+    int started[thread_count];
+    for (int t = 0; t < thread_count; t++) {
+        int first = (int)((long long)count * t / thread_count);
+        int last = (int)((long long)count * (t + 1) / thread_count);
+        slices[t].workspace = workspace;
+        slices[t].cells = cells + first;
+        slices[t].count = last - first;
+        started[t] = t > 0 && pthread_create(&threads[t], NULL, wave_worker, &slices[t]) == 0;
+    }
+    for (int t = 0; t < thread_count; t++) {
+        if (!started[t]) {
+            wave_worker(&slices[t]);
+        }
+    }
+    for (int t = 1; t < thread_count; t++) {
+        if (started[t]) {
+            pthread_join(threads[t], NULL);
+        }
+    }
+}
+
+/*
+ * Recompute the cells downstream of those defined since the last call
+ */
+CalcStatus workspace_recompute(Workspace *workspace, size_t *recomputed, CalcError *error) {
+    if (recomputed != NULL) {
+        *recomputed = 0;
+    }
+    if (workspace->pending_count == 0) {
+        return CALC_OK;
+    }
+    int *wave = malloc((size_t)workspace->cell_count * sizeof(int));
+    int *following = malloc((size_t)workspace->cell_count * sizeof(int));
+    if (wave == NULL || following == NULL) {
+        free(wave);
+        free(following);
+        return workspace_error(error, CALC_ERR_OUT_OF_MEMORY, "Out of memory");
+    }
+
+    // Reach every affected cell, using wave as the queue
+    uint32_t epoch = next_epoch(workspace);
+    const WorkspaceCell *cells = workspace->cells;
+    uint32_t *marks = workspace->marks;
+    int *waiting = workspace->waiting;
+    int count = 0;
+    for (int p = 0; p < workspace->pending_count; p++) {
+        int c = workspace->pending[p];
+        if (marks[c] != epoch) {
+            marks[c] = epoch;
+            wave[count++] = c;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        const WorkspaceCell *cell = &cells[wave[i]];
+        for (int d = 0; d < cell->dependent_count; d++) {
+            int c = cell->dependents[d];
+            if (marks[c] != epoch) {
+                marks[c] = epoch;
+                wave[count++] = c;
+            }
+        }
+    }
+
+    // The first wave: cells none of whose inputs were reached
+    int wave_count = 0;
+    for (int i = 0; i < count; i++) {
+        int c = wave[i];
+        const WorkspaceCell *cell = &cells[c];
+        waiting[c] = 0;
+        for (int v = 0; cell->formula != NULL && v < cell->program.variable_count; v++) {
+            waiting[c] += marks[cell->inputs[v]] == epoch;
+        }
+        if (waiting[c] == 0) {
+            wave[wave_count++] = c;
+        }
+    }
+
+    size_t done = 0;
+    while (wave_count > 0) {
+        evaluate_wave(workspace, wave, wave_count);
+        done += (size_t)wave_count;
+        int following_count = 0;
+        for (int i = 0; i < wave_count; i++) {
+            const WorkspaceCell *cell = &cells[wave[i]];
+            for (int d = 0; d < cell->dependent_count; d++) {
+                int c = cell->dependents[d];
+                if (marks[c] == epoch && --waiting[c] == 0) {
+                    following[following_count++] = c;
+                }
+            }
+        }
+        int *swap = wave;
+        wave = following;
+        following = swap;
+        wave_count = following_count;
+    }
+
+    free(wave);
+    free(following);
+    workspace->pending_count = 0;
+    if (recomputed != NULL) {
+        *recomputed = done;
+    }
+    return CALC_OK;
+}
+
+/*
+ * Value of cell as of the last workspace_recompute()
+ */
+CalcStatus workspace_value(const Workspace *workspace, int cell, CalcValue *value,
+                           CalcError *error) {
+    const WorkspaceCell *source = &workspace->cells[cell];
+    CalcStatus status = (CalcStatus)workspace->status[cell];
+    value->value = workspace->values[cell];
+    value->integer = source->integer;
+    value->is_integer = source->is_integer;
+    if (error != NULL && status != CALC_OK) {
+        *error = source->error;
+    }
+    return status;
+}
+
+/*
+ * Evaluate an expression over the cells' current values
+ */
+CalcStatus workspace_evaluate(const Workspace *workspace, const char *expression, Arena *arena,
+                              double *result, CalcError *error) {
+    Program program;
+    CalcStatus status = program_store_compile(workspace->store, expression, &program, arena, error,
+                                              NULL);
+    if (status != CALC_OK) {
+        return status;
+    }
+    double *values = arena_alloc(arena, ((size_t)program.variable_count + 1) * sizeof(double));
+    if (values == NULL) {
+        return workspace_error(error, CALC_ERR_OUT_OF_MEMORY, "Out of memory");
+    }
+    for (int v = 0; v < program.variable_count; v++) {
+        const char *name = program.variables[v];
+        int c = workspace_find(workspace, name, strlen(name));
+        if (c < 0) {
+            return workspace_error(error, CALC_ERR_UNBOUND_VARIABLE, "'%s' is not defined", name);
+        }
+        CalcStatus failed = (CalcStatus)workspace->status[c];
+        if (failed != CALC_OK) {
+            if (workspace->cells[c].formula == NULL) {
+                return workspace_error(error, failed, "%s", workspace->cells[c].error.message);
+            }
+            return workspace_error(error, failed, "%s in '%s'", calc_status_string(failed), name);
+        }
+        values[v] = workspace->values[c];
+    }
+    return evaluate_program_with(&program, values, result, error);
+}
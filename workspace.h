@@ -0,0 +1,93 @@
+/*
+ * Workspace Header File
+ * Named formulas that refer to each other, recomputed incrementally
+ */
+
+#ifndef WORKSPACE_H
+#define WORKSPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "calc.h"
+#include "arena.h"
+#include "program_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct WorkspaceCell WorkspaceCell;
+
+// A set of cells such as "margin = revenue - cost". Each formula is
+// compiled once, when it is defined; its identifiers are the cells it
+// reads. workspace_recompute() then evaluates only the cells downstream
+// of those defined since the previous call. Not synchronized: one thread
+// at a time may call into a workspace.
+typedef struct {
+    WorkspaceCell *cells;
+    int cell_count;
+    int cell_capacity;
+    // What a recompute touches for every cell, kept apart from the cells
+    // so that reading an input's value is one dense array access
+    double *values;         // values[c]: value of cell c, NaN if it failed
+    unsigned char *status;  // status[c]: CalcStatus of cell c
+    uint32_t *marks;        // epoch of the last graph walk that reached c
+    int *waiting;           // inputs of c the current recompute has yet to do
+    uint32_t *slots;        // name index: cell + 1, 0 marks an empty slot
+    size_t slot_mask;
+    Arena programs;         // compiled formulas
+    Arena scratch;          // formulas are compiled here, then packed into programs
+    size_t live_text;       // formula bytes of the current definitions
+    size_t dead_text;       // formula bytes compiled into programs but replaced
+    int *pending;           // cells defined since the last recompute
+    int pending_count;
+    int pending_capacity;
+    uint32_t epoch;         // visit mark of the current graph walk
+    int threads;            // threads workspace_recompute() may use
+    ProgramStore *store;    // optional; formulas seen by earlier runs skip the parser
+} Workspace;
+
+// Returns: 1 on success, 0 if out of memory
+int workspace_init(Workspace *workspace);
+void workspace_free(Workspace *workspace);
+
+// Threads one recompute may use (1 by default); values do not depend on it
+void workspace_set_threads(Workspace *workspace, int threads);
+
+// Compile formulas through store (NULL for none), which must stay open
+// while the workspace is in use
+void workspace_attach_store(Workspace *workspace, ProgramStore *store);
+
+// Define or redefine the cell name (length characters, an identifier) as
+// formula. Cells the formula names need not exist yet; until they are
+// defined they, and every cell reading them, are unbound.
+// Returns: CALC_OK, the formula's compile error, or CALC_ERR_CYCLE when
+//          the cell would depend on itself (the old definition is kept)
+CalcStatus workspace_define(Workspace *workspace, const char *name, size_t length,
+                            const char *formula, CalcError *error);
+
+// Evaluate every cell that reads, directly or not, a cell defined since
+// the last call, each after all of its inputs. *recomputed (may be NULL)
+// receives how many cells were evaluated.
+// Returns: CALC_OK, or CALC_ERR_OUT_OF_MEMORY (call again to retry)
+CalcStatus workspace_recompute(Workspace *workspace, size_t *recomputed, CalcError *error);
+
+// Returns: the cell called name (length characters), or -1
+int workspace_find(const Workspace *workspace, const char *name, size_t length);
+
+// Value of cell as of the last workspace_recompute(). A failing cell has
+// its own error, or the error of the input it could not read.
+// Returns: CALC_OK or the cell's error
+CalcStatus workspace_value(const Workspace *workspace, int cell, CalcValue *value,
+                           CalcError *error);
+
+// Evaluate an expression over the cells' current values, compiling it
+// into arena; the workspace itself is not changed
+CalcStatus workspace_evaluate(const Workspace *workspace, const char *expression, Arena *arena,
+                              double *result, CalcError *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // WORKSPACE_H
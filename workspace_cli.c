@@ -0,0 +1,242 @@
+/*
+ * Workspace Mode Implementation File
+ *
+ *   cli_calculator --workspace model.txt
+ *
+ * Each line of input is one of:
+ *
+ *   margin = revenue - cost     define or redefine the cell margin
+ *   margin                      print the value of a cell
+ *   margin / revenue * 100      print the value of an expression over cells
+ *
+ * Empty lines and lines starting with '#' are skipped. Definitions print
+ * nothing unless they fail; cells may be used before they are defined.
+ * Nothing is evaluated while definitions come in: the first line that
+ * asks for a value recomputes the cells downstream of everything defined
+ * since the previous one (see workspace.c), so loading a model costs one
+ * pass over it, and changing one input afterwards costs only the cells
+ * that read it, directly or not.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "calc.h"
+#include "arena.h"
+#include "format.h"
+#include "reduce.h"
+#include "workspace.h"
+#include "workspace_cli.h"
+
+typedef struct {
+    size_t definitions;
+    size_t recomputes;
+    size_t recomputed;      // cells evaluated over all recomputes
+} WorkspaceStats;
+
+static int is_identifier_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+}
+
+static int is_identifier_char(char c) {
+    return is_identifier_start(c) || (c >= '0' && c <= '9');
+}
+
+/*
+ * Length of the identifier that fills text (surrounding blanks aside)
+ * Returns: its length, 0 if text is not a single identifier; *start is
+ *          set to its first character
+ */
+static size_t identifier_span(const char *text, const char **start) {
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    *start = text;
+    if (!is_identifier_start(*text)) {
+        return 0;
+    }
+    size_t length = 1;
+    while (is_identifier_char(text[length])) {
+        length++;
+    }
+    const char *rest = text + length;
+    while (*rest == ' ' || *rest == '\t') {
+        rest++;
+    }
+    return *rest == '\0' ? length : 0;
+}
+
+/*
+ * Handle one line of input
+ */
+static void run_line(Workspace *workspace, char *line, Arena *arena, int precision,
+                     WorkspaceStats *stats) {
+    size_t len = strlen(line);
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+        line[--len] = '\0';
+    }
+    const char *text = line;
+    while (*text == ' ' || *text == '\t') {
+        text++;
+    }
+    if (*text == '\0' || *text == '#') {
+        return;
+    }
+
+    CalcError error;
+    char *equals = strchr(line, '=');
+    if (equals != NULL) {
+        const char *name;
+        *equals = '\0';
+        size_t length = identifier_span(line, &name);
+        if (length == 0) {
+            printf("Error: Cell name must be an identifier\n");
+        } else if (workspace_define(workspace, name, length, equals + 1, &error) != CALC_OK) {
+            printf("Error: %s\n", error.message);
+        } else {
+            stats->definitions++;
+        }
+        return;
+    }
+
+    if (workspace->pending_count > 0) {
+        size_t recomputed;
+        if (workspace_recompute(workspace, &recomputed, &error) != CALC_OK) {
+            printf("Error: %s\n", error.message);
+            return;
+        }
+        stats->recomputes++;
+        stats->recomputed += recomputed;
+    }
+
+    char out[FORMAT_BUFFER_SIZE];
+    int out_length;
+    const char *name;
+    size_t length = identifier_span(line, &name);
+    int cell = length > 0 ? workspace_find(workspace, name, length) : -1;
+    if (cell >= 0) {
+        CalcValue value;
+        if (workspace_value(workspace, cell, &value, &error) != CALC_OK) {
+            printf("Error: %s\n", error.message);
+            return;
+        }
+        out_length = format_value(&value, precision, out);
+    } else {
+        double value;
+        arena_reset(arena);
+        if (workspace_evaluate(workspace, line, arena, &value, &error) != CALC_OK) {
+            printf("Error: %s\n", error.message);
+            return;
+        }
+        out_length = format_double(value, precision, out);
+    }
+    printf("%.*s\n", out_length, out);
+}
+
+/*
+ * Entry point for: cli_calculator --workspace [file] [--threads N]
+ *                                 [--precision N] [--stats] [--store FILE]
+ * --threads N lets a recompute evaluate independent cells on N threads
+ * (0: one per online CPU); values are the same for any N. --stats
+ * reports on stderr how many cells the recomputes evaluated. --store
+ * compiles formulas through the program store in FILE (see
+ * program_store.c), so a model loaded again skips the parser.
+ */
+int workspace_main(int argc, char *argv[]) {
+    const char *path = NULL;
+    const char *store_path = NULL;
+    int threads = 1;
+    int precision = FORMAT_SHORTEST;
+    int show_stats = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if (threads <= 0) {
+                long online = sysconf(_SC_NPROCESSORS_ONLN);
+                threads = online > 0 ? (int)online : 1;
+            }
+        } else if (strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            precision = atoi(argv[++i]);
+            if (precision < 0 || precision > FORMAT_MAX_PRECISION) {
+                printf("Error: Precision must be between 0 and %d\n", FORMAT_MAX_PRECISION);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--store") == 0 && i + 1 < argc) {
+            store_path = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            printf("Usage: %s --workspace [file] [--threads N] [--precision N] [--stats]\n"
+                   "       [--store FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *input = stdin;
+    if (path != NULL && strcmp(path, "-") != 0) {
+        input = fopen(path, "r");
+        if (input == NULL) {
+            fprintf(stderr, "Error: Cannot open '%s'\n", path);
+            return 1;
+        }
+    }
+
+    Workspace workspace;
+    if (!workspace_init(&workspace)) {
+        fprintf(stderr, "Error: Out of memory\n");
+        if (input != stdin) {
+            fclose(input);
+        }
+        return 1;
+    }
+    workspace_set_threads(&workspace, threads);
+    ProgramStore store;
+    int store_open = 0;
+    if (store_path != NULL) {
+        store_open = program_store_open(&store, store_path);
+        if (store_open) {
+            workspace_attach_store(&workspace, &store);
+        } else {
+            fprintf(stderr, "Warning: Could not open program store '%s'\n", store_path);
+        }
+    }
+    if (threads > 1) {
+        reduce_set_threads(1);  // cells are already evaluated in parallel
+    }
+
+    Arena arena;
+    arena_init(&arena);
+    WorkspaceStats stats = { 0, 0, 0 };
+    char *line = NULL;
+    size_t capacity = 0;
+    while (getline(&line, &capacity, input) != -1) {
+        run_line(&workspace, line, &arena, precision, &stats);
+    }
+    int status = ferror(input) ? 1 : 0;
+    if (status) {
+        fprintf(stderr, "Error: Failed to read input\n");
+    }
+
+    if (show_stats) {
+        fprintf(stderr, "Workspace: %d cells, %llu definitions, %llu recomputes, "
+                "%llu cells recomputed\n", workspace.cell_count,
+                (unsigned long long)stats.definitions, (unsigned long long)stats.recomputes,
+                (unsigned long long)stats.recomputed);
+    }
+    free(line);
+    arena_free(&arena);
+    workspace_free(&workspace);
+    if (store_open) {
+        program_store_close(&store);
+    }
+    if (input != stdin) {
+        fclose(input);
+    }
+    return status;
+}
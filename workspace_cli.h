@@ -0,0 +1,11 @@
+/*
+ * Workspace Mode Header File
+ * Named formulas read from a file or stdin, recomputed incrementally
+ */
+
+#ifndef WORKSPACE_CLI_H
+#define WORKSPACE_CLI_H
+
+int workspace_main(int argc, char *argv[]);
+
+#endif  // WORKSPACE_CLI_H